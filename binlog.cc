@@ -16,6 +16,8 @@
 
 #include <sys/types.h>
 
+#include <algorithm>
+
 #include "absl/strings/str_cat.h"
 #include "absl/strings/strip.h"
 #include "absl/strings/string_view.h"
@@ -37,10 +39,17 @@ Binlog::Binlog(const char *directory, int64_t max_binlog_size,
       ff_(ff),
       binlog_file_(nullptr),
       index_(directory, ff),
+      unpublished_since_(0),
       encryptor_(
           BinlogEncryptorFactory::GetInstance(FLAGS_ripple_encryption_scheme)),
-      truncate_counter_(0) {
+      truncate_counter_(0),
+      unpositioned_readers_(0),
+      trash_bytes_(0),
+      trash_bytes_freed_(0) {
   position_.own_format.SetToRipple(FLAGS_ripple_version_binlog.c_str());
+  index_.SetValidateOnRecover(FLAGS_ripple_binlog_index_validate_files);
+  index_.SetRecoverThreads(FLAGS_ripple_binlog_index_recover_threads);
+  ScanTrash();
 }
 
 Binlog::~Binlog() { Close(); }
@@ -411,6 +420,10 @@ int Binlog::Recover() {
     return -1;
   }
 
+  // Files closed before a restart may not have been archived yet, the
+  // queue of the archiver is lost when we stop.
+  ArchiveClosedFiles();
+
   absl::MutexLock position_lock(&position_mutex_);
   position_ = pos;
 
@@ -433,33 +446,43 @@ bool Binlog::Close() {
   absl::ReaderMutexLock position_lock(&position_mutex_);
   absl::MutexLock file_lock(&file_mutex_);
   if (binlog_file_ != nullptr)
-    CloseFileLocked();
+    return CloseFileLocked();
   return true;
 }
 
 // Close an opened binlog.
-void Binlog::CloseFileLocked() {
+bool Binlog::CloseFileLocked() {
   CHECK(binlog_file_ != nullptr);
+  bool ok = encryptor_->Flush(binlog_file_);
+  if (!ok) {
+    LOG(ERROR) << "Failed to write encrypted block";
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_ENCRYPT);
+  }
   binlog_file_->Sync();
   binlog_file_->Close();
   binlog_file_ = nullptr;
-  flushed_gtid_position_ = position_.latest_completed_gtid_position;
+  if (ok)
+    flushed_gtid_position_ = position_.latest_completed_gtid_position;
+  return ok;
 }
 
 bool Binlog::GetPosition(const GTIDList &pos, BinlogPosition *dst,
                          std::string *message) const {
-  BinlogIndex::Entry entry;
-  if (!index_.GetEntry(pos, &entry, message)) {
+  BinlogIndex::EntryRef entry = index_.FindEntry(pos, message);
+  if (entry == nullptr) {
     return false;
   }
-  if (!pos.IsEmpty() && entry.last_position.Equal(pos)) {
-    CHECK(index_.GetNextEntry(entry.filename, &entry)) <<
-        "pos: " << pos.ToString() << ", entry: " << entry.ToString();
+  if (!pos.IsEmpty() && entry->last_position.Equal(pos)) {
+    BinlogIndex::EntryRef next = index_.FindNextEntry(entry->filename);
+    CHECK(next != nullptr) <<
+        "pos: " << pos.ToString() << ", entry: " << entry->ToString();
+    entry = next;
   } else {
     // TODO(jonaso): seek offset in file using gtid-index
   }
-  dst->Init(entry.filename, entry.start_position,
-            entry.start_master_position);
+  dst->Init(entry->filename, entry->start_position,
+            entry->start_master_position);
   return true;
 }
 
@@ -469,10 +492,15 @@ BinlogPosition Binlog::GetBinlogPosition() {
   return position_;
 }
 
+FilePosition Binlog::GetLatestMasterPosition() {
+  absl::ReaderMutexLock position_lock(&position_mutex_);
+  return position_.latest_master_position;
+}
+
 bool Binlog::GetNextFile(FilePosition *pos) const {
-  BinlogIndex::Entry entry;
-  if (index_.GetNextEntry(pos->filename, &entry)) {
-    pos->filename = entry.filename;
+  BinlogIndex::EntryRef entry = index_.FindNextEntry(pos->filename);
+  if (entry != nullptr) {
+    pos->filename = entry->filename;
     return true;
   }
   return false;
@@ -509,6 +537,7 @@ bool Binlog::WaitBinlogEndPosition(FilePosition *pos,
       monitoring::rippled_binlog_error->Increment(monitoring::ERROR_FLUSH_FILE);
     } else {
       flushed_gtid_position_ = position_.latest_completed_gtid_position;
+      RecordPublished();
     }
   }
 
@@ -518,6 +547,13 @@ bool Binlog::WaitBinlogEndPosition(FilePosition *pos,
   return retVal;
 }
 
+void Binlog::RecordPublished() {
+  if (unpublished_since_ != 0) {
+    monitoring::latency_written_to_published->RecordSince(unpublished_since_);
+    unpublished_since_ = 0;
+  }
+}
+
 void Binlog::Stop() {
   absl::MutexLock position_lock(&position_mutex_);
   stop_ = true;
@@ -576,7 +612,7 @@ bool Binlog::AddEvent(RawLogEventData event, bool wait) {
     if (ev.EqualExceptTimestamp(position_.master_format)) {
       monitoring::binlog_last_event_timestamp->Set(event.header.timestamp);
       monitoring::binlog_last_event_received->Set(
-          absl::ToUnixSeconds(absl::Now()));
+          monitoring::CoarseUnixSeconds());
       return true;  // skip writing unneeded FDs
     }
 
@@ -596,7 +632,7 @@ bool Binlog::AddEvent(RawLogEventData event, bool wait) {
     }
     monitoring::binlog_last_event_timestamp->Set(event.header.timestamp);
     monitoring::binlog_last_event_received->Set(
-        absl::ToUnixSeconds(absl::Now()));
+        monitoring::CoarseUnixSeconds());
     return success;
   }
 
@@ -623,12 +659,18 @@ bool Binlog::AddEvent(RawLogEventData event, bool wait) {
       monitoring::ERROR_UPDATE_BINLOG_POS);
     return false;
   } else if (res == 1) {
+    // Readers are only given positions at block boundaries, so write events
+    // buffered by a block encryptor when a transaction completes.
+    CHECK(FlushEncryptor(wait));
     DLOG(INFO) << "Update binlog position to end_pos: "
                << position_.latest_completed_gtid_position.ToString().c_str()
                << ", gtid: "
                << position_.latest_completed_gtid.ToString().c_str();
+    if (unpublished_since_ == 0)
+      unpublished_since_ = monitoring::MonotonicMicros();
     if (wait) {
       flushed_gtid_position_ = position_.latest_completed_gtid_position;
+      RecordPublished();
     }
   }
 
@@ -640,6 +682,21 @@ bool Binlog::AddEvent(RawLogEventData event, bool wait) {
   return true;
 }
 
+bool Binlog::Flush() {
+  absl::MutexLock position_lock(&position_mutex_);
+  if (flushed_gtid_position_.equal(position_.latest_completed_gtid_position))
+    return true;
+  absl::MutexLock file_lock(&file_mutex_);
+  if (!binlog_file_->Flush()) {
+    LOG(ERROR) << "Failed to flush binlog file";
+    monitoring::rippled_binlog_error->Increment(monitoring::ERROR_FLUSH_FILE);
+    return false;
+  }
+  flushed_gtid_position_ = position_.latest_completed_gtid_position;
+  RecordPublished();
+  return true;
+}
+
 bool Binlog::SwitchFile(std::string *newfile) {
   absl::MutexLock position_lock(&position_mutex_);
   absl::MutexLock file_lock(&file_mutex_);
@@ -651,11 +708,10 @@ bool Binlog::SwitchFile(std::string *newfile) {
 }
 
 bool Binlog::SwitchFileLocked() {
-  CloseFileLocked();
+  bool ok = CloseFileLocked();
   BinlogPosition pos = position_;
   CHECK(index_.CloseEntry(pos.gtid_start_position, pos.next_master_position,
                           pos.latest_event_end_position.offset));
-  bool ok = true;
   if (!Finalize(pos.latest_event_end_position.filename)) ok = false;
   // Immediately mark the file for archiving. The actual archiving will happen
   // automatically later, and the file will remain available at the same
@@ -710,7 +766,8 @@ bool Binlog::WriteEvent(RawLogEventData event, off_t *offset, bool wait) {
 
   // Set correct nextpos
   event.header.nextpos =
-      *offset + event.header.event_length + encryptor_->GetExtraSize();
+      *offset + event.header.event_length +
+      encryptor_->GetExtraSize(event.header.event_length);
   event.header.SerializeToBuffer(const_cast<uint8_t*>(event.event_buffer),
                                  event.header.PackLength());
 
@@ -729,14 +786,33 @@ bool Binlog::WriteEvent(RawLogEventData event, off_t *offset, bool wait) {
   }
 
   int64_t o;
-  binlog_file_->Tell(&o);
+  encryptor_->Tell(binlog_file_, &o);
   assert(o == event.header.nextpos);
   *offset = o;
 
   // TODO(jonaso): update gtid-index
   monitoring::binlog_last_event_timestamp->Set(event.header.timestamp);
-  monitoring::binlog_last_event_received->Set(absl::ToUnixSeconds(absl::Now()));
+  monitoring::binlog_last_event_received->Set(
+      monitoring::CoarseUnixSeconds());
+
+  return true;
+}
 
+bool Binlog::FlushEncryptor(bool wait) {
+  absl::MutexLock file_lock(&file_mutex_);
+  if (!encryptor_->HasBufferedEvents())
+    return true;
+  if (!encryptor_->Flush(binlog_file_)) {
+    LOG(ERROR) << "Failed to write encrypted block";
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_ENCRYPT);
+    return false;
+  }
+  if (wait && !binlog_file_->Flush()) {
+    LOG(ERROR) << "Failed to flush binlog file";
+    monitoring::rippled_binlog_error->Increment(monitoring::ERROR_FLUSH_FILE);
+    return false;
+  }
   return true;
 }
 
@@ -772,6 +848,10 @@ bool Binlog::Rollback(BinlogPosition *pos, bool *truncated) {
   if (binlog_open) {
     // close/reopen binlog after truncation, so that
     // the file implementation doesn't get confused about offsets.
+    // Buffered events are those of the unfinished transaction, as they
+    // are flushed when a transaction completes. Writing them would only
+    // encrypt data at offsets that are encrypted again after truncation.
+    encryptor_->Discard();
     binlog_file_->Close();
     binlog_file_ = nullptr;
   }
@@ -804,26 +884,82 @@ bool Binlog::Rollback(BinlogPosition *pos, bool *truncated) {
 
 void Binlog::RegisterReader(BinlogReader *reader) {
   absl::MutexLock mutex(&purge_mutex_);
-  readers_.insert(reader);
+  if (readers_.emplace(reader, std::string()).second) {
+    unpositioned_readers_++;
+  }
 }
 
 void Binlog::UnregisterReader(BinlogReader *reader) {
   absl::MutexLock mutex(&purge_mutex_);
   auto it = readers_.find(reader);
   if (it != readers_.end()) {
+    UnpinFileLocked(it->second);
     readers_.erase(it);
   }
 }
 
-bool Binlog::IsSafeToPurgeLocked(absl::string_view filename) const {
-  for (BinlogReader *reader : readers_) {
-    if (!reader->IsSafeToPurge(filename))
-      return false;
+void Binlog::PinFile(BinlogReader *reader, absl::string_view filename) {
+  absl::MutexLock mutex(&purge_mutex_);
+  auto it = readers_.find(reader);
+  if (it == readers_.end()) {
+    return;  // not registered, e.g used during recovery.
   }
-  return true;
+  // Pin new file before unpinning old so that a reader moving forward
+  // never leaves a gap for purge.
+  std::string old_file = std::move(it->second);
+  it->second = std::string(filename);
+  PinFileLocked(it->second);
+  UnpinFileLocked(old_file);
+}
+
+void Binlog::PinFileLocked(const std::string& filename) {
+  if (filename.empty()) {
+    unpositioned_readers_++;
+  } else {
+    pinned_files_[filename]++;
+  }
+}
+
+void Binlog::UnpinFileLocked(const std::string& filename) {
+  if (filename.empty()) {
+    unpositioned_readers_--;
+    return;
+  }
+  auto it = pinned_files_.find(filename);
+  CHECK(it != pinned_files_.end());
+  if (--it->second == 0) {
+    pinned_files_.erase(it);
+  }
+}
+
+bool Binlog::IsSafeToPurgeLocked(const std::string& filename) const {
+  if (unpositioned_readers_ > 0) {
+    return false;
+  }
+  return pinned_files_.empty() ||
+      FilenameLess()(filename, pinned_files_.begin()->first);
 }
 
 bool Binlog::Remove(absl::string_view filename) {
+  if (FLAGS_ripple_purge_trash_rate > 0) {
+    // Unlinking a large file frees all its blocks at once, which causes
+    // io latency spikes. Move it to trash and let ShrinkTrash() free it
+    // gradually instead.
+    std::string trash_path = absl::StrCat(GetTrashDirectory(), filename);
+    int64_t size = 0;
+    ff_.DiskSize(GetPath(filename), &size);
+    if (ff_.CreateDirectory(GetTrashDirectory()) &&
+        ff_.Rename(GetPath(filename), trash_path)) {
+      absl::MutexLock lock(&trash_mutex_);
+      trash_.emplace_back(trash_path, size);
+      trash_bytes_ += size;
+      monitoring::binlog_trash_bytes->Set(trash_bytes_);
+      return true;
+    }
+    LOG(WARNING) << "Failed to move " << GetPath(filename) << " to trash"
+                 << ", unlinking it instead";
+  }
+
   if (!ff_.Delete(GetPath(filename))) {
     LOG(ERROR) << "Failed to unlink " << GetPath(filename);
     monitoring::rippled_binlog_error->Increment(
@@ -853,23 +989,32 @@ bool Binlog::Archive(absl::string_view filename) {
   return true;
 }
 
+void Binlog::ArchiveClosedFiles() {
+  absl::MutexLock file_lock(&file_mutex_);
+  for (BinlogIndex::EntryRef entry = index_.FindEntry(GTIDList());
+       entry != nullptr && entry->is_closed;
+       entry = index_.FindNextEntry(entry->filename)) {
+    Archive(entry->filename);
+  }
+}
+
 bool Binlog::PurgeLogs(std::string *oldest_file) {
   return PurgeLogsUntil("", oldest_file);
 }
 
 bool Binlog::PurgeLogsBefore(absl::Time before_time, std::string *oldest_file) {
   GTIDList pos;
-  BinlogIndex::Entry entry;
-  if (!index_.GetEntry(pos, &entry)) {
+  BinlogIndex::EntryRef entry = index_.FindEntry(pos);
+  if (entry == nullptr) {
     LOG(WARNING) << "Failed to find first binlog index entry";
     return false;
   }
 
   int cnt = 0;
-  while (entry.is_closed) {
+  while (entry->is_closed) {
     absl::Time mtime;
-    if (!ff_.Mtime(GetPath(entry.filename), &mtime)) {
-      LOG(WARNING) << "Failed to stat file: " << entry.filename;
+    if (!ff_.Mtime(GetPath(entry->filename), &mtime)) {
+      LOG(WARNING) << "Failed to stat file: " << entry->filename;
       monitoring::rippled_binlog_error->Increment(monitoring::ERROR_STAT_FILE);
       return false;
     }
@@ -879,22 +1024,23 @@ bool Binlog::PurgeLogsBefore(absl::Time before_time, std::string *oldest_file) {
     }
 
     cnt++;
-    std::string filename = entry.filename;
-    if (!index_.GetNextEntry(filename, &entry))
+    BinlogIndex::EntryRef next = index_.FindNextEntry(entry->filename);
+    if (next == nullptr)
       break;
+    entry = next;
   }
 
   if (cnt > 0) {
     LOG(INFO) << "PurgeLogsBefore(" << before_time << ") => found " << cnt
               << " files";
   }
-  return PurgeLogsUntil(entry.filename, oldest_file);
+  return PurgeLogsUntil(entry->filename, oldest_file);
 }
 
 bool Binlog::PurgeLogsKeepSize(size_t keep_size, std::string *oldest_file) {
   GTIDList pos;
-  BinlogIndex::Entry entry;
-  if (!index_.GetEntry(pos, &entry)) {
+  BinlogIndex::EntryRef entry = index_.FindEntry(pos);
+  if (entry == nullptr) {
     LOG(WARNING) << "Failed to find first binlog index entry";
     return false;
   }
@@ -904,13 +1050,14 @@ bool Binlog::PurgeLogsKeepSize(size_t keep_size, std::string *oldest_file) {
       GetBinlogPosition().latest_event_end_position.offset;
 
   int cnt = 0;
-  while (entry.is_closed && (total_size - entry.file_size > keep_size)) {
+  while (entry->is_closed && (total_size - entry->file_size > keep_size)) {
     cnt++;
-    total_size -= entry.file_size;
+    total_size -= entry->file_size;
 
-    std::string filename = entry.filename;
-    if (!index_.GetNextEntry(filename, &entry))
+    BinlogIndex::EntryRef next = index_.FindNextEntry(entry->filename);
+    if (next == nullptr)
       break;
+    entry = next;
   }
 
   if (cnt > 0) {
@@ -919,36 +1066,121 @@ bool Binlog::PurgeLogsKeepSize(size_t keep_size, std::string *oldest_file) {
               << "(new total size: " << total_size << ")";
   }
 
-  return PurgeLogsUntil(entry.filename, oldest_file);
+  return PurgeLogsUntil(entry->filename, oldest_file);
+}
+
+std::string Binlog::GetTrashDirectory() const {
+  return absl::StrCat(directory_, "trash/");
+}
+
+void Binlog::ScanTrash() {
+  // The factory lists trash of all tiers, e.g archived files moved to
+  // trash are in the trash directory of the archive.
+  std::vector<std::string> names;
+  if (!ff_.List(GetTrashDirectory(), &names) || names.empty()) {
+    return;
+  }
+  std::sort(names.begin(), names.end());
+
+  absl::MutexLock lock(&trash_mutex_);
+  for (const std::string& name : names) {
+    std::string path = absl::StrCat(GetTrashDirectory(), name);
+    int64_t size;
+    if (ff_.DiskSize(path, &size)) {
+      trash_.emplace_back(path, size);
+      trash_bytes_ += size;
+    }
+  }
+  monitoring::binlog_trash_bytes->Set(trash_bytes_);
+}
+
+bool Binlog::ShrinkTrash(size_t max_bytes, size_t *freed) {
+  *freed = 0;
+  while (*freed < max_bytes) {
+    std::string path;
+    int64_t size;
+    {
+      absl::MutexLock lock(&trash_mutex_);
+      if (trash_.empty()) break;
+      path = trash_.front().first;
+      size = trash_.front().second;
+    }
+
+    // Only this method removes files from trash_, so path stays first.
+    // Sizes are on disk, as that is what truncating frees, e.g for
+    // compressed files.
+    bool ok = true;
+    int64_t new_size = std::max<int64_t>(0, size - (max_bytes - *freed));
+    if (new_size > 0) {
+      file::AppendOnlyFile* f;
+      ok = ff_.Open(&f, path, "r+");
+      if (ok) {
+        ok = f->Truncate(new_size);
+        f->Close();
+      }
+      if (!ok) {
+        LOG(WARNING) << "Failed to truncate " << path << ", unlinking it";
+        monitoring::rippled_binlog_error->Increment(
+          monitoring::ERROR_TRUNCATE_FILE);
+      }
+    }
+    if (!ok || new_size == 0) {
+      if (!ff_.Delete(path)) {
+        LOG(ERROR) << "Failed to unlink " << path;
+        monitoring::rippled_binlog_error->Increment(
+          monitoring::ERROR_UNLINK_FILE);
+      }
+      new_size = 0;
+    }
+    *freed += size - new_size;
+
+    absl::MutexLock lock(&trash_mutex_);
+    trash_bytes_ -= std::min<uint64_t>(trash_bytes_, size - new_size);
+    trash_bytes_freed_ += size - new_size;
+    if (new_size == 0) {
+      trash_.pop_front();
+    } else {
+      trash_.front().second = new_size;
+    }
+  }
+
+  absl::MutexLock lock(&trash_mutex_);
+  monitoring::binlog_trash_bytes->Set(trash_bytes_);
+  monitoring::binlog_trash_bytes_freed->Set(trash_bytes_freed_);
+  return !trash_.empty();
+}
+
+bool Binlog::CompactIndex() {
+  return index_.MaybeCompact();
 }
 
 bool Binlog::PurgeLogsUntil(absl::string_view to_file,
                             std::string *oldest_file) {
   GTIDList pos;
-  BinlogIndex::Entry entry;
-  if (!index_.GetEntry(pos, &entry)) {
+  BinlogIndex::EntryRef entry = index_.FindEntry(pos);
+  if (entry == nullptr) {
     LOG(WARNING) << "Failed to find first binlog index entry";
     return false;
   }
 
-  while (entry.is_closed && entry.filename != to_file) {
-    BinlogIndex::Entry next_entry = entry;
-    index_.GetNextEntry(entry.filename, &next_entry);
+  while (entry->is_closed && entry->filename != to_file) {
+    BinlogIndex::EntryRef next_entry = index_.FindNextEntry(entry->filename);
+    if (next_entry == nullptr) next_entry = entry;
     {
       absl::MutexLock mutex(&purge_mutex_);
-      if (!IsSafeToPurgeLocked(entry.filename)) {
-        LOG(INFO) << "Unable to purge " << entry.filename
+      if (!IsSafeToPurgeLocked(entry->filename)) {
+        LOG(INFO) << "Unable to purge " << entry->filename
                   << ", file is in use";
         break;
       }
-      if (!index_.MarkFirstEntryPurged(entry)) {
+      if (!index_.MarkFirstEntryPurged(*entry)) {
         LOG(ERROR) << "Failed to mark purged "
-                   << entry.filename << " in index!";
+                   << entry->filename << " in index!";
         monitoring::rippled_binlog_error->Increment(
           monitoring::ERROR_MARK_FILE_AS_PURGED);
         return false;
       } else {
-        LOG(INFO) << "Marking " << entry.filename << " as purged";
+        LOG(INFO) << "Marking " << entry->filename << " as purged";
       }
     }
 
@@ -957,20 +1189,20 @@ bool Binlog::PurgeLogsUntil(absl::string_view to_file,
       position_.gtid_purged = index_.GetOldestEntry().start_position;
     }
 
-    if (!Remove(entry.filename)) {
+    if (!Remove(entry->filename)) {
       return false;
     }
-    LOG(INFO) << "Purged " << entry.filename;
+    LOG(INFO) << "Purged " << entry->filename;
 
-    if (!index_.PurgeFirstEntry(entry)) {
-      LOG(ERROR) << "Failed to purge " << entry.filename << " from index!";
+    if (!index_.PurgeFirstEntry(*entry)) {
+      LOG(ERROR) << "Failed to purge " << entry->filename << " from index!";
       monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_PURGE_FILE_FROM_INDEX);
       return false;
     }
     entry = next_entry;
   }
-  oldest_file->assign(entry.filename);
+  oldest_file->assign(entry->filename);
   return true;
 }
 
@@ -19,9 +19,11 @@
 
 #include <sys/types.h>
 
-#include <set>
+#include <deque>
+#include <map>
 #include <string>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "binlog_index.h"
@@ -41,6 +43,7 @@ namespace mysql_ripple {
 // 1) Create(), Recover(), and Close() are NOT thread safe
 //
 // 2) One thread (writer) may call AddEvent/SwitchFile()
+//    (HedgedIngest lets several threads take turns being the writer)
 // 3) Any number threads (readers) may call GetBinlogPosition(),
 //    WaitBinlogEndPosition(), GetNextFile(), GetPosition()
 class Binlog : public BinlogReader::BinlogInterface {
@@ -82,6 +85,12 @@ class Binlog : public BinlogReader::BinlogInterface {
   virtual BinlogPosition GetBinlogPosition()
       ABSL_LOCKS_EXCLUDED(position_mutex_);
 
+  // Get master position of the latest event added, without copying the
+  // rest of the binlog position.
+  // Thread safe.
+  virtual FilePosition GetLatestMasterPosition()
+      ABSL_LOCKS_EXCLUDED(position_mutex_);
+
   // Wait for a file position other than pos (for BinlogReader)
   // and store current end position in *pos.
   //
@@ -100,6 +109,10 @@ class Binlog : public BinlogReader::BinlogInterface {
   virtual bool AddEvent(RawLogEventData event, bool wait)
       ABSL_LOCKS_EXCLUDED(file_mutex_, position_mutex_);
 
+  // Flush events of completed transactions to disk, as AddEvent() does when
+  // wait is true.
+  virtual bool Flush() ABSL_LOCKS_EXCLUDED(file_mutex_, position_mutex_);
+
   // Switch local binlog file.
   // Store name of new file in newfile.
   virtual bool SwitchFile(std::string *newfile)
@@ -112,11 +125,17 @@ class Binlog : public BinlogReader::BinlogInterface {
 
   // Register/unregister a binlog reader.
   // This is used when purging logs so that we don't purge too far.
+  // A registered reader blocks purging until it has pinned a file.
   // Note: callers shall NOT hold mutexes when calling (Un)RegisterReader or
   // we might deadlock due to locking mutexes in opposite order.
   void RegisterReader(BinlogReader *reader) override;
   void UnregisterReader(BinlogReader *reader) override;
 
+  // Set file that a registered reader is reading, replacing the file
+  // previously pinned by it. Pinned files and newer are not purged.
+  // Thread safe.
+  void PinFile(BinlogReader *reader, absl::string_view filename) override;
+
   // Get next file (for BinlogReader).
   // pos is in/out argument.
   // Thread safe.
@@ -133,6 +152,8 @@ class Binlog : public BinlogReader::BinlogInterface {
   std::string GetPath(absl::string_view filename) const override;
 
   // Remove a binlog file.
+  // If --ripple_purge_trash_rate is set, the file is moved to the trash
+  // directory and freed later by ShrinkTrash().
   bool Remove(absl::string_view filename) ABSL_LOCKS_EXCLUDED(file_mutex_);
 
   // Get size of binlog file.
@@ -166,6 +187,18 @@ class Binlog : public BinlogReader::BinlogInterface {
                               std::string *oldest_file)
       ABSL_LOCKS_EXCLUDED(position_mutex_);
 
+  // Compact the binlog index if it has grown large.
+  // See BinlogIndex::MaybeCompact().
+  virtual bool CompactIndex();
+
+  // Free files in trash, see Remove(). Files are truncated a bit at a time,
+  // freeing at most max_bytes on disk in total, and unlinked once empty.
+  // The bytes freed are stored in *freed.
+  // Returns true if there are files left in trash.
+  // Thread safe.
+  virtual bool ShrinkTrash(size_t max_bytes, size_t *freed)
+      ABSL_LOCKS_EXCLUDED(trash_mutex_);
+
  private:
   //
   bool stop_;
@@ -198,26 +231,75 @@ class Binlog : public BinlogReader::BinlogInterface {
   // The file position of the last GTID that has been fully flushed to storage.
   FilePosition flushed_gtid_position_;
 
+  // MonotonicMicros() when the oldest transaction not yet in
+  // flushed_gtid_position_ was completed, 0 if none.
+  // Like flushed_gtid_position_, it is updated either with position_mutex_
+  // held exclusively, or shared together with file_mutex_.
+  int64_t unpublished_since_;
+
   // Currently connected master mysqld.
   const mysql::ClientConnection *current_master_connection_;
 
-  // Binlog encryptor, encrypts events (one by one).
+  // Binlog encryptor, encrypts events one by one or in blocks.
   std::unique_ptr<BinlogEncryptor> encryptor_;
 
   // No of times we truncated binlog,
   // used to prevent readers from reading unpublished data.
   int64_t truncate_counter_;
 
-  // Mutex covering readers_
+  // Mutex covering readers_, pinned_files_ and unpositioned_readers_.
   // To avoid deadlocks, never hold any other locks when acquiring/releasing
   // purge_mutex_.
   absl::Mutex purge_mutex_;
 
-  // set of binlog readers, iterated when purging binlog.
-  std::set<BinlogReader*> readers_;
+  // Compare binlog filenames in the order they are created.
+  struct FilenameLess {
+    bool operator()(const std::string& a, const std::string& b) const {
+      return a.size() != b.size() ? a.size() < b.size() : a < b;
+    }
+  };
+
+  // Registered binlog readers and the file each has pinned,
+  // empty if it has not pinned any yet.
+  absl::flat_hash_map<BinlogReader*, std::string> readers_
+      ABSL_GUARDED_BY(purge_mutex_);
 
-  // Check is filename IsSafeToPurge with all readers_
-  bool IsSafeToPurgeLocked(absl::string_view filename) const;
+  // Pinned files and no of readers that have pinned them.
+  // The first one is the oldest file that can't be purged.
+  std::map<std::string, int, FilenameLess> pinned_files_
+      ABSL_GUARDED_BY(purge_mutex_);
+
+  // No of registered readers that have not pinned any file.
+  int unpositioned_readers_ ABSL_GUARDED_BY(purge_mutex_);
+
+  // Add/remove one pin of filename.
+  void PinFileLocked(const std::string& filename)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(purge_mutex_);
+  void UnpinFileLocked(const std::string& filename)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(purge_mutex_);
+
+  // Mutex covering trash_.
+  absl::Mutex trash_mutex_;
+
+  // Paths of files in trash directory with their size on disk, oldest
+  // first.
+  std::deque<std::pair<std::string, int64_t>> trash_
+      ABSL_GUARDED_BY(trash_mutex_);
+
+  // No of bytes on disk in trash and total no of bytes freed.
+  uint64_t trash_bytes_ ABSL_GUARDED_BY(trash_mutex_);
+  uint64_t trash_bytes_freed_ ABSL_GUARDED_BY(trash_mutex_);
+
+  // Get directory where removed files are moved.
+  std::string GetTrashDirectory() const;
+
+  // Add files in trash directory (left by a previous run) to trash_.
+  void ScanTrash() ABSL_LOCKS_EXCLUDED(trash_mutex_);
+
+  // Check if filename is older than all files pinned by readers.
+  // This doesn't lock any reader.
+  bool IsSafeToPurgeLocked(const std::string& filename) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(purge_mutex_);
 
   // Validate an event prior to writing it to local binlog.
   bool ValidateEvent(RawLogEventData event);
@@ -259,6 +341,10 @@ class Binlog : public BinlogReader::BinlogInterface {
   bool SwitchFileLocked()
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_mutex_, position_mutex_);
 
+  // Record latency of transactions that were just added to
+  // flushed_gtid_position_.
+  void RecordPublished();
+
   // Check if this event shall be written to disk.
   bool SkipWritingEvent(RawLogEventData event) const;
 
@@ -266,6 +352,9 @@ class Binlog : public BinlogReader::BinlogInterface {
   bool WriteEvent(RawLogEventData event, off_t *offset, bool wait)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_mutex_);
 
+  // Write events buffered by the encryptor, flushing file if wait.
+  bool FlushEncryptor(bool wait) ABSL_LOCKS_EXCLUDED(file_mutex_);
+
   // Rollback any started but not completed transactions (GTIDs)
   // by truncating the binlog file. Updates pos to reflect actions taken.
   // The truncated variable is set to TRUE if the binlog file was truncated.
@@ -280,10 +369,15 @@ class Binlog : public BinlogReader::BinlogInterface {
   bool Archive(absl::string_view filename)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_mutex_);
 
+  // Mark all closed binlog files for archiving, e.g after a restart.
+  // Files that are already archived are skipped by the file factory.
+  void ArchiveClosedFiles() ABSL_LOCKS_EXCLUDED(file_mutex_);
+
   // Close an opened binlog.
   // On entry the file must be open and file_mutex_ must be held.
   // On return, it will be closed and file_mutex_ remains held.
-  void CloseFileLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_mutex_)
+  // Returns false if events buffered by the encryptor could not be written.
+  bool CloseFileLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(file_mutex_)
       ABSL_SHARED_LOCKS_REQUIRED(position_mutex_);
 
   Binlog(Binlog&&) = delete;
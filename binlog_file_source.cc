@@ -0,0 +1,214 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "binlog_file_source.h"
+
+#include <utility>
+
+#include "file_util.h"
+#include "logging.h"
+#include "mysql_constants.h"
+#include "mysql_protocol.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+BinlogFileSource::BinlogFileSource(const std::vector<std::string> &files,
+                                   const file::Factory &ff)
+    : files_(files), ff_(ff), next_file_(0), file_(nullptr),
+      end_of_file_(0), checksum_(false), has_pending_(false), failed_(false),
+      events_read_(0), bytes_read_(0) {
+}
+
+BinlogFileSource::~BinlogFileSource() {
+  CloseFile();
+}
+
+bool BinlogFileSource::OpenNextFile() {
+  const std::string &filename = files_[next_file_++];
+  absl::string_view header(constants::BINLOG_HEADER,
+                           sizeof(constants::BINLOG_HEADER));
+  if (file_util::OpenAndValidate(&file_, ff_, filename, "r", header) !=
+      file_util::OK) {
+    LOG(ERROR) << "Failed to open binlog file " << filename;
+    return false;
+  }
+  if (!ff_.Size(filename, &end_of_file_)) {
+    LOG(ERROR) << "Failed to get size of binlog file " << filename;
+    CloseFile();
+    return false;
+  }
+  // Encryption and checksums are set by events in each file.
+  encryptor_.reset(BinlogEncryptorFactory::GetInstance(0));
+  checksum_ = false;
+  return true;
+}
+
+void BinlogFileSource::CloseFile() {
+  if (file_ != nullptr) {
+    file_->Close();
+    file_ = nullptr;
+  }
+}
+
+int BinlogFileSource::ReadEvent(Buffer *dst) {
+  Buffer buffer;
+  while (true) {
+    if (file_ == nullptr) {
+      if (next_file_ == files_.size())
+        return 0;
+      if (!OpenNextFile())
+        return -1;
+    }
+
+    switch (encryptor_->Read(file_, end_of_file_, &buffer)) {
+      case file_util::READ_OK:
+        break;
+      case file_util::READ_EOF:
+        CloseFile();
+        continue;
+      case file_util::READ_ERROR:
+        LOG(ERROR) << "Failed to read event from "
+                   << files_[next_file_ - 1];
+        return -1;
+    }
+
+    RawLogEventData event;
+    if (!event.ParseFromBuffer(buffer.data(), buffer.size())) {
+      LOG(ERROR) << "Failed to parse event from "
+                 << files_[next_file_ - 1];
+      return -1;
+    }
+    events_read_++;
+    bytes_read_ += buffer.size();
+
+    switch (event.header.type) {
+      case constants::ET_FORMAT_DESCRIPTION: {
+        // Whether the FD has a checksum depends on its own checksum
+        // field, so parse a stripped copy like MasterSession does.
+        RawLogEventData copy = event;
+        mysql::Protocol::StripEventChecksum(&copy);
+        FormatDescriptorEvent format;
+        if (!format.ParseFromRawLogEventData(copy)) {
+          LOG(ERROR) << "Failed to parse format descriptor from "
+                     << files_[next_file_ - 1];
+          return -1;
+        }
+        checksum_ = format.checksum;
+        // ripple files have own format followed by master format,
+        // the last one is the one of the original master.
+        format_ = format;
+        continue;
+      }
+      case constants::ET_START_ENCRYPTION: {
+        BinlogEncryptor *encryptor =
+            BinlogEncryptorFactory::GetInstance(event);
+        if (encryptor == nullptr) {
+          LOG(ERROR) << "Failed to create encryptor for "
+                     << files_[next_file_ - 1];
+          return -1;
+        }
+        encryptor_.reset(encryptor);
+        continue;
+      }
+      case constants::ET_ROTATE:
+      case constants::ET_STOP:
+      case constants::ET_HEARTBEAT:
+      case constants::ET_GTID_LIST_MARIADB:
+      case constants::ET_BINLOG_CHECKPOINT:
+      case constants::ET_PREVIOUS_GTIDS_MYSQL:
+        continue;
+      default:
+        break;
+    }
+
+    if (checksum_ && !mysql::Protocol::VerifyAndStripEventChecksum(&event)) {
+      LOG(ERROR) << "Checksum mismatch in " << files_[next_file_ - 1];
+      return -1;
+    }
+    dst->clear();
+    event.DeepCopy(dst);
+    // Keep the length in the copied header in sync with the stripped event.
+    event.header.SerializeToBuffer(dst->data(),
+                                   constants::LOG_EVENT_HEADER_LENGTH);
+    return 1;
+  }
+}
+
+bool BinlogFileSource::Init() {
+  // Read up to the first GTID event, skipping any non transactional
+  // events at the start of the binlog.
+  while (!has_pending_) {
+    int res = ReadEvent(&pending_);
+    if (res < 0) {
+      failed_ = true;
+      return false;
+    }
+    if (res == 0)
+      break;
+    has_pending_ = constants::IsGtidEvent(pending_[4]);
+  }
+  if (format_.IsEmpty()) {
+    LOG(ERROR) << "No format descriptor found in binlog files";
+    return false;
+  }
+  return true;
+}
+
+std::string BinlogFileSource::GetServerVersion() const {
+  return format_.server_version;
+}
+
+void BinlogFileSource::GetFormatDescriptor(
+    FormatDescriptorEvent *format) const {
+  *format = format_;
+}
+
+bool BinlogFileSource::NextTransaction(Transaction *trx) {
+  trx->events.clear();
+  trx->timestamp = 0;
+  if (!has_pending_)
+    return false;
+
+  LogEventHeader header;
+  header.ParseFromBuffer(pending_.data(), pending_.size());
+  trx->timestamp = header.timestamp;
+  trx->events.push_back(std::move(pending_));
+  has_pending_ = false;
+
+  while (true) {
+    Buffer event;
+    int res = ReadEvent(&event);
+    if (res < 0) {
+      // The transaction may be incomplete, don't send it.
+      failed_ = true;
+      trx->events.clear();
+      return false;
+    }
+    if (res == 0)
+      break;
+    if (constants::IsGtidEvent(event[4])) {
+      pending_ = std::move(event);
+      has_pending_ = true;
+      break;
+    }
+    trx->events.push_back(std::move(event));
+  }
+  return true;
+}
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_BINLOG_FILE_SOURCE_H
+#define MYSQL_RIPPLE_BINLOG_FILE_SOURCE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "encryption.h"
+#include "fake_master.h"
+#include "file.h"
+#include "log_event.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+// An EventSource replaying existing binlog files, written either by
+// mysqld (with or without checksums) or by ripple (possibly encrypted).
+//
+// Events outside of transactions (format descriptors, rotates,
+// gtid lists, checkpoints...) are dropped as the FakeMaster generates
+// its own. Each transaction keeps the timestamp of its GTID event so that
+// it can be replayed with original pacing.
+class BinlogFileSource : public EventSource {
+ public:
+  BinlogFileSource(const std::vector<std::string> &files,
+                   const file::Factory &ff);
+  ~BinlogFileSource() override;
+
+  // Read up to the first transaction to find the format descriptor.
+  // Shall be called before any other method.
+  bool Init();
+
+  std::string GetServerVersion() const override;
+  void GetFormatDescriptor(FormatDescriptorEvent *format) const override;
+  // Returns false at the end of the files, or on error, see Failed().
+  bool NextTransaction(Transaction *trx) override;
+
+  // Did reading stop at an error rather than at the end of the files.
+  bool Failed() const { return failed_; }
+
+  // Number of events/bytes read from the files.
+  uint64_t GetEventsRead() const { return events_read_; }
+  uint64_t GetBytesRead() const { return bytes_read_; }
+
+ private:
+  const std::vector<std::string> files_;
+  const file::Factory &ff_;
+  size_t next_file_;
+  file::InputFile *file_;
+  int64_t end_of_file_;
+  std::unique_ptr<BinlogEncryptor> encryptor_;
+  bool checksum_;
+  FormatDescriptorEvent format_;
+
+  // Event read ahead, i.e the GTID event of the next transaction.
+  Buffer pending_;
+  bool has_pending_;
+  bool failed_;
+
+  uint64_t events_read_;
+  uint64_t bytes_read_;
+
+  bool OpenNextFile();
+  void CloseFile();
+
+  // Read next event of a transaction into dst (without checksum).
+  // Return 1 on success, 0 when all files have been read and -1 on error.
+  int ReadEvent(Buffer *dst);
+
+  BinlogFileSource(const BinlogFileSource&) = delete;
+  BinlogFileSource& operator=(const BinlogFileSource&) = delete;
+};
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_BINLOG_FILE_SOURCE_H
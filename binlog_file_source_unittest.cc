@@ -0,0 +1,195 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "binlog_file_source.h"
+
+#include "gtest/gtest.h"
+#include "byte_order.h"
+#include "file_FILE.h"
+#include "log_event.h"
+#include "mysql_constants.h"
+#include "mysql_protocol.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+static const char *test_dir = nullptr;
+const std::string GetTestDir() {
+  if (test_dir == nullptr) {
+    if (getenv("TEST_TMPDIR")) {
+      test_dir = getenv("TEST_TMPDIR");
+    } else {
+      test_dir = ".";
+    }
+  }
+  return std::string(test_dir);
+}
+
+// Writes a binlog file like mysqld does.
+class BinlogFileWriter {
+ public:
+  explicit BinlogFileWriter(bool checksum) : checksum_(checksum) {
+    data_.Append(reinterpret_cast<const uint8_t*>(constants::BINLOG_HEADER),
+                 sizeof(constants::BINLOG_HEADER));
+  }
+
+  void Add(const EventBase &event, uint32_t timestamp = 0) {
+    LogEventHeader header;
+    header.timestamp = timestamp;
+    header.type = event.GetEventType();
+    header.server_id = 1;
+    header.event_length = header.PackLength() + event.PackLength() +
+        (checksum_ ? 4 : 0);
+    header.nextpos = data_.size() + header.event_length;
+    header.flags = 0;
+    uint8_t *ptr = data_.Append(header.event_length);
+    header.SerializeToBuffer(ptr, header.PackLength());
+    event.SerializeToBuffer(ptr + header.PackLength(), event.PackLength());
+    if (checksum_) {
+      int len = header.event_length - 4;
+      byte_order::store4(ptr + len,
+                         mysql::Protocol::ComputeEventChecksum(ptr, len));
+    }
+  }
+
+  void AddTransaction(uint64_t seq_no, uint32_t timestamp) {
+    GTIDEvent gtid;
+    gtid.gtid.set_server_id(1);
+    gtid.gtid.seq_no = seq_no;
+    gtid.gtid.domain_id = 0;
+    gtid.flags = 0;
+    gtid.is_standalone = 0;
+    gtid.has_group_commit_id = 0;
+    Add(gtid, timestamp);
+    QueryEvent query;
+    query.query = "INSERT INTO t1 VALUES (1)";
+    Add(query, timestamp);
+    XIDEvent xid;
+    xid.xid = seq_no;
+    Add(xid, timestamp);
+  }
+
+  void Write(const std::string &filename) {
+    file::AppendOnlyFile *file;
+    file::FILE_Factory().Delete(filename);
+    ASSERT_TRUE(file::FILE_Factory().Create(&file, filename, "w"));
+    ASSERT_TRUE(file->Write(data_));
+    ASSERT_TRUE(file->Close());
+  }
+
+ private:
+  bool checksum_;
+  Buffer data_;
+};
+
+FormatDescriptorEvent MariaDBFormat(bool checksum) {
+  FormatDescriptorEvent format;
+  format.SetToRipple("10.3.27-MariaDB-log");
+  format.checksum = checksum;
+  return format;
+}
+
+TEST(BinlogFileSource, Replay) {
+  std::string file1 = GetTestDir() + "/binlog_file_source.000001";
+  std::string file2 = GetTestDir() + "/binlog_file_source.000002";
+
+  {
+    // First file with checksums and some non transactional events.
+    BinlogFileWriter writer(true);
+    writer.Add(MariaDBFormat(true));
+    HeartbeatEvent heartbeat;
+    heartbeat.filename = "binlog.000001";
+    writer.Add(heartbeat);
+    writer.AddTransaction(1, 1000);
+    writer.AddTransaction(2, 1001);
+    RotateEvent rotate;
+    rotate.filename = "binlog.000002";
+    rotate.offset = 4;
+    writer.Add(rotate);
+    writer.Write(file1);
+  }
+  {
+    // Second file without checksums.
+    BinlogFileWriter writer(false);
+    writer.Add(MariaDBFormat(false));
+    writer.AddTransaction(3, 1005);
+    writer.Write(file2);
+  }
+
+  BinlogFileSource source({file1, file2}, file::FILE_Factory());
+  ASSERT_TRUE(source.Init());
+  EXPECT_EQ(source.GetServerVersion(), "10.3.27-MariaDB-log");
+
+  Transaction trx;
+  for (uint64_t seq_no = 1; seq_no <= 3; seq_no++) {
+    ASSERT_TRUE(source.NextTransaction(&trx));
+    ASSERT_EQ(trx.events.size(), 3);
+    EXPECT_EQ(trx.timestamp, seq_no == 3 ? 1005 : 999 + seq_no);
+
+    RawLogEventData event;
+    ASSERT_TRUE(event.ParseFromBuffer(trx.events[0].data(),
+                                      trx.events[0].size()));
+    EXPECT_EQ(event.header.type, constants::ET_GTID_MARIADB);
+    GTIDEvent gtid;
+    ASSERT_TRUE(gtid.ParseFromRawLogEventData(event));
+    EXPECT_EQ(gtid.gtid.seq_no, seq_no);
+
+    // Checksums are stripped.
+    ASSERT_TRUE(event.ParseFromBuffer(trx.events[2].data(),
+                                      trx.events[2].size()));
+    EXPECT_EQ(event.header.type, constants::ET_XID);
+    EXPECT_EQ(trx.events[2].size(), constants::LOG_EVENT_HEADER_LENGTH + 8);
+  }
+  EXPECT_FALSE(source.NextTransaction(&trx));
+  EXPECT_FALSE(source.Failed());
+
+  file::FILE_Factory().Delete(file1);
+  file::FILE_Factory().Delete(file2);
+}
+
+TEST(BinlogFileSource, ReadError) {
+  std::string file1 = GetTestDir() + "/binlog_file_source.000001";
+  {
+    BinlogFileWriter writer(true);
+    writer.Add(MariaDBFormat(true));
+    writer.AddTransaction(1, 1000);
+    writer.AddTransaction(2, 1001);
+    writer.Write(file1);
+  }
+
+  // The second file can not be read, so the last transaction of the first
+  // one may be incomplete.
+  BinlogFileSource source({file1, GetTestDir() + "/binlog_file_source.missing"},
+                          file::FILE_Factory());
+  ASSERT_TRUE(source.Init());
+  Transaction trx;
+  ASSERT_TRUE(source.NextTransaction(&trx));
+  EXPECT_FALSE(source.Failed());
+  EXPECT_FALSE(source.NextTransaction(&trx));
+  EXPECT_TRUE(trx.events.empty());
+  EXPECT_TRUE(source.Failed());
+
+  file::FILE_Factory().Delete(file1);
+}
+
+TEST(BinlogFileSource, MissingFile) {
+  BinlogFileSource source({GetTestDir() + "/binlog_file_source.missing"},
+                          file::FILE_Factory());
+  EXPECT_FALSE(source.Init());
+}
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
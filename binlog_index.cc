@@ -15,10 +15,20 @@
 #include "binlog_index.h"
 
 #include <unistd.h>
+#include <zlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "byte_order.h"
 #include "file.h"
 #include "logging.h"
 #include "monitoring.h"
@@ -27,11 +37,46 @@ namespace mysql_ripple {
 
 constexpr const char HEADER[] = "# this is a binlog index for ripple\n";
 
+constexpr size_t BinlogIndex::Entry::kUnknownFileSize;
+
+namespace {
+
+// Call fn(0) ... fn(count - 1) using at most max_threads threads.
+void ParallelFor(size_t count, int max_threads,
+                 const std::function<void(size_t)>& fn) {
+  size_t num_threads = std::min(count, static_cast<size_t>(
+      std::max(max_threads, 1)));
+  if (num_threads <= 1) {
+    for (size_t n = 0; n < count; n++) fn(n);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t n = next++; n < count; n = next++) fn(n);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+
 BinlogIndex::BinlogIndex(const char* directory, const file::Factory& ff)
     : directory_(directory),
       basename_("binlog"),
       ff_(ff),
-      index_file_(nullptr) {
+      index_file_(nullptr),
+      validate_on_recover_(true),
+      recover_threads_(1),
+      journal_records_(0),
+      compacting_(false),
+      first_entry_seqno_(0) {
   if (directory_.back() != '/')
     directory_ += "/";
 }
@@ -52,6 +97,10 @@ std::string BinlogIndex::GetIndexFilename() const {
   return directory_ + basename_ + ".index";
 }
 
+std::string BinlogIndex::GetSnapshotFilename() const {
+  return directory_ + basename_ + ".index.snapshot";
+}
+
 // Create binlog index and open if non-exists.
 // If a binlog index already exists return false.
 bool BinlogIndex::Create() {
@@ -76,19 +125,25 @@ bool BinlogIndex::Create() {
     absl::MutexLock lock(&file_mutex_);
     CHECK(index_file_ == nullptr);
     index_file_ = f;
-    last_file_line_is_open_ = false;
+    journal_records_ = 0;
   }
 
   {
     absl::MutexLock lock(&entries_mutex_);
-    index_entries_.clear();
+    AssignEntriesLocked({});
   }
   return true;
 }
 
 // Open binlog index and recover/discard unfinished entries.
 int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
-  index_entries_.clear();
+  {
+    absl::MutexLock lock(&entries_mutex_);
+    AssignEntriesLocked({});
+  }
+  // Entries are parsed and validated into a local vector,
+  // and published once recovery has succeeded.
+  std::vector<Entry> entries;
   file::InputFile* f;
 
   auto res =
@@ -108,63 +163,24 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
 
   // this struct is used only during recover.
   struct recover_entry {
-    int lineno;
     file_util::OpenResultCode open_file_result;
   };
   std::vector<recover_entry> recover_entries;
 
-  // read all lines in file (and then validate consistency).
-  int lineno = 1;
-  Buffer buf;
-  bool done = false;
-  while (!done || !buf.empty()) {
-    auto pos = std::find(std::begin(buf), std::end(buf), '\n');
-    while (!done && pos == std::end(buf)) {
-      auto len = buf.size();
-      // read more data until we find a newline.
-      done = !f->Read(buf, 256);
-      pos = std::find(std::begin(buf) + len, std::end(buf), '\n');
-    }
-    if (pos != std::end(buf)) pos++;
-    std::string line(std::begin(buf), pos);
-    buf.erase(std::begin(buf), pos);
+  // Set if the index file needs to be rewritten after recovery,
+  // e.g. when the last record in it was not completely written.
+  bool rewrite = false;
+  size_t records = 0;
 
-    Entry entry;
-    recover_entry recover_info;
-    recover_info.lineno = lineno;
-    lineno++;
-    if (line.empty()) {
-      // empty line...should be EOF
-      if (!f->eof()) {
-        f->Close();
-        LOG(ERROR) << "Inconsistent binlog-index"
-                   << ", line: " << lineno
-                   << ", found unexpected empty line";
-        monitoring::rippled_binlog_error->Increment(
-          monitoring::ERROR_INCONSISTENT_INDEX);
-        return -1;
-      }
-
-      break;  // end of file
-    } else {
-      if (line[0] == '#')
-        continue;
-
-      if (!entry.Parse(line)) {
-        f->Close();
-        LOG(ERROR) << "Inconsistent binlog-index"
-                   << ", line: " << lineno
-                   << ", failed to parse line: \"" << line << "\"";
-        monitoring::rippled_binlog_error->Increment(
-          monitoring::ERROR_INCONSISTENT_INDEX);
-        return -1;
-      }
-
-      recover_info.open_file_result = handler->Validate(entry.filename);
-      recover_entries.push_back(recover_info);
-      entry.file_size = handler->GetFileSize(entry.filename);
-      index_entries_.push_back(entry);
+  // read the whole file, the header has already been consumed.
+  std::string data(HEADER);
+  {
+    Buffer buf;
+    while (f->Read(buf, 65536)) {
+      data.append(std::begin(buf), std::end(buf));
+      buf.clear();
     }
+    data.append(std::begin(buf), std::end(buf));
   }
 
   if (!f->eof()) {
@@ -175,8 +191,85 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
         monitoring::ERROR_FAILED_READ_INDEX);
     return -1;
   }
+  f->Close();
 
-  CHECK(index_entries_.size() == recover_entries.size());
+  // If there is a snapshot of a prefix of the file, start from that
+  // and only replay the records appended after it.
+  absl::string_view rest(data);
+  size_t snapshot_bytes;
+  bool snapshot = ReadSnapshot(data, &entries, &snapshot_bytes);
+  if (snapshot) {
+    rest.remove_prefix(snapshot_bytes);
+  } else {
+    entries.clear();
+    rest.remove_prefix(strlen(HEADER));
+  }
+
+  // replay all lines (and then validate consistency).
+  ReplayState replay(&entries);
+  // Lines after a snapshot are records, never legacy lines.
+  replay.checksummed = snapshot;
+  int lineno = 1;
+  while (!rest.empty()) {
+    size_t eol = rest.find('\n');
+    absl::string_view line =
+        eol == absl::string_view::npos ? rest : rest.substr(0, eol + 1);
+    rest.remove_prefix(line.size());
+
+    lineno++;
+    if (line[0] == '#')
+      continue;
+
+    records++;
+    switch (ReplayRecord(line, &replay)) {
+      case REPLAY_OK:
+        if (line.back() != '\n') {
+          // An entry without tail, as written by older versions.
+          // Records can't be appended after it.
+          rewrite = true;
+        }
+        break;
+      case REPLAY_TORN:
+        // Only the last line can be partially written.
+        if (!rest.empty()) {
+          LOG(ERROR) << "Inconsistent binlog-index"
+                     << ", line: " << lineno
+                     << ", partially written record: \"" << line << "\"";
+          monitoring::rippled_binlog_error->Increment(
+            monitoring::ERROR_INCONSISTENT_INDEX);
+          return -1;
+        }
+        LOG(WARNING) << "Discarding partially written record"
+                     << " at end of binlog-index: \"" << line << "\"";
+        rewrite = true;
+        break;
+      case REPLAY_ERROR:
+        LOG(ERROR) << "Inconsistent binlog-index"
+                   << ", line: " << lineno
+                   << ", failed to replay line: \"" << line << "\"";
+        monitoring::rippled_binlog_error->Increment(
+          monitoring::ERROR_INCONSISTENT_INDEX);
+        return -1;
+    }
+  }
+  replay.Finish();
+
+  // Validate and stat files in parallel, each entry only writes to
+  // its own slot so the result is the same as if done serially.
+  recover_entries.resize(entries.size());
+  ParallelFor(entries.size(), recover_threads_, [&](size_t n) {
+    Entry& entry = entries[n];
+    // Closed files with a persisted size are not modified after they
+    // are closed, validating them can be deferred to when they are read.
+    bool deferred = !validate_on_recover_ && entry.is_closed &&
+        !entry.is_purged && n + 1 < entries.size() &&
+        entry.file_size != Entry::kUnknownFileSize;
+    recover_entries[n].open_file_result =
+        deferred ? file_util::OK : handler->Validate(entry.filename);
+    if (!entry.is_closed || entry.file_size == Entry::kUnknownFileSize) {
+      entry.file_size = handler->GetFileSize(entry.filename);
+    }
+  });
 
   bool ok = true;
 
@@ -193,9 +286,9 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
    * 1: start_position='' last_position=''
    */
   // entry[N-1].last_position != nullptr => entry[N].start_position != nullptr
-  for (size_t n = 1; n < index_entries_.size(); n++) {
-    if (!index_entries_[n-1].last_position.IsEmpty()) {
-      if (index_entries_[n].start_position.IsEmpty()) {
+  for (size_t n = 1; n < entries.size(); n++) {
+    if (!entries[n-1].last_position.IsEmpty()) {
+      if (entries[n].start_position.IsEmpty()) {
         LOG(ERROR) << "Inconsistent binlog-index"
                    << ", entry: " << n
                    << ", missing or empty start position";
@@ -224,9 +317,9 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
    */
   // N < last: entry[N].start_position != nullptr =>
   // entry[N].last_position != nullptr
-  for (size_t n = 0; n + 1 < index_entries_.size(); n++) {
-    if (!index_entries_[n].start_position.IsEmpty()) {
-      if (index_entries_[n].last_position.IsEmpty()) {
+  for (size_t n = 0; n + 1 < entries.size(); n++) {
+    if (!entries[n].start_position.IsEmpty()) {
+      if (entries[n].last_position.IsEmpty()) {
         LOG(ERROR) << "Inconsistent binlog-index"
                    << ", entry: " << n
                    << ", missing or empty last position";
@@ -238,9 +331,9 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
   }
 
   // entry[N].last_pos != nullptr => entry[N].last_next_master_pos != nullptr
-  for (size_t n = 0; n < index_entries_.size(); n++) {
-    if (!index_entries_[n].last_position.IsEmpty()) {
-      if (index_entries_[n].last_next_master_position.IsEmpty()) {
+  for (size_t n = 0; n < entries.size(); n++) {
+    if (!entries[n].last_position.IsEmpty()) {
+      if (entries[n].last_next_master_position.IsEmpty()) {
         LOG(ERROR) << "Inconsistent binlog-index"
                    << ", entry: " << n
                    << ", missing or empty last next master position";
@@ -266,12 +359,12 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
   // Only last entry may have incomplete binlog file
   for (size_t n = 0; n + 1 < recover_entries.size(); n++) {
     if (!(recover_entries[n].open_file_result == file_util::OK ||
-          (index_entries_[n].is_purged == true &&
+          (entries[n].is_purged == true &&
            recover_entries[n].open_file_result == file_util::NO_SUCH_FILE))) {
       LOG(ERROR) << "Inconsistent binlog-index"
                  << ", entry: " << n
                  << ", binlog file not valid: "
-                 << index_entries_[n].filename;
+                 << entries[n].filename;
       monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_INCONSISTENT_INDEX);
       ok = false;
@@ -279,8 +372,8 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
   }
 
   // only last entry can be !is_closed
-  for (size_t n = 0; n + 1 < index_entries_.size(); n++) {
-    if (!index_entries_[n].is_closed) {
+  for (size_t n = 0; n + 1 < entries.size(); n++) {
+    if (!entries[n].is_closed) {
       LOG(ERROR) << "Inconsistent binlog-index"
                  << ", entry: " << n
                  << ", only last entry can be open";
@@ -291,11 +384,11 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
   }
 
   // Check state of last entry
-  if (!index_entries_.empty()) {
+  if (!entries.empty()) {
     // last entry can't be purged
-    if (index_entries_.back().is_purged) {
+    if (entries.back().is_purged) {
       LOG(ERROR) << "Inconsistent binlog-index"
-                 << ", entry: " << (index_entries_.size() - 1)
+                 << ", entry: " << (entries.size() - 1)
                  << ", last entry can't be purged";
       monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_INCONSISTENT_INDEX);
@@ -305,13 +398,13 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
     switch (recover_entries.back().open_file_result) {
       case file_util::NO_SUCH_FILE:
       case file_util::FILE_EMPTY:
-        if (!index_entries_.back().last_position.IsEmpty()) {
+        if (!entries.back().last_position.IsEmpty()) {
           // If last_position isn't empty
           // then file for last entry should be OK
           LOG(ERROR) << "Inconsistent binlog-index"
-                     << ", entry: " << (index_entries_.size() - 1)
+                     << ", entry: " << (entries.size() - 1)
                      << ", binlog file not valid: "
-                     << index_entries_.back().filename;
+                     << entries.back().filename;
           monitoring::rippled_binlog_error->Increment(
             monitoring::ERROR_INCONSISTENT_INDEX);
           ok = false;
@@ -321,9 +414,9 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
         break;
       case file_util::INVALID_MAGIC:
         LOG(ERROR) << "Inconsistent binlog-index"
-                   << ", entry: " << (index_entries_.size() - 1)
+                   << ", entry: " << (entries.size() - 1)
                    << ", binlog file not valid: "
-                     << index_entries_.back().filename;
+                     << entries.back().filename;
         monitoring::rippled_binlog_error->Increment(
           monitoring::ERROR_INVALID_MAGIC);
 
@@ -332,32 +425,41 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
     }
   }
 
-  f->Close();
   if (!ok) {
     return -1;
   }
 
   // We think that state is OK, now check what to do...
-  // TODO(nerdatmath): shouldn't we hold the lock here?
-  if (index_file_ != nullptr) {
-    index_file_->Close();
+  {
+    absl::MutexLock lock(&file_mutex_);
+    if (index_file_ != nullptr) {
+      index_file_->Close();
+      index_file_ = nullptr;
+    }
+    if (!ff_.Open(&index_file_, GetIndexFilename(), "a")) return -1;
+    journal_records_ = records;
   }
-  if (!ff_.Open(&index_file_, GetIndexFilename(), "a")) return -1;
-  last_file_line_is_open_ =
-      !index_entries_.empty() && index_entries_.back().last_position.IsEmpty();
 
-  if (index_entries_.empty()) {
+  if (entries.empty()) {
     // This is equivalent to an empty file
+    if (rewrite && !RewriteIndex(entries)) {
+      LOG(ERROR) << "Failed to rewrite index";
+      monitoring::rippled_binlog_error->Increment(
+        monitoring::ERROR_FAILED_REWRITE_INDEX);
+      return -1;
+    }
     return 1;
   }
 
   // purge entries that was marked as purged.
+  // Note: the file might already be removed if we crashed before
+  // the purge record was appended.
   bool purged = false;
-  for (size_t n = 0; n + 1 < index_entries_.size(); n++) {
-    if (index_entries_[n].is_purged &&
-        recover_entries[n].open_file_result != file_util::NO_SUCH_FILE) {
+  for (size_t n = 0; n + 1 < entries.size(); n++) {
+    if (entries[n].is_purged) {
       purged = true;
-      if (!handler->Remove(index_entries_[n].filename)) {
+      if (recover_entries[n].open_file_result != file_util::NO_SUCH_FILE &&
+          !handler->Remove(entries[n].filename)) {
         return false;
       }
     }
@@ -365,12 +467,12 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
 
   if (purged) {
     std::vector<Entry> copy;
-    for (size_t n = 0; n < index_entries_.size(); n++) {
-      if (!index_entries_[n].is_purged) {
-        copy.push_back(index_entries_[n]);
+    for (size_t n = 0; n < entries.size(); n++) {
+      if (!entries[n].is_purged) {
+        copy.push_back(entries[n]);
       }
     }
-    index_entries_.swap(copy);
+    entries.swap(copy);
   }
 
   bool truncated = false;
@@ -380,12 +482,12 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
     // truncate last entry in index-file.
     LOG(INFO) << "Last entry of binlog index was empty"
               << ", removing that from index file"
-              << ", empty file: " << index_entries_.back().filename;
-    index_entries_.pop_back();
+              << ", empty file: " << entries.back().filename;
+    entries.pop_back();
   }
 
-  if (purged || truncated) {
-    if (!RewriteIndex(index_entries_)) {
+  if (purged || truncated || rewrite) {
+    if (!RewriteIndex(entries)) {
       LOG(ERROR) << "Failed to rewrite index";
       monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_FAILED_REWRITE_INDEX);
@@ -393,6 +495,8 @@ int BinlogIndex::Recover(BinlogRecoveryHandlerInterface *handler) {
     }
   }
 
+  absl::MutexLock lock(&entries_mutex_);
+  AssignEntriesLocked(entries);
   return 1;
 }
 
@@ -415,10 +519,10 @@ bool BinlogIndex::Close() {
 
 BinlogIndex::Entry BinlogIndex::GetOldestEntry() const {
   absl::MutexLock lock(&entries_mutex_);
-  for (const Entry& entry : index_entries_) {
-    if (entry.is_purged)
+  for (const EntryRef& entry : index_entries_) {
+    if (entry->is_purged)
       continue;
-    return entry;
+    return *entry;
   }
 
   Entry entry;
@@ -433,7 +537,7 @@ BinlogIndex::Entry BinlogIndex::GetCurrentEntry() const {
     entry.Reset();
     return entry;
   }
-  return index_entries_.back();
+  return *index_entries_.back();
 }
 
 // Add a new entry to the index.
@@ -449,6 +553,7 @@ bool BinlogIndex::NewEntry(const GTIDList& start_position,
         monitoring::ERROR_OLD_FILE_NOT_CLOSED);
       return false;
     }
+    CHECK(entry.is_closed);
   }
 
   entry.is_closed = false;
@@ -457,28 +562,16 @@ bool BinlogIndex::NewEntry(const GTIDList& start_position,
   entry.start_master_position = master_position;
   entry.last_position.Reset();
   entry.last_next_master_position.Reset();
+  entry.file_size = Entry::kUnknownFileSize;
   entry.filename = GetNextFilename(entry.filename);
-  std::string str = entry.FormatHead();
 
-  {
-    absl::MutexLock lock(&file_mutex_);
-    CHECK(!last_file_line_is_open_);
-    if (!(index_file_->Write(str) && index_file_->Sync())) {
-      index_file_->Close();
-      index_file_ = nullptr;
-      LOG(ERROR) << "Failed to write entry to binlog index"
-                 << ", size: " << str.size();
-      monitoring::rippled_binlog_error->Increment(
-          monitoring::ERROR_WRITE_INDEX_ENTRY);
-      return false;
-    }
-    last_file_line_is_open_ = true;
+  absl::MutexLock file_lock(&file_mutex_);
+  if (!AppendRecordLocked(RECORD_NEW, entry)) {
+    return false;
   }
 
-  {
-    absl::MutexLock lock(&entries_mutex_);
-    index_entries_.push_back(entry);
-  }
+  absl::MutexLock lock(&entries_mutex_);
+  PushBackEntryLocked(entry);
   return true;
 }
 
@@ -487,6 +580,7 @@ bool BinlogIndex::CloseEntry(const GTIDList& last_position,
                              const FilePosition& last_next_master_position,
                              size_t file_size) {
   Entry entry = GetCurrentEntry();
+  CHECK(!entry.filename.empty() && !entry.is_closed);
 
   if (!entry.start_position.IsEmpty()) {
     if (last_position.IsEmpty())
@@ -502,27 +596,14 @@ bool BinlogIndex::CloseEntry(const GTIDList& last_position,
   entry.last_position = last_position;
   entry.last_next_master_position = last_next_master_position;
   entry.file_size = file_size;
-  std::string str = entry.FormatTail();
 
-  {
-    absl::MutexLock lock(&file_mutex_);
-    CHECK(last_file_line_is_open_);
-    if (!(index_file_->Write(str) && index_file_->Sync())) {
-      index_file_->Close();
-      index_file_ = nullptr;
-      LOG(ERROR) << "Failed to write entry-tail to binlog index"
-                 << ", size: " << str.size();
-      monitoring::rippled_binlog_error->Increment(
-          monitoring::ERROR_WRITE_INDEX_ENTRY);
-      return false;
-    }
-    last_file_line_is_open_ = false;
+  absl::MutexLock file_lock(&file_mutex_);
+  if (!AppendRecordLocked(RECORD_CLOSE, entry)) {
+    return false;
   }
 
-  {
-    absl::MutexLock lock(&entries_mutex_);
-    index_entries_.back() = entry;
-  }
+  absl::MutexLock lock(&entries_mutex_);
+  index_entries_.back() = std::make_shared<const Entry>(entry);
   return true;
 }
 
@@ -552,6 +633,10 @@ std::string BinlogIndex::Entry::FormatTail() const {
     tmp += " last_next_master_pos=" + last_next_master_position.ToString();
   }
 
+  if (file_size != kUnknownFileSize) {
+    absl::StrAppend(&tmp, " size=", file_size);
+  }
+
   if (is_purged) {
     tmp += " purged=1";
   }
@@ -559,6 +644,170 @@ std::string BinlogIndex::Entry::FormatTail() const {
   return tmp + "\n";
 }
 
+namespace {
+
+const char* const kRecordNames[] = {
+  "",             // RECORD_ENTRY has no name.
+  "new",          // RECORD_NEW
+  "close",        // RECORD_CLOSE
+  "mark_purged",  // RECORD_MARK_PURGED
+  "purge",        // RECORD_PURGE
+};
+
+uint32_t Checksum(absl::string_view data) {
+  return crc32(0, reinterpret_cast<const Bytef*>(data.data()), data.size());
+}
+
+}  // namespace
+
+// Records are lines on the form
+//   <name> filename=X <fields> crc=<checksum>\n
+// where name is one of kRecordNames, fields are formatted as in FormatHead()
+// or FormatTail() and checksum is crc32 of everything before " crc=".
+// RECORD_ENTRY is the legacy format of a line, i.e a name-less
+// FormatHead()+FormatTail().
+std::string BinlogIndex::FormatRecord(RecordType type, const Entry& entry) {
+  std::string tmp;
+  switch (type) {
+    case RECORD_ENTRY:
+      tmp = entry.FormatHead() + entry.FormatTail();
+      tmp.pop_back();  // newline
+      break;
+    case RECORD_NEW:
+      tmp = absl::StrCat(kRecordNames[type], " ", entry.FormatHead());
+      break;
+    case RECORD_CLOSE:
+      tmp = absl::StrCat(kRecordNames[type], " filename=", entry.filename,
+                         entry.FormatTail());
+      tmp.pop_back();  // newline
+      break;
+    case RECORD_MARK_PURGED:
+    case RECORD_PURGE:
+      tmp = absl::StrCat(kRecordNames[type], " filename=", entry.filename);
+      break;
+  }
+  absl::StrAppend(&tmp, " crc=", Checksum(tmp), "\n");
+  return tmp;
+}
+
+BinlogIndex::ReplayState::ReplayState(std::vector<Entry>* entries)
+    : entries(entries), removed(entries->size()), checksummed(false) {
+  for (size_t i = 0; i < entries->size(); i++) {
+    slots[(*entries)[i].filename] = i;
+  }
+}
+
+void BinlogIndex::ReplayState::Finish() {
+  size_t n = 0;
+  for (size_t i = 0; i < entries->size(); i++) {
+    if (!removed[i]) {
+      if (n != i) (*entries)[n] = std::move((*entries)[i]);
+      n++;
+    }
+  }
+  entries->resize(n);
+}
+
+BinlogIndex::ReplayResult BinlogIndex::ReplayRecord(
+    absl::string_view line, ReplayState* state) {
+  bool complete = !line.empty() && line.back() == '\n';
+  absl::string_view body = line;
+  if (complete) body.remove_suffix(1);
+
+  RecordType type = RECORD_ENTRY;
+  for (int t = RECORD_NEW; t <= RECORD_PURGE; t++) {
+    if (absl::ConsumePrefix(&body, absl::StrCat(kRecordNames[t], " "))) {
+      type = static_cast<RecordType>(t);
+      break;
+    }
+  }
+
+  // Only the last entry of a legacy index is written without newline,
+  // any other incomplete line is a partially written record, e.g one torn
+  // inside its name.
+  size_t crc_pos = line.rfind(" crc=");
+  bool checksummed = crc_pos != absl::string_view::npos;
+  if (!complete &&
+      (type != RECORD_ENTRY || checksummed || state->checksummed)) {
+    return REPLAY_TORN;
+  }
+
+  if (checksummed) {
+    uint32_t crc;
+    absl::string_view value = line.substr(crc_pos + strlen(" crc="));
+    value.remove_suffix(1);  // newline
+    if (!absl::SimpleAtoi(value, &crc) ||
+        crc != Checksum(line.substr(0, crc_pos))) {
+      return REPLAY_ERROR;
+    }
+  } else if (type != RECORD_ENTRY || state->checksummed) {
+    // Legacy lines come before all records.
+    return REPLAY_ERROR;
+  }
+
+  Entry entry;
+  if (!entry.Parse(complete ? absl::StrCat(body, "\n") : std::string(body))) {
+    return complete ? REPLAY_ERROR : REPLAY_TORN;
+  }
+  if (!complete && entry.filename.empty()) {
+    return REPLAY_TORN;
+  }
+  state->checksummed |= checksummed;
+
+  std::vector<Entry>* entries = state->entries;
+  auto find = [state](const std::string& filename) -> Entry* {
+    auto it = state->slots.find(filename);
+    return it == state->slots.end() ? nullptr
+                                    : &(*state->entries)[it->second];
+  };
+  auto push_back = [state, entries](const Entry& entry) {
+    state->slots[entry.filename] = entries->size();
+    entries->push_back(entry);
+    state->removed.push_back(false);
+  };
+
+  switch (type) {
+    case RECORD_ENTRY:
+      push_back(entry);
+      return REPLAY_OK;
+    case RECORD_NEW:
+      entry.is_closed = false;
+      push_back(entry);
+      return REPLAY_OK;
+    case RECORD_CLOSE: {
+      if (entries->empty() || state->removed.back() ||
+          entries->back().is_closed ||
+          entries->back().filename != entry.filename) {
+        return REPLAY_ERROR;
+      }
+      Entry& last = entries->back();
+      last.last_position = entry.last_position;
+      last.last_next_master_position = entry.last_next_master_position;
+      last.file_size = entry.file_size;
+      last.is_closed = true;
+      return REPLAY_OK;
+    }
+    case RECORD_MARK_PURGED: {
+      Entry* found = find(entry.filename);
+      if (found == nullptr) {
+        return REPLAY_ERROR;
+      }
+      found->is_purged = true;
+      return REPLAY_OK;
+    }
+    case RECORD_PURGE: {
+      Entry* found = find(entry.filename);
+      if (found == nullptr || !found->is_purged) {
+        return REPLAY_ERROR;
+      }
+      state->removed[found - entries->data()] = true;
+      state->slots.erase(entry.filename);
+      return REPLAY_OK;
+    }
+  }
+  return REPLAY_ERROR;
+}
+
 bool BinlogIndex::Entry::Parse(absl::string_view line) {
   Reset();
   is_closed = line.back() == '\n';
@@ -572,6 +821,7 @@ bool BinlogIndex::Entry::Parse(absl::string_view line) {
     const auto start_master_pos_len = sizeof("start_master_pos=") - 1;
     const auto last_next_master_pos_len = sizeof("last_next_master_pos=") - 1;
     const auto purged_len = sizeof("purged=") - 1;
+    const auto size_len = sizeof("size=") - 1;
     if (s.compare(0, filename_len, "filename=") == 0) {
       filename = std::string(s.substr(filename_len));
     } else if (s.compare(0, start_pos_len, "start_pos=") == 0) {
@@ -597,6 +847,10 @@ bool BinlogIndex::Entry::Parse(absl::string_view line) {
       if (!absl::SimpleAtob(s.substr(purged_len), &is_purged)) {
         return false;
       }
+    } else if (s.compare(0, size_len, "size=") == 0) {
+      if (!absl::SimpleAtoi(s.substr(size_len), &file_size)) {
+        return false;
+      }
     } else {
       // allow other strings on this line...
     }
@@ -635,95 +889,185 @@ std::string BinlogIndex::Entry::ToString() const {
 
 bool BinlogIndex::GetEntry(const GTIDList& pos, Entry *dst,
                            std::string *message) const {
-  absl::MutexLock lock(&entries_mutex_);
-  if (index_entries_.empty()) return false;
-
-  for (const Entry& entry : index_entries_) {
-    if (entry.is_purged)
-      continue;
+  EntryRef entry = FindEntry(pos, message);
+  if (entry == nullptr)
+    return false;
+  *dst = *entry;
+  return true;
+}
 
-    if (pos.IsEmpty()) {
-      // start from the beginning...
-      *dst = entry;
-      return true;
+BinlogIndex::EntryRef BinlogIndex::FindEntry(const GTIDList& pos,
+                                             std::string *message) const {
+  absl::MutexLock lock(&entries_mutex_);
+  if (index_entries_.empty()) return nullptr;
+
+  // Purged entries can only be found at the front of the index.
+  auto first = std::find_if(index_entries_.begin(), index_entries_.end(),
+                            [](const EntryRef& e) { return !e->is_purged; });
+  if (first == index_entries_.end()) {
+    if (message != nullptr) {
+      *message =
+          "Fatal error. "
+          "Connecting slave requested to start from GTID " + pos.ToString() +
+          ", which is not in the master's binlog.";
     }
+    return nullptr;
+  }
 
-    // we scanned too far...
-    if (!GTIDList::Subset(entry.start_position, pos)) {
-      if (message != nullptr) {
-        *message =
-            "Fatal error. "
-            "Connecting slave requested to start from GTID " + pos.ToString() +
-            ", which is not in the master's binlog "
-            "(min found " + entry.start_position.ToString() + ")";
-      }
-      return false;
-    }
+  if (pos.IsEmpty()) {
+    // start from the beginning...
+    return *first;
+  }
 
-    if (GTIDList::Subset(pos, entry.last_position)) {
-      *dst = entry;
-      return true;
+  // Since last_position is growing over the entries, the entries that
+  // contain pos (or are still open) form a suffix of the index.
+  // Locate first entry of that suffix.
+  auto found = std::partition_point(
+      first, index_entries_.end(), [&pos](const EntryRef& e) {
+        return e->is_closed && !GTIDList::Subset(pos, e->last_position);
+      });
+
+  // start_position is also growing, so if it's contained in pos for the
+  // last entry we need to look at, it's contained for all entries before it.
+  auto last = found == index_entries_.end() ? found - 1 : found;
+  if (!GTIDList::Subset((*last)->start_position, pos)) {
+    if (message != nullptr) {
+      // Report first entry that we scanned too far into.
+      auto min = std::partition_point(
+          first, last + 1, [&pos](const EntryRef& e) {
+            return GTIDList::Subset(e->start_position, pos);
+          });
+      *message =
+          "Fatal error. "
+          "Connecting slave requested to start from GTID " + pos.ToString() +
+          ", which is not in the master's binlog "
+          "(min found " + (*min)->start_position.ToString() + ")";
     }
+    return nullptr;
+  }
 
-    // GTIDList was not found in older entries and
-    // this entry is still open, search here.
-    if (!entry.is_closed) {
-      *dst = entry;
-      return true;
+  if (found == index_entries_.end()) {
+    if (message != nullptr) {
+      *message =
+          "Fatal error. "
+          "Connecting slave requested to start from GTID " + pos.ToString() +
+          ", which is not in the master's binlog.";
     }
+    return nullptr;
   }
 
-  if (message != nullptr) {
-    *message =
-        "Fatal error. "
-        "Connecting slave requested to start from GTID " + pos.ToString() +
-        ", which is not in the master's binlog.";
+  return *found;
+}
+
+bool BinlogIndex::GetNextEntry(absl::string_view filename, Entry* dst) const {
+  EntryRef entry = FindNextEntry(filename);
+  if (entry == nullptr)
+    return false;
+  *dst = *entry;
+  return true;
+}
+
+BinlogIndex::EntryRef BinlogIndex::FindNextEntry(
+    absl::string_view filename) const {
+  absl::MutexLock lock(&entries_mutex_);
+  auto it = filename_to_seqno_.find(filename);
+  if (it == filename_to_seqno_.end())
+    return nullptr;
+  size_t n = it->second - first_entry_seqno_;
+  if (n + 1 >= index_entries_.size())
+    return nullptr;
+  if (index_entries_[n]->is_purged)
+    return nullptr;
+  return index_entries_[n + 1];
+}
+
+void BinlogIndex::AssignEntriesLocked(const std::vector<Entry>& entries) {
+  index_entries_.clear();
+  filename_to_seqno_.clear();
+  first_entry_seqno_ = 0;
+  for (const Entry& entry : entries) {
+    PushBackEntryLocked(entry);
   }
+}
 
-  return false;
+void BinlogIndex::PushBackEntryLocked(const Entry& entry) {
+  filename_to_seqno_[entry.filename] =
+      first_entry_seqno_ + index_entries_.size();
+  index_entries_.push_back(std::make_shared<const Entry>(entry));
 }
 
-bool BinlogIndex::GetNextEntry(absl::string_view filename, Entry* dst) const {
+void BinlogIndex::PopFrontEntryLocked() {
+  filename_to_seqno_.erase(index_entries_.front()->filename);
+  index_entries_.pop_front();
+  first_entry_seqno_++;
+}
+
+void BinlogIndex::PopBackEntryLocked() {
+  filename_to_seqno_.erase(index_entries_.back()->filename);
+  index_entries_.pop_back();
+}
+
+std::vector<BinlogIndex::Entry> BinlogIndex::CopyEntries() const {
   absl::MutexLock lock(&entries_mutex_);
-  for (size_t n = 0; n + 1 < index_entries_.size(); n++) {
-    if (index_entries_[n].is_purged)
-      continue;
-    if (index_entries_[n].filename == filename) {
-      *dst = index_entries_[n+1];
-      return true;
-    }
+  std::vector<Entry> copy;
+  copy.reserve(index_entries_.size());
+  for (const EntryRef& entry : index_entries_) {
+    copy.push_back(*entry);
   }
-  return false;
+  return copy;
 }
 
-bool BinlogIndex::RewriteIndex(const std::vector<Entry>& entries) {
-  absl::MutexLock lock(&file_mutex_);
-  std::string real_name = GetIndexFilename();
-  std::string tmp_name = real_name + ".tmp";
+bool BinlogIndex::AppendRecordLocked(RecordType type, const Entry& entry) {
+  if (index_file_ == nullptr) {
+    LOG(ERROR) << "Failed to append record to binlog index, it is not open";
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_WRITE_INDEX_ENTRY);
+    return false;
+  }
+  std::string str = FormatRecord(type, entry);
+  if (!(index_file_->Write(str) && index_file_->Sync())) {
+    index_file_->Close();
+    index_file_ = nullptr;
+    LOG(ERROR) << "Failed to write record to binlog index"
+               << ", size: " << str.size();
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_WRITE_INDEX_ENTRY);
+    return false;
+  }
+  journal_records_++;
+  if (compacting_) {
+    pending_records_.push_back(std::move(str));
+  }
+  return true;
+}
 
+file::AppendOnlyFile* BinlogIndex::WriteIndexFile(
+    const std::string& filename, const std::vector<Entry>& entries,
+    size_t* bytes, uint32_t* crc) {
   // remove any old version
-  ff_.Delete(tmp_name);
+  ff_.Delete(filename);
 
   file::AppendOnlyFile* f;
-  if (!ff_.Create(&f, tmp_name, "w")) {
+  if (!ff_.Create(&f, filename, "w")) {
     LOG(ERROR) << "Failed to create temp binlog index file";
-    return false;
+    return nullptr;
   }
   if (!f->Write(HEADER)) {
     LOG(ERROR) << "Failed to write binlog index header";
     monitoring::rippled_binlog_error->Increment(
       monitoring::ERROR_WRITE_FILE);
     f->Close();
-    return false;
+    return nullptr;
   }
-  bool last_file_line_is_open = false;
-
-  for (const Entry& entry : entries) {
-    std::string str = entry.FormatHead();
-    CHECK(!last_file_line_is_open);
-    if (entry.is_closed) {
-      str += entry.FormatTail();
-    }
+  *bytes = strlen(HEADER);
+  *crc = Checksum(HEADER);
+
+  for (size_t n = 0; n < entries.size(); n++) {
+    const Entry& entry = entries[n];
+    // Only the last entry can be open.
+    CHECK(entry.is_closed || n + 1 == entries.size());
+    std::string str = FormatRecord(entry.is_closed ? RECORD_ENTRY : RECORD_NEW,
+                                   entry);
     if (!f->Write(str)) {
       LOG(ERROR) << "Failed to write entry to binlog index (tmp)"
                  << ", size: " << str.size();
@@ -732,11 +1076,17 @@ bool BinlogIndex::RewriteIndex(const std::vector<Entry>& entries) {
       monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_WRITE_FILE);
       f->Close();
-      return false;
+      return nullptr;
     }
-    last_file_line_is_open = str.back() != '\n';
+    *bytes += str.size();
+    *crc = crc32(*crc, reinterpret_cast<const Bytef*>(str.data()), str.size());
   }
+  return f;
+}
 
+bool BinlogIndex::ReplaceIndexFileLocked(file::AppendOnlyFile* f,
+                                         const std::string& filename) {
+  std::string real_name = GetIndexFilename();
   if (!f->Sync() || !f->Close()) {
     LOG(ERROR) << "Failed to sync and close tmp binlog index";
     monitoring::rippled_binlog_error->Increment(
@@ -744,7 +1094,7 @@ bool BinlogIndex::RewriteIndex(const std::vector<Entry>& entries) {
     return false;
   }
 
-  if (!ff_.Rename(tmp_name, real_name)) {
+  if (!ff_.Rename(filename, real_name)) {
     LOG(ERROR) << "Failed to rename tmp binlog index";
     monitoring::rippled_binlog_error->Increment(
       monitoring::ERROR_RENAME_FILE);
@@ -755,23 +1105,333 @@ bool BinlogIndex::RewriteIndex(const std::vector<Entry>& entries) {
     index_file_->Close();
     index_file_ = nullptr;
   }
-  if (!ff_.Open(&index_file_, real_name, "a")) return false;
-  last_file_line_is_open_ = last_file_line_is_open;
+  return ff_.Open(&index_file_, real_name, "a");
+}
+
+bool BinlogIndex::RewriteIndex(const std::vector<Entry>& entries) {
+  absl::MutexLock lock(&file_mutex_);
+  std::string tmp_name = GetIndexFilename() + ".tmp";
+  size_t bytes;
+  uint32_t crc;
+  file::AppendOnlyFile* f = WriteIndexFile(tmp_name, entries, &bytes, &crc);
+  if (f == nullptr) {
+    return false;
+  }
+  if (!ReplaceIndexFileLocked(f, tmp_name)) {
+    return false;
+  }
+  journal_records_ = 0;
+
+  // The snapshot is only an optimization, Recover() will ignore it
+  // if it was not replaced.
+  std::string snapshot_tmp_name = GetSnapshotFilename() + ".tmp";
+  if (WriteSnapshot(snapshot_tmp_name, entries, bytes, crc)) {
+    ff_.Rename(snapshot_tmp_name, GetSnapshotFilename());
+  }
+  return true;
+}
+
+// Don't bother compacting small journals.
+static const size_t kMinJournalRecords = 1024;
+
+bool BinlogIndex::MaybeCompact() {
+  std::vector<Entry> entries;
+  {
+    absl::MutexLock lock(&file_mutex_);
+    if (index_file_ == nullptr || compacting_) {
+      return true;
+    }
+    entries = CopyEntries();
+    if (journal_records_ < std::max(kMinJournalRecords, entries.size())) {
+      return true;
+    }
+    compacting_ = true;
+    pending_records_.clear();
+  }
+
+  // Write the new file without holding file_mutex_, so that NewEntry(),
+  // CloseEntry() and purging can proceed meanwhile.
+  std::string tmp_name = GetIndexFilename() + ".compact";
+  size_t bytes;
+  uint32_t crc;
+  file::AppendOnlyFile* f = WriteIndexFile(tmp_name, entries, &bytes, &crc);
+  std::string snapshot_tmp_name = GetSnapshotFilename() + ".compact";
+  bool snapshot = f != nullptr &&
+      WriteSnapshot(snapshot_tmp_name, entries, bytes, crc);
+
+  absl::MutexLock lock(&file_mutex_);
+  compacting_ = false;
+  if (f == nullptr) {
+    pending_records_.clear();
+    LOG(ERROR) << "Failed to compact index";
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_FAILED_REWRITE_INDEX);
+    return false;
+  }
+
+  // Add records appended since the snapshot was taken.
+  size_t records = pending_records_.size();
+  bool ok = true;
+  for (const std::string& str : pending_records_) {
+    if (!f->Write(str)) {
+      ok = false;
+      break;
+    }
+  }
+  pending_records_.clear();
+
+  if (!ok || index_file_ == nullptr) {
+    // Index file was closed (or failed) while compacting.
+    f->Close();
+    ff_.Delete(tmp_name);
+    LOG(ERROR) << "Failed to compact index";
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_FAILED_REWRITE_INDEX);
+    return false;
+  }
+
+  if (!ReplaceIndexFileLocked(f, tmp_name)) {
+    LOG(ERROR) << "Failed to compact index";
+    monitoring::rippled_binlog_error->Increment(
+      monitoring::ERROR_FAILED_REWRITE_INDEX);
+    return false;
+  }
+
+  if (snapshot) {
+    ff_.Rename(snapshot_tmp_name, GetSnapshotFilename());
+  }
+
+  LOG(INFO) << "Compacted binlog index"
+            << ", journal records: " << journal_records_
+            << ", entries: " << entries.size() + records;
+  journal_records_ = records;
+  return true;
+}
+
+// Snapshot file layout, all integers are little endian.
+//   header:  magic(8) version(4) entries(4) index_bytes(8) index_crc(4)
+//            arena_size(4) body_crc(4) header_crc(4)
+//   records: entries * kSnapshotRecordSize
+//   arena:   arena_size bytes
+// A record consists of
+//   (offset(4), length(4)) in arena for filename, start_pos,
+//   start_master_pos, end_pos and last_next_master_pos,
+//   file_size(8), flags(4), unused(4)
+// The positions are stored in the same string format as in the index file.
+namespace {
+
+const char kSnapshotMagic[] = "RIPLIDX\0";
+const uint32_t kSnapshotVersion = 1;
+const size_t kSnapshotHeaderSize = 40;
+const size_t kSnapshotRecordSize = 56;
+const uint32_t kSnapshotClosed = 1;
+const uint32_t kSnapshotPurged = 2;
+
+enum SnapshotString {
+  SNAPSHOT_FILENAME,
+  SNAPSHOT_START_POS,
+  SNAPSHOT_START_MASTER_POS,
+  SNAPSHOT_END_POS,
+  SNAPSHOT_LAST_NEXT_MASTER_POS,
+  SNAPSHOT_STRINGS
+};
+
+}  // namespace
+
+bool BinlogIndex::WriteSnapshot(const std::string& filename,
+                                const std::vector<Entry>& entries,
+                                size_t bytes, uint32_t crc) {
+  std::string records(entries.size() * kSnapshotRecordSize, '\0');
+  std::string arena;
+  absl::flat_hash_map<std::string, uint32_t> offsets;
+  auto add = [&](const std::string& str, uint8_t* dst) {
+    auto it = offsets.find(str);
+    if (it == offsets.end()) {
+      it = offsets.emplace(str, arena.size()).first;
+      arena += str;
+    }
+    byte_order::store4(dst, it->second);
+    byte_order::store4(dst + 4, str.size());
+  };
+
+  for (size_t n = 0; n < entries.size(); n++) {
+    const Entry& entry = entries[n];
+    uint8_t* ptr = reinterpret_cast<uint8_t*>(&records[0]) +
+        n * kSnapshotRecordSize;
+    std::string strings[SNAPSHOT_STRINGS];
+    strings[SNAPSHOT_FILENAME] = entry.filename;
+    entry.start_position.SerializeToString(&strings[SNAPSHOT_START_POS]);
+    if (!entry.start_master_position.IsEmpty()) {
+      strings[SNAPSHOT_START_MASTER_POS] =
+          entry.start_master_position.ToString();
+    }
+    if (entry.is_closed) {
+      entry.last_position.SerializeToString(&strings[SNAPSHOT_END_POS]);
+      if (!entry.last_next_master_position.IsEmpty()) {
+        strings[SNAPSHOT_LAST_NEXT_MASTER_POS] =
+            entry.last_next_master_position.ToString();
+      }
+    }
+    for (int i = 0; i < SNAPSHOT_STRINGS; i++) {
+      add(strings[i], ptr + 8 * i);
+    }
+    ptr += 8 * SNAPSHOT_STRINGS;
+    byte_order::store8(ptr, entry.is_closed ? entry.file_size
+                                            : Entry::kUnknownFileSize);
+    byte_order::store4(ptr + 8, (entry.is_closed ? kSnapshotClosed : 0) |
+                                (entry.is_purged ? kSnapshotPurged : 0));
+  }
+
+  uint32_t body_crc = Checksum(records);
+  body_crc = crc32(body_crc, reinterpret_cast<const Bytef*>(arena.data()),
+                   arena.size());
+
+  uint8_t header[kSnapshotHeaderSize];
+  memcpy(header, kSnapshotMagic, 8);
+  byte_order::store4(header + 8, kSnapshotVersion);
+  byte_order::store4(header + 12, entries.size());
+  byte_order::store8(header + 16, bytes);
+  byte_order::store4(header + 24, crc);
+  byte_order::store4(header + 28, arena.size());
+  byte_order::store4(header + 32, body_crc);
+  byte_order::store4(header + 36, crc32(0, header, 36));
+
+  // remove any old version
+  ff_.Delete(filename);
+
+  file::AppendOnlyFile* f;
+  if (!ff_.Create(&f, filename, "w")) {
+    LOG(WARNING) << "Failed to create binlog index snapshot";
+    return false;
+  }
+  absl::string_view header_str(reinterpret_cast<const char*>(header),
+                               sizeof(header));
+  if (!(f->Write(header_str) && f->Write(records) && f->Write(arena) &&
+        f->Sync())) {
+    LOG(WARNING) << "Failed to write binlog index snapshot";
+    f->Close();
+    ff_.Delete(filename);
+    return false;
+  }
+  return f->Close();
+}
+
+bool BinlogIndex::ReadSnapshot(absl::string_view content,
+                               std::vector<Entry>* entries, size_t* bytes) {
+  file::InputFile* f;
+  if (!ff_.Open(&f, GetSnapshotFilename(), "r")) {
+    return false;  // no snapshot.
+  }
+  Buffer buf;
+  while (f->Read(buf, 65536)) {}
+  bool eof = f->eof();
+  f->Close();
+  if (!eof || buf.size() < kSnapshotHeaderSize) {
+    LOG(WARNING) << "Failed to read binlog index snapshot";
+    return false;
+  }
+
+  const uint8_t* header = buf.data();
+  size_t count = byte_order::load4(header + 12);
+  size_t index_bytes = byte_order::load8(header + 16);
+  size_t arena_size = byte_order::load4(header + 28);
+  size_t records_size = count * kSnapshotRecordSize;
+  if (memcmp(header, kSnapshotMagic, 8) != 0 ||
+      byte_order::load4(header + 8) != kSnapshotVersion ||
+      byte_order::load4(header + 36) != crc32(0, header, 36) ||
+      buf.size() != kSnapshotHeaderSize + records_size + arena_size ||
+      byte_order::load4(header + 32) !=
+          crc32(0, header + kSnapshotHeaderSize, records_size + arena_size)) {
+    LOG(WARNING) << "Ignoring corrupt binlog index snapshot";
+    return false;
+  }
+
+  // Check that the snapshot is of this version of the index file.
+  if (index_bytes > content.size() ||
+      byte_order::load4(header + 24) !=
+          Checksum(content.substr(0, index_bytes))) {
+    LOG(INFO) << "Ignoring binlog index snapshot of other index file";
+    return false;
+  }
+
+  const uint8_t* records = header + kSnapshotHeaderSize;
+  absl::string_view arena(
+      reinterpret_cast<const char*>(records + records_size), arena_size);
+  auto get = [&arena](const uint8_t* ptr, absl::string_view* dst) {
+    size_t offset = byte_order::load4(ptr);
+    size_t len = byte_order::load4(ptr + 4);
+    if (offset + len > arena.size()) return false;
+    *dst = arena.substr(offset, len);
+    return true;
+  };
+
+  entries->clear();
+  entries->reserve(count);
+  // Start position of an entry is normally same as end position of the
+  // previous one, and they share string in arena. Only parse it once.
+  absl::string_view prev_end_pos;
+  for (size_t n = 0; n < count; n++) {
+    const uint8_t* ptr = records + n * kSnapshotRecordSize;
+    absl::string_view strings[SNAPSHOT_STRINGS];
+    for (int i = 0; i < SNAPSHOT_STRINGS; i++) {
+      if (!get(ptr + 8 * i, &strings[i])) {
+        LOG(WARNING) << "Ignoring corrupt binlog index snapshot";
+        return false;
+      }
+    }
+    ptr += 8 * SNAPSHOT_STRINGS;
+    uint32_t flags = byte_order::load4(ptr + 8);
+
+    Entry entry;
+    entry.filename = std::string(strings[SNAPSHOT_FILENAME]);
+    entry.file_size = byte_order::load8(ptr);
+    entry.is_closed = (flags & kSnapshotClosed) != 0;
+    entry.is_purged = (flags & kSnapshotPurged) != 0;
+    bool ok = true;
+    if (n > 0 && entries->back().is_closed &&
+        strings[SNAPSHOT_START_POS].data() == prev_end_pos.data() &&
+        strings[SNAPSHOT_START_POS].size() == prev_end_pos.size()) {
+      entry.start_position = entries->back().last_position;
+    } else {
+      ok &= entry.start_position.Parse(strings[SNAPSHOT_START_POS]);
+    }
+    if (!strings[SNAPSHOT_START_MASTER_POS].empty()) {
+      ok &= entry.start_master_position.Parse(
+          strings[SNAPSHOT_START_MASTER_POS]);
+    }
+    if (entry.is_closed) {
+      ok &= entry.last_position.Parse(strings[SNAPSHOT_END_POS]);
+      if (!strings[SNAPSHOT_LAST_NEXT_MASTER_POS].empty()) {
+        ok &= entry.last_next_master_position.Parse(
+            strings[SNAPSHOT_LAST_NEXT_MASTER_POS]);
+      }
+    }
+    if (!ok) {
+      LOG(WARNING) << "Ignoring corrupt binlog index snapshot";
+      return false;
+    }
+    prev_end_pos = strings[SNAPSHOT_END_POS];
+    entries->push_back(std::move(entry));
+  }
+
+  *bytes = index_bytes;
   return true;
 }
 
 bool BinlogIndex::MarkFirstEntryPurged(const Entry& entry) {
-  // Copy entries, so we can modify the found entry.
-  std::vector<Entry> copy;
+  absl::MutexLock file_lock(&file_mutex_);
+  EntryRef first;
+  size_t size;
   {
     absl::MutexLock lock(&entries_mutex_);
-    copy = index_entries_;
+    size = index_entries_.size();
+    if (size > 0) first = index_entries_.front();
   }
 
   // Locate entry
-  if (copy.size() <= 1) {
+  if (size <= 1) {
     LOG(ERROR) << "Failed to mark entry " << entry.filename
-               << " as purged, only " << copy.size()
+               << " as purged, only " << size
                << " entry in index!";
     monitoring::rippled_binlog_error->Increment(
       monitoring::ERROR_MARK_ENTRY_AS_PURGED);
@@ -779,17 +1439,17 @@ bool BinlogIndex::MarkFirstEntryPurged(const Entry& entry) {
   }
 
   // One can only purge oldest entry.
-  if (copy.front().filename.compare(entry.filename) != 0) {
+  if (first->filename.compare(entry.filename) != 0) {
     LOG(ERROR) << "Failed to mark entry " << entry.filename
                << " as purged, oldest entry is: "
-               << copy.front().filename;
+               << first->filename;
     monitoring::rippled_binlog_error->Increment(
       monitoring::ERROR_MARK_ENTRY_AS_PURGED);
     return false;  // not found
   }
 
   // Entry already marked as purged...
-  if (copy.front().is_purged) {
+  if (first->is_purged) {
     LOG(ERROR) << "Failed to mark entry " << entry.filename
                << " as purged, it is already marked!";
     monitoring::rippled_binlog_error->Increment(
@@ -797,63 +1457,61 @@ bool BinlogIndex::MarkFirstEntryPurged(const Entry& entry) {
     return false;
   }
 
-
-  // Modify copy
-  copy.front().is_purged = true;
-
   // Write this to disk
-  if (!RewriteIndex(copy)) {
+  if (!AppendRecordLocked(RECORD_MARK_PURGED, *first)) {
     LOG(ERROR) << "Failed to purge mark entry " << entry.filename
-               << ", rewrite of index file failed!";
+               << ", append to index file failed!";
     monitoring::rippled_binlog_error->Increment(
       monitoring::ERROR_MARK_ENTRY_AS_PURGED);
     return false;
   }
 
   // And finally update in memory version
-  {
-    absl::MutexLock lock(&entries_mutex_);
-    index_entries_.front().is_purged = true;
-  }
-
+  Entry purged = *first;
+  purged.is_purged = true;
+  absl::MutexLock lock(&entries_mutex_);
+  index_entries_.front() = std::make_shared<const Entry>(purged);
   return true;
 }
 
 bool BinlogIndex::PurgeFirstEntry(const Entry& entry) {
-  std::vector<Entry> copy;
+  absl::MutexLock file_lock(&file_mutex_);
+  EntryRef first;
+  size_t size;
   {
     absl::MutexLock lock(&entries_mutex_);
-    copy = index_entries_;
+    size = index_entries_.size();
+    if (size > 0) first = index_entries_.front();
   }
 
   // Locate entry
-  if (copy.size() <= 1)
+  if (size <= 1)
     return false;  // not found
 
   // One can only purge oldest entry.
-  if (copy.front().filename.compare(entry.filename) != 0)
+  if (first->filename.compare(entry.filename) != 0)
     return false;  // not found
 
   // It needs to be marked first.
-  if (copy.front().is_purged != true) {
+  if (first->is_purged != true) {
     LOG(ERROR) << "Failed to purge entry, entry.is_purged != true";
     return false;
   }
 
-  // Remove the in memory version
-  {
-    absl::MutexLock lock(&entries_mutex_);
-    index_entries_.erase(index_entries_.begin(), index_entries_.begin()+1);
-    copy = index_entries_;
+  if (!AppendRecordLocked(RECORD_PURGE, *first)) {
+    return false;
   }
 
-  // And rewrite index again
-  return RewriteIndex(copy);
+  // Remove the in memory version
+  absl::MutexLock lock(&entries_mutex_);
+  PopFrontEntryLocked();
+  return true;
 }
 
 bool BinlogIndex::MarkAndPurgeLastEntry(const Entry& entry) {
-  // We need to keep mutex for all of this method
-  // since end of vector is also modified by NewEntry
+  // We need to keep mutexes for all of this method
+  // since end of index is also modified by NewEntry
+  absl::MutexLock file_lock(&file_mutex_);
   absl::MutexLock lock(&entries_mutex_);
 
   // Locate entry
@@ -862,51 +1520,49 @@ bool BinlogIndex::MarkAndPurgeLastEntry(const Entry& entry) {
     return false;  // not found
   }
 
-  if (index_entries_.back().filename.compare(entry.filename) != 0) {
+  if (index_entries_.back()->filename.compare(entry.filename) != 0) {
     LOG(ERROR) << "Failed to mark entry " << entry.filename
                << " as purged, newest entry is: "
-               << index_entries_.back().filename;
+               << index_entries_.back()->filename;
     monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_MARK_ENTRY_AS_PURGED);
     return false;  // not found
   }
 
-  if (index_entries_.back().is_purged) {
+  if (index_entries_.back()->is_purged) {
     LOG(ERROR) << "Failed to mark entry " << entry.filename
                << " as purged, it is already marked!";
     return false;
   }
 
-  // Modify
-  index_entries_.back().is_purged = true;
-
   // Write this to disk
-  if (!RewriteIndex(index_entries_)) {
+  if (!AppendRecordLocked(RECORD_MARK_PURGED, *index_entries_.back())) {
     LOG(ERROR) << "Failed to purge mark entry "
                << entry.filename
-               << ", rewrite of index file failed!";
+               << ", append to index file failed!";
     monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_MARK_ENTRY_AS_PURGED);
     return false;
   }
 
-  // Now remove it from in memory copy.
-  index_entries_.erase(index_entries_.end()-1, index_entries_.end());
-
-  // And finally write that to disk.
-  return RewriteIndex(index_entries_);
+  // And finally purge it.
+  if (!AppendRecordLocked(RECORD_PURGE, *index_entries_.back())) {
+    return false;
+  }
+  PopBackEntryLocked();
+  return true;
 }
 
 // Get total size of all binlogs in index
 size_t BinlogIndex::GetTotalSize() const {
   absl::MutexLock lock(&entries_mutex_);
   size_t sum = 0;
-  for (const Entry& entry : index_entries_) {
-    if (entry.is_purged)
+  for (const EntryRef& entry : index_entries_) {
+    if (entry->is_purged)
       continue;
-    if (entry.is_closed == false)
+    if (entry->is_closed == false)
       continue;
-    sum += entry.file_size;
+    sum += entry->file_size;
   }
   return sum;
 }
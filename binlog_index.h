@@ -18,9 +18,12 @@
 #define MYSQL_RIPPLE_BINLOG_INDEX_H
 
 #include <cstdio>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "binlog_position.h"
@@ -33,6 +36,8 @@ namespace mysql_ripple {
 // This is a class that is used during recovery
 // - to validates that a file is a valid binlog file
 // - to remove files that are marked as purged
+// Validate() and GetFileSize() can be called concurrently from
+// several threads.
 class BinlogRecoveryHandlerInterface {
  public:
   virtual ~BinlogRecoveryHandlerInterface() {}
@@ -52,12 +57,19 @@ class BinlogReader;  // forward declaration to avoid circular includes.
 // This class represents a binlog index.
 // I.e a list of binlog files with start/last GTID.
 //
+// The index file is a journal, each mutation appends one record (line)
+// to it, see FormatRecord(). Recover() replays the records, and
+// MaybeCompact() periodically rewrites the file to one line per entry.
+// Indexes written in the legacy format (one line per entry without
+// checksum) are read, but versions without the journal can't read the
+// records, so downgrading over an existing index is not supported.
+//
 // Thread safety of this class works as follows:
 // 1) Create(), Recover(), Close() is NOT thread safe
 //
 // 2) One thread (writer) may call NewFile()/CloseFile()
 // 3) Any number threads (readers) may call GetEntry(), GetCurrentEntry()
-//    GetNextEntry()
+//    GetNextEntry(), FindEntry(), FindNextEntry()
 class BinlogIndex {
  public:
   explicit BinlogIndex(const char* directory, const file::Factory& ff);
@@ -72,11 +84,21 @@ class BinlogIndex {
   virtual bool Create();
 
   // Open binlog index and recover/discard unfinished entries.
+  // If a snapshot of the index is found, only records appended
+  // after it are replayed.
   // return 0 - no state found on disk
   //        1 - state recovered
   //       -1 - an error/inconsistency
   virtual int Recover(BinlogRecoveryHandlerInterface *handler);
 
+  // Set if Recover() shall validate all binlog files (default), or only
+  // those that might have been modified or removed since the index entry
+  // was written. Other files are then validated when they are opened.
+  void SetValidateOnRecover(bool validate) { validate_on_recover_ = validate; }
+
+  // Set max no of threads that Recover() uses to validate binlog files.
+  void SetRecoverThreads(int threads) { recover_threads_ = threads; }
+
   // Check if binlog index is open.
   virtual bool IsOpen();
 
@@ -85,7 +107,10 @@ class BinlogIndex {
 
   // An index entry (line).
   struct Entry {
-    Entry() { is_closed = is_purged = false; }
+    Entry() {
+      is_closed = is_purged = false;
+      file_size = kUnknownFileSize;
+    }
 
     // Filename
     std::string filename;
@@ -111,7 +136,9 @@ class BinlogIndex {
     bool is_closed;
 
     // Size of file, only for closed files.
-    // Not saved in index, but recreated during startup.
+    // Saved in index when file is closed. Indexes written by older versions
+    // don't have it, it is then recreated during startup.
+    static constexpr size_t kUnknownFileSize = ~static_cast<size_t>(0);
     size_t file_size;
 
     bool IsEmpty() const {
@@ -126,6 +153,7 @@ class BinlogIndex {
     void Reset() {
       is_purged = false;
       is_closed = false;
+      file_size = kUnknownFileSize;
       filename.clear();
       start_position.Reset();
       start_master_position.Reset();
@@ -139,6 +167,11 @@ class BinlogIndex {
     std::string FormatTail() const;
   };
 
+  // Entries are never modified once added to the index, a change
+  // replaces the entry. This makes it safe to keep a reference to an
+  // entry after the lookup has returned.
+  typedef std::shared_ptr<const Entry> EntryRef;
+
   // Add a new entry to the index.
   virtual bool NewEntry(const GTIDList& start_position,
                         const FilePosition& master_position);
@@ -156,6 +189,16 @@ class BinlogIndex {
   // Get next file.
   virtual bool GetNextEntry(absl::string_view filename, Entry* dst) const;
 
+  // Same as GetEntry() but without copying the entry.
+  // Return nullptr on failure, and then populates message with reason.
+  // This is O(log(entries)) GTIDList comparisons.
+  virtual EntryRef FindEntry(const GTIDList& start_pos,
+                             std::string *message = nullptr) const;
+
+  // Same as GetNextEntry() but without copying the entry.
+  // Return nullptr if there is no next file.
+  virtual EntryRef FindNextEntry(absl::string_view filename) const;
+
   // Get oldest entry.
   // return empty Entry if no files are present in index.
   virtual Entry GetOldestEntry() const;
@@ -167,28 +210,50 @@ class BinlogIndex {
   // Get name of index file.
   virtual std::string GetIndexFilename() const;
 
+  // Get name of index snapshot file.
+  virtual std::string GetSnapshotFilename() const;
+
   // Get total size of all binlogs in index
   virtual size_t GetTotalSize() const;
 
   // Mark entry as purged.
-  // This will only rewrite the index file adding the purge flag to entry.
+  // This will only append a mark-purged record to the index file.
   // This is split from the purge so that the potentially slower Purge-call
   // can be made without holding external mutexes.
   // NOTE: entry is redundant but used to prevent race-conditions.
   virtual bool MarkFirstEntryPurged(const Entry& entry);
 
   // Purge the entry.
-  // This removes entry from the index file (by rewriting the index).
+  // This removes entry from the index (by appending a purge record).
   // NOTE: entry is redundant but used to prevent race-conditions.
   virtual bool PurgeFirstEntry(const Entry& entry);
 
   // MarkAndPurge last entry in index.
-  // This removes entry from the index file (by rewriting the index).
+  // This removes entry from the index (by appending mark-purged and
+  // purge records).
   // This method is used during recovery when a binlog file
   // without any GTIDs is found.
   // NOTE: entry is redundant but used to prevent race-conditions.
   virtual bool MarkAndPurgeLastEntry(const Entry& entry);
 
+  // Compact the index file if enough records have been appended to it
+  // since it was last written from scratch.
+  // Appends are not blocked while the compacted file is being written.
+  // Return false on failure, the old index file is then kept.
+  virtual bool MaybeCompact();
+
+  // Type of records in index file.
+  enum RecordType {
+    RECORD_ENTRY,        // complete entry, written by compaction.
+    RECORD_NEW,          // NewEntry()
+    RECORD_CLOSE,        // CloseEntry()
+    RECORD_MARK_PURGED,  // MarkFirstEntryPurged()/MarkAndPurgeLastEntry()
+    RECORD_PURGE,        // PurgeFirstEntry()/MarkAndPurgeLastEntry()
+  };
+
+  // Format a record with checksum, including terminating newline.
+  static std::string FormatRecord(RecordType type, const Entry& entry);
+
  private:
   // directory
   std::string directory_;
@@ -202,21 +267,44 @@ class BinlogIndex {
   // The index file.
   file::AppendOnlyFile* index_file_;
 
-  // True iff the last write to the index file has just a head and no tail.
-  bool last_file_line_is_open_;
+  // See SetValidateOnRecover().
+  bool validate_on_recover_;
+
+  // See SetRecoverThreads().
+  int recover_threads_;
 
   // Mutex protecting index file.
   // NewEntry and Purge can run concurrently and this mutex
   // make sure that only one of them writes to file at a time.
+  // If both are needed, file_mutex_ is locked before entries_mutex_.
   mutable absl::Mutex file_mutex_;
 
+  // No of records appended to index file since it was last rewritten.
+  size_t journal_records_;
+
+  // True while MaybeCompact() is writing a new index file. Records appended
+  // in the meantime are also kept in pending_records_, and are added to
+  // the new file before it replaces the old.
+  bool compacting_;
+  std::vector<std::string> pending_records_;
+
   // Mutex protecting index_entries_
   // (which is only member variable that can be accessed concurrently
   // if using class according to API)
   mutable absl::Mutex entries_mutex_;
 
-  // The index entries.
-  std::vector<Entry> index_entries_;
+  // The index entries, oldest first.
+  // start_position/last_position are monotonically growing over the entries,
+  // which is what allows FindEntry() to binary search them.
+  std::deque<EntryRef> index_entries_;
+
+  // Sequence number of index_entries_.front(), incremented when an
+  // entry is removed from the front of the index.
+  uint64_t first_entry_seqno_;
+
+  // Map from filename to sequence number of the entry,
+  // i.e index_entries_[seqno - first_entry_seqno_].
+  absl::flat_hash_map<std::string, uint64_t> filename_to_seqno_;
 
   BinlogIndex(BinlogIndex&&) = delete;
   BinlogIndex(const BinlogIndex&) = delete;
@@ -226,6 +314,83 @@ class BinlogIndex {
   // Get next filename.
   std::string GetNextFilename(absl::string_view filename) const;
 
+  // Helpers keeping index_entries_ and filename_to_seqno_ in sync.
+  // Shall be called with entries_mutex_ locked.
+  void AssignEntriesLocked(const std::vector<Entry>& entries);
+  void PushBackEntryLocked(const Entry& entry);
+  void PopFrontEntryLocked();
+  void PopBackEntryLocked();
+
+  // Get copy of all entries.
+  std::vector<Entry> CopyEntries() const;
+
+  // Result of replaying one line of the index file.
+  enum ReplayResult {
+    REPLAY_OK,
+    REPLAY_TORN,   // last record was not completely written.
+    REPLAY_ERROR,  // corrupt or inconsistent record.
+  };
+
+  // State of replaying the lines of the index file on entries.
+  struct ReplayState {
+    explicit ReplayState(std::vector<Entry>* entries);
+
+    // Drop the entries removed by purge records from entries, after the
+    // last line has been replayed.
+    void Finish();
+
+    std::vector<Entry>* entries;
+
+    // Purge records only mark entries removed, so that replaying them
+    // doesn't shift the entries after them.
+    std::vector<bool> removed;
+
+    // Map from filename to position of entry that is not removed.
+    absl::flat_hash_map<std::string, size_t> slots;
+
+    // Set when a checksummed record has been replayed. Legacy lines
+    // (without checksum) are only valid before the first one.
+    bool checksummed;
+  };
+
+  // Replay one line of the index file (including newline if present).
+  static ReplayResult ReplayRecord(absl::string_view line,
+                                   ReplayState* state);
+
+  // Append a record to index file and make it durable.
+  // Shall be called with file_mutex_ locked.
+  bool AppendRecordLocked(RecordType type, const Entry& entry);
+
+  // Write header and entries to a new file named filename.
+  // Returns the file, still open, or nullptr on failure.
+  // The number of bytes written and their checksum are stored
+  // in *bytes and *crc.
+  file::AppendOnlyFile* WriteIndexFile(const std::string& filename,
+                                       const std::vector<Entry>& entries,
+                                       size_t* bytes, uint32_t* crc);
+
+  // The snapshot is a binary version of the first bytes of the index file,
+  // as written by WriteIndexFile(). It contains a fixed size record per
+  // entry, and an arena with the (deduplicated) strings of the entries.
+  // It lets Recover() skip parsing the text format of those entries.
+  //
+  // Write a snapshot of entries to a file named filename.
+  bool WriteSnapshot(const std::string& filename,
+                     const std::vector<Entry>& entries,
+                     size_t bytes, uint32_t crc);
+
+  // Read snapshot and check that it matches the beginning of the content of
+  // the index file. On success, store entries and no of bytes of the index
+  // file that it covers.
+  bool ReadSnapshot(absl::string_view content, std::vector<Entry>* entries,
+                    size_t* bytes);
+
+  // Sync and close file, rename it to the index filename
+  // and reopen it as index_file_.
+  // Shall be called with file_mutex_ locked.
+  bool ReplaceIndexFileLocked(file::AppendOnlyFile* file,
+                              const std::string& filename);
+
   // This function writes content of entries to the binlog index.
   // First it writes it to a temporary file, and then it renames that file
   // to overwrite the old.
@@ -17,8 +17,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+
 #include "gtest/gtest.h"
 #include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
 #include "binlog_reader.h"
 #include "file.h"
 #include "gtid.h"
@@ -50,8 +53,9 @@ struct Validator : public BinlogRecoveryHandlerInterface {
 
   size_t GetFileSize(absl::string_view filename) override { return 0; }
 
-  int num_validate;
-  int num_remove;
+  // Validate() is called concurrently.
+  std::atomic<int> num_validate;
+  std::atomic<int> num_remove;
   file_util::OpenResultCode validate_result;
 };
 
@@ -69,6 +73,7 @@ const char* GetTestDir() {
 
 bool cleanup(const BinlogIndex& index) {
   unlink(index.GetIndexFilename().c_str());
+  unlink(index.GetSnapshotFilename().c_str());
   return true;
 }
 
@@ -419,6 +424,194 @@ bool Create(BinlogIndex *index,
   return true;
 }
 
+std::vector<std::string> ReadLines(const std::string& filename) {
+  std::vector<std::string> lines;
+  FILE* f = fopen(filename.c_str(), "r");
+  if (f == nullptr) return lines;
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), f) != nullptr) {
+    lines.push_back(buf);
+  }
+  fclose(f);
+  return lines;
+}
+
+void WriteLines(const std::string& filename,
+                const std::vector<std::string>& lines) {
+  FILE* f = fopen(filename.c_str(), "w");
+  for (const std::string& line : lines) {
+    fputs(line.c_str(), f);
+  }
+  fclose(f);
+}
+
+TEST(Binlog_index, Journal) {
+  monitoring::Initialize();
+  auto& ff = file::FILE_Factory();
+  BinlogIndex index(GetTestDir(), ff);
+  EXPECT_TRUE(Create(&index, {{"", "1-1-1"},
+                              {"1-1-1", "1-1-2"},
+                              {"1-1-2", nullptr}}));
+  BinlogIndex::Entry first = GetEntries(index)[0];
+  EXPECT_TRUE(index.MarkFirstEntryPurged(first));
+  EXPECT_TRUE(index.PurgeFirstEntry(first));
+  EXPECT_TRUE(index.Close());
+
+  // header + 3 new + 2 close + mark_purged + purge
+  std::vector<std::string> lines = ReadLines(index.GetIndexFilename());
+  ASSERT_EQ(lines.size(), 8);
+  EXPECT_EQ(lines[1].compare(0, 4, "new "), 0);
+  EXPECT_EQ(lines[2].compare(0, 6, "close "), 0);
+  EXPECT_EQ(lines[6].compare(0, 12, "mark_purged "), 0);
+  EXPECT_EQ(lines[7].compare(0, 6, "purge "), 0);
+
+  Validator validator(file_util::OK);
+  EXPECT_EQ(index.Recover(&validator), 1);
+  EXPECT_EQ(validator.num_remove, 0);
+  std::vector<BinlogIndex::Entry> entries = GetEntries(index);
+  ASSERT_EQ(entries.size(), 2);
+  EXPECT_TRUE(entries[0].is_closed);
+  EXPECT_EQ(entries[0].last_position.ToString(), "1-1-2");
+  EXPECT_FALSE(entries[1].is_closed);
+
+  // Appending continues after recovery.
+  GTIDList last_pos;
+  EXPECT_TRUE(last_pos.Parse("1-1-3"));
+  EXPECT_TRUE(index.CloseEntry(last_pos, FilePosition("master.bin", 0), 0));
+  EXPECT_TRUE(index.Close());
+  lines = ReadLines(index.GetIndexFilename());
+  ASSERT_EQ(lines.size(), 9);
+
+  // A partially written last record is discarded.
+  std::string torn = lines.back();
+  lines.back() = torn.substr(0, torn.size() / 2);
+  WriteLines(index.GetIndexFilename(), lines);
+  EXPECT_EQ(index.Recover(&validator), 1);
+  entries = GetEntries(index);
+  ASSERT_EQ(entries.size(), 2);
+  EXPECT_FALSE(entries[1].is_closed);
+  EXPECT_TRUE(index.Close());
+
+  // The index was rewritten, compacted, during recovery.
+  lines = ReadLines(index.GetIndexFilename());
+  ASSERT_EQ(lines.size(), 3);
+  EXPECT_EQ(lines[1].compare(0, 9, "filename="), 0);
+  EXPECT_EQ(lines[2].compare(0, 4, "new "), 0);
+
+  // A complete record with bad checksum is an error.
+  lines[1].replace(lines[1].find("1-1-2"), 5, "1-1-9");
+  WriteLines(index.GetIndexFilename(), lines);
+  EXPECT_EQ(index.Recover(&validator), -1);
+
+  // A torn record that is not last is an error.
+  lines = {lines[0], torn.substr(0, torn.size() / 2), torn};
+  WriteLines(index.GetIndexFilename(), lines);
+  EXPECT_EQ(index.Recover(&validator), -1);
+
+  EXPECT_TRUE(index.Close());
+  EXPECT_TRUE(cleanup(index));
+}
+
+TEST(Binlog_index, JournalTail) {
+  monitoring::Initialize();
+  auto& ff = file::FILE_Factory();
+  BinlogIndex index(GetTestDir(), ff);
+  EXPECT_TRUE(Create(&index, {{"", "1-1-1"},
+                              {"1-1-1", "1-1-2"},
+                              {"1-1-2", nullptr}}));
+  BinlogIndex::Entry first = GetEntries(index)[0];
+  EXPECT_TRUE(index.MarkFirstEntryPurged(first));
+  EXPECT_TRUE(index.PurgeFirstEntry(first));
+  EXPECT_TRUE(index.Close());
+  const std::vector<std::string> lines = ReadLines(index.GetIndexFilename());
+  Validator validator(file_util::OK);
+
+  // A record torn inside its name is discarded.
+  std::vector<std::string> torn = lines;
+  torn.push_back("mark_pu");
+  WriteLines(index.GetIndexFilename(), torn);
+  EXPECT_EQ(index.Recover(&validator), 1);
+  EXPECT_EQ(GetEntries(index).size(), 2);
+  EXPECT_TRUE(index.Close());
+
+  // Legacy lines are not accepted after records.
+  std::vector<std::string> legacy = lines;
+  legacy.insert(legacy.end() - 1, "filename=x start_pos='1-1-2'"
+                " end_pos='1-1-3'\n");
+  WriteLines(index.GetIndexFilename(), legacy);
+  EXPECT_EQ(index.Recover(&validator), -1);
+
+  EXPECT_TRUE(index.Close());
+  EXPECT_TRUE(cleanup(index));
+}
+
+TEST(Binlog_index, Compact) {
+  monitoring::Initialize();
+  auto& ff = file::FILE_Factory();
+  BinlogIndex index(GetTestDir(), ff);
+  std::vector<std::pair<std::string, const char*>> list;
+  std::vector<std::string> gtids;
+  for (int i = 0; i < 600; i++) {
+    gtids.push_back(absl::StrCat("1-1-", i + 1));
+  }
+  list.push_back({"", gtids[0].c_str()});
+  for (int i = 1; i < 600; i++) {
+    list.push_back({gtids[i - 1], gtids[i].c_str()});
+  }
+  EXPECT_TRUE(Create(&index, list));
+  std::vector<BinlogIndex::Entry> before = GetEntries(index);
+  for (int i = 0; i < 100; i++) {
+    BinlogIndex::Entry first = GetEntries(index)[0];
+    EXPECT_TRUE(index.MarkFirstEntryPurged(first));
+    EXPECT_TRUE(index.PurgeFirstEntry(first));
+  }
+  EXPECT_EQ(ReadLines(index.GetIndexFilename()).size(), 1 + 1200 + 200);
+
+  EXPECT_TRUE(index.MaybeCompact());
+  EXPECT_EQ(ReadLines(index.GetIndexFilename()).size(), 1 + 500);
+
+  // Too few records to compact again.
+  GTIDList pos;
+  EXPECT_TRUE(pos.Parse("1-1-600"));
+  EXPECT_TRUE(index.NewEntry(pos, FilePosition("master-bin", 0)));
+  EXPECT_TRUE(index.MaybeCompact());
+  EXPECT_EQ(ReadLines(index.GetIndexFilename()).size(), 1 + 501);
+  EXPECT_TRUE(index.Close());
+
+  // Recover from snapshot, with deferred validation only the last file
+  // is validated.
+  Validator validator(file_util::OK);
+  index.SetRecoverThreads(4);
+  index.SetValidateOnRecover(false);
+  EXPECT_EQ(index.Recover(&validator), 1);
+  EXPECT_EQ(validator.num_validate, 1);
+  std::vector<BinlogIndex::Entry> after = GetEntries(index);
+  ASSERT_EQ(after.size(), 501);
+  for (int i = 0; i < 500; i++) {
+    EXPECT_EQ(after[i].ToString(), before[i + 100].ToString());
+    EXPECT_EQ(after[i].file_size, 0);
+  }
+  EXPECT_FALSE(after.back().is_closed);
+  EXPECT_TRUE(index.Close());
+
+  // A corrupt snapshot is ignored.
+  std::vector<std::string> lines = ReadLines(index.GetSnapshotFilename());
+  ASSERT_FALSE(lines.empty());
+  lines.back().back() ^= 1;
+  WriteLines(index.GetSnapshotFilename(), lines);
+  index.SetValidateOnRecover(true);
+  EXPECT_EQ(index.Recover(&validator), 1);
+  EXPECT_EQ(validator.num_validate, 1 + 501);
+  after = GetEntries(index);
+  ASSERT_EQ(after.size(), 501);
+  for (int i = 0; i < 500; i++) {
+    EXPECT_EQ(after[i].ToString(), before[i + 100].ToString());
+  }
+
+  EXPECT_TRUE(index.Close());
+  EXPECT_TRUE(cleanup(index));
+}
+
 TEST(Binlog_index, GetNext) {
   monitoring::Initialize();
   auto& ff = file::FILE_Factory();
@@ -506,4 +699,66 @@ TEST(Binlog_index, GetNext) {
   }
 }
 
+TEST(Binlog_index, Lookup) {
+  monitoring::Initialize();
+  auto& ff = file::FILE_Factory();
+  // Entry N contains GTIDs 0-1-(N*10+1) .. 0-1-(N*10+10).
+  const int kEntries = 100;
+  std::vector<std::pair<std::string, const char*>> entries;
+  std::vector<std::string> positions;
+  for (int n = 0; n <= kEntries; n++) {
+    positions.push_back("0-1-" + std::to_string(n * 10));
+  }
+  for (int n = 0; n < kEntries; n++) {
+    entries.push_back({ positions[n], positions[n + 1].c_str() });
+  }
+  BinlogIndex index(GetTestDir(), ff);
+  EXPECT_TRUE(Create(&index, entries));
+
+  for (int seq_no = 0; seq_no < kEntries * 10; seq_no++) {
+    GTIDList pos;
+    EXPECT_TRUE(pos.Parse("0-1-" + std::to_string(seq_no)));
+    BinlogIndex::EntryRef entry = index.FindEntry(pos);
+    ASSERT_NE(entry, nullptr);
+    // last GTID of a file is start position for next file,
+    // but the file that contains it is returned.
+    int n = seq_no == 0 ? 0 : (seq_no - 1) / 10;
+    EXPECT_EQ(entry->filename,
+              absl::StrCat(index.GetBasename(), ".", absl::Dec(n, absl::kZeroPad6)));
+
+    BinlogIndex::EntryRef next = index.FindNextEntry(entry->filename);
+    if (n + 1 < kEntries) {
+      ASSERT_NE(next, nullptr);
+      EXPECT_EQ(next->start_position.ToString(), positions[n + 1]);
+    } else {
+      EXPECT_EQ(next, nullptr);
+    }
+  }
+
+  // Position after last entry is not found.
+  GTIDList pos;
+  std::string message;
+  EXPECT_TRUE(pos.Parse("0-1-" + std::to_string(kEntries * 10 + 1)));
+  EXPECT_EQ(index.FindEntry(pos, &message), nullptr);
+  EXPECT_FALSE(message.empty());
+
+  // Purge first entry, positions in it are no longer found.
+  BinlogIndex::Entry oldest = index.GetOldestEntry();
+  EXPECT_TRUE(index.MarkFirstEntryPurged(oldest));
+  EXPECT_TRUE(index.PurgeFirstEntry(oldest));
+  EXPECT_EQ(index.FindNextEntry(oldest.filename), nullptr);
+  message.clear();
+  pos.Reset();
+  EXPECT_TRUE(pos.Parse("0-1-5"));
+  EXPECT_EQ(index.FindEntry(pos, &message), nullptr);
+  EXPECT_NE(message.find("min found 0-1-10"), std::string::npos) << message;
+  pos.Reset();
+  EXPECT_TRUE(pos.Parse("0-1-15"));
+  ASSERT_NE(index.FindEntry(pos), nullptr);
+  EXPECT_EQ(index.FindEntry(pos)->filename, index.GetBasename() + ".000001");
+  EXPECT_EQ(GetEntries(index).size(), kEntries - 1);
+
+  EXPECT_TRUE(cleanup(index));
+}
+
 }  // namespace mysql_ripple
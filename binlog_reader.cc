@@ -14,22 +14,42 @@
 
 #include "binlog_reader.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "flags.h"
 #include "logging.h"
 #include "monitoring.h"
 #include "mysql_constants.h"
 
 namespace mysql_ripple {
 
+const size_t BinlogReader::kMinEventPartSize;
+
+// Memory of the event parts held by all readers of large events.
+static MemoryBudget *GetLargeEventBudget() {
+  static MemoryBudget *budget =
+      new MemoryBudget(FLAGS_ripple_large_event_memory);
+  return budget;
+}
+
 BinlogReader::BinlogReader(const file::Factory &ff,
                            BinlogReader::BinlogInterface *binlog,
                            BinlogEndPositionProviderInterface *binlog_endpos)
     : binlog_(binlog),
       binlog_endpos_(binlog_endpos != nullptr ? binlog_endpos : binlog),
-      encryptor_(BinlogEncryptorFactory::GetInstance(0)),
       ff_(ff),
       binlog_file_(nullptr),
       truncate_counter_(0),
-      seek_completed_(false) {}
+      end_position_time_(monitoring::MonotonicMicros()),
+      max_event_part_(SIZE_MAX),
+      remaining_(0),
+      budget_acquired_(0),
+      seek_completed_(false) {
+  SetEncryptor(BinlogEncryptorFactory::GetInstance(0));
+}
 
 BinlogReader::~BinlogReader() { CloseFile(); }
 
@@ -45,6 +65,9 @@ bool BinlogReader::Open(GTIDList *pos, std::string *message) {
     // will cause ReadEvent() to "refresh", i.e call WaitBinlogEndPosition.
     end_of_file_ = position_.latest_event_end_position.offset;
 
+    // Prevent purge of the file we're about to read.
+    binlog_->PinFile(this, position_.latest_event_end_position.filename);
+
     // Seek to exact position.
     if (Seek(pos, message))
       return true;
@@ -79,6 +102,16 @@ bool BinlogReader::Close() {
 
 file_util::ReadResultCode BinlogReader::ReadEvent(RawLogEventData *event,
                                                   absl::Duration timeout) {
+  while (remaining_ > 0) {
+    // Skip the parts of the previous event that were not read.
+    absl::string_view part;
+    auto result = ReadEventPart(&part);
+    if (result != file_util::READ_OK)
+      return result;
+  }
+  // Free the memory held after a large event.
+  buffer_.Reset(FLAGS_ripple_large_event_size);
+
   if (position_.latest_event_end_position.offset == end_of_file_) {
     // We have read all the way up to latest end of current binlog.
     // Wait for that to change.
@@ -89,6 +122,7 @@ file_util::ReadResultCode BinlogReader::ReadEvent(RawLogEventData *event,
       event->header.event_length = 0;
       return file_util::READ_OK;
     }
+    end_position_time_ = monitoring::MonotonicMicros();
 
     if (truncate_counter != truncate_counter_) {
       // Binlog has been truncated, we need to reopen file
@@ -119,7 +153,8 @@ file_util::ReadResultCode BinlogReader::ReadEvent(RawLogEventData *event,
     }
   }
 
-  switch (Read(&buffer_)) {
+  int64_t offset;
+  switch (Read(&buffer_, &remaining_, &offset)) {
     case file_util::READ_OK:
       break;
     case file_util::READ_ERROR:
@@ -135,7 +170,36 @@ file_util::ReadResultCode BinlogReader::ReadEvent(RawLogEventData *event,
       return file_util::READ_EOF;
   }
 
-  if (!event->ParseFromBuffer(buffer_.data(), buffer_.size())) {
+  if (remaining_ > 0) {
+    // Only the header of a large event has been read, wait for memory
+    // before holding its parts.
+    absl::Duration wait =
+        absl::Seconds(FLAGS_ripple_large_event_memory_timeout);
+    if (!GetLargeEventBudget()->Acquire(max_event_part_, wait, stop_)) {
+      LOG(ERROR) << "Gave up waiting for memory to read large event"
+                 << ", " << position_.latest_event_end_position.ToString()
+                 << ", used: " << GetLargeEventBudget()->GetUsed();
+      monitoring::rippled_binlog_error->Increment(
+          monitoring::ERROR_READ_EVENT);
+      return file_util::READ_ERROR;
+    }
+    budget_acquired_ = max_event_part_;
+
+    // Read the first part after the header.
+    uint8_t header[constants::LOG_EVENT_HEADER_LENGTH];
+    size_t header_size = std::min(buffer_.size(), sizeof(header));
+    memcpy(header, buffer_.data(), header_size);
+    absl::string_view part;
+    auto result = ReadEventPart(&part, max_event_part_ - header_size);
+    if (result != file_util::READ_OK)
+      return result;
+    buffer_.insert(buffer_.begin(), header, header + header_size);
+  }
+
+  bool parsed = remaining_ > 0 ?
+      event->ParsePartFromBuffer(buffer_.data(), buffer_.size()) :
+      event->ParseFromBuffer(buffer_.data(), buffer_.size());
+  if (!parsed) {
     LOG(ERROR) << "Failure while parsing log event"
                << ", " << position_.latest_event_end_position.ToString();
     monitoring::rippled_binlog_error->Increment(
@@ -152,11 +216,10 @@ file_util::ReadResultCode BinlogReader::ReadEvent(RawLogEventData *event,
         monitoring::ERROR_INIT_ENCRYPTOR);
       return file_util::READ_ERROR;
     }
-    encryptor_.reset(encryptor);
+    SetEncryptor(encryptor);
+    encryptor_->Tell(binlog_file_, &offset);
   }
 
-  int64_t offset;
-  binlog_file_->Tell(&offset);
   absl::MutexLock lock(&mutex_);
   if (position_.Update(*event, offset) == -1) {
     LOG(ERROR) << "Failed to update binlog position"
@@ -170,6 +233,44 @@ file_util::ReadResultCode BinlogReader::ReadEvent(RawLogEventData *event,
   return file_util::READ_OK;
 }
 
+void BinlogReader::SetMaxEventPartSize(size_t size,
+                                       std::function<bool()> stop) {
+  max_event_part_ = std::max(size, kMinEventPartSize);
+  stop_ = std::move(stop);
+}
+
+file_util::ReadResultCode BinlogReader::ReadEventPart(absl::string_view *part) {
+  return ReadEventPart(part, max_event_part_);
+}
+
+file_util::ReadResultCode BinlogReader::ReadEventPart(absl::string_view *part,
+                                                      size_t max_size) {
+  size_t size = std::min(remaining_, max_size);
+  if (encryptor_->ReadMore(binlog_file_, size, &buffer_) !=
+      file_util::READ_OK) {
+    LOG(ERROR) << "Failure while reading log event part"
+               << ", " << position_.latest_event_end_position.ToString()
+               << ", remaining: " << remaining_;
+    monitoring::rippled_binlog_error->Increment(
+        monitoring::ERROR_READ_EVENT);
+    EndEventParts();
+    return file_util::READ_ERROR;
+  }
+  remaining_ -= size;
+  if (remaining_ == 0)
+    EndEventParts();
+  *part = buffer_;
+  return file_util::READ_OK;
+}
+
+void BinlogReader::EndEventParts() {
+  remaining_ = 0;
+  if (budget_acquired_ > 0) {
+    GetLargeEventBudget()->Release(budget_acquired_);
+    budget_acquired_ = 0;
+  }
+}
+
 bool BinlogReader::Seek(GTIDList *pos, std::string *msg) {
   if (pos->IsEmpty()) {
     absl::MutexLock lock(&mutex_);
@@ -259,11 +360,12 @@ bool BinlogReader::OpenFile() {
 }
 
 void BinlogReader::CloseFile() {
+  EndEventParts();
   if (binlog_file_ != nullptr) {
     binlog_file_->Close();
     binlog_file_ = nullptr;
     // assume file is unencrypted until StartEncryptionEvent is read
-    encryptor_.reset(BinlogEncryptorFactory::GetInstance(0));
+    SetEncryptor(BinlogEncryptorFactory::GetInstance(0));
   }
 }
 
@@ -289,6 +391,7 @@ bool BinlogReader::SwitchFile() {
   CHECK(pos.offset == end_of_file_);  // Only switchfile if we're at the end
   DLOG(INFO) << "switchfile from: " << pos.ToString();
   if (binlog_->GetNextFile(&pos)) {
+    binlog_->PinFile(this, pos.filename);
     CloseFile();
     SetCurrentFile(pos.filename);
     return true;
@@ -308,14 +411,22 @@ void BinlogReader::SetCurrentFile(absl::string_view filename) {
   end_of_file_ = 0;
 }
 
-file_util::ReadResultCode BinlogReader::Read(Buffer *dst) {
+void BinlogReader::SetEncryptor(BinlogEncryptor *encryptor) {
+  encryptor_.reset(encryptor);
+  read_event_ = encryptor->GetEventReader();
+}
+
+file_util::ReadResultCode BinlogReader::Read(Buffer *dst, size_t *remaining,
+                                             int64_t *offset) {
   if (!OpenFile()) {
     LOG(ERROR) << "Open failed when reading binlog";
     monitoring::rippled_binlog_error->Increment(monitoring::ERROR_OPEN_FILE);
     return file_util::READ_ERROR;
   }
 
-  auto read_result = encryptor_->Read(binlog_file_, end_of_file_, dst);
+  auto read_result = read_event_(encryptor_.get(), binlog_file_,
+                                 end_of_file_, max_event_part_, dst,
+                                 remaining, offset);
   if (read_result == file_util::READ_ERROR) {
     LOG(ERROR) << "Error while reading binlog";
     monitoring::rippled_binlog_error->Increment(monitoring::ERROR_READ_FILE);
@@ -333,18 +444,6 @@ file_util::OpenResultCode BinlogReader::Validate(absl::string_view filename) {
   return res;
 }
 
-// Check if it's safe to purge a file.
-bool BinlogReader::IsSafeToPurge(absl::string_view filename) const {
-  absl::MutexLock lock(&mutex_);
-  auto last_filename = position_.latest_event_end_position.filename;
-  if (last_filename.empty()) {
-    // We have called RegisterReader, but not yet GetPosition()
-    // block any purge.
-    return false;
-  }
-  return last_filename != filename;
-}
-
 file_util::OpenResultCode BinlogReader::OpenAndValidate(
     file::InputFile **file, absl::string_view filename) {
   std::string fn(filename);
@@ -18,6 +18,7 @@
 #define MYSQL_RIPPLE_BINLOG_READER_H
 
 #include <cstdio>
+#include <functional>
 #include <vector>
 
 #include "absl/strings/string_view.h"
@@ -43,6 +44,7 @@ class BinlogReader {
     virtual bool GetNextFile(FilePosition *pos) const = 0;
     virtual void RegisterReader(BinlogReader *reader) = 0;
     virtual void UnregisterReader(BinlogReader *reader) = 0;
+    virtual void PinFile(BinlogReader *reader, absl::string_view filename) = 0;
     virtual std::string GetPath(absl::string_view filename) const = 0;
     virtual bool GetBinlogSize(absl::string_view filename,
                                off_t *size) const = 0;
@@ -69,9 +71,33 @@ class BinlogReader {
   //         - READ_EOF if getting eof in middle of event
   //         - READ_OK and event with length == 0 on timeout
   //           (this can only happen at end of binlog)
+  // An event larger than the max part size is read in parts, *event then
+  // holds the first part (see GetRemainingEventBytes()). The position is
+  // updated to the end of the event right away.
   virtual file_util::ReadResultCode ReadEvent(RawLogEventData *event,
                                               absl::Duration timeout);
 
+  // Read events larger than size bytes in parts of size bytes, so that
+  // the memory used per event is bounded. By default events are read
+  // whole. size is raised to kMinEventPartSize.
+  // The parts held by all readers are bounded by
+  // --ripple_large_event_memory, ReadEvent() of a large event waits for
+  // memory and fails after --ripple_large_event_memory_timeout or once
+  // stop returns true.
+  void SetMaxEventPartSize(size_t size, std::function<bool()> stop);
+
+  // Parts are large enough to hold the fixed part of any event, e.g the
+  // status variables of a query.
+  static const size_t kMinEventPartSize = 64 * 1024;
+
+  // Bytes of the event last returned by ReadEvent() that are yet to be read
+  // by ReadEventPart(). Parts not read are skipped by the next ReadEvent().
+  size_t GetRemainingEventBytes() const { return remaining_; }
+
+  // Read the next part of the event returned by ReadEvent() into *part,
+  // which is valid until the next read.
+  file_util::ReadResultCode ReadEventPart(absl::string_view *part);
+
   // Get current binlog position of this reader.
   // This method is thread-safe and should/can be used for monitoring.
   // If Reader has not completed seeking, an empty position will be returned.
@@ -97,25 +123,32 @@ class BinlogReader {
   // as that when ripple was shutdown.
   BinlogEncryptor *CopyEncryptor() const { return encryptor_->Copy(); }
 
-  // Check if it's safe to purge a file.
-  bool IsSafeToPurge(absl::string_view filename) const;
-
   // If ReadEvent returns READ_EOF, one can use this method to see
   // how big current file is. This is used to truncate away half written
   // events at end of binlog.
   off_t GetEndOfFile() const { return end_of_file_; }
 
+  // MonotonicMicros() when the reader last saw the binlog end position
+  // move, i.e when the latest events it can read were published.
+  int64_t GetEndPositionTime() const { return end_position_time_; }
+
  private:
   mutable absl::Mutex mutex_;
   BinlogInterface *binlog_;
   BinlogEndPositionProviderInterface *binlog_endpos_;
   std::unique_ptr<BinlogEncryptor> encryptor_;
+  BinlogEncryptor::EventReader read_event_;  // bound to encryptor_
   const file::Factory &ff_;
   file::InputFile *binlog_file_;
   off_t end_of_file_;  // size of current binlog file
   int64_t truncate_counter_;  // has binlog been truncated.
+  int64_t end_position_time_;
   BinlogPosition position_;
   Buffer buffer_;
+  size_t max_event_part_;
+  size_t remaining_;        // bytes of the current event not read
+  size_t budget_acquired_;  // of the large event memory budget
+  std::function<bool()> stop_;  // polled while waiting for the budget
 
   bool seek_completed_;
 
@@ -124,7 +157,16 @@ class BinlogReader {
   bool OpenFile();
   void CloseFile();
   bool SwitchFile();
-  file_util::ReadResultCode Read(Buffer *dst);
+  // Read next event, or its first part, into dst, the bytes left of it
+  // into *remaining and the offset after it into *offset.
+  file_util::ReadResultCode Read(Buffer *dst, size_t *remaining,
+                                 int64_t *offset);
+  void SetEncryptor(BinlogEncryptor *encryptor);
+  // ReadEventPart() of at most max_size bytes.
+  file_util::ReadResultCode ReadEventPart(absl::string_view *part,
+                                          size_t max_size);
+  // Stop reading the current event in parts.
+  void EndEventParts();
   void SetCurrentFile(absl::string_view filename);
   void ReopenBinlogFile();
 
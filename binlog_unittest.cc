@@ -0,0 +1,254 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "binlog.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+#include "binlog_reader.h"
+#include "buffer.h"
+#include "file.h"
+#include "flags.h"
+#include "gtid.h"
+#include "log_event.h"
+#include "monitoring.h"
+#include "purge_thread.h"
+
+namespace mysql_ripple {
+
+namespace {
+
+struct TestEvent {
+  Buffer buffer;
+  RawLogEventData raw;
+
+  TestEvent(const EventBase &event, uint32_t nextpos) {
+    LogEventHeader header;
+    header.timestamp = 0;
+    header.type = event.GetEventType();
+    header.server_id = 1;
+    header.event_length = header.PackLength() + event.PackLength();
+    header.nextpos = nextpos;
+    header.flags = 0;
+    uint8_t *ptr = buffer.Append(header.event_length);
+    header.SerializeToBuffer(ptr, header.PackLength());
+    event.SerializeToBuffer(ptr + header.PackLength(), event.PackLength());
+    EXPECT_TRUE(raw.ParseFromBuffer(buffer.data(), buffer.size()));
+  }
+};
+
+class BinlogTest : public ::testing::Test {
+ protected:
+  BinlogTest() : seq_no_(0) {}
+
+  void SetUp() override {
+    monitoring::Initialize();
+    FLAGS_ripple_encryption_scheme = 0;
+    // Move purged files to trash.
+    FLAGS_ripple_purge_trash_rate = 1;
+    binlog_.reset(new Binlog("binlog", int64_t{1} << 30, factory_));
+    ASSERT_TRUE(binlog_->Create());
+    FormatDescriptorEvent format;
+    format.SetToRipple("10.3.0-MariaDB");
+    format.checksum = 0;
+    ASSERT_TRUE(binlog_->AddEvent(TestEvent(format, 0).raw, true));
+    RotateEvent rotate;
+    rotate.offset = 4;
+    rotate.filename = "master-bin.1";
+    ASSERT_TRUE(binlog_->AddEvent(TestEvent(rotate, 0).raw, true));
+  }
+
+  void TearDown() override {
+    binlog_.reset();
+    FLAGS_ripple_purge_trash_rate = 0;
+  }
+
+  // Add a transaction to the current file.
+  void AddTransaction() {
+    seq_no_++;
+    GTIDEvent gtid;
+    gtid.gtid.set_server_id(1);
+    gtid.gtid.seq_no = seq_no_;
+    gtid.flags = 0;
+    gtid.is_standalone = false;
+    gtid.has_group_commit_id = false;
+    QueryEvent query;
+    query.query = "INSERT";
+    XIDEvent xid;
+    xid.xid = seq_no_;
+    uint32_t nextpos = seq_no_ * 1000;
+    EXPECT_TRUE(binlog_->AddEvent(TestEvent(gtid, nextpos - 2).raw, false));
+    EXPECT_TRUE(binlog_->AddEvent(TestEvent(query, nextpos - 1).raw, false));
+    EXPECT_TRUE(binlog_->AddEvent(TestEvent(xid, nextpos).raw, true));
+  }
+
+  std::string GetCurrentFile() {
+    return binlog_->GetBinlogPosition().latest_event_end_position.filename;
+  }
+
+  // Add a transaction and switch to a new file.
+  // Returns the name of the file that was closed.
+  std::string WriteFile() {
+    std::string filename = GetCurrentFile();
+    AddTransaction();
+    std::string newfile;
+    EXPECT_TRUE(binlog_->SwitchFile(&newfile));
+    return filename;
+  }
+
+  int64_t GetSize(const std::string& path) {
+    int64_t size;
+    return factory_.Size(path, &size) ? size : -1;
+  }
+
+  // Purge as much as readers allow, returning the oldest file kept.
+  std::string Purge() {
+    std::string oldest_file;
+    EXPECT_TRUE(binlog_->PurgeLogsUntil(GetCurrentFile(), &oldest_file));
+    return oldest_file;
+  }
+
+  std::vector<std::string> ListTrash() {
+    std::vector<std::string> names;
+    factory_.List("binlog/trash", &names);
+    return names;
+  }
+
+  file::MemoryFactory factory_;
+  std::unique_ptr<Binlog> binlog_;
+  uint64_t seq_no_;
+};
+
+}  // namespace
+
+TEST_F(BinlogTest, ReadersPinFiles) {
+  std::string first = WriteFile();
+  std::string second = WriteFile();
+  std::string third = WriteFile();
+
+  // A registered reader that has not found its position yet blocks all
+  // purging.
+  BinlogReader unpositioned(factory_, binlog_.get());
+  binlog_->RegisterReader(&unpositioned);
+  EXPECT_EQ(Purge(), first);
+  binlog_->UnregisterReader(&unpositioned);
+
+  // Two readers of the same file.
+  BinlogReader reader1(factory_, binlog_.get());
+  BinlogReader reader2(factory_, binlog_.get());
+  GTIDList start;
+  std::string message;
+  ASSERT_TRUE(reader1.Open(&start, &message)) << message;
+  ASSERT_TRUE(reader2.Open(&start, &message)) << message;
+  EXPECT_EQ(Purge(), first);
+  EXPECT_TRUE(reader1.Close());
+  EXPECT_EQ(Purge(), first);
+
+  // The reader pins the next file when it switches to it.
+  RawLogEventData event;
+  do {
+    ASSERT_EQ(reader2.ReadEvent(&event, absl::ZeroDuration()),
+              file_util::READ_OK);
+    ASSERT_GT(event.header.event_length, 0);
+  } while (reader2.GetBinlogPositionUnsafe()
+               .latest_event_end_position.filename != second);
+  EXPECT_EQ(Purge(), second);
+
+  EXPECT_TRUE(reader2.Close());
+  EXPECT_EQ(Purge(), GetCurrentFile());
+  EXPECT_EQ(ListTrash(), std::vector<std::string>({first, second, third}));
+}
+
+TEST_F(BinlogTest, PurgeMovesFilesToTrash) {
+  std::string first = WriteFile();
+  std::string second = WriteFile();
+  int64_t size = GetSize("binlog/" + first);
+  ASSERT_GT(size, 0);
+
+  std::string oldest_file;
+  ASSERT_TRUE(binlog_->PurgeLogsUntil(second, &oldest_file));
+  EXPECT_EQ(oldest_file, second);
+  EXPECT_EQ(GetSize("binlog/" + first), -1);
+  EXPECT_EQ(ListTrash(), std::vector<std::string>({first}));
+  EXPECT_EQ(GetSize("binlog/trash/" + first), size);
+}
+
+TEST_F(BinlogTest, ShrinkTrash) {
+  std::string first = WriteFile();
+  std::string oldest_file;
+  ASSERT_TRUE(binlog_->PurgeLogsUntil(GetCurrentFile(), &oldest_file));
+  std::string path = "binlog/trash/" + first;
+  int64_t size = GetSize(path);
+  ASSERT_GT(size, 10);
+
+  // The file is truncated a bit at a time and unlinked when empty.
+  size_t freed;
+  while (size > 10) {
+    EXPECT_TRUE(binlog_->ShrinkTrash(10, &freed));
+    EXPECT_EQ(freed, 10);
+    size -= 10;
+    EXPECT_EQ(GetSize(path), size);
+  }
+  EXPECT_FALSE(binlog_->ShrinkTrash(10, &freed));
+  EXPECT_EQ(freed, size);
+  EXPECT_EQ(GetSize(path), -1);
+  EXPECT_TRUE(ListTrash().empty());
+
+  EXPECT_FALSE(binlog_->ShrinkTrash(10, &freed));
+  EXPECT_EQ(freed, 0);
+}
+
+TEST_F(BinlogTest, TrashIsFoundAfterRestart) {
+  std::string first = WriteFile();
+  std::string second = WriteFile();
+  std::string oldest_file;
+  ASSERT_TRUE(binlog_->PurgeLogsUntil(GetCurrentFile(), &oldest_file));
+  int64_t size = GetSize("binlog/trash/" + first) +
+      GetSize("binlog/trash/" + second);
+  size_t freed;
+  EXPECT_TRUE(binlog_->ShrinkTrash(10, &freed));
+  size -= 10;
+  // Recover() removes a last file without transactions.
+  AddTransaction();
+
+  // Files left in trash are freed by the next run.
+  binlog_.reset(new Binlog("binlog", int64_t{1} << 30, factory_));
+  ASSERT_EQ(binlog_->Recover(), 1);
+  EXPECT_FALSE(binlog_->ShrinkTrash(size, &freed));
+  EXPECT_EQ(freed, size);
+  EXPECT_TRUE(ListTrash().empty());
+}
+
+TEST_F(BinlogTest, TrashThread) {
+  std::string first = WriteFile();
+  std::string oldest_file;
+  ASSERT_TRUE(binlog_->PurgeLogsUntil(GetCurrentFile(), &oldest_file));
+  ASSERT_EQ(ListTrash().size(), 1);
+
+  FLAGS_ripple_purge_trash_rate = 1024 * 1024;
+  TrashThread thread(binlog_.get());
+  ASSERT_TRUE(thread.Start());
+  absl::Time deadline = absl::Now() + absl::Seconds(30);
+  while (!ListTrash().empty() && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  EXPECT_TRUE(ListTrash().empty());
+  EXPECT_TRUE(thread.Join());
+}
+
+}  // namespace mysql_ripple
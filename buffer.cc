@@ -0,0 +1,143 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffer.h"
+
+#include "absl/time/clock.h"
+
+namespace mysql_ripple {
+
+const size_t BufferPool::kMinBlockSize;
+const size_t BufferPool::kMaxBlockSize;
+const int BufferPool::kMaxBlocksPerClass;
+const size_t BufferPool::kMaxCachedBytes;
+constexpr absl::Duration MemoryBudget::kStopPollInterval;
+
+namespace {
+
+// Size classes kMinBlockSize, 2 * kMinBlockSize, ... kMaxBlockSize.
+const int kClasses = 11;
+static_assert(BufferPool::kMinBlockSize << (kClasses - 1) ==
+              BufferPool::kMaxBlockSize, "kClasses");
+
+struct Cache {
+  void *blocks[kClasses][BufferPool::kMaxBlocksPerClass];
+  int count[kClasses];
+  size_t bytes;
+};
+
+// The cache of a thread is reached through a trivially destructible
+// pointer, so that Buffers freed during thread exit after the cache has
+// been destroyed (e.g by other thread_local destructors) go to the heap.
+thread_local Cache *thread_cache = nullptr;
+thread_local bool cache_destroyed = false;
+
+class CacheOwner {
+ public:
+  CacheOwner() : cache_() { thread_cache = &cache_; }
+
+  ~CacheOwner() {
+    for (int c = 0; c < kClasses; c++) {
+      for (int i = 0; i < cache_.count[c]; i++)
+        ::operator delete(cache_.blocks[c][i]);
+    }
+    thread_cache = nullptr;
+    cache_destroyed = true;
+  }
+
+ private:
+  Cache cache_;
+};
+
+Cache *GetCache() {
+  if (thread_cache == nullptr && !cache_destroyed) {
+    thread_local CacheOwner owner;
+  }
+  return thread_cache;
+}
+
+// Return size class of size, or -1 if it is not cached.
+int GetClass(size_t size) {
+  if (size > BufferPool::kMaxBlockSize)
+    return -1;
+  int c = 0;
+  while ((BufferPool::kMinBlockSize << c) < size)
+    c++;
+  return c;
+}
+
+}  // namespace
+
+void *BufferPool::Allocate(size_t size) {
+  int c = GetClass(size);
+  if (c < 0)
+    return ::operator new(size);
+  Cache *cache = GetCache();
+  if (cache != nullptr && cache->count[c] > 0) {
+    cache->bytes -= kMinBlockSize << c;
+    return cache->blocks[c][--cache->count[c]];
+  }
+  return ::operator new(kMinBlockSize << c);
+}
+
+void BufferPool::Free(void *ptr, size_t size) {
+  int c = GetClass(size);
+  if (c >= 0) {
+    Cache *cache = GetCache();
+    size_t block_size = kMinBlockSize << c;
+    if (cache != nullptr && cache->count[c] < kMaxBlocksPerClass &&
+        cache->bytes + block_size <= kMaxCachedBytes) {
+      cache->blocks[c][cache->count[c]++] = ptr;
+      cache->bytes += block_size;
+      return;
+    }
+  }
+  ::operator delete(ptr);
+}
+
+size_t BufferPool::GetCachedBytes() {
+  Cache *cache = GetCache();
+  return cache != nullptr ? cache->bytes : 0;
+}
+
+bool MemoryBudget::Acquire(size_t size, absl::Duration timeout,
+                           const std::function<bool()> &stop) {
+  absl::Time deadline = absl::Now() + timeout;
+  absl::MutexLock lock(&mutex_);
+  auto check = [this, size]() {
+    return used_ == 0 || used_ + size <= limit_;
+  };
+  while (!check()) {
+    absl::Duration wait = deadline - absl::Now();
+    if (wait <= absl::ZeroDuration() || (stop && stop()))
+      return false;
+    if (stop)
+      wait = std::min(wait, kStopPollInterval);
+    mutex_.AwaitWithTimeout(absl::Condition(&check), wait);
+  }
+  used_ += size;
+  return true;
+}
+
+void MemoryBudget::Release(size_t size) {
+  absl::MutexLock lock(&mutex_);
+  used_ -= size;
+}
+
+size_t MemoryBudget::GetUsed() const {
+  absl::MutexLock lock(&mutex_);
+  return used_;
+}
+
+}  // namespace mysql_ripple
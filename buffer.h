@@ -17,17 +17,113 @@
 #ifndef MYSQL_RIPPLE_BUFFER_H
 #define MYSQL_RIPPLE_BUFFER_H
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <utility>
 #include <vector>
 
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 
 namespace mysql_ripple {
 
-class Buffer : public std::vector<uint8_t> {
+// Thread local cache of the memory blocks backing Buffers.
+//
+// Blocks are kept in power of two size classes from kMinBlockSize to
+// kMaxBlockSize bytes. A freed block is cached by the freeing thread, so
+// the temporary Buffers created per event reuse memory instead of going
+// to the heap. Larger blocks, and blocks that do not fit in the cache,
+// are allocated and freed with operator new/delete.
+class BufferPool {
  public:
-  // Extend size by n bytes and return pointer to
+  static const size_t kMinBlockSize = 64;
+  static const size_t kMaxBlockSize = 64 * 1024;
+
+  // Max blocks cached per size class and thread.
+  static const int kMaxBlocksPerClass = 8;
+
+  // Max bytes cached per thread.
+  static const size_t kMaxCachedBytes = 1024 * 1024;
+
+  // Allocate a block of at least size bytes.
+  static void *Allocate(size_t size);
+
+  // Free a block returned by Allocate(size).
+  static void Free(void *ptr, size_t size);
+
+  // Bytes cached by the calling thread.
+  static size_t GetCachedBytes();
+};
+
+// Allocator of Buffer.
+//
+// Growing the underlying vector default-initializes the new bytes, i.e
+// leaves them uninitialized, so that Buffer can skip zero-filling bytes
+// that are overwritten right away by a read, a decryption or a copy.
+// Memory comes from BufferPool.
+template <typename T>
+class BufferAllocator {
+ public:
+  typedef T value_type;
+
+  BufferAllocator() noexcept {}
+  template <typename U>
+  BufferAllocator(const BufferAllocator<U> &) noexcept {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(BufferPool::Allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) noexcept {
+    BufferPool::Free(ptr, n * sizeof(T));
+  }
+
+  // Value-initialization (e.g by resize()) default-initializes instead.
+  template <typename U>
+  void construct(U *ptr) noexcept {
+    ::new (static_cast<void *>(ptr)) U;
+  }
+
+  template <typename U, typename... Args>
+  void construct(U *ptr, Args &&... args) {
+    ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool operator==(const BufferAllocator<U> &) const noexcept { return true; }
+  template <typename U>
+  bool operator!=(const BufferAllocator<U> &) const noexcept { return false; }
+};
+
+// Bytes of an event or a packet.
+//
+// resize() and Append(n) zero-fill the new bytes. Since pooled memory may
+// hold data of other events (e.g decrypted binlog data), the uninitialized
+// variants shall only be used when every new byte is overwritten before
+// the buffer is used.
+class Buffer : public std::vector<uint8_t, BufferAllocator<uint8_t>> {
+ public:
+  using std::vector<uint8_t, BufferAllocator<uint8_t>>::resize;
+
+  void resize(size_t n) {
+    size_t curr = size();
+    ResizeUninitialized(n);
+    if (n > curr)
+      std::fill(begin() + curr, end(), 0);
+  }
+
+  // Resize to n bytes, leaving new bytes uninitialized.
+  void ResizeUninitialized(size_t n) {
+    std::vector<uint8_t, BufferAllocator<uint8_t>>::resize(n);
+  }
+
+  // Extend size by n zero bytes and return pointer to
   // start place of extension.
   uint8_t* Append(size_t n) {
     size_t curr = size();
@@ -35,12 +131,28 @@ class Buffer : public std::vector<uint8_t> {
     return data() + curr;
   }
 
+  // Like Append(n), but the new bytes are uninitialized.
+  uint8_t* AppendUninitialized(size_t n) {
+    size_t curr = size();
+    ResizeUninitialized(curr + n);
+    return data() + curr;
+  }
+
   // Append n bytes from ptr to end of this buffer.
   bool Append(const uint8_t *ptr, size_t n) {
-    insert(end(), ptr, ptr + n);
+    if (n > 0)
+      memcpy(AppendUninitialized(n), ptr, n);
     return true;
   }
 
+  // Clear the buffer, and free its memory if it has grown larger than
+  // max_capacity, e.g to hold a large event.
+  void Reset(size_t max_capacity) {
+    clear();
+    if (capacity() > max_capacity)
+      shrink_to_fit();
+  }
+
   // Implicit conversion to absl::string_view.
   operator absl::string_view() const {
     auto b = reinterpret_cast<const char*>(data());
@@ -48,6 +160,33 @@ class Buffer : public std::vector<uint8_t> {
   }
 };
 
+// Bytes of memory shared by several users, e.g the slave sessions sending
+// large events.
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(size_t limit) : limit_(limit), used_(0) {}
+
+  // Take size bytes of the budget, waiting until other users have released
+  // enough of it. A size larger than the limit waits until nothing is used.
+  // Returns false, taking nothing, if the bytes are not available within
+  // timeout or once stop returns true. stop is polled while waiting.
+  bool Acquire(size_t size, absl::Duration timeout,
+               const std::function<bool()> &stop = nullptr);
+
+  // Give back size bytes taken by Acquire().
+  void Release(size_t size);
+
+  size_t GetUsed() const;
+
+  // How often Acquire() calls stop.
+  static constexpr absl::Duration kStopPollInterval = absl::Milliseconds(100);
+
+ private:
+  const size_t limit_;
+  mutable absl::Mutex mutex_;
+  size_t used_ ABSL_GUARDED_BY(mutex_);
+};
+
 }  // namespace mysql_ripple
 
 #endif  // MYSQL_RIPPLE_BUFFER_H
@@ -0,0 +1,161 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffer.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace mysql_ripple {
+
+TEST(Buffer, Append) {
+  Buffer buffer;
+  uint8_t *ptr = buffer.Append(3);
+  memcpy(ptr, "abc", 3);
+  EXPECT_TRUE(buffer.Append(reinterpret_cast<const uint8_t *>("de"), 2));
+  EXPECT_EQ(absl::string_view(buffer), "abcde");
+
+  Buffer copy(buffer);
+  EXPECT_EQ(absl::string_view(copy), "abcde");
+  buffer.resize(2);
+  EXPECT_EQ(absl::string_view(buffer), "ab");
+  buffer.resize(3, 'x');
+  EXPECT_EQ(absl::string_view(buffer), "abx");
+}
+
+TEST(Buffer, GrowZeroFills) {
+  std::thread([] {
+    // Make the pool hand out a block with old data in it.
+    {
+      Buffer old;
+      old.ResizeUninitialized(100);
+      memset(old.data(), 'x', old.size());
+    }
+    Buffer buffer;
+    buffer.resize(50);
+    uint8_t *ptr = buffer.Append(50);
+    EXPECT_EQ(ptr, buffer.data() + 50);
+    for (uint8_t c : buffer)
+      EXPECT_EQ(c, 0);
+  }).join();
+}
+
+TEST(BufferPool, Reuse) {
+  std::thread([] {
+    EXPECT_EQ(BufferPool::GetCachedBytes(), 0);
+    const uint8_t *data;
+    {
+      Buffer buffer;
+      buffer.reserve(100);
+      data = buffer.data();
+    }
+    EXPECT_EQ(BufferPool::GetCachedBytes(), 128);
+
+    // Blocks are reused for sizes of the same class.
+    Buffer buffer;
+    buffer.reserve(128);
+    EXPECT_EQ(buffer.data(), data);
+    EXPECT_EQ(BufferPool::GetCachedBytes(), 0);
+
+    // Large blocks are not cached.
+    {
+      Buffer large;
+      large.reserve(BufferPool::kMaxBlockSize + 1);
+    }
+    EXPECT_EQ(BufferPool::GetCachedBytes(), 0);
+  }).join();
+}
+
+TEST(BufferPool, Limits) {
+  std::thread([] {
+    {
+      std::vector<Buffer> buffers(2 * BufferPool::kMaxBlocksPerClass);
+      for (Buffer &buffer : buffers)
+        buffer.reserve(BufferPool::kMinBlockSize);
+    }
+    EXPECT_EQ(BufferPool::GetCachedBytes(),
+              BufferPool::kMaxBlocksPerClass * BufferPool::kMinBlockSize);
+    {
+      std::vector<Buffer> buffers(BufferPool::kMaxBlocksPerClass);
+      for (Buffer &buffer : buffers)
+        buffer.reserve(BufferPool::kMaxBlockSize);
+    }
+    EXPECT_LE(BufferPool::GetCachedBytes(), BufferPool::kMaxCachedBytes);
+  }).join();
+}
+
+TEST(Buffer, Reset) {
+  Buffer buffer;
+  buffer.resize(1000);
+  buffer.Reset(1000);
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_GE(buffer.capacity(), 1000);
+  buffer.Reset(100);
+  EXPECT_EQ(buffer.capacity(), 0);
+}
+
+TEST(MemoryBudget, Acquire) {
+  MemoryBudget budget(100);
+  EXPECT_TRUE(budget.Acquire(60, absl::ZeroDuration()));
+  EXPECT_TRUE(budget.Acquire(40, absl::ZeroDuration()));
+  EXPECT_EQ(budget.GetUsed(), 100);
+
+  // Waits until enough is released.
+  absl::Notification acquired;
+  std::thread thread([&] {
+    EXPECT_TRUE(budget.Acquire(50, absl::InfiniteDuration()));
+    acquired.Notify();
+  });
+  EXPECT_FALSE(acquired.WaitForNotificationWithTimeout(absl::Milliseconds(10)));
+  budget.Release(40);
+  EXPECT_FALSE(acquired.WaitForNotificationWithTimeout(absl::Milliseconds(10)));
+  budget.Release(60);
+  acquired.WaitForNotification();
+  thread.join();
+  EXPECT_EQ(budget.GetUsed(), 50);
+
+  // More than the limit is granted when nothing else is used.
+  budget.Release(50);
+  EXPECT_TRUE(budget.Acquire(200, absl::ZeroDuration()));
+  EXPECT_EQ(budget.GetUsed(), 200);
+  budget.Release(200);
+}
+
+TEST(MemoryBudget, GivesUp) {
+  MemoryBudget budget(100);
+  EXPECT_TRUE(budget.Acquire(100, absl::ZeroDuration()));
+
+  // Times out.
+  EXPECT_FALSE(budget.Acquire(1, absl::Milliseconds(10)));
+  EXPECT_EQ(budget.GetUsed(), 100);
+
+  // Stops waiting when asked to, however long the timeout.
+  std::atomic<bool> stop(false);
+  std::thread thread([&] {
+    EXPECT_FALSE(budget.Acquire(1, absl::InfiniteDuration(),
+                                [&stop]() { return stop.load(); }));
+  });
+  absl::SleepFor(absl::Milliseconds(10));
+  stop = true;
+  thread.join();
+  EXPECT_EQ(budget.GetUsed(), 100);
+  budget.Release(100);
+}
+
+}  // namespace mysql_ripple
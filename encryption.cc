@@ -16,10 +16,16 @@
 
 #include <arpa/inet.h>  // htonl
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <thread>
+#include <typeinfo>
+#include <vector>
 
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "my_crypt.h"
 #include "my_crypt_key_management.h"
 #include "byte_order.h"
@@ -35,6 +41,7 @@ static const int kKeyLength = 16;
 static const int kNonceLength = 16;
 static const int kIvLength = 20;
 static const int kTagLength = 16;
+static const int kExtraSize = 4 + kTagLength;
 
 class ExampleKeyHandler : public KeyHandler {
  public:
@@ -84,21 +91,134 @@ bool KeyHandler::GetRandomBytes(uint8_t *dst, int len) {
   return ::RandomBytes(dst, len) == CRYPT_OK;
 }
 
+namespace {
+
+// Worker threads encrypting and decrypting the blocks of events that span
+// several blocks in parallel. Started on first use and shared by all
+// encryptors.
+class CryptPool {
+ public:
+  static CryptPool *Get() {
+    static CryptPool *pool = new CryptPool(std::min<int>(
+        FLAGS_ripple_encryption_threads, std::thread::hardware_concurrency()));
+    return pool;
+  }
+
+  // Run fn(slot, n) for n in [0, count) as ParallelFor(), return true if
+  // all calls returned true.
+  bool ParallelAll(size_t count, const std::function<bool(int, size_t)> &fn) {
+    if (count == 1)
+      return fn(0, 0);
+    std::vector<char> ok(count, false);
+    ParallelFor(count, [&](int slot, size_t n) { ok[n] = fn(slot, n); });
+    return std::find(ok.begin(), ok.end(), false) == ok.end();
+  }
+
+  // Number of threads that can run in parallel, including the caller.
+  int GetSlots() const { return slots_; }
+
+  // Call fn(slot, 0) ... fn(slot, count - 1) on the calling thread (slot 0)
+  // and the workers (slot 1 ... GetSlots() - 1). If the workers are busy
+  // with another caller everything runs on the calling thread.
+  void ParallelFor(size_t count,
+                   const std::function<void(int, size_t)> &fn) {
+    if (slots_ <= 1 || count <= 1 || !run_mutex_.TryLock()) {
+      for (size_t n = 0; n < count; n++) fn(0, n);
+      return;
+    }
+    {
+      absl::MutexLock lock(&mutex_);
+      fn_ = &fn;
+      count_ = count;
+      next_ = 0;
+      remaining_ = count;
+    }
+    Run(0);
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(
+          +[](size_t *remaining) { return *remaining == 0; }, &remaining_));
+      fn_ = nullptr;
+    }
+    run_mutex_.Unlock();
+  }
+
+ private:
+  explicit CryptPool(int threads)
+      : slots_(std::max(threads, 1)), fn_(nullptr), count_(0), next_(0),
+        remaining_(0) {
+    for (int slot = 1; slot < slots_; slot++) {
+      std::thread(&CryptPool::Work, this, slot).detach();
+    }
+  }
+
+  bool HasWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return fn_ != nullptr && next_ < count_;
+  }
+
+  void Work(int slot) {
+    while (true) {
+      mutex_.LockWhen(absl::Condition(this, &CryptPool::HasWork));
+      mutex_.Unlock();
+      Run(slot);
+    }
+  }
+
+  // Run items of the current job until there are none left.
+  void Run(int slot) {
+    while (true) {
+      const std::function<void(int, size_t)> *fn;
+      size_t n;
+      {
+        absl::MutexLock lock(&mutex_);
+        if (!HasWork())
+          return;
+        fn = fn_;
+        n = next_++;
+      }
+      (*fn)(slot, n);
+      absl::MutexLock lock(&mutex_);
+      remaining_--;
+    }
+  }
+
+  const int slots_;
+  absl::Mutex run_mutex_;  // held by the caller of ParallelFor
+  absl::Mutex mutex_;
+  const std::function<void(int, size_t)> *fn_ ABSL_GUARDED_BY(mutex_);
+  size_t count_ ABSL_GUARDED_BY(mutex_);
+  size_t next_ ABSL_GUARDED_BY(mutex_);
+  size_t remaining_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace
+
+struct AesGcmBinlogEncryptor::Cipher {
+  Aes128GcmEncrypter encrypter;
+  Aes128GcmDecrypter decrypter;
+  bool encrypter_keyed = false;
+  bool decrypter_keyed = false;
+};
+
 AesGcmBinlogEncryptor::AesGcmBinlogEncryptor(int crypt_scheme,
                                              KeyHandler *key_handler)
-    : crypt_scheme_(crypt_scheme), key_handler_(key_handler) {
+    : remaining_(0), event_end_(0), crypt_scheme_(crypt_scheme),
+      key_handler_(key_handler) {
   key_.Append(kKeyLength);
   iv_.Append(kIvLength);
 }
 
 AesGcmBinlogEncryptor::AesGcmBinlogEncryptor(const AesGcmBinlogEncryptor& orig)
-  : crypt_scheme_(orig.crypt_scheme_),
+  : remaining_(0), event_end_(0), crypt_scheme_(orig.crypt_scheme_),
     key_handler_(orig.key_handler_->Copy()) {
   key_.Append(kKeyLength);
   iv_.Append(kIvLength);
   SetKeyAndNonce(orig.key_version_, orig.iv_.data(), kNonceLength);
 }
 
+AesGcmBinlogEncryptor::~AesGcmBinlogEncryptor() {
+}
+
 bool AesGcmBinlogEncryptor::Init() {
   Buffer buf;
   buf.Append(kNonceLength);
@@ -133,30 +253,74 @@ bool AesGcmBinlogEncryptor::SetKeyAndNonce(uint32_t version,
   }
   memcpy(iv_.data(), nonce, len);
 
+  // Cipher contexts are keyed on first use.
+  ciphers_.clear();
   return true;
 }
 
+AesGcmBinlogEncryptor::Cipher *AesGcmBinlogEncryptor::GetCipher(int slot) {
+  if (ciphers_.empty()) {
+    ciphers_.resize(CryptPool::Get()->GetSlots());
+  }
+  if (ciphers_[slot] == nullptr) {
+    ciphers_[slot].reset(new Cipher());
+  }
+  return ciphers_[slot].get();
+}
+
 bool AesGcmBinlogEncryptor::Encrypt(off_t pos, const uint8_t *src, int len,
                                     Buffer *dst) {
-  byte_order::store4(iv_.data() + kNonceLength, pos);
-  Aes128GcmEncrypter encrypter;
-  if (encrypter.Init(key_.data(), iv_.data(), iv_.size()) != CRYPT_OK) {
+  dst->ResizeUninitialized(kExtraSize + len);
+  return EncryptTo(GetCipher(0), pos, src, len, dst->data());
+}
+
+bool AesGcmBinlogEncryptor::InitEncrypter(Cipher *cipher, off_t pos) {
+  uint8_t iv[kIvLength];
+  memcpy(iv, iv_.data(), kNonceLength);
+  byte_order::store4(iv + kNonceLength, pos);
+  Aes128GcmEncrypter &encrypter = cipher->encrypter;
+  CryptResult res = cipher->encrypter_keyed ?
+      encrypter.SetIv(iv) : encrypter.Init(key_.data(), iv, kIvLength);
+  if (res != CRYPT_OK) {
     LOG(ERROR) << "Failed to encrypt log event"
                << ", encrypter.Init() failed";
     monitoring::rippled_binlog_error->Increment(
         monitoring::ERROR_INIT_ENCRYPTOR);
     return false;
   }
+  cipher->encrypter_keyed = true;
+  return true;
+}
+
+bool AesGcmBinlogEncryptor::InitDecrypter(Cipher *cipher, off_t pos) {
+  uint8_t iv[kIvLength];
+  memcpy(iv, iv_.data(), kNonceLength);
+  byte_order::store4(iv + kNonceLength, pos);
+  Aes128GcmDecrypter &decrypter = cipher->decrypter;
+  CryptResult res = cipher->decrypter_keyed ?
+      decrypter.SetIv(iv) : decrypter.Init(key_.data(), iv, kIvLength);
+  if (res != CRYPT_OK) {
+    LOG(WARNING) << "Failed to decrypt log event"
+                 << ", decrypter.Init() failed";
+    return false;
+  }
+  cipher->decrypter_keyed = true;
+  return true;
+}
 
-  dst->resize(4 + len + kTagLength);
+bool AesGcmBinlogEncryptor::EncryptTo(Cipher *cipher, off_t pos,
+                                      const uint8_t *src, int len,
+                                      uint8_t *dst) {
+  if (!InitEncrypter(cipher, pos))
+    return false;
+  Aes128GcmEncrypter &encrypter = cipher->encrypter;
 
   // 1. store length.
-  byte_order::store4(dst->data(), len);
+  byte_order::store4(dst, len);
 
   // 2. store encrypted event.
   int encrypted_len = 0;
-  if (encrypter.Encrypt(src, len,
-                        dst->data() + 4, &encrypted_len) != CRYPT_OK) {
+  if (encrypter.Encrypt(src, len, dst + 4, &encrypted_len) != CRYPT_OK) {
     LOG(ERROR) << "Failed to encrypt log event"
                << ", encrypter.Encrypt() failed";
     monitoring::rippled_binlog_error->Increment(
@@ -174,7 +338,7 @@ bool AesGcmBinlogEncryptor::Encrypt(off_t pos, const uint8_t *src, int len,
   }
 
   // 3. store tag.
-  if (encrypter.GetTag(dst->data() + 4 + len, kTagLength) != CRYPT_OK) {
+  if (encrypter.GetTag(dst + 4 + len, kTagLength) != CRYPT_OK) {
     LOG(ERROR) << "Failed to encrypt log event"
                << ", encrypter.GetTag() returned error";
     monitoring::rippled_binlog_error->Increment(
@@ -187,14 +351,21 @@ bool AesGcmBinlogEncryptor::Encrypt(off_t pos, const uint8_t *src, int len,
 
 bool AesGcmBinlogEncryptor::Decrypt(off_t pos, const uint8_t *src, int len,
                                     Buffer *dst) {
-  byte_order::store4(iv_.data() + kNonceLength, pos);
-  Aes128GcmDecrypter decrypter;
-  if (decrypter.Init(key_.data(), iv_.data(), iv_.size()) != CRYPT_OK) {
+  int event_len = len >= 4 ? byte_order::load4(src) : 0;
+  if (len != (4 + event_len + kTagLength)) {
     LOG(WARNING) << "Failed to decrypt log event"
-                 << ", decrypter.Init() failed";
+                 << ", len: " << len
+                 << ", event_len: " << event_len
+                 << ", kTagLength: " << kTagLength;
     return false;
   }
+  dst->ResizeUninitialized(event_len);
+  return DecryptTo(GetCipher(0), pos, src, len, dst->data());
+}
 
+bool AesGcmBinlogEncryptor::DecryptTo(Cipher *cipher, off_t pos,
+                                      const uint8_t *src, int len,
+                                      uint8_t *dst) {
   // 1. read length.
   int event_len = byte_order::load4(src);
   if (len != (4 + event_len + kTagLength)) {
@@ -205,6 +376,10 @@ bool AesGcmBinlogEncryptor::Decrypt(off_t pos, const uint8_t *src, int len,
     return false;
   }
 
+  if (!InitDecrypter(cipher, pos))
+    return false;
+  Aes128GcmDecrypter &decrypter = cipher->decrypter;
+
   // 2. read and set tag.
   if (decrypter.SetTag(src + 4 + event_len, kTagLength) != CRYPT_OK) {
     LOG(WARNING) << "Failed to decrypt log event"
@@ -214,9 +389,8 @@ bool AesGcmBinlogEncryptor::Decrypt(off_t pos, const uint8_t *src, int len,
 
   // 3. decrypt.
   int decrypted_len = 0;
-  dst->resize(event_len);
   if (decrypter.Decrypt(src + 4, event_len,
-                        dst->data(), &decrypted_len) != CRYPT_OK) {
+                        dst, &decrypted_len) != CRYPT_OK) {
     LOG(WARNING) << "Failed to decrypt log event"
                  << ", decrypter.Decrypt() failed";
     return false;
@@ -239,13 +413,22 @@ bool AesGcmBinlogEncryptor::Decrypt(off_t pos, const uint8_t *src, int len,
   return true;
 }
 
-int AesGcmBinlogEncryptor::GetExtraSize() const {
-  return 4 + kTagLength;
+int AesGcmBinlogEncryptor::GetExtraSize(int len) const {
+  return kExtraSize;
 }
 
 file_util::ReadResultCode AesGcmBinlogEncryptor::Read(file::InputFile *file,
                                                       off_t end_of_file,
                                                       Buffer *dst) {
+  size_t remaining;
+  return AesGcmBinlogEncryptor::ReadPart(file, end_of_file, SIZE_MAX, dst,
+                                         &remaining);
+}
+
+file_util::ReadResultCode AesGcmBinlogEncryptor::ReadPart(
+    file::InputFile *file, off_t end_of_file, size_t max_size, Buffer *dst,
+    size_t *remaining_bytes) {
+  *remaining_bytes = 0;
   int64_t offset;
   file->Tell(&offset);
 
@@ -261,16 +444,43 @@ file_util::ReadResultCode AesGcmBinlogEncryptor::Read(file::InputFile *file,
   }
 
   int len = byte_order::load4(buffer_.data());
-  int remaining = len + GetExtraSize() - 4;
-  if (offset + len + GetExtraSize() > end_of_file) {
+  int remaining = len + kExtraSize - 4;
+  if (offset + len + kExtraSize > end_of_file) {
     LOG(WARNING) << "Failed to read encrypted log event"
                  << ", offset: " << offset
                  << ", len: " << len
-                 << ", GetExtraSize(): " << GetExtraSize()
+                 << ", kExtraSize: " << kExtraSize
                  << ", end_of_file: " << end_of_file;
     return file_util::READ_EOF;
   }
 
+  if (static_cast<size_t>(len) > max_size) {
+    // Decrypt the header, the tag is checked by the last ReadMore().
+    max_size = constants::LOG_EVENT_HEADER_LENGTH;
+    buffer_.clear();
+    if (!file->Read(buffer_, max_size)) {
+      LOG(WARNING) << "Failed to read encrypted log event"
+                   << ", offset: " << offset << ", size: " << max_size;
+      return file_util::READ_ERROR;
+    }
+    Cipher *cipher = GetCipher(0);
+    int decrypted_len = 0;
+    dst->ResizeUninitialized(max_size);
+    if (!InitDecrypter(cipher, offset) ||
+        cipher->decrypter.Decrypt(buffer_.data(), max_size, dst->data(),
+                                  &decrypted_len) != CRYPT_OK ||
+        static_cast<size_t>(decrypted_len) != max_size) {
+      LOG(WARNING) << "Failed to read encrypted log event"
+                   << ", offset: " << offset
+                   << ", Decrypt() failed";
+      return file_util::READ_ERROR;
+    }
+    remaining_ = len - max_size;
+    event_end_ = offset + len + kExtraSize;
+    *remaining_bytes = remaining_;
+    return file_util::READ_OK;
+  }
+
   if (remaining != 0 && !file->Read(buffer_, remaining)) {
     LOG(WARNING) << "Failed to read encrypted log event"
                  << ", offset: " << offset << ", remaining: " << remaining;
@@ -287,6 +497,103 @@ file_util::ReadResultCode AesGcmBinlogEncryptor::Read(file::InputFile *file,
   return file_util::READ_OK;
 }
 
+file_util::ReadResultCode AesGcmBinlogEncryptor::ReadMore(
+    file::InputFile *file, size_t size, Buffer *dst) {
+  if (size > remaining_) {
+    LOG(WARNING) << "Failed to read encrypted log event"
+                 << ", size: " << size << ", remaining: " << remaining_;
+    return file_util::READ_ERROR;
+  }
+  Cipher *cipher = GetCipher(0);
+  buffer_.clear();
+  int decrypted_len = 0;
+  dst->ResizeUninitialized(size);
+  if (!file->Read(buffer_, size) ||
+      cipher->decrypter.Decrypt(buffer_.data(), size, dst->data(),
+                                &decrypted_len) != CRYPT_OK ||
+      static_cast<size_t>(decrypted_len) != size) {
+    LOG(WARNING) << "Failed to read encrypted log event"
+                 << ", end: " << event_end_
+                 << ", Decrypt() failed";
+    remaining_ = 0;
+    return file_util::READ_ERROR;
+  }
+  remaining_ -= size;
+  if (remaining_ > 0)
+    return file_util::READ_OK;
+
+  buffer_.clear();
+  if (!file->Read(buffer_, kTagLength) ||
+      cipher->decrypter.SetTag(buffer_.data(), kTagLength) != CRYPT_OK ||
+      cipher->decrypter.CheckTag() != CRYPT_OK) {
+    LOG(WARNING) << "Failed to read encrypted log event"
+                 << ", end: " << event_end_
+                 << ", CheckTag() failed";
+    return file_util::READ_ERROR;
+  }
+  return file_util::READ_OK;
+}
+
+bool AesGcmBinlogEncryptor::Tell(file::BaseFile *file, int64_t *offset) {
+  if (remaining_ > 0) {
+    *offset = event_end_;
+    return true;
+  }
+  return file->Tell(offset);
+}
+
+bool AesGcmBinlogEncryptor::WriteLarge(file::AppendOnlyFile *file,
+                                       int64_t offset,
+                                       absl::string_view src) {
+  Cipher *cipher = GetCipher(0);
+  if (!InitEncrypter(cipher, offset))
+    return false;
+  buffer_.resize(4);
+  byte_order::store4(buffer_.data(), src.size());
+  if (!file->Write(buffer_)) {
+    LOG(WARNING) << "Failed to write encrypted log event"
+                 << ", offset: " << offset << ", length: " << src.size();
+    return false;
+  }
+  const uint8_t *ptr = reinterpret_cast<const uint8_t *>(src.data());
+  size_t size = src.size();
+  while (size > 0) {
+    size_t len = std::min<size_t>(size, FLAGS_ripple_large_event_size);
+    int encrypted_len = 0;
+    buffer_.ResizeUninitialized(len);
+    if (cipher->encrypter.Encrypt(ptr, len, buffer_.data(),
+                                  &encrypted_len) != CRYPT_OK ||
+        static_cast<size_t>(encrypted_len) != len) {
+      LOG(ERROR) << "Failed to encrypt log event"
+                 << ", encrypter.Encrypt() failed";
+      monitoring::rippled_binlog_error->Increment(
+          monitoring::ERROR_ENCRYPT);
+      return false;
+    }
+    if (!file->Write(buffer_)) {
+      LOG(WARNING) << "Failed to write encrypted log event"
+                   << ", offset: " << offset << ", length: " << src.size();
+      return false;
+    }
+    ptr += len;
+    size -= len;
+  }
+  buffer_.resize(kTagLength);
+  if (cipher->encrypter.GetTag(buffer_.data(), kTagLength) != CRYPT_OK) {
+    LOG(ERROR) << "Failed to encrypt log event"
+               << ", encrypter.GetTag() returned error";
+    monitoring::rippled_binlog_error->Increment(
+        monitoring::ERROR_ENCRYPT);
+    return false;
+  }
+  if (!file->Write(buffer_)) {
+    LOG(WARNING) << "Failed to write encrypted log event"
+                 << ", offset: " << offset << ", length: " << src.size();
+    return false;
+  }
+  return true;
+}
+
 bool AesGcmBinlogEncryptor::Write(file::AppendOnlyFile *file,
                                   absl::string_view src) {
   int64_t offset;
@@ -295,6 +602,9 @@ bool AesGcmBinlogEncryptor::Write(file::AppendOnlyFile *file,
                  << ", Tell() failed!";
     return false;
   }
+  if (src.size() > FLAGS_ripple_large_event_size) {
+    return WriteLarge(file, offset, src);
+  }
   if (!Encrypt(offset, reinterpret_cast<const unsigned char *>(src.data()),
                src.size(), &buffer_)) {
     LOG(WARNING) << "Failed to write encrypted log event"
@@ -321,6 +631,9 @@ int AesGcmBinlogEncryptor::GetStartEncryptionEvent(const LogEventHeader& head,
   if (crypt_scheme_ == 255 && FLAGS_danger_danger_use_dbug_keys) {
     // store 1 even if we use fake keys (i.e 255)
     event.crypt_scheme = 1;
+  } else if (crypt_scheme_ == 254 && FLAGS_danger_danger_use_dbug_keys) {
+    // store 2 even if we use fake keys (i.e 254)
+    event.crypt_scheme = 2;
   } else {
     event.crypt_scheme = crypt_scheme_;
   }
@@ -341,6 +654,246 @@ int AesGcmBinlogEncryptor::GetStartEncryptionEvent(const LogEventHeader& head,
   return 1;
 }
 
+const int BlockBinlogEncryptor::kBlockSize;
+
+BlockBinlogEncryptor::BlockBinlogEncryptor(int crypt_scheme,
+                                           KeyHandler *key_handler)
+    : AesGcmBinlogEncryptor(crypt_scheme, key_handler), block_pos_(0),
+      end_of_file_(0) {
+}
+
+BlockBinlogEncryptor::BlockBinlogEncryptor(const BlockBinlogEncryptor& orig)
+    : AesGcmBinlogEncryptor(orig), block_pos_(0), end_of_file_(0) {
+}
+
+bool BlockBinlogEncryptor::Init() {
+  block_.clear();
+  block_pos_ = 0;
+  pending_.clear();
+  return AesGcmBinlogEncryptor::Init();
+}
+
+BinlogEncryptor *BlockBinlogEncryptor::Copy() const {
+  return new BlockBinlogEncryptor(*this);
+}
+
+// Size of blocks holding size bytes, a partial block is counted as if
+// it was written.
+static int64_t BlocksSize(int64_t size) {
+  const int64_t block_size = BlockBinlogEncryptor::kBlockSize;
+  int64_t blocks = (size + block_size - 1) / block_size;
+  return size + blocks * kExtraSize;
+}
+
+int BlockBinlogEncryptor::GetExtraSize(int len) const {
+  int64_t pending = pending_.size();
+  return BlocksSize(pending + len) - BlocksSize(pending) - len;
+}
+
+file_util::ReadResultCode BlockBinlogEncryptor::ReadBytes(
+    file::InputFile *file, off_t end_of_file, size_t size, Buffer *dst) {
+  while (size > 0) {
+    if (block_pos_ == block_.size()) {
+      block_.clear();
+      block_pos_ = 0;
+      if (size >= kBlockSize) {
+        // The rest of a large event, decrypt full blocks straight into dst
+        // and in parallel.
+        int64_t offset;
+        file->Tell(&offset);
+        size_t count = size / kBlockSize;
+        size_t record_size = kExtraSize + kBlockSize;
+        if (offset + static_cast<int64_t>(count * record_size) > end_of_file) {
+          LOG(WARNING) << "Failed to read encrypted block"
+                       << ", offset: " << offset
+                       << ", blocks: " << count
+                       << ", end_of_file: " << end_of_file;
+          return file_util::READ_EOF;
+        }
+        encrypted_.clear();
+        if (!file->Read(encrypted_, count * record_size)) {
+          LOG(WARNING) << "Failed to read encrypted block"
+                       << ", offset: " << offset << ", blocks: " << count;
+          return file_util::READ_ERROR;
+        }
+        uint8_t *out = dst->AppendUninitialized(count * kBlockSize);
+        GetCipher(0);
+        bool ok = CryptPool::Get()->ParallelAll(count, [&](int slot,
+                                                           size_t n) {
+          const uint8_t *record = encrypted_.data() + n * record_size;
+          return byte_order::load4(record) == kBlockSize &&
+              DecryptTo(GetCipher(slot), offset + n * record_size, record,
+                        record_size, out + n * kBlockSize);
+        });
+        if (!ok) {
+          LOG(WARNING) << "Failed to read encrypted block"
+                       << ", offset: " << offset
+                       << ", Decrypt() failed";
+          return file_util::READ_ERROR;
+        }
+        size -= count * kBlockSize;
+        continue;
+      }
+
+      auto result = AesGcmBinlogEncryptor::Read(file, end_of_file, &block_);
+      if (result != file_util::READ_OK) {
+        block_.clear();
+        return result;
+      }
+    }
+
+    size_t len = std::min(size, block_.size() - block_pos_);
+    dst->Append(block_.data() + block_pos_, len);
+    block_pos_ += len;
+    size -= len;
+  }
+  return file_util::READ_OK;
+}
+
+file_util::ReadResultCode BlockBinlogEncryptor::Read(file::InputFile *file,
+                                                     off_t end_of_file,
+                                                     Buffer *dst) {
+  size_t remaining;
+  return BlockBinlogEncryptor::ReadPart(file, end_of_file, SIZE_MAX, dst,
+                                        &remaining);
+}
+
+file_util::ReadResultCode BlockBinlogEncryptor::ReadPart(
+    file::InputFile *file, off_t end_of_file, size_t max_size, Buffer *dst,
+    size_t *remaining) {
+  *remaining = 0;
+  dst->clear();
+  auto result = ReadBytes(file, end_of_file,
+                          constants::LOG_EVENT_HEADER_LENGTH, dst);
+  if (result != file_util::READ_OK)
+    return result;
+
+  LogEventHeader header;
+  if (!header.ParseFromBuffer(dst->data(), dst->size()) ||
+      header.event_length < constants::LOG_EVENT_HEADER_LENGTH) {
+    LOG(WARNING) << "Failed to read encrypted log event"
+                 << ", invalid event in block"
+                 << ", block_pos: " << block_pos_
+                 << ", block size: " << block_.size();
+    block_.clear();
+    block_pos_ = 0;
+    return file_util::READ_ERROR;
+  }
+
+  size_t size = header.event_length - constants::LOG_EVENT_HEADER_LENGTH;
+  size_t part = header.event_length > max_size ? 0 : size;
+  if (part < size) {
+    // Check that the whole event can be read before returning a part.
+    int64_t end;
+    Tell(file, &end);
+    size_t unread = block_.size() - block_pos_;
+    end += size;
+    if (size > unread)
+      end += (size - unread + kBlockSize - 1) / kBlockSize * kExtraSize;
+    if (end > end_of_file) {
+      LOG(WARNING) << "Failed to read encrypted log event"
+                   << ", end: " << end
+                   << ", end_of_file: " << end_of_file;
+      return file_util::READ_EOF;
+    }
+    result = ReadBytes(file, end_of_file, part, dst);
+    if (result != file_util::READ_OK)
+      return result;
+    end_of_file_ = end_of_file;
+    event_end_ = end;
+    remaining_ = size - part;
+    *remaining = remaining_;
+    return file_util::READ_OK;
+  }
+
+  return ReadBytes(file, end_of_file, size, dst);
+}
+
+file_util::ReadResultCode BlockBinlogEncryptor::ReadMore(
+    file::InputFile *file, size_t size, Buffer *dst) {
+  if (size > remaining_) {
+    LOG(WARNING) << "Failed to read encrypted log event"
+                 << ", size: " << size << ", remaining: " << remaining_;
+    return file_util::READ_ERROR;
+  }
+  dst->clear();
+  auto result = ReadBytes(file, end_of_file_, size, dst);
+  remaining_ = result == file_util::READ_OK ? remaining_ - size : 0;
+  return result;
+}
+
+bool BlockBinlogEncryptor::Write(file::AppendOnlyFile *file,
+                                 absl::string_view src) {
+  // Encrypt full blocks as soon as there are enough of them, so that
+  // large events are not buffered whole.
+  size_t max_pending = std::max<size_t>(
+      kBlockSize, FLAGS_ripple_large_event_size / kBlockSize * kBlockSize);
+  while (!src.empty()) {
+    size_t len = std::min(src.size(), max_pending - pending_.size());
+    pending_.Append(reinterpret_cast<const uint8_t *>(src.data()), len);
+    src.remove_prefix(len);
+    if (pending_.size() >= kBlockSize &&
+        !WriteBlocks(file, pending_.size() - pending_.size() % kBlockSize))
+      return false;
+  }
+  return true;
+}
+
+bool BlockBinlogEncryptor::Flush(file::AppendOnlyFile *file) {
+  if (pending_.empty()) {
+    return true;
+  }
+  return WriteBlocks(file, pending_.size());
+}
+
+bool BlockBinlogEncryptor::WriteBlocks(file::AppendOnlyFile *file,
+                                       size_t len) {
+  int64_t offset;
+  if (!file->Tell(&offset)) {
+    LOG(WARNING) << "Failed to write encrypted block"
+                 << ", Tell() failed!";
+    return false;
+  }
+
+  size_t count = (len + kBlockSize - 1) / kBlockSize;
+  size_t record_size = kExtraSize + kBlockSize;
+  encrypted_.ResizeUninitialized(BlocksSize(len));
+  GetCipher(0);
+  bool ok = CryptPool::Get()->ParallelAll(count, [&](int slot, size_t n) {
+    size_t size = std::min<size_t>(kBlockSize, len - n * kBlockSize);
+    return EncryptTo(GetCipher(slot), offset + n * record_size,
+                     pending_.data() + n * kBlockSize, size,
+                     encrypted_.data() + n * record_size);
+  });
+  if (!ok) {
+    LOG(WARNING) << "Failed to write encrypted block"
+                 << ", offset: " << offset
+                 << ", Encrypt() failed!";
+    return false;
+  }
+  if (!file->Write(encrypted_)) {
+    LOG(WARNING) << "Failed to write encrypted block"
+                 << ", offset: " << offset
+                 << ", length: " << encrypted_.size();
+    return false;
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + len);
+  return true;
+}
+
+bool BlockBinlogEncryptor::Tell(file::BaseFile *file, int64_t *offset) {
+  if (remaining_ > 0) {
+    *offset = event_end_;
+    return true;
+  }
+  if (!file->Tell(offset)) {
+    return false;
+  }
+  *offset += BlocksSize(pending_.size());
+  *offset -= block_.size() - block_pos_;
+  return true;
+}
+
 BinlogEncryptor *NullBinlogEncryptor::Copy() const {
   return new NullBinlogEncryptor();
 }
@@ -348,6 +901,15 @@ BinlogEncryptor *NullBinlogEncryptor::Copy() const {
 file_util::ReadResultCode NullBinlogEncryptor::Read(file::InputFile *file,
                                                     off_t end_of_file,
                                                     Buffer *dst) {
+  size_t remaining;
+  return NullBinlogEncryptor::ReadPart(file, end_of_file, SIZE_MAX, dst,
+                                       &remaining);
+}
+
+file_util::ReadResultCode NullBinlogEncryptor::ReadPart(
+    file::InputFile *file, off_t end_of_file, size_t max_size, Buffer *dst,
+    size_t *remaining_bytes) {
+  *remaining_bytes = 0;
   int64_t offset;
   file->Tell(&offset);
   if (offset + constants::LOG_EVENT_HEADER_LENGTH > end_of_file) {
@@ -369,8 +931,9 @@ file_util::ReadResultCode NullBinlogEncryptor::Read(file::InputFile *file,
     return file_util::READ_ERROR;
   }
 
-  int length = header.event_length;
-  int remaining = length - dst->size();
+  size_t length = header.event_length;
+  size_t part = length > max_size ? dst->size() : length;
+  size_t remaining = part - dst->size();
   if (offset + length > end_of_file) {
     LOG(WARNING) << "Failed to read unencrypted log event"
                  << ", offset: " << offset
@@ -384,9 +947,37 @@ file_util::ReadResultCode NullBinlogEncryptor::Read(file::InputFile *file,
                  << ", offset: " << offset << ", remaining: " << remaining;
     return file_util::READ_ERROR;
   }
+  if (part < length) {
+    remaining_ = length - part;
+    event_end_ = offset + length;
+    *remaining_bytes = remaining_;
+  }
   return file_util::READ_OK;
 }
 
+file_util::ReadResultCode NullBinlogEncryptor::ReadMore(file::InputFile *file,
+                                                        size_t size,
+                                                        Buffer *dst) {
+  dst->clear();
+  if (size > remaining_ || !file->Read(*dst, size)) {
+    LOG(WARNING) << "Failed to read unencrypted log event"
+                 << ", end: " << event_end_
+                 << ", size: " << size << ", remaining: " << remaining_;
+    remaining_ = 0;
+    return file_util::READ_ERROR;
+  }
+  remaining_ -= size;
+  return file_util::READ_OK;
+}
+
+bool NullBinlogEncryptor::Tell(file::BaseFile *file, int64_t *offset) {
+  if (remaining_ > 0) {
+    *offset = event_end_;
+    return true;
+  }
+  return file->Tell(offset);
+}
+
 bool NullBinlogEncryptor::Write(file::AppendOnlyFile *file,
                                 absl::string_view src) {
   int64_t offset;
@@ -399,6 +990,48 @@ bool NullBinlogEncryptor::Write(file::AppendOnlyFile *file,
   return ok;
 }
 
+file_util::ReadResultCode BinlogEncryptor::ReadEvent(BinlogEncryptor *encryptor,
+                                                     file::InputFile *file,
+                                                     off_t end_of_file,
+                                                     size_t max_size,
+                                                     Buffer *dst,
+                                                     size_t *remaining,
+                                                     int64_t *offset) {
+  auto result = encryptor->ReadPart(file, end_of_file, max_size, dst,
+                                    remaining);
+  if (result == file_util::READ_OK && !encryptor->Tell(file, offset))
+    return file_util::READ_ERROR;
+  return result;
+}
+
+// EventReader for encryptors whose dynamic type is exactly T. The qualified
+// calls are bound at compile time and can be inlined here, since the
+// implementations live in this file.
+template <class T>
+static file_util::ReadResultCode ReadEventAs(BinlogEncryptor *encryptor,
+                                             file::InputFile *file,
+                                             off_t end_of_file,
+                                             size_t max_size, Buffer *dst,
+                                             size_t *remaining,
+                                             int64_t *offset) {
+  T *t = static_cast<T *>(encryptor);
+  auto result = t->T::ReadPart(file, end_of_file, max_size, dst, remaining);
+  if (result == file_util::READ_OK && !t->T::Tell(file, offset))
+    return file_util::READ_ERROR;
+  return result;
+}
+
+BinlogEncryptor::EventReader BinlogEncryptor::GetEventReader() const {
+  const std::type_info &type = typeid(*this);
+  if (type == typeid(NullBinlogEncryptor))
+    return ReadEventAs<NullBinlogEncryptor>;
+  if (type == typeid(AesGcmBinlogEncryptor))
+    return ReadEventAs<AesGcmBinlogEncryptor>;
+  if (type == typeid(BlockBinlogEncryptor))
+    return ReadEventAs<BlockBinlogEncryptor>;
+  return ReadEvent;
+}
+
 BinlogEncryptor* BinlogEncryptorFactory::GetInstance(int crypt_scheme) {
   switch (crypt_scheme) {
     case 0:
@@ -411,6 +1044,14 @@ BinlogEncryptor* BinlogEncryptorFactory::GetInstance(int crypt_scheme) {
       return new AesGcmBinlogEncryptor(
           crypt_scheme,
           KeyHandler::GetInstance(crypt_scheme == 255));
+    case 2:
+    case 254:
+      if (crypt_scheme == 2 && FLAGS_danger_danger_use_dbug_keys)
+        crypt_scheme = 254;
+      // 254 = example key handler
+      return new BlockBinlogEncryptor(
+          crypt_scheme,
+          KeyHandler::GetInstance(crypt_scheme == 254));
   }
   return nullptr;
 }
@@ -432,18 +1073,26 @@ BinlogEncryptor *BinlogEncryptorFactory::GetInstance(
     return new NullBinlogEncryptor();
   }
 
-  if (!(event.crypt_scheme == 1 || event.crypt_scheme == 255)) {
+  if (!(event.crypt_scheme == 1 || event.crypt_scheme == 255 ||
+        event.crypt_scheme == 2 || event.crypt_scheme == 254)) {
     assert(false);
     return nullptr;
   }
 
   if (event.crypt_scheme == 1 && FLAGS_danger_danger_use_dbug_keys)
     event.crypt_scheme = 255;
-
-  // scheme 255 => example key handler...
-  KeyHandler *key_handler = KeyHandler::GetInstance(event.crypt_scheme == 255);
-  AesGcmBinlogEncryptor *aes = new AesGcmBinlogEncryptor(event.crypt_scheme,
-                                                         key_handler);
+  if (event.crypt_scheme == 2 && FLAGS_danger_danger_use_dbug_keys)
+    event.crypt_scheme = 254;
+
+  // scheme 255 and 254 => example key handler...
+  bool example = event.crypt_scheme == 255 || event.crypt_scheme == 254;
+  KeyHandler *key_handler = KeyHandler::GetInstance(example);
+  AesGcmBinlogEncryptor *aes;
+  if (event.crypt_scheme == 2 || event.crypt_scheme == 254) {
+    aes = new BlockBinlogEncryptor(event.crypt_scheme, key_handler);
+  } else {
+    aes = new AesGcmBinlogEncryptor(event.crypt_scheme, key_handler);
+  }
   if (!aes->SetKeyAndNonce(event.key_version,
                            reinterpret_cast<const uint8_t*>(event.nonce.data()),
                            event.nonce.size())) {
@@ -21,6 +21,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <memory>
+#include <vector>
 
 #include "absl/strings/string_view.h"
 #include "buffer.h"
@@ -72,6 +73,26 @@ class BinlogEncryptor {
   virtual file_util::ReadResultCode Read(file::InputFile *file,
                                          off_t end_of_file, Buffer *dst) = 0;
 
+  // Read one event like Read() if it is at most max_size bytes, otherwise
+  // read only its header, so that the caller can make room for the rest,
+  // and store the number of bytes of the event left in *remaining. These
+  // are read with ReadMore() before the next event. While parts remain
+  // Tell() returns the position after the event. Encryptors that can not
+  // split events read the whole event.
+  virtual file_util::ReadResultCode ReadPart(file::InputFile *file,
+                                             off_t end_of_file,
+                                             size_t max_size, Buffer *dst,
+                                             size_t *remaining) {
+    *remaining = 0;
+    return Read(file, end_of_file, dst);
+  }
+
+  // Read the next size bytes of the event started by ReadPart() into dst.
+  virtual file_util::ReadResultCode ReadMore(file::InputFile *file,
+                                             size_t size, Buffer *dst) {
+    return file_util::READ_ERROR;
+  }
+
   // Write one event to file at current position.
   virtual bool Write(file::AppendOnlyFile *file, absl::string_view src) = 0;
 
@@ -80,8 +101,26 @@ class BinlogEncryptor {
                  absl::string_view(reinterpret_cast<const char *>(src), len));
   }
 
-  // Get extra size needed for the encryption.
-  virtual int GetExtraSize() const = 0;
+  // Write events buffered by Write() to file.
+  // Only BlockBinlogEncryptor buffers events.
+  virtual bool Flush(file::AppendOnlyFile *file) { return true; }
+
+  // Drop events buffered by Write() without writing them, e.g those of a
+  // transaction that is rolled back.
+  virtual void Discard() {}
+
+  // Return true if Write() has buffered events not yet written to file.
+  virtual bool HasBufferedEvents() const { return false; }
+
+  // Get position after the last event read or written. This is the file
+  // position unless events are buffered.
+  virtual bool Tell(file::BaseFile *file, int64_t *offset) {
+    return file->Tell(offset);
+  }
+
+  // Get extra size needed for the encryption of the next event written,
+  // which is len bytes.
+  virtual int GetExtraSize(int len) const = 0;
 
   // Get StartEncryption event
   // return 0 if none needed
@@ -89,6 +128,29 @@ class BinlogEncryptor {
   //       -1 on error
   virtual int GetStartEncryptionEvent(const LogEventHeader& header,
                                       Buffer *dst) const = 0;
+
+  // Read the start of one event into dst like ReadPart() and on success
+  // store the position after the event in *offset like Tell().
+  typedef file_util::ReadResultCode (*EventReader)(BinlogEncryptor *encryptor,
+                                                   file::InputFile *file,
+                                                   off_t end_of_file,
+                                                   size_t max_size,
+                                                   Buffer *dst,
+                                                   size_t *remaining,
+                                                   int64_t *offset);
+
+  // Get an EventReader for this encryptor that calls the ReadPart() and Tell()
+  // of its class directly rather than through the vtable, so that the
+  // encryptor is resolved once per file instead of once per event.
+  EventReader GetEventReader() const;
+
+  // EventReader using virtual calls, works with any encryptor.
+  static file_util::ReadResultCode ReadEvent(BinlogEncryptor *encryptor,
+                                             file::InputFile *file,
+                                             off_t end_of_file,
+                                             size_t max_size, Buffer *dst,
+                                             size_t *remaining,
+                                             int64_t *offset);
 };
 
 class AesGcmBinlogEncryptor : public BinlogEncryptor {
@@ -97,7 +159,7 @@ class AesGcmBinlogEncryptor : public BinlogEncryptor {
   AesGcmBinlogEncryptor(int crypt_scheme, KeyHandler *key_handler);
   AesGcmBinlogEncryptor(const AesGcmBinlogEncryptor&);
 
-  virtual ~AesGcmBinlogEncryptor() {}
+  ~AesGcmBinlogEncryptor() override;
 
   // GetRandomBytes from KeyHandler (convenience).
   virtual bool GetRandomBytes(uint8_t *buffer, int length) {
@@ -119,7 +181,7 @@ class AesGcmBinlogEncryptor : public BinlogEncryptor {
   virtual bool Decrypt(off_t pos, const uint8_t *src, int len, Buffer *dst);
 
   // Get extra size needed for the encryption.
-  int GetExtraSize() const override;
+  int GetExtraSize(int len) const override;
 
   // Read one event from file and store it into dst.
   // Event is read from current file position and no attempt to read after
@@ -127,9 +189,23 @@ class AesGcmBinlogEncryptor : public BinlogEncryptor {
   file_util::ReadResultCode Read(file::InputFile *file, off_t end_of_file,
                                  Buffer *dst) override;
 
-  // Write one event to file at current position.
+  // An event larger than max_size is decrypted as it is read and its tag
+  // checked when the last part is read. Hence parts are returned before
+  // the event is authenticated, ReadMore() of the last part fails if the
+  // event was tampered with.
+  file_util::ReadResultCode ReadPart(file::InputFile *file, off_t end_of_file,
+                                     size_t max_size, Buffer *dst,
+                                     size_t *remaining) override;
+  file_util::ReadResultCode ReadMore(file::InputFile *file, size_t size,
+                                     Buffer *dst) override;
+
+  // Write one event to file at current position. Events larger than
+  // --ripple_large_event_size are encrypted and written in parts of that
+  // size.
   bool Write(file::AppendOnlyFile *file, absl::string_view src) override;
 
+  bool Tell(file::BaseFile *file, int64_t *offset) override;
+
   // Get StartEncryption event
   // return 0 if none needed
   //        1 if event added to dst
@@ -137,17 +213,119 @@ class AesGcmBinlogEncryptor : public BinlogEncryptor {
   int GetStartEncryptionEvent(const LogEventHeader& header,
                               Buffer *dst) const override;
 
+ protected:
+  // Cipher contexts of one thread. They are keyed on first use and only
+  // get a new iv per event.
+  struct Cipher;
+
+  // Get cipher contexts for slot, 0 is the calling thread and other
+  // slots are worker threads. Call GetCipher(0) before a parallel
+  // operation so that the contexts of all slots are allocated.
+  Cipher *GetCipher(int slot);
+
+  // Encrypt len bytes at src as one event or block at pos, storing
+  // length, encrypted data and tag (len + GetExtraSize(len) bytes) in dst.
+  bool EncryptTo(Cipher *cipher, off_t pos, const uint8_t *src, int len,
+                 uint8_t *dst);
+
+  // Decrypt the len bytes (as stored by EncryptTo) at src into dst,
+  // which has room for the decrypted length stored in src.
+  bool DecryptTo(Cipher *cipher, off_t pos, const uint8_t *src, int len,
+                 uint8_t *dst);
+
+  // Event being read in parts.
+  size_t remaining_;   // bytes of it not yet read
+  int64_t event_end_;  // position after it
+
  private:
+  // Set the iv of the encrypter or decrypter of cipher for the event or
+  // block at pos, keying it on first use.
+  bool InitEncrypter(Cipher *cipher, off_t pos);
+  bool InitDecrypter(Cipher *cipher, off_t pos);
+
+  // Encrypt and write an event in parts of --ripple_large_event_size.
+  bool WriteLarge(file::AppendOnlyFile *file, int64_t offset,
+                  absl::string_view src);
+
   Buffer iv_;
   Buffer key_;
   Buffer buffer_;
   int crypt_scheme_;
   uint32_t key_version_;
   std::unique_ptr<KeyHandler> key_handler_;
+  std::vector<std::unique_ptr<Cipher>> ciphers_;
+};
+
+// Encrypts blocks of events rather than single events, so that the length,
+// the tag and the cipher setup are paid once per block.
+//
+// Events are written as a stream cut into blocks of kBlockSize bytes, a
+// block has the same format as an event encrypted by AesGcmBinlogEncryptor.
+// Write() buffers events and writes the blocks that are full, Flush()
+// writes a last partial block. Read() decrypts a block once and returns its
+// events one by one. An event larger than a block spans several blocks,
+// which are encrypted and decrypted in parallel by up to
+// --ripple_encryption_threads threads.
+//
+// The position of an event is the offset at which its last block would end
+// if the event was the last one of that block. So the position of an event
+// ending a block is a file offset while other positions can not be seeked
+// to. Binlog flushes when a transaction completes, hence all positions
+// given to readers are at block boundaries.
+class BlockBinlogEncryptor : public AesGcmBinlogEncryptor {
+ public:
+  static const int kBlockSize = 64 * 1024;
+
+  // Note that BlockBinlogEncryptor takes ownership of KeyHandler
+  BlockBinlogEncryptor(int crypt_scheme, KeyHandler *key_handler);
+  BlockBinlogEncryptor(const BlockBinlogEncryptor&);
+
+  bool Init() override;
+
+  // Make copy of this encryptor, buffered events are not copied.
+  BinlogEncryptor *Copy() const override;
+
+  // Extra size is added for each block an event starts.
+  int GetExtraSize(int len) const override;
+
+  file_util::ReadResultCode Read(file::InputFile *file, off_t end_of_file,
+                                 Buffer *dst) override;
+  file_util::ReadResultCode ReadPart(file::InputFile *file, off_t end_of_file,
+                                     size_t max_size, Buffer *dst,
+                                     size_t *remaining) override;
+  file_util::ReadResultCode ReadMore(file::InputFile *file, size_t size,
+                                     Buffer *dst) override;
+
+  // Events are encrypted as soon as a block is full, so at most
+  // --ripple_large_event_size bytes of a large event are buffered.
+  bool Write(file::AppendOnlyFile *file, absl::string_view src) override;
+
+  bool Flush(file::AppendOnlyFile *file) override;
+  void Discard() override { pending_.clear(); }
+
+  bool HasBufferedEvents() const override { return !pending_.empty(); }
+
+  bool Tell(file::BaseFile *file, int64_t *offset) override;
+
+ private:
+  Buffer block_;       // decrypted block being read
+  size_t block_pos_;   // offset of next byte to read in block_
+  Buffer pending_;     // events written but not yet encrypted
+  Buffer encrypted_;
+  off_t end_of_file_;  // of the event being read in parts
+
+  // Encrypt and write the first len bytes of pending_.
+  bool WriteBlocks(file::AppendOnlyFile *file, size_t len);
+
+  // Read size bytes of the event stream, appending them to dst.
+  file_util::ReadResultCode ReadBytes(file::InputFile *file,
+                                      off_t end_of_file, size_t size,
+                                      Buffer *dst);
 };
 
 class NullBinlogEncryptor : public BinlogEncryptor {
  public:
+  NullBinlogEncryptor() : remaining_(0), event_end_(0) {}
   virtual ~NullBinlogEncryptor() {}
   bool Init() override { return true; }
 
@@ -159,12 +337,19 @@ class NullBinlogEncryptor : public BinlogEncryptor {
   // end_of_file will be made.
   file_util::ReadResultCode Read(file::InputFile *file, off_t end_of_file,
                                  Buffer *dst) override;
+  file_util::ReadResultCode ReadPart(file::InputFile *file, off_t end_of_file,
+                                     size_t max_size, Buffer *dst,
+                                     size_t *remaining) override;
+  file_util::ReadResultCode ReadMore(file::InputFile *file, size_t size,
+                                     Buffer *dst) override;
 
   // Write one event to file at current position.
   bool Write(file::AppendOnlyFile *file, absl::string_view src) override;
 
+  bool Tell(file::BaseFile *file, int64_t *offset) override;
+
   // Get extra size needed for the encryption.
-  int GetExtraSize() const override { return 0; }
+  int GetExtraSize(int len) const override { return 0; }
 
   // Get StartEncryption event.
   // return 0 if none needed
@@ -174,6 +359,11 @@ class NullBinlogEncryptor : public BinlogEncryptor {
                               Buffer *dst) const override {
     return 0;
   }
+
+ private:
+  // Event being read in parts.
+  size_t remaining_;   // bytes of it not yet read
+  int64_t event_end_;  // position after it
 };
 
 class BinlogEncryptorFactory {
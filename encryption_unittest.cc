@@ -17,6 +17,7 @@
 #include "gtest/gtest.h"
 
 #include "file.h"
+#include "flags.h"
 #include "log_event.h"
 #include "mysql_constants.h"
 
@@ -40,8 +41,9 @@ TEST(KeyHandler, Basic) {
 
 TEST(BinlogEncryptorFactory, Basic) {
   std::vector<int> list = {
-    0,   // NullBinlogEncryptor
-    255  // Aes+ExampleKeyHandler
+    0,    // NullBinlogEncryptor
+    255,  // Aes+ExampleKeyHandler
+    254   // Block Aes+ExampleKeyHandler
   };
   for (auto crypt_scheme : list) {
     BinlogEncryptor *enc = BinlogEncryptorFactory::GetInstance(crypt_scheme);
@@ -73,11 +75,11 @@ TEST(AesGcmBinlogEncryptor, Basic) {
   // Encrypt same event twice, once @offset and once @offset+1.
   Buffer enc1;
   EXPECT_TRUE(encryptor.Encrypt(offset, event.data(), event.size(), &enc1));
-  EXPECT_EQ(enc1.size(), event.size() + encryptor.GetExtraSize());
+  EXPECT_EQ(enc1.size(), event.size() + encryptor.GetExtraSize(event.size()));
 
   Buffer enc2;
   EXPECT_TRUE(encryptor.Encrypt(offset + 1, event.data(), event.size(), &enc2));
-  EXPECT_EQ(enc2.size(), event.size() + encryptor.GetExtraSize());
+  EXPECT_EQ(enc2.size(), event.size() + encryptor.GetExtraSize(event.size()));
 
   // This should be different encrypted data.
   EXPECT_EQ(enc1.size(), enc2.size());
@@ -138,8 +140,14 @@ void TestReadWrite(BinlogEncryptor *encryptor, const file::Factory &factory) {
   for (int i = 0; i < 256; i++) {
     events.push_back(constants::LOG_EVENT_HEADER_LENGTH +
                      (rand_r(&seed) % 1024));
+    if (i % 64 == 0) {
+      // and some large ones.
+      events.push_back(constants::LOG_EVENT_HEADER_LENGTH +
+                       (rand_r(&seed) % (1024 * 1024)));
+    }
   }
 
+  std::vector<int64_t> positions;
   for (int size : events) {
     int val = (size & 255);
 
@@ -152,19 +160,63 @@ void TestReadWrite(BinlogEncryptor *encryptor, const file::Factory &factory) {
     header.event_length = size;
     header.type = val;
     header.SerializeToBuffer(buf.data(), constants::LOG_EVENT_HEADER_LENGTH);
+    // The position of an event is known before it is written.
+    int extra = encryptor->GetExtraSize(size);
+    int64_t start, end;
+    EXPECT_TRUE(encryptor->Tell(ofile, &start));
     EXPECT_TRUE(encryptor->Write(ofile, buf.data(), buf.size()));
+    EXPECT_TRUE(encryptor->Tell(ofile, &end));
+    EXPECT_EQ(end, start + size + extra);
+    positions.push_back(end);
     EXPECT_TRUE(ofile->Flush());
   }
+  EXPECT_TRUE(encryptor->Flush(ofile));
+  EXPECT_FALSE(encryptor->HasBufferedEvents());
+  EXPECT_TRUE(ofile->Flush());
 
   int64_t end_of_file;
   ofile->Tell(&end_of_file);
+  int64_t position;
+  EXPECT_TRUE(encryptor->Tell(ofile, &position));
+  EXPECT_EQ(position, end_of_file);
   EXPECT_TRUE(ifile->Seek(0));
-  for (int size : events) {
+  // Mix reads through the vtable with the direct EventReader, and reads
+  // of whole events with reads in parts.
+  BinlogEncryptor::EventReader read_event = encryptor->GetEventReader();
+  for (size_t n = 0; n < events.size(); n++) {
+    int size = events[n];
     int val = (size & 255);
 
     Buffer buf;
-    EXPECT_EQ(encryptor->Read(ifile, end_of_file, &buf), file_util::READ_OK);
+    size_t remaining;
+    if (n % 3 == 0) {
+      EXPECT_EQ(encryptor->Read(ifile, end_of_file, &buf),
+                file_util::READ_OK);
+      EXPECT_TRUE(encryptor->Tell(ifile, &position));
+    } else if (n % 3 == 1) {
+      EXPECT_EQ(read_event(encryptor, ifile, end_of_file, SIZE_MAX, &buf,
+                           &remaining, &position),
+                file_util::READ_OK);
+      EXPECT_EQ(remaining, 0);
+    } else {
+      EXPECT_EQ(read_event(encryptor, ifile, end_of_file, 1000, &buf,
+                           &remaining, &position),
+                file_util::READ_OK);
+      // Only the header of a larger event is read.
+      EXPECT_EQ(buf.size(),
+                size > 1000 ? constants::LOG_EVENT_HEADER_LENGTH : size);
+      EXPECT_EQ(buf.size() + remaining, size);
+      Buffer part;
+      while (remaining > 0) {
+        size_t len = std::min<size_t>(remaining, 4096);
+        ASSERT_EQ(encryptor->ReadMore(ifile, len, &part), file_util::READ_OK);
+        EXPECT_EQ(part.size(), len);
+        buf.Append(part.data(), part.size());
+        remaining -= len;
+      }
+    }
     EXPECT_EQ(buf.size(), size);
+    EXPECT_EQ(position, positions[n]);
     bool ok = true;
     for (int i = constants::LOG_EVENT_HEADER_LENGTH; i < buf.size(); i++) {
       if (ok && (buf.data()[i] != val)) {
@@ -193,11 +245,98 @@ TEST(AesGcmBinlogEncryptor, ReadWriteFILE) {
   TestReadWrite(&encryptor, file::FILE_Factory());
 }
 
+TEST(BlockBinlogEncryptor, ReadWriteFILE) {
+  BlockBinlogEncryptor encryptor(254, KeyHandler::GetInstance(true));
+  EXPECT_TRUE(encryptor.Init());
+  TestReadWrite(&encryptor, file::FILE_Factory());
+}
+
+TEST(BlockBinlogEncryptor, Blocks) {
+  BlockBinlogEncryptor encryptor(254, KeyHandler::GetInstance(true));
+  EXPECT_TRUE(encryptor.Init());
+  file::AppendOnlyFile *ofile;
+  std::string name =
+      std::string(GetTestDir()) + "/test_blocks." + std::to_string(getpid());
+  ASSERT_TRUE(file::FILE_Factory().Open(&ofile, name, "w"));
+
+  Buffer event;
+  event.resize(100);
+  LogEventHeader header;
+  memset(&header, 0, sizeof(header));
+  header.event_length = event.size();
+  header.SerializeToBuffer(event.data(), constants::LOG_EVENT_HEADER_LENGTH);
+
+  // Events are buffered until flushed or until a block is full.
+  int64_t offset;
+  EXPECT_EQ(encryptor.GetExtraSize(event.size()), 20);
+  EXPECT_TRUE(encryptor.Write(ofile, event));
+  EXPECT_EQ(encryptor.GetExtraSize(event.size()), 0);
+  EXPECT_TRUE(encryptor.Write(ofile, event));
+  EXPECT_TRUE(encryptor.HasBufferedEvents());
+  EXPECT_TRUE(ofile->Tell(&offset));
+  EXPECT_EQ(offset, 0);
+  EXPECT_TRUE(encryptor.Flush(ofile));
+  EXPECT_TRUE(ofile->Tell(&offset));
+  EXPECT_EQ(offset, 2 * event.size() + 20);
+
+  // Full blocks are written, the rest is buffered.
+  const int count = BlockBinlogEncryptor::kBlockSize / event.size() + 1;
+  for (int i = 0; i < count; i++) {
+    EXPECT_TRUE(encryptor.Write(ofile, event));
+  }
+  EXPECT_TRUE(encryptor.HasBufferedEvents());
+  EXPECT_TRUE(ofile->Tell(&offset));
+  EXPECT_EQ(offset, 2 * event.size() + 20 +
+                    BlockBinlogEncryptor::kBlockSize + 20);
+
+  // A large event starts a block for each kBlockSize bytes.
+  Buffer large;
+  large.resize(3 * BlockBinlogEncryptor::kBlockSize);
+  header.event_length = large.size();
+  header.SerializeToBuffer(large.data(), constants::LOG_EVENT_HEADER_LENGTH);
+  int64_t start, end;
+  EXPECT_EQ(encryptor.GetExtraSize(large.size()), 3 * 20);
+  EXPECT_TRUE(encryptor.Tell(ofile, &start));
+  EXPECT_TRUE(encryptor.Write(ofile, large));
+  EXPECT_TRUE(encryptor.Tell(ofile, &end));
+  EXPECT_EQ(end, start + large.size() + 3 * 20);
+  EXPECT_TRUE(encryptor.Flush(ofile));
+  EXPECT_TRUE(ofile->Tell(&offset));
+  EXPECT_EQ(offset, end);
+
+  // Discarded events are not written.
+  EXPECT_TRUE(encryptor.Write(ofile, event));
+  EXPECT_TRUE(encryptor.HasBufferedEvents());
+  encryptor.Discard();
+  EXPECT_FALSE(encryptor.HasBufferedEvents());
+  EXPECT_TRUE(encryptor.Tell(ofile, &offset));
+  EXPECT_EQ(offset, end);
+  EXPECT_TRUE(encryptor.Flush(ofile));
+  EXPECT_TRUE(ofile->Tell(&offset));
+  EXPECT_EQ(offset, end);
+
+  ASSERT_TRUE(ofile->Close());
+  ASSERT_TRUE(file::FILE_Factory().Delete(name));
+}
+
 TEST(NullBinlogEncryptor, ReadWriteFILE) {
   NullBinlogEncryptor encryptor;
   TestReadWrite(&encryptor, file::FILE_Factory());
 }
 
+TEST(BinlogEncryptor, ReadWriteLargeEvents) {
+  // Large events are written in parts.
+  uint64_t large_event_size = FLAGS_ripple_large_event_size;
+  FLAGS_ripple_large_event_size = 200 * 1024;
+  for (int scheme : {0, 255, 254}) {
+    std::unique_ptr<BinlogEncryptor> encryptor(
+        BinlogEncryptorFactory::GetInstance(scheme));
+    EXPECT_TRUE(encryptor->Init());
+    TestReadWrite(encryptor.get(), file::FILE_Factory());
+  }
+  FLAGS_ripple_large_event_size = large_event_size;
+}
+
 TEST(AesGcmBinlogEncryptor, LogEvent) {
   AesGcmBinlogEncryptor encryptor(255, KeyHandler::GetInstance(true));
   encryptor.Init();
@@ -233,4 +372,22 @@ TEST(AesGcmBinlogEncryptor, LogEvent) {
   delete encryptor2;
 }
 
+TEST(BlockBinlogEncryptor, LogEvent) {
+  BlockBinlogEncryptor encryptor(254, KeyHandler::GetInstance(true));
+  encryptor.Init();
+
+  Buffer buf;
+  LogEventHeader header;
+  memset(&header, 0, sizeof(header));
+  EXPECT_EQ(encryptor.GetStartEncryptionEvent(header, &buf), 1);
+
+  RawLogEventData event;
+  EXPECT_TRUE(event.ParseFromBuffer(buf.data(), buf.size()));
+
+  std::unique_ptr<BinlogEncryptor> encryptor2(
+      BinlogEncryptorFactory::GetInstance(event));
+  EXPECT_TRUE(dynamic_cast<BlockBinlogEncryptor*>(encryptor2.get()) !=
+              nullptr);
+}
+
 }  // namespace mysql_ripple
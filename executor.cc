@@ -14,18 +14,34 @@
 
 #include "executor.h"
 
-#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
 
-#include "absl/time/time.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
-extern "C" void *ThreadPoolExecutorRun_C(void *arg) {
-  reinterpret_cast<mysql_ripple::ThreadPoolExecutor::Thread*>(arg)->Run();
-  return nullptr;
-}
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "logging.h"
 
 namespace mysql_ripple {
 
-ThreadPoolExecutor::ThreadPoolExecutor() {
+ThreadPoolExecutor::ThreadPoolExecutor()
+    : ThreadPoolExecutor(Options()) {
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(const Options &options)
+    : options_(options),
+      stopping_(false),
+      threads_(0),
+      idle_threads_(0),
+      metrics_trigger_([this]() { SetMetrics(); }) {
+  absl::MutexLock lock(&mutex_);
+  while (threads_ < std::min(options_.min_threads, options_.max_threads)) {
+    if (!StartThread())
+      break;
+  }
 }
 
 ThreadPoolExecutor::~ThreadPoolExecutor() {
@@ -34,49 +50,180 @@ ThreadPoolExecutor::~ThreadPoolExecutor() {
 }
 
 bool ThreadPoolExecutor::Execute(RunnableInterface *runnable) {
-  Thread *thr = new Thread();
-  thr->executor_ = this;
-  thr->runnable_ = runnable;
-  absl::MutexLock lock(&mutex_);
-  if (!pthread_create(&thr->thread_, nullptr, ThreadPoolExecutorRun_C, thr)) {
-    running_threads_.emplace(thr->thread_, thr);
-    return true;
+  JoinExitedThreads();
+
+  mutex_.Lock();
+  if (stopping_) {
+    mutex_.Unlock();
+    runnable->Unref();
+    return false;
+  }
+  queue_.push_back({runnable, monitoring::MonotonicMicros()});
+  if (static_cast<size_t>(idle_threads_) < queue_.size() &&
+      threads_ < options_.max_threads &&
+      !StartThread() && threads_ == 0) {
+    queue_.pop_back();
+    mutex_.Unlock();
+    runnable->Unref();
+    return false;
   }
-  return false;
+  mutex_.Unlock();
+  return true;
 }
 
 void ThreadPoolExecutor::Stop() {
-  absl::MutexLock lock(&mutex_);
-  for (auto& thread : running_threads_) {
-    Thread *obj = thread.second;
-    obj->runnable_->Stop();
+  std::deque<Task> queued;
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+    for (RunnableInterface *runnable : running_) {
+      runnable->Stop();
+    }
+    queued.swap(queue_);
+  }
+  for (Task &task : queued) {
+    task.runnable->Unref();
   }
 }
 
 void ThreadPoolExecutor::WaitStopped() {
   Stop();
 
+  {
+    absl::MutexLock lock(&mutex_);
+    auto check = [this]() { return threads_ == 0; };
+    mutex_.Await(absl::Condition(&check));
+  }
+  JoinExitedThreads();
+}
+
+int ThreadPoolExecutor::GetThreads() const {
+  absl::MutexLock lock(&mutex_);
+  return threads_;
+}
+
+int ThreadPoolExecutor::GetBusyThreads() const {
+  absl::MutexLock lock(&mutex_);
+  return running_.size();
+}
+
+int ThreadPoolExecutor::GetQueued() const {
   absl::MutexLock lock(&mutex_);
-  auto check = [this]() { return running_threads_.empty(); };
-  mutex_.Await(absl::Condition(&check));
-
-  for (auto& thread : terminated_threads_) {
-    void* retval;
-    pthread_t id = thread.first;
-    Thread *obj = thread.second;
-    pthread_join(id, &retval);
-    delete obj;
+  return queue_.size();
+}
+
+bool ThreadPoolExecutor::StartThread() {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (options_.stack_size > 0) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t stack_size = std::max<size_t>(options_.stack_size,
+                                         PTHREAD_STACK_MIN);
+    stack_size = (stack_size + page_size - 1) / page_size * page_size;
+    pthread_attr_setstacksize(&attr, stack_size);
+  }
+  if (!options_.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : options_.cpus) {
+      CPU_SET(cpu, &cpus);
+    }
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+
+  pthread_t thread;
+  int error = pthread_create(&thread, &attr, WorkerMain, this);
+  pthread_attr_destroy(&attr);
+  if (error != 0) {
+    LOG(ERROR) << "Failed to start worker thread: " << strerror(error)
+               << ", threads: " << threads_;
+    return false;
   }
-  terminated_threads_.clear();
+  // Counted as idle until it takes a runnable, so that runnables queued
+  // before it is scheduled do not start more workers.
+  threads_++;
+  idle_threads_++;
+  return true;
 }
 
-void ThreadPoolExecutor::Thread::Run() {
-  runnable_->Run();
-  absl::MutexLock lock(&executor_->mutex_);
-  runnable_->Unref();
-  runnable_ = nullptr;
-  executor_->running_threads_.erase(thread_);
-  executor_->terminated_threads_.emplace(thread_, this);
+void ThreadPoolExecutor::JoinExitedThreads() {
+  std::vector<pthread_t> exited;
+  {
+    absl::MutexLock lock(&mutex_);
+    exited.swap(exited_threads_);
+  }
+  for (pthread_t thread : exited) {
+    void *retval;
+    pthread_join(thread, &retval);
+  }
+}
+
+void *ThreadPoolExecutor::WorkerMain(void *arg) {
+  static_cast<ThreadPoolExecutor *>(arg)->Work();
+  return nullptr;
+}
+
+void ThreadPoolExecutor::Work() {
+  auto has_work = [this]() { return stopping_ || !queue_.empty(); };
+  mutex_.Lock();
+  while (true) {
+    bool woken = mutex_.AwaitWithTimeout(absl::Condition(&has_work),
+                                         options_.idle_timeout);
+    if (stopping_)
+      break;
+    if (!woken) {
+      // Idle workers above min_threads exit.
+      if (threads_ > options_.min_threads)
+        break;
+      continue;
+    }
+
+    RunnableInterface *runnable = queue_.front().runnable;
+    queue_.pop_front();
+    idle_threads_--;
+    running_.insert(runnable);
+    mutex_.Unlock();
+    runnable->Run();
+    mutex_.Lock();
+    running_.erase(runnable);
+    mutex_.Unlock();
+    runnable->Unref();
+    mutex_.Lock();
+    idle_threads_++;
+  }
+  // Joined by the next Execute() or WaitStopped().
+  idle_threads_--;
+  threads_--;
+  exited_threads_.push_back(pthread_self());
+  mutex_.Unlock();
+}
+
+void ThreadPoolExecutor::SetMetrics() {
+  absl::MutexLock lock(&mutex_);
+  monitoring::executor_threads->Set(threads_);
+  monitoring::executor_busy_threads->Set(running_.size());
+  monitoring::executor_queued->Set(queue_.size());
+  monitoring::executor_queue_wait->Set(
+      queue_.empty() ? 0 :
+      monitoring::MonotonicMicros() - queue_.front().queued_time);
+}
+
+bool ThreadPoolExecutor::ParseCpuList(absl::string_view str,
+                                      std::vector<int> *cpus) {
+  cpus->clear();
+  for (absl::string_view range : absl::StrSplit(str, ',', absl::SkipEmpty())) {
+    std::vector<absl::string_view> ends = absl::StrSplit(range, '-');
+    int first, last;
+    if (ends.size() > 2 || !absl::SimpleAtoi(ends[0], &first) ||
+        !absl::SimpleAtoi(ends.back(), &last) || first < 0 ||
+        first > last || last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return true;
 }
 
 }  // namespace mysql_ripple
@@ -19,10 +19,18 @@
 
 #include <pthread.h>
 
-#include <unordered_map>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
 
-#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "monitoring.h"
 
 namespace mysql_ripple {
 
@@ -38,28 +46,67 @@ class RunnableInterface {
   virtual void Unref() = 0;
 };
 
+// Runs runnables on a pool of worker threads.
+//
+// min_threads workers are started up front and kept. More are started when
+// all are busy, up to max_threads, and exit again after being idle for
+// idle_timeout. Runnables executed while max_threads are busy wait in a
+// queue for a worker. Exited workers are joined by the next Execute().
 class ThreadPoolExecutor {
  public:
+  struct Options {
+    int min_threads = 0;
+    int max_threads = INT_MAX;
+    absl::Duration idle_timeout = absl::Seconds(60);
+    size_t stack_size = 0;  // bytes, 0 = pthread default
+    std::vector<int> cpus;  // pin workers to these cpus, empty = any
+  };
+
   ThreadPoolExecutor();
+  explicit ThreadPoolExecutor(const Options &options);
   virtual ~ThreadPoolExecutor();
 
+  // Run runnable on a worker, or queue it if max_threads are busy.
+  // Returns false if the executor is stopped or no worker could be
+  // started, runnable is then Unref()'d.
   virtual bool Execute(RunnableInterface *runnable);
 
+  // Stop() running runnables and do not start queued ones.
   virtual void Stop();
 
+  // Wait for runnables and workers to finish.
   virtual void WaitStopped();
 
-  // A managed thread.
-  struct Thread {
-    pthread_t thread_;
-    ThreadPoolExecutor *executor_;
-    RunnableInterface *runnable_;
-    void Run();
-  };
+  int GetThreads() const;
+  int GetBusyThreads() const;
+  int GetQueued() const;
+
+  // Parse a list of cpus like "0-3,8".
+  static bool ParseCpuList(absl::string_view str, std::vector<int> *cpus);
+
  private:
-  absl::Mutex mutex_;
-  absl::flat_hash_map<pthread_t, Thread *> running_threads_;
-  absl::flat_hash_map<pthread_t, Thread *> terminated_threads_;
+  struct Task {
+    RunnableInterface *runnable;
+    int64_t queued_time;  // MonotonicMicros()
+  };
+
+  const Options options_;
+  mutable absl::Mutex mutex_;
+  bool stopping_ ABSL_GUARDED_BY(mutex_);
+  int threads_ ABSL_GUARDED_BY(mutex_);
+  int idle_threads_ ABSL_GUARDED_BY(mutex_);
+  std::deque<Task> queue_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_set<RunnableInterface *> running_ ABSL_GUARDED_BY(mutex_);
+  std::vector<pthread_t> exited_threads_ ABSL_GUARDED_BY(mutex_);
+
+  monitoring::CallbackTrigger metrics_trigger_;
+
+  bool StartThread() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void JoinExitedThreads() ABSL_LOCKS_EXCLUDED(mutex_);
+  void SetMetrics();
+
+  static void *WorkerMain(void *arg);
+  void Work();
 };
 
 }  // namespace mysql_ripple
@@ -0,0 +1,131 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "executor.h"
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace mysql_ripple {
+
+namespace {
+
+// Runs until stopped.
+class TestRunnable : public RunnableInterface {
+ public:
+  void Run() override {
+    started_.Notify();
+    stop_.WaitForNotification();
+  }
+  void Stop() override {
+    if (!stop_.HasBeenNotified())
+      stop_.Notify();
+  }
+  void Unref() override { unrefs_++; }
+
+  absl::Notification started_;
+  absl::Notification stop_;
+  std::atomic<int> unrefs_{0};
+};
+
+void WaitFor(const std::function<bool()> &check) {
+  while (!check())
+    absl::SleepFor(absl::Milliseconds(1));
+}
+
+}  // namespace
+
+TEST(ThreadPoolExecutor, GrowsAndQueues) {
+  ThreadPoolExecutor::Options options;
+  options.min_threads = 1;
+  options.max_threads = 2;
+  options.stack_size = 64 * 1024;
+  ThreadPoolExecutor executor(options);
+  EXPECT_EQ(executor.GetThreads(), 1);
+
+  std::vector<TestRunnable> runnables(3);
+  for (TestRunnable &runnable : runnables)
+    EXPECT_TRUE(executor.Execute(&runnable));
+  runnables[0].started_.WaitForNotification();
+  runnables[1].started_.WaitForNotification();
+  EXPECT_EQ(executor.GetThreads(), 2);
+  EXPECT_EQ(executor.GetBusyThreads(), 2);
+  EXPECT_EQ(executor.GetQueued(), 1);
+
+  // The queued runnable starts when a worker is free.
+  runnables[0].Stop();
+  runnables[2].started_.WaitForNotification();
+  WaitFor([&] { return runnables[0].unrefs_ == 1; });
+  EXPECT_EQ(executor.GetQueued(), 0);
+
+  executor.Stop();
+  executor.WaitStopped();
+  EXPECT_EQ(executor.GetThreads(), 0);
+  for (TestRunnable &runnable : runnables)
+    EXPECT_EQ(runnable.unrefs_, 1);
+  EXPECT_FALSE(executor.Execute(&runnables[0]));
+  EXPECT_EQ(runnables[0].unrefs_, 2);
+}
+
+TEST(ThreadPoolExecutor, IdleWorkersExit) {
+  ThreadPoolExecutor::Options options;
+  options.min_threads = 1;
+  options.idle_timeout = absl::Milliseconds(10);
+  ThreadPoolExecutor executor(options);
+
+  std::vector<TestRunnable> runnables(3);
+  for (TestRunnable &runnable : runnables)
+    EXPECT_TRUE(executor.Execute(&runnable));
+  for (TestRunnable &runnable : runnables)
+    runnable.started_.WaitForNotification();
+  EXPECT_EQ(executor.GetThreads(), 3);
+
+  for (TestRunnable &runnable : runnables)
+    runnable.Stop();
+  WaitFor([&] { return executor.GetThreads() == 1; });
+}
+
+TEST(ThreadPoolExecutor, StopUnrefsQueued) {
+  ThreadPoolExecutor::Options options;
+  options.max_threads = 1;
+  ThreadPoolExecutor executor(options);
+
+  TestRunnable running, queued;
+  EXPECT_TRUE(executor.Execute(&running));
+  EXPECT_TRUE(executor.Execute(&queued));
+  running.started_.WaitForNotification();
+  executor.Stop();
+  EXPECT_EQ(queued.unrefs_, 1);
+  executor.WaitStopped();
+  EXPECT_FALSE(queued.started_.HasBeenNotified());
+  EXPECT_EQ(running.unrefs_, 1);
+}
+
+TEST(ThreadPoolExecutor, ParseCpuList) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ThreadPoolExecutor::ParseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_TRUE(ThreadPoolExecutor::ParseCpuList("0-2,5", &cpus));
+  EXPECT_EQ(cpus, std::vector<int>({0, 1, 2, 5}));
+  EXPECT_FALSE(ThreadPoolExecutor::ParseCpuList("2-1", &cpus));
+  EXPECT_FALSE(ThreadPoolExecutor::ParseCpuList("1-2-3", &cpus));
+  EXPECT_FALSE(ThreadPoolExecutor::ParseCpuList("x", &cpus));
+}
+
+}  // namespace mysql_ripple
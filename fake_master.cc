@@ -0,0 +1,514 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fake_master.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "byte_order.h"
+#include "logging.h"
+#include "mysql_constants.h"
+#include "mysql_init.h"
+#include "resultset.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+namespace {
+
+// Get the GTID of trx from its first event.
+bool GetGTID(const Transaction &trx, GTID *gtid) {
+  RawLogEventData raw;
+  if (trx.events.empty() ||
+      !raw.ParsePartFromBuffer(trx.events[0].data(), trx.events[0].size()))
+    return false;
+  if (raw.header.type == constants::ET_GTID_MARIADB) {
+    GTIDEvent ev;
+    if (!ev.ParseFromRawLogEventData(raw))
+      return false;
+    *gtid = ev.gtid;
+    return true;
+  }
+  if (raw.header.type == constants::ET_GTID_MYSQL) {
+    GTIDMySQLEvent ev;
+    if (!ev.ParseFromRawLogEventData(raw))
+      return false;
+    *gtid = ev.gtid;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+SyntheticWorkload::SyntheticWorkload(const Options &options)
+    : options_(options), seq_no_(0) {
+  uuid_.ConstructFromServerId(options_.server_id);
+  // Pad statement so that the serialized QueryEvent gets event_size bytes.
+  QueryEvent ev;
+  ev.query = "INSERT INTO t1 VALUES ('')";
+  int size = constants::LOG_EVENT_HEADER_LENGTH + ev.PackLength();
+  statement_ = "INSERT INTO t1 VALUES ('" +
+      std::string(std::max(0, options_.event_size - size), 'x') + "')";
+}
+
+std::string SyntheticWorkload::GetServerVersion() const {
+  return options_.mariadb ? "10.3.0-MariaDB-ripple-benchmark"
+                          : "5.7.30-ripple-benchmark";
+}
+
+template <typename T>
+void SyntheticWorkload::AddEvent(const T &event, Transaction *trx) {
+  RawLogEventData raw;
+  raw.header.timestamp = 0;
+  raw.header.type = event.GetEventType();
+  raw.header.server_id = options_.server_id;
+  raw.header.event_length = raw.header.PackLength() + event.PackLength();
+  raw.header.nextpos = 0;
+  raw.header.flags = 0;
+
+  trx->events.emplace_back();
+  Buffer *buf = &trx->events.back();
+  raw.SerializeToBuffer(buf);
+  event.SerializeToBuffer(buf->data() + raw.header.PackLength(),
+                          event.PackLength());
+}
+
+bool SyntheticWorkload::NextTransaction(Transaction *trx) {
+  trx->events.clear();
+  trx->timestamp = 0;
+  if (seq_no_ >= options_.transactions)
+    return false;
+  seq_no_++;
+
+  if (options_.mariadb) {
+    GTIDEvent gtid;
+    gtid.gtid.set_server_id(options_.server_id);
+    gtid.gtid.seq_no = seq_no_;
+    gtid.gtid.domain_id = 0;
+    // SerializeToBuffer() takes the standalone and group commit bits from
+    // the unpacked fields, not from flags, so all of them must be set.
+    gtid.flags = 0;
+    gtid.is_standalone = options_.statements == 0;
+    gtid.has_group_commit_id = 0;
+    gtid.commit_no = 0;
+    AddEvent(gtid, trx);
+  } else {
+    GTIDMySQLEvent gtid;
+    gtid.gtid.server_id.uuid = uuid_;
+    gtid.gtid.seq_no = seq_no_;
+    gtid.commit_flag = 1;
+    AddEvent(gtid, trx);
+    if (options_.statements > 0) {
+      QueryEvent begin;
+      begin.query = "BEGIN";
+      AddEvent(begin, trx);
+    }
+  }
+
+  QueryEvent query;
+  query.query = statement_;
+  for (int i = 0; i < std::max(1, options_.statements); i++) {
+    AddEvent(query, trx);
+  }
+
+  if (options_.statements > 0) {
+    XIDEvent xid;
+    xid.xid = seq_no_;
+    AddEvent(xid, trx);
+  }
+
+  return true;
+}
+
+FakeMaster::FakeMaster(mysql::ServerPort *port, EventSource *source,
+                       const Options &options)
+    : port_(port), source_(source), options_(options),
+      stop_(false), done_(false), transactions_sent_(0), bytes_sent_(0),
+      start_time_(0), end_time_(0), send_time_chunks_(0),
+      connection_(nullptr), semi_sync_(false), position_(0),
+      has_last_(false), taken_(0), first_timestamp_(0) {
+  // Reserve chunk pointers up front so that GetSendTime() can read
+  // them concurrently with RecordSendTime().
+  send_times_.resize(1 << 12);
+}
+
+FakeMaster::~FakeMaster() {
+  Stop();
+}
+
+void FakeMaster::Start() {
+  thread_ = std::thread(&FakeMaster::Run, this);
+}
+
+void FakeMaster::Stop() {
+  if (!thread_.joinable())
+    return;
+  stop_.store(true);
+  port_->Shutdown();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (connection_ != nullptr) {
+      connection_->Abort();
+    }
+  }
+  thread_.join();
+}
+
+int64_t FakeMaster::GetSendTime(uint64_t transaction) const {
+  size_t chunk = transaction / kSendTimeChunk;
+  if (chunk >= send_time_chunks_.load(std::memory_order_acquire))
+    return 0;
+  return send_times_[chunk][transaction % kSendTimeChunk].load(
+      std::memory_order_acquire);
+}
+
+void FakeMaster::RecordSendTime(uint64_t transaction, int64_t now) {
+  size_t chunk = transaction / kSendTimeChunk;
+  if (chunk >= send_times_.size())
+    return;
+  if (chunk >= send_time_chunks_.load(std::memory_order_relaxed)) {
+    send_times_[chunk].reset(new std::atomic<int64_t>[kSendTimeChunk]());
+    send_time_chunks_.store(chunk + 1, std::memory_order_release);
+  }
+  send_times_[chunk][transaction % kSendTimeChunk].store(
+      now, std::memory_order_release);
+}
+
+void FakeMaster::Run() {
+  mysql::ThreadInit();
+  while (!stop_.load()) {
+    mysql::ServerConnection *con = port_->Accept();
+    if (con == nullptr)
+      break;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      connection_ = con;
+    }
+    if (!stop_.load()) {
+      ServeConnection();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      connection_ = nullptr;
+    }
+    con->Disconnect();
+    delete con;
+  }
+  mysql::ThreadDeinit();
+}
+
+void FakeMaster::ServeConnection() {
+  protocol_.reset(new mysql::Protocol(connection_));
+  semi_sync_ = false;
+  requested_.Reset();
+  if (!protocol_->Authenticate()) {
+    LOG(WARNING) << "Fake master failed to authenticate slave";
+    return;
+  }
+
+  while (!stop_.load()) {
+    connection_->Reset();
+    Connection::Packet p = connection_->ReadPacket();
+    if (p.length <= 0)
+      return;
+
+    switch (p.ptr[0]) {
+      case constants::COM_QUIT:
+        return;
+      case constants::COM_QUERY: {
+        absl::string_view query(reinterpret_cast<const char*>(p.ptr + 1),
+                                p.length - 1);
+        if (!HandleQuery(query))
+          return;
+        break;
+      }
+      case constants::COM_REGISTER_SLAVE:
+      case constants::COM_INIT_DB:
+        if (!protocol_->SendOK())
+          return;
+        break;
+      case constants::COM_BINLOG_DUMP:
+        // MariaDB slaves have set @slave_connect_state.
+        StreamEvents();
+        return;
+      case constants::COM_BINLOG_DUMP_GTID: {
+        mysql::COM_Binlog_Dump_GTID args;
+        if (!mysql::Protocol::Unpack(p.ptr + 1, p.length - 1, &args)) {
+          const char *msg = "Failed to parse arguments to COM_Binlog_Dump_GTID";
+          LOG(ERROR) << "Fake master: " << msg;
+          protocol_->SendERR(1236, "42000", msg);
+          return;
+        }
+        requested_.Assign(args.gtid_executed);
+        StreamEvents();
+        return;
+      }
+      default:
+        LOG(ERROR) << "Fake master got unhandled command: "
+                   << static_cast<unsigned>(p.ptr[0]);
+        return;
+    }
+  }
+}
+
+bool FakeMaster::SendVariable(const char *name, const std::string &value) {
+  resultset::Resultset result;
+  result.column_definition = {
+    {nullptr, nullptr, "Variable_name", constants::TYPE_VARCHAR, 255},
+    {nullptr, nullptr, "Value", constants::TYPE_VARCHAR, 255}};
+  result.rowFunction = resultset::NullRowFunction;
+  result.rows = {{{name}, {value.c_str()}}};
+  return protocol_->SendResultset(result);
+}
+
+bool FakeMaster::HandleQuery(absl::string_view query) {
+  if (absl::StartsWithIgnoreCase(query, "SHOW VARIABLES LIKE 'SERVER_ID'")) {
+    return SendVariable("server_id", std::to_string(options_.server_id));
+  }
+  if (absl::StartsWithIgnoreCase(query, "SHOW VARIABLES LIKE 'server_name'")) {
+    return SendVariable("server_name", "fake_master");
+  }
+  if (absl::StrContains(query, "rpl_semi_sync_master_enabled")) {
+    return SendVariable("rpl_semi_sync_master_enabled",
+                        options_.semi_sync_every > 0 ? "ON" : "OFF");
+  }
+  if (absl::StartsWithIgnoreCase(query, "SET @rpl_semi_sync_slave")) {
+    semi_sync_ = options_.semi_sync_every > 0;
+  }
+  const char kConnectState[] = "SET @slave_connect_state=";
+  if (absl::StartsWithIgnoreCase(query, kConnectState)) {
+    GTIDStartPosition start;
+    if (!start.ParseMariaDBConnectState(
+            query.substr(strlen(kConnectState)))) {
+      LOG(ERROR) << "Fake master failed to parse: " << query;
+      protocol_->SendERR(1236, "42000", "Failed to parse slave_connect_state");
+      return false;
+    }
+    requested_.Assign(start);
+  }
+  return protocol_->SendOK();
+}
+
+bool FakeMaster::SendArtificialEvent(const EventBase &event) {
+  RawLogEventData raw;
+  raw.header.timestamp = 0;
+  raw.header.type = event.GetEventType();
+  raw.header.server_id = options_.server_id;
+  raw.header.event_length = raw.header.PackLength() + event.PackLength();
+  raw.header.nextpos = 0;
+  raw.header.flags = 0;
+
+  Buffer buf;
+  raw.SerializeToBuffer(&buf);
+  event.SerializeToBuffer(buf.data() + raw.header.PackLength(),
+                          event.PackLength());
+  return SendEvent(&buf, true, false);
+}
+
+bool FakeMaster::SendEvent(Buffer *event, bool artificial, bool request_ack) {
+  uint32_t length = event->size() + 4;  // include checksum
+  if (!artificial) {
+    position_ += length;
+  }
+
+  Buffer packet;
+  int prefix = semi_sync_ ? 3 : 1;
+  uint8_t *ptr = packet.Append(prefix + length);
+  ptr[0] = 0;
+  if (semi_sync_) {
+    ptr[1] = constants::SEMI_SYNC_HEADER;
+    ptr[2] = request_ack ? 1 : 0;
+  }
+  memcpy(ptr + prefix, event->data(), event->size());
+  uint8_t *header = ptr + prefix;
+  if (!artificial) {
+    byte_order::store4(header + 0,
+                       static_cast<uint32_t>(absl::ToUnixSeconds(absl::Now())));
+    byte_order::store4(header + 13, position_);
+  }
+  byte_order::store4(header + 9, length);
+  byte_order::store4(header + length - 4,
+                     mysql::Protocol::ComputeEventChecksum(header, length - 4));
+
+  if (!connection_->WritePacket(packet)) {
+    return false;
+  }
+  bytes_sent_.fetch_add(packet.size(), std::memory_order_relaxed);
+  return true;
+}
+
+bool FakeMaster::ReadSemiSyncReply() {
+  Connection::Packet p = connection_->ReadPacket();
+  if (p.length < 9 || p.ptr[0] != constants::SEMI_SYNC_HEADER) {
+    LOG(ERROR) << "Fake master got malformed semi-sync reply"
+               << ", length: " << p.length;
+    return false;
+  }
+  return true;
+}
+
+void FakeMaster::Pace(const Transaction &trx) {
+  absl::Time next = next_send_;
+  if (options_.rate > 0) {
+    next_send_ += absl::Seconds(1) / options_.rate;
+  }
+  if (options_.speed > 0 && trx.timestamp != 0) {
+    if (first_timestamp_ == 0) {
+      first_timestamp_ = trx.timestamp;
+      first_send_ = absl::Now();
+    }
+    int64_t elapsed = trx.timestamp > first_timestamp_ ?
+        trx.timestamp - first_timestamp_ : 0;
+    next = std::max(next,
+                    first_send_ + absl::Seconds(elapsed) / options_.speed);
+  }
+  absl::Time now = absl::Now();
+  if (next > now) {
+    absl::SleepFor(next - now);
+  }
+}
+
+bool FakeMaster::CanResume(bool *resend) {
+  *resend = has_last_ && !requested_.Contained(last_gtid_);
+  return GTIDList::Subset(sent_, requested_);
+}
+
+bool FakeMaster::TakeTransaction() {
+  while (true) {
+    if (has_last_) {
+      if (sent_.IsEmpty()) {
+        // Sources need not have consecutive sequence numbers.
+        sent_ = GTIDList(GTIDList::KEY_UNSPECIFIED,
+                         last_gtid_.server_id.uuid.empty()
+                             ? GTIDList::MODE_MONOTONIC
+                             : GTIDList::MODE_GAPS);
+      }
+      if (!sent_.Update(last_gtid_)) {
+        LOG(ERROR) << "Fake master got gtid " << last_gtid_.ToString()
+                   << " out of order after " << sent_.ToString();
+        return false;
+      }
+      has_last_ = false;
+    }
+    if (!source_->NextTransaction(&last_))
+      return false;
+    if (!GetGTID(last_, &last_gtid_)) {
+      LOG(ERROR) << "Fake master got transaction without GTID event";
+      return false;
+    }
+    has_last_ = true;
+    // Skip what the slave already has.
+    if (!requested_.Contained(last_gtid_)) {
+      taken_++;
+      return true;
+    }
+  }
+}
+
+bool FakeMaster::StreamEvents() {
+  bool resend;
+  if (!CanResume(&resend)) {
+    std::string msg = "Fake master can not rewind to '" +
+                      requested_.ToString() + "', it has sent '" +
+                      sent_.ToString() + "'";
+    LOG(ERROR) << msg;
+    protocol_->SendERR(1236, "HY000", msg.c_str());
+    return false;
+  }
+
+  position_ = 4;
+
+  RotateEvent rotate;
+  rotate.filename = "fake-master-bin.000001";
+  rotate.offset = position_;
+  if (!SendArtificialEvent(rotate))
+    return false;
+
+  FormatDescriptorEvent format;
+  source_->GetFormatDescriptor(&format);
+  format.checksum = 1;
+  {
+    RawLogEventData raw;
+    raw.header.timestamp = 0;
+    raw.header.type = format.GetEventType();
+    raw.header.server_id = options_.server_id;
+    raw.header.event_length = raw.header.PackLength() + format.PackLength();
+    raw.header.nextpos = 0;
+    raw.header.flags = 0;
+    Buffer buf;
+    raw.SerializeToBuffer(&buf);
+    format.SerializeToBuffer(buf.data() + raw.header.PackLength(),
+                             format.PackLength());
+    // The FD is sent as a real event so that it advances position.
+    if (!SendEvent(&buf, false, false))
+      return false;
+  }
+
+  next_send_ = absl::Now();
+  first_timestamp_ = 0;
+
+  while (!stop_.load()) {
+    if (resend) {
+      resend = false;
+    } else if (!TakeTransaction()) {
+      break;
+    }
+    Pace(last_);
+
+    // The transaction is counted once, even if it is sent again.
+    uint64_t no = taken_ - 1;
+    bool request_ack = semi_sync_ &&
+        ((no + 1) % options_.semi_sync_every) == 0;
+    int64_t now = monitoring::MonotonicMicros();
+    if (no >= transactions_sent_.load()) {
+      if (no == 0) {
+        start_time_.store(now);
+      }
+      RecordSendTime(no, now);
+    }
+    for (size_t i = 0; i < last_.events.size(); i++) {
+      bool last = i + 1 == last_.events.size();
+      if (!SendEvent(&last_.events[i], false, request_ack && last))
+        return false;
+    }
+    if (request_ack) {
+      if (!ReadSemiSyncReply())
+        return false;
+      ack_latency_.Record(monitoring::MonotonicMicros() - now);
+    }
+    end_time_.store(monitoring::MonotonicMicros());
+    transactions_sent_.store(taken_);
+  }
+  done_.store(true);
+
+  // Keep the connection alive with heartbeats until stopped.
+  HeartbeatEvent heartbeat;
+  heartbeat.filename = rotate.filename;
+  while (!stop_.load()) {
+    absl::SleepFor(absl::Milliseconds(100));
+    if (!SendArtificialEvent(heartbeat))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
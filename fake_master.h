@@ -0,0 +1,212 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_FAKE_MASTER_H
+#define MYSQL_RIPPLE_FAKE_MASTER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "buffer.h"
+#include "gtid.h"
+#include "log_event.h"
+#include "monitoring.h"
+#include "mysql_protocol.h"
+#include "mysql_server_port.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+// A transaction to be sent by the FakeMaster.
+struct Transaction {
+  // Serialized events without checksum, starting with a GTID event.
+  // Timestamp and nextpos of the headers are set by the FakeMaster when
+  // the event is sent.
+  std::vector<Buffer> events;
+
+  // Original commit time (unix seconds) used for pacing, 0 if unknown.
+  uint32_t timestamp = 0;
+};
+
+// A source of transactions for the FakeMaster.
+class EventSource {
+ public:
+  virtual ~EventSource() {}
+
+  // Server version announced to the slave, MariaDB or MySQL flavour.
+  virtual std::string GetServerVersion() const = 0;
+
+  // Format descriptor sent to the slave. The checksum is set by the
+  // FakeMaster.
+  virtual void GetFormatDescriptor(FormatDescriptorEvent *format) const {
+    format->SetToRipple(GetServerVersion().c_str());
+  }
+
+  // Get next transaction, return false when there are no more.
+  virtual bool NextTransaction(Transaction *trx) = 0;
+};
+
+// Synthetic workload of identical transactions.
+class SyntheticWorkload : public EventSource {
+ public:
+  struct Options {
+    bool mariadb = true;
+    uint32_t server_id = 1;
+    uint64_t transactions = 100000;
+    // Number of statements per transaction, 0 gives standalone
+    // transactions with a single statement (like DDL).
+    int statements = 4;
+    // Size of each statement event.
+    int event_size = 256;
+  };
+
+  explicit SyntheticWorkload(const Options &options);
+
+  std::string GetServerVersion() const override;
+  bool NextTransaction(Transaction *trx) override;
+
+ private:
+  const Options options_;
+  Uuid uuid_;
+  uint64_t seq_no_;
+  std::string statement_;
+
+  template <typename T> void AddEvent(const T &event, Transaction *trx);
+};
+
+// A stand-in for a mysqld master. It accepts one slave connection at a
+// time, answers the queries that ClientConnection sends when connecting
+// and streams transactions from an EventSource when the slave sends
+// COM_BINLOG_DUMP or COM_BINLOG_DUMP_GTID.
+//
+// Transactions that the slave already has are skipped. The EventSource can
+// not be rewound, so a slave that reconnects may only lack the last
+// transaction taken from it, which is then sent again. Other reconnects
+// are refused.
+class FakeMaster {
+ public:
+  struct Options {
+    uint32_t server_id = 1;
+    // Transactions per second, 0 for as fast as possible.
+    double rate = 0;
+    // Replay transactions at this multiple of the speed given by their
+    // original timestamps, 0 to ignore timestamps.
+    double speed = 0;
+    // Request a semi-sync reply every n:th transaction, 0 for never.
+    // Semi-sync is only used if the slave enables it.
+    int semi_sync_every = 0;
+  };
+
+  // port shall be bound and listening.
+  FakeMaster(mysql::ServerPort *port, EventSource *source,
+             const Options &options);
+  ~FakeMaster();
+
+  void Start();
+  void Stop();
+
+  // Has the EventSource been exhausted.
+  bool Done() const { return done_.load(); }
+
+  uint64_t GetTransactionsSent() const { return transactions_sent_.load(); }
+  uint64_t GetBytesSent() const { return bytes_sent_.load(); }
+
+  // MonotonicMicros() when transaction (counted from 0) was sent,
+  // 0 if it has not been sent yet.
+  int64_t GetSendTime(uint64_t transaction) const;
+
+  // MonotonicMicros() when first/last transaction was sent.
+  int64_t GetStartTime() const { return start_time_.load(); }
+  int64_t GetEndTime() const { return end_time_.load(); }
+
+  // Time from sending a transaction until the semi-sync reply is received.
+  const monitoring::internal::HistogramCell &GetAckLatency() const {
+    return ack_latency_;
+  }
+
+ private:
+  mysql::ServerPort *port_;
+  EventSource *source_;
+  const Options options_;
+  std::thread thread_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> done_;
+
+  std::atomic<uint64_t> transactions_sent_;
+  std::atomic<uint64_t> bytes_sent_;
+  std::atomic<int64_t> start_time_;
+  std::atomic<int64_t> end_time_;
+  // Send time of transactions, grown in chunks so that readers never
+  // see a reallocation.
+  static const int kSendTimeChunk = 1 << 16;
+  std::vector<std::unique_ptr<std::atomic<int64_t>[]>> send_times_;
+  std::atomic<size_t> send_time_chunks_;
+  monitoring::internal::HistogramCell ack_latency_;
+
+  // State of the current connection. connection_ is only changed by the
+  // thread and only under mutex_, so that Stop() can abort it.
+  std::mutex mutex_;
+  mysql::ServerConnection *connection_;
+  std::unique_ptr<mysql::Protocol> protocol_;
+  bool semi_sync_;
+  uint32_t position_;
+  // GTIDs that the slave requested to start after.
+  GTIDList requested_;
+
+  // The last transaction taken from the source, kept so that it can be
+  // sent again if the slave did not get all of it, and the GTIDs of the
+  // transactions before it. Only accessed by the thread.
+  Transaction last_;
+  GTID last_gtid_;
+  bool has_last_;
+  GTIDList sent_;
+  // Number of transactions taken from the source, not counting those
+  // skipped.
+  uint64_t taken_;
+
+  // Pacing state, see Pace().
+  absl::Time next_send_;
+  absl::Time first_send_;
+  uint32_t first_timestamp_;
+
+  void Run();
+  void ServeConnection();
+  bool HandleQuery(absl::string_view query);
+  bool SendVariable(const char *name, const std::string &value);
+  bool StreamEvents();
+  bool CanResume(bool *resend);
+  bool TakeTransaction();
+  bool SendArtificialEvent(const EventBase &event);
+  bool SendEvent(Buffer *event, bool artificial, bool request_ack);
+  bool ReadSemiSyncReply();
+  void Pace(const Transaction &trx);
+  void RecordSendTime(uint64_t transaction, int64_t now);
+
+  FakeMaster(const FakeMaster&) = delete;
+  FakeMaster& operator=(const FakeMaster&) = delete;
+};
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_FAKE_MASTER_H
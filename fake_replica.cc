@@ -0,0 +1,119 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fake_replica.h"
+
+#include "absl/time/clock.h"
+#include "gtid.h"
+#include "log_event.h"
+#include "logging.h"
+#include "mysql_constants.h"
+#include "mysql_init.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+FakeReplica::FakeReplica(const FakeMaster *master, const Options &options)
+    : master_(master), options_(options), stop_(false),
+      transactions_received_(0), bytes_received_(0), end_time_(0) {
+  connection_.SetOwnServerId(options_.server_id);
+}
+
+FakeReplica::~FakeReplica() {
+  Stop();
+}
+
+void FakeReplica::Start() {
+  thread_ = std::thread(&FakeReplica::Run, this);
+}
+
+void FakeReplica::Stop() {
+  if (!thread_.joinable())
+    return;
+  stop_.store(true);
+  connection_.Abort();
+  thread_.join();
+}
+
+bool FakeReplica::WaitDone(absl::Duration timeout) {
+  absl::Time deadline = absl::Now() + timeout;
+  while (true) {
+    if (options_.transactions > 0) {
+      if (GetTransactionsReceived() >= options_.transactions)
+        return true;
+    } else if (master_->Done() &&
+               GetTransactionsReceived() >= master_->GetTransactionsSent()) {
+      return true;
+    }
+    if (absl::Now() >= deadline || !thread_.joinable())
+      return false;
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+}
+
+bool FakeReplica::Connect() {
+  // ripple might not yet be listening, retry for a while.
+  for (int i = 0; i < 100 && !stop_.load(); i++) {
+    if (connection_.Connect("fake_replica", options_.host.c_str(),
+                            options_.port, "tcp", "", "")) {
+      return connection_.StartReplicationStream(GTIDList(), false);
+    }
+    connection_.Disconnect();
+    absl::SleepFor(absl::Milliseconds(100));
+  }
+  return false;
+}
+
+void FakeReplica::Run() {
+  mysql::ThreadInit();
+  if (!Connect()) {
+    LOG(ERROR) << "Fake replica " << options_.server_id
+               << " failed to start replication: "
+               << connection_.GetLastErrorMessage();
+  }
+
+  uint64_t no = 0;
+  while (!stop_.load()) {
+    Connection::Packet packet = connection_.ReadPacket();
+    if (packet.length <= 0)
+      break;
+    if (packet.ptr[0] == 254 && packet.length < 8)
+      break;
+
+    LogEventHeader header;
+    if (!header.ParseFromBuffer(packet.ptr + 1, packet.length - 1)) {
+      LOG(ERROR) << "Fake replica failed to parse event header";
+      break;
+    }
+    bytes_received_.fetch_add(packet.length, std::memory_order_relaxed);
+
+    if (constants::IsGtidEvent(header.type)) {
+      int64_t now = monitoring::MonotonicMicros();
+      int64_t sent = master_->GetSendTime(no);
+      if (sent != 0) {
+        latency_.Record(now - sent);
+      }
+      end_time_.store(now);
+      transactions_received_.store(++no);
+    }
+  }
+
+  connection_.Disconnect();
+  mysql::ThreadDeinit();
+}
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
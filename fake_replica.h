@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_FAKE_REPLICA_H
+#define MYSQL_RIPPLE_FAKE_REPLICA_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "fake_master.h"
+#include "monitoring.h"
+#include "mysql_client_connection.h"
+
+namespace mysql_ripple {
+
+namespace bench {
+
+// A stand-in for a mysqld slave. It connects to ripple, starts a
+// replication stream from the beginning and counts received transactions.
+// The latency of each transaction is measured against the time the
+// FakeMaster sent it.
+class FakeReplica {
+ public:
+  struct Options {
+    std::string host = "127.0.0.1";
+    int port = 0;
+    uint32_t server_id = 0;
+    // Number of transactions to wait for, 0 to wait for all transactions
+    // the FakeMaster sends.
+    uint64_t transactions = 0;
+  };
+
+  FakeReplica(const FakeMaster *master, const Options &options);
+  ~FakeReplica();
+
+  void Start();
+  void Stop();
+
+  // Wait until all transactions have been received or timeout expires.
+  bool WaitDone(absl::Duration timeout);
+
+  uint64_t GetTransactionsReceived() const {
+    return transactions_received_.load();
+  }
+  uint64_t GetBytesReceived() const { return bytes_received_.load(); }
+
+  // MonotonicMicros() when the last transaction was received.
+  int64_t GetEndTime() const { return end_time_.load(); }
+
+  // Time from FakeMaster sending a transaction until it is received here.
+  const monitoring::internal::HistogramCell &GetLatency() const {
+    return latency_;
+  }
+
+ private:
+  const FakeMaster *master_;
+  const Options options_;
+  mysql::ClientConnection connection_;
+  std::thread thread_;
+  std::atomic<bool> stop_;
+
+  std::atomic<uint64_t> transactions_received_;
+  std::atomic<uint64_t> bytes_received_;
+  std::atomic<int64_t> end_time_;
+  monitoring::internal::HistogramCell latency_;
+
+  void Run();
+  bool Connect();
+
+  FakeReplica(const FakeReplica&) = delete;
+  FakeReplica& operator=(const FakeReplica&) = delete;
+};
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_FAKE_REPLICA_H
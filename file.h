@@ -19,6 +19,7 @@
 
 // Aggregation of all file factories.
 #include "file_FILE.h"
+#include "file_memory.h"
 #define DEFAULT_FILE_FACTORY() file::FILE_Factory()
 
 #endif  // MYSQL_RIPPLE_FILE_H
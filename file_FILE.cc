@@ -14,8 +14,13 @@
 
 #include "file_FILE.h"
 
+#include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <utime.h>
+
+#include <cerrno>
+#include <cstring>
 
 namespace {
 
@@ -57,7 +62,7 @@ class FI : public InputFile, public AppendOnlyFile {
 
   // read size bytes from current file position, appending into buffer.
   bool Read(Buffer &b, int64_t size) override {
-    auto end = b.Append(size) + size;
+    auto end = b.AppendUninitialized(size) + size;
     while (size > 0) {
       size -= fread(end - size, 1, size, file_);
       if (ferror(file_) && errno == EINTR) continue;
@@ -151,6 +156,32 @@ class FF : public Factory {
     *time = absl::FromTimeT(st.st_mtime);
     return true;
   }
+
+  bool SetMtime(absl::string_view filename, absl::Time time) const override {
+    struct utimbuf times;
+    std::string name(filename);
+    times.actime = times.modtime = absl::ToTimeT(time);
+    return utime(name.c_str(), &times) == 0;
+  }
+
+  bool CreateDirectory(absl::string_view dirname) const override {
+    std::string name(dirname);
+    return mkdir(name.c_str(), 0755) == 0 || errno == EEXIST;
+  }
+
+  bool List(absl::string_view dirname,
+            std::vector<std::string> *names) const override {
+    std::string name(dirname);
+    DIR *dir = opendir(name.c_str());
+    if (dir == nullptr) return false;
+    while (struct dirent *ent = readdir(dir)) {
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+        continue;
+      names->push_back(ent->d_name);
+    }
+    closedir(dir);
+    return true;
+  }
 };
 
 const FF theFactory;
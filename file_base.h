@@ -19,6 +19,8 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
@@ -90,8 +92,24 @@ class Factory {
 
   virtual bool Size(absl::string_view filename, int64_t *size) const = 0;
 
+  // bytes used by file on disk, which differs from Size() for files
+  // stored compressed. These are the units of AppendOnlyFile::Truncate()
+  // on such files.
+  virtual bool DiskSize(absl::string_view filename, int64_t *size) const {
+    return Size(filename, size);
+  }
+
   virtual bool Mtime(absl::string_view filename, absl::Time *time) const = 0;
 
+  virtual bool SetMtime(absl::string_view filename, absl::Time time) const = 0;
+
+  // create directory dirname, succeeds if it already exists.
+  virtual bool CreateDirectory(absl::string_view dirname) const = 0;
+
+  // list names of files in directory dirname.
+  virtual bool List(absl::string_view dirname,
+                    std::vector<std::string> *names) const = 0;
+
  protected:
   Factory() {}
   virtual ~Factory() {}
@@ -0,0 +1,483 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "file_compressed.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "byte_order.h"
+
+namespace mysql_ripple {
+
+namespace file {
+
+// Format of a compressed file:
+//   header:  magic(4) version(4) frame_size(4) unused(4)
+//   frames:  zlib compressed frames
+//   index:   per frame offset(8) length(4)
+//   trailer: index_offset(8) frame_count(4) size(8) magic(4)
+// The magic differs from the binlog magic (0xfe 'b' 'i' 'n').
+static const uint8_t kMagic[4] = { 0xfe, 'r', 'p', 'z' };
+static const uint32_t kVersion = 1;
+static const int kHeaderSize = 16;
+static const int kIndexEntrySize = 12;
+static const int kTrailerSize = 24;
+
+const int CompressedFactory::kFrameSize;
+
+FrameCache::FrameCache(size_t capacity) : capacity_(capacity), size_(0) {
+}
+
+std::shared_ptr<const Buffer> FrameCache::Get(const std::string &filename,
+                                              int64_t frame) {
+  absl::MutexLock lock(&mutex_);
+  auto it = frames_.find(Key(filename, frame));
+  if (it == frames_.end())
+    return nullptr;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+void FrameCache::Put(const std::string &filename, int64_t frame,
+                     std::shared_ptr<const Buffer> data) {
+  if (data->size() > capacity_)
+    return;
+  absl::MutexLock lock(&mutex_);
+  Key key(filename, frame);
+  if (frames_.count(key))
+    return;
+  size_ += data->size();
+  lru_.emplace_front(key, std::move(data));
+  frames_[key] = lru_.begin();
+  while (size_ > capacity_) {
+    size_ -= lru_.back().second->size();
+    frames_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+void FrameCache::Erase(const std::string &filename) {
+  absl::MutexLock lock(&mutex_);
+  auto it = frames_.lower_bound(Key(filename, 0));
+  while (it != frames_.end() && it->first.first == filename) {
+    size_ -= it->second->second->size();
+    lru_.erase(it->second);
+    it = frames_.erase(it);
+  }
+}
+
+size_t FrameCache::GetSize() const {
+  absl::MutexLock lock(&mutex_);
+  return size_;
+}
+
+// Presents the uncompressed content of a compressed file.
+class CompressedFactory::Reader : public InputFile {
+ public:
+  Reader(InputFile *file, absl::string_view filename, Index index,
+         FrameCache *cache)
+      : file_(file), filename_(filename), index_(std::move(index)),
+        cache_(cache), position_(0), eof_(false), frame_no_(-1) {}
+
+  // close file.
+  bool Close() override {
+    bool res = file_->Close();
+    delete this;
+    return res;
+  }
+
+  // return current file position into offset.
+  bool Tell(int64_t *offset) override {
+    *offset = position_;
+    return true;
+  }
+
+  // set current file position to offset.
+  bool Seek(int64_t offset) override {
+    if (offset < 0) return false;
+    position_ = offset;
+    eof_ = false;
+    return true;
+  }
+
+  // read size bytes from current file position, appending into buffer.
+  bool Read(Buffer &b, int64_t size) override {
+    while (size > 0) {
+      if (position_ >= index_.size) {
+        eof_ = true;
+        return false;
+      }
+      int64_t frame_no = position_ / index_.frame_size;
+      if (!LoadFrame(frame_no))
+        return false;
+      int64_t offset = position_ - frame_no * index_.frame_size;
+      int64_t len = std::min<int64_t>(size, frame_->size() - offset);
+      b.Append(frame_->data() + offset, len);
+      position_ += len;
+      size -= len;
+    }
+    return true;
+  }
+
+  bool eof() override { return eof_; }
+
+ private:
+  InputFile *file_;
+  const std::string filename_;
+  const Index index_;
+  FrameCache *cache_;
+  int64_t position_;
+  bool eof_;
+
+  // Current frame, kept so that sequential reads skip the cache.
+  int64_t frame_no_;
+  std::shared_ptr<const Buffer> frame_;
+
+  bool LoadFrame(int64_t frame_no) {
+    if (frame_no == frame_no_)
+      return true;
+    frame_ = cache_->Get(filename_, frame_no);
+    if (frame_ == nullptr) {
+      const Index::Frame &frame = index_.frames[frame_no];
+      Buffer compressed;
+      if (!file_->Seek(frame.offset) ||
+          !file_->Read(compressed, frame.length))
+        return false;
+      int64_t expected = std::min<int64_t>(
+          index_.frame_size, index_.size - frame_no * index_.frame_size);
+      std::shared_ptr<Buffer> data = std::make_shared<Buffer>();
+      data->ResizeUninitialized(expected);
+      uLongf len = expected;
+      if (uncompress(data->data(), &len, compressed.data(),
+                     compressed.size()) != Z_OK ||
+          static_cast<int64_t>(len) != expected)
+        return false;
+      cache_->Put(filename_, frame_no, data);
+      frame_ = std::move(data);
+    }
+    frame_no_ = frame_no;
+    return true;
+  }
+};
+
+// Writes a compressed file, a frame at a time.
+class CompressedFactory::Writer : public AppendOnlyFile {
+ public:
+  explicit Writer(AppendOnlyFile *file)
+      : file_(file), size_(0), offset_(kHeaderSize) {}
+
+  bool WriteHeader() {
+    uint8_t header[kHeaderSize];
+    memcpy(header, kMagic, sizeof(kMagic));
+    byte_order::store4(header + 4, kVersion);
+    byte_order::store4(header + 8, kFrameSize);
+    byte_order::store4(header + 12, 0);
+    return file_->Write(absl::string_view(
+        reinterpret_cast<const char*>(header), sizeof(header)));
+  }
+
+  // close file, writing last frame and index. As the file is only
+  // complete once closed, it is also synced.
+  bool Close() override {
+    bool ok = (pending_.empty() || WriteFrame()) && WriteIndex() &&
+        file_->Sync();
+    ok = file_->Close() && ok;
+    delete this;
+    return ok;
+  }
+
+  // return current file position into offset.
+  bool Tell(int64_t *offset) override {
+    *offset = size_;
+    return true;
+  }
+
+  // compressed files are only written sequentially.
+  bool Truncate(int64_t new_size) override { return false; }
+
+  // write data to file at current file position.
+  bool Write(absl::string_view data) override {
+    while (!data.empty()) {
+      size_t len = std::min<size_t>(data.size(),
+                                    kFrameSize - pending_.size());
+      pending_.Append(reinterpret_cast<const uint8_t*>(data.data()), len);
+      data.remove_prefix(len);
+      size_ += len;
+      if (pending_.size() == static_cast<size_t>(kFrameSize) &&
+          !WriteFrame())
+        return false;
+    }
+    return true;
+  }
+
+  // flush pending writes, except the current frame which is written when
+  // full or when the file is closed.
+  bool Flush() override { return file_->Flush(); }
+
+  // make writes durable.
+  bool Sync() override { return file_->Sync(); }
+
+ private:
+  AppendOnlyFile *file_;
+  int64_t size_;
+  int64_t offset_;
+  Buffer pending_;
+  Buffer compressed_;
+  std::vector<Index::Frame> frames_;
+
+  bool WriteFrame() {
+    uLongf len = compressBound(pending_.size());
+    compressed_.ResizeUninitialized(len);
+    if (compress2(compressed_.data(), &len, pending_.data(), pending_.size(),
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+      return false;
+    compressed_.resize(len);
+    if (!file_->Write(compressed_))
+      return false;
+    frames_.push_back({offset_, static_cast<int32_t>(len)});
+    offset_ += len;
+    pending_.clear();
+    return true;
+  }
+
+  bool WriteIndex() {
+    Buffer index;
+    for (const Index::Frame &frame : frames_) {
+      uint8_t *ptr = index.Append(kIndexEntrySize);
+      byte_order::store8(ptr, frame.offset);
+      byte_order::store4(ptr + 8, frame.length);
+    }
+    uint8_t *ptr = index.Append(kTrailerSize);
+    byte_order::store8(ptr, offset_);
+    byte_order::store4(ptr + 8, frames_.size());
+    byte_order::store8(ptr + 12, size_);
+    memcpy(ptr + 20, kMagic, sizeof(kMagic));
+    return file_->Write(index);
+  }
+};
+
+// Truncates the compressed data of a file proportionally, making it an
+// uncompressed file. Used to gradually free compressed files in trash.
+class CompressedFactory::Truncator : public AppendOnlyFile {
+ public:
+  Truncator(AppendOnlyFile *file, int64_t file_size, int64_t size)
+      : file_(file), file_size_(file_size), size_(size) {}
+
+  // Truncate to new_size bytes on disk.
+
+  bool Close() override {
+    bool res = file_->Close();
+    delete this;
+    return res;
+  }
+
+  bool Tell(int64_t *offset) override {
+    *offset = size_;
+    return true;
+  }
+
+  bool Truncate(int64_t new_size) override {
+    if (new_size >= file_size_)
+      return true;
+    return file_->Truncate(new_size);
+  }
+
+  bool Write(absl::string_view data) override { return false; }
+  bool Flush() override { return file_->Flush(); }
+  bool Sync() override { return file_->Sync(); }
+
+ private:
+  AppendOnlyFile *file_;
+  const int64_t file_size_;
+  const int64_t size_;
+};
+
+CompressedFactory::CompressedFactory(const Factory &base, size_t cache_size)
+    : base_(base), cache_(cache_size) {
+}
+
+CompressedFactory::~CompressedFactory() {
+}
+
+bool CompressedFactory::ParseIndex(InputFile *file, int64_t file_size,
+                                   Index *index) {
+  if (file_size < kHeaderSize + kTrailerSize)
+    return false;
+  Buffer header, trailer;
+  if (!file->Seek(0) || !file->Read(header, kHeaderSize) ||
+      memcmp(header.data(), kMagic, sizeof(kMagic)) != 0 ||
+      byte_order::load4(header.data() + 4) != kVersion)
+    return false;
+  if (!file->Seek(file_size - kTrailerSize) ||
+      !file->Read(trailer, kTrailerSize) ||
+      memcmp(trailer.data() + 20, kMagic, sizeof(kMagic)) != 0)
+    return false;
+
+  int64_t index_offset = byte_order::load8(trailer.data());
+  int64_t count = byte_order::load4(trailer.data() + 8);
+  index->size = byte_order::load8(trailer.data() + 12);
+  index->frame_size = byte_order::load4(header.data() + 8);
+  if (index->frame_size <= 0 ||
+      index_offset + count * kIndexEntrySize + kTrailerSize != file_size ||
+      count != (index->size + index->frame_size - 1) / index->frame_size)
+    return false;
+
+  Buffer entries;
+  if (!file->Seek(index_offset) ||
+      !file->Read(entries, count * kIndexEntrySize))
+    return false;
+  index->frames.resize(count);
+  int64_t offset = kHeaderSize;
+  for (int64_t i = 0; i < count; i++) {
+    const uint8_t *ptr = entries.data() + i * kIndexEntrySize;
+    index->frames[i].offset = byte_order::load8(ptr);
+    index->frames[i].length = byte_order::load4(ptr + 8);
+    if (index->frames[i].offset != offset)
+      return false;
+    offset += index->frames[i].length;
+  }
+  return offset == index_offset;
+}
+
+bool CompressedFactory::ReadIndex(absl::string_view filename,
+                                  int64_t *file_size, Index *index) const {
+  InputFile *f;
+  if (!base_.Size(filename, file_size) || !base_.Open(&f, filename, "r"))
+    return false;
+  bool compressed = ParseIndex(f, *file_size, index);
+  f->Close();
+  return compressed;
+}
+
+bool CompressedFactory::Create(AppendOnlyFile **file,
+                               absl::string_view filename,
+                               absl::string_view mode) const {
+  int64_t size;
+  if (base_.Size(filename, &size))
+    return false;
+  return Open(file, filename, mode);
+}
+
+bool CompressedFactory::Open(AppendOnlyFile **file,
+                             absl::string_view filename,
+                             absl::string_view mode) const {
+  AppendOnlyFile *f;
+  if (absl::StartsWith(mode, "w")) {
+    cache_.Erase(std::string(filename));
+    if (!base_.Open(&f, filename, mode))
+      return false;
+    Writer *writer = new Writer(f);
+    if (!writer->WriteHeader()) {
+      writer->Close();
+      return false;
+    }
+    *file = writer;
+    return true;
+  }
+
+  int64_t file_size;
+  Index index;
+  bool compressed = ReadIndex(filename, &file_size, &index);
+  if (!base_.Open(&f, filename, mode))
+    return false;
+  if (compressed) {
+    cache_.Erase(std::string(filename));
+    *file = new Truncator(f, file_size, index.size);
+  } else {
+    *file = f;
+  }
+  return true;
+}
+
+bool CompressedFactory::Open(InputFile **file, absl::string_view filename,
+                             absl::string_view mode) const {
+  int64_t file_size;
+  InputFile *f;
+  if (!base_.Size(filename, &file_size) || !base_.Open(&f, filename, mode))
+    return false;
+  Index index;
+  if (ParseIndex(f, file_size, &index)) {
+    *file = new Reader(f, filename, std::move(index), &cache_);
+    return true;
+  }
+  if (!f->Seek(0)) {
+    f->Close();
+    return false;
+  }
+  *file = f;
+  return true;
+}
+
+bool CompressedFactory::Delete(absl::string_view filename) const {
+  cache_.Erase(std::string(filename));
+  return base_.Delete(filename);
+}
+
+bool CompressedFactory::Rename(absl::string_view filename,
+                               absl::string_view newname) const {
+  cache_.Erase(std::string(filename));
+  cache_.Erase(std::string(newname));
+  return base_.Rename(filename, newname);
+}
+
+bool CompressedFactory::Finalize(absl::string_view filename) const {
+  return base_.Finalize(filename);
+}
+
+bool CompressedFactory::Archive(absl::string_view filename) const {
+  return base_.Archive(filename);
+}
+
+bool CompressedFactory::Size(absl::string_view filename,
+                             int64_t *size) const {
+  int64_t file_size;
+  Index index;
+  if (ReadIndex(filename, &file_size, &index)) {
+    *size = index.size;
+    return true;
+  }
+  return base_.Size(filename, size);
+}
+
+bool CompressedFactory::DiskSize(absl::string_view filename,
+                                 int64_t *size) const {
+  return base_.DiskSize(filename, size);
+}
+
+bool CompressedFactory::Mtime(absl::string_view filename,
+                              absl::Time *time) const {
+  return base_.Mtime(filename, time);
+}
+
+bool CompressedFactory::SetMtime(absl::string_view filename,
+                                 absl::Time time) const {
+  return base_.SetMtime(filename, time);
+}
+
+bool CompressedFactory::CreateDirectory(absl::string_view dirname) const {
+  return base_.CreateDirectory(dirname);
+}
+
+bool CompressedFactory::List(absl::string_view dirname,
+                             std::vector<std::string> *names) const {
+  return base_.List(dirname, names);
+}
+
+}  // namespace file
+
+}  // namespace mysql_ripple
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_FILE_COMPRESSED_H
+#define MYSQL_RIPPLE_FILE_COMPRESSED_H
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "file_base.h"
+
+namespace mysql_ripple {
+
+namespace file {
+
+// Cache of decompressed frames shared by all readers of a
+// CompressedFactory, evicting least recently used frames.
+class FrameCache {
+ public:
+  explicit FrameCache(size_t capacity);
+
+  // Return frame no of file or nullptr if not cached.
+  std::shared_ptr<const Buffer> Get(const std::string &filename,
+                                    int64_t frame);
+  void Put(const std::string &filename, int64_t frame,
+           std::shared_ptr<const Buffer> data);
+
+  // Remove all frames of file.
+  void Erase(const std::string &filename);
+
+  size_t GetSize() const;
+
+ private:
+  typedef std::pair<std::string, int64_t> Key;
+  typedef std::list<std::pair<Key, std::shared_ptr<const Buffer>>> List;
+
+  const size_t capacity_;
+  mutable absl::Mutex mutex_;
+  size_t size_ ABSL_GUARDED_BY(mutex_);
+  List lru_ ABSL_GUARDED_BY(mutex_);  // most recently used first
+  std::map<Key, List::iterator> frames_ ABSL_GUARDED_BY(mutex_);
+};
+
+// A Factory storing files compressed in a seekable format on top of a
+// base factory.
+//
+// Files created with mode "w" are written as zlib compressed frames of
+// kFrameSize bytes followed by an index of the frames. Reading such a file
+// presents the uncompressed content and Seek() only needs to decompress
+// the frame containing the new position. Size() returns the uncompressed
+// size. Files not in this format are read as is, so uncompressed files can
+// be mixed with compressed ones.
+//
+// Compressed files can not be appended to. They can be truncated to let
+// trash be freed gradually. Truncate() then takes a size on disk, see
+// DiskSize(), and leaves a file that is read as is.
+class CompressedFactory : public Factory {
+ public:
+  static const int kFrameSize = 256 * 1024;
+
+  // Decompressed frames are cached up to cache_size bytes.
+  CompressedFactory(const Factory &base, size_t cache_size);
+  ~CompressedFactory() override;
+
+  bool Create(AppendOnlyFile **file, absl::string_view filename,
+              absl::string_view mode) const override;
+
+  bool Open(AppendOnlyFile **file, absl::string_view filename,
+            absl::string_view mode) const override;
+
+  bool Open(InputFile **file, absl::string_view filename,
+            absl::string_view mode) const override;
+
+  bool Delete(absl::string_view filename) const override;
+
+  bool Rename(absl::string_view filename,
+              absl::string_view newname) const override;
+
+  bool Finalize(absl::string_view filename) const override;
+
+  bool Archive(absl::string_view filename) const override;
+
+  bool Size(absl::string_view filename, int64_t *size) const override;
+
+  bool DiskSize(absl::string_view filename, int64_t *size) const override;
+
+  bool Mtime(absl::string_view filename, absl::Time *time) const override;
+
+  bool SetMtime(absl::string_view filename, absl::Time time) const override;
+
+  bool CreateDirectory(absl::string_view dirname) const override;
+
+  bool List(absl::string_view dirname,
+            std::vector<std::string> *names) const override;
+
+  const FrameCache &GetCache() const { return cache_; }
+
+  // Frame index of a compressed file.
+  struct Index {
+    struct Frame {
+      int64_t offset;  // offset of compressed frame in file
+      int32_t length;  // length of compressed frame
+    };
+    std::vector<Frame> frames;
+    int32_t frame_size;  // uncompressed size of all but the last frame
+    int64_t size;        // uncompressed size of file
+  };
+
+ private:
+  class Reader;
+  class Writer;
+  class Truncator;
+
+  const Factory &base_;
+  mutable FrameCache cache_;
+
+  // Read index of file if it is compressed, return false if it is not.
+  static bool ParseIndex(InputFile *file, int64_t file_size, Index *index);
+  bool ReadIndex(absl::string_view filename, int64_t *file_size,
+                 Index *index) const;
+
+  CompressedFactory(const CompressedFactory&) = delete;
+  CompressedFactory& operator=(const CompressedFactory&) = delete;
+};
+
+}  // namespace file
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_FILE_COMPRESSED_H
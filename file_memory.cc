@@ -0,0 +1,433 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "file_memory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+
+namespace mysql_ripple {
+
+namespace file {
+
+const int64_t MemoryFactory::kPageSize;
+
+// Content of a file. Bytes past size_ in allocated pages are always zero,
+// so that growing the file (by Truncate() or by writing past the end)
+// reads back zeros without clearing anything.
+class MemoryFactory::Data {
+ public:
+  Data() : size_(0), mtime_(absl::Now()) {}
+
+  int64_t Size() const {
+    absl::ReaderMutexLock lock(&mutex_);
+    return size_;
+  }
+
+  absl::Time Mtime() const {
+    absl::ReaderMutexLock lock(&mutex_);
+    return mtime_;
+  }
+
+  void SetMtime(absl::Time time) {
+    absl::MutexLock lock(&mutex_);
+    mtime_ = time;
+  }
+
+  int64_t MemoryUsage() const {
+    absl::ReaderMutexLock lock(&mutex_);
+    return pages_.size() * kPageSize;
+  }
+
+  // Copy up to size bytes at offset into dst, return number of bytes copied.
+  int64_t Read(int64_t offset, int64_t size, uint8_t *dst) const {
+    absl::ReaderMutexLock lock(&mutex_);
+    if (offset >= size_)
+      return 0;
+    size = std::min(size, size_ - offset);
+    for (int64_t done = 0; done < size;) {
+      int64_t page_offset = (offset + done) % kPageSize;
+      int64_t len = std::min(size - done, kPageSize - page_offset);
+      memcpy(dst + done,
+             pages_[(offset + done) / kPageSize].get() + page_offset, len);
+      done += len;
+    }
+    return size;
+  }
+
+  // Write data at offset, return offset after the written data.
+  int64_t Write(int64_t offset, absl::string_view data) {
+    absl::MutexLock lock(&mutex_);
+    return WriteLocked(offset, data);
+  }
+
+  // Write data at end of file, return offset after the written data.
+  int64_t Append(absl::string_view data) {
+    absl::MutexLock lock(&mutex_);
+    return WriteLocked(size_, data);
+  }
+
+  void Truncate(int64_t size) {
+    absl::MutexLock lock(&mutex_);
+    if (size < size_) {
+      pages_.resize((size + kPageSize - 1) / kPageSize);
+      if (size % kPageSize != 0) {
+        int64_t page_offset = size % kPageSize;
+        memset(pages_.back().get() + page_offset, 0,
+               kPageSize - page_offset);
+      }
+    } else {
+      Reserve(size);
+    }
+    size_ = size;
+    mtime_ = absl::Now();
+  }
+
+ private:
+  mutable absl::Mutex mutex_;
+  std::vector<std::unique_ptr<uint8_t[]>> pages_ ABSL_GUARDED_BY(mutex_);
+  int64_t size_ ABSL_GUARDED_BY(mutex_);
+  absl::Time mtime_ ABSL_GUARDED_BY(mutex_);
+
+  // Allocate (zeroed) pages to hold size bytes.
+  void Reserve(int64_t size) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    while (static_cast<int64_t>(pages_.size()) * kPageSize < size) {
+      pages_.emplace_back(new uint8_t[kPageSize]());
+    }
+  }
+
+  int64_t WriteLocked(int64_t offset, absl::string_view data)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    int64_t size = data.size();
+    Reserve(offset + size);
+    for (int64_t done = 0; done < size;) {
+      int64_t page_offset = (offset + done) % kPageSize;
+      int64_t len = std::min(size - done, kPageSize - page_offset);
+      memcpy(pages_[(offset + done) / kPageSize].get() + page_offset,
+             data.data() + done, len);
+      done += len;
+    }
+    size_ = std::max(size_, offset + size);
+    mtime_ = absl::Now();
+    return offset + size;
+  }
+};
+
+// An open file, i.e a position in a Data.
+class MemoryFactory::File : public InputFile, public AppendOnlyFile {
+ public:
+  File(std::shared_ptr<Data> data, bool append)
+      : data_(std::move(data)), append_(append),
+        position_(append ? data_->Size() : 0), eof_(false) {}
+
+  // close file.
+  bool Close() override {
+    delete this;
+    return true;
+  }
+
+  // return current file position into offset.
+  bool Tell(int64_t *offset) override {
+    *offset = position_;
+    return true;
+  }
+
+  // set current file position to offset.
+  bool Seek(int64_t offset) override {
+    if (offset < 0) return false;
+    position_ = offset;
+    eof_ = false;
+    return true;
+  }
+
+  // truncate file to new_size.
+  bool Truncate(int64_t new_size) override {
+    if (new_size < 0) return false;
+    data_->Truncate(new_size);
+    return true;
+  }
+
+  // read size bytes from current file position, appending into buffer.
+  bool Read(Buffer &b, int64_t size) override {
+    uint8_t *ptr = b.AppendUninitialized(size);
+    int64_t len = data_->Read(position_, size, ptr);
+    position_ += len;
+    if (len < size) {
+      b.resize(b.size() - (size - len));
+      eof_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  // write size bytes from buffer to file at current file position.
+  bool Write(absl::string_view data) override {
+    if (append_) {
+      position_ = data_->Append(data);
+    } else {
+      position_ = data_->Write(position_, data);
+    }
+    return true;
+  }
+
+  // flush pending writes.
+  bool Flush() override { return true; }
+
+  // make writes durable.
+  bool Sync() override { return true; }
+
+  bool eof() override { return eof_; }
+
+ private:
+  std::shared_ptr<Data> data_;
+  const bool append_;
+  int64_t position_;
+  bool eof_;
+};
+
+MemoryFactory::MemoryFactory(const Factory *spill) : spill_(spill) {
+}
+
+MemoryFactory::~MemoryFactory() {
+}
+
+std::shared_ptr<MemoryFactory::Data> MemoryFactory::Find(
+    absl::string_view filename) const {
+  absl::MutexLock lock(&mutex_);
+  auto it = files_.find(std::string(filename));
+  if (it == files_.end())
+    return nullptr;
+  return it->second;
+}
+
+bool MemoryFactory::InSpill(absl::string_view filename) const {
+  int64_t size;
+  return spill_ != nullptr && Find(filename) == nullptr &&
+      spill_->Size(filename, &size);
+}
+
+bool MemoryFactory::OpenFile(File **file, absl::string_view filename,
+                             absl::string_view mode) const {
+  if (mode.empty())
+    return false;
+  std::shared_ptr<Data> data;
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = files_.find(std::string(filename));
+    if (it != files_.end()) {
+      data = it->second;
+    } else if (mode[0] == 'r') {
+      return false;
+    } else {
+      data = std::make_shared<Data>();
+      files_[std::string(filename)] = data;
+    }
+  }
+  if (mode[0] == 'w') {
+    data->Truncate(0);
+  }
+  *file = new File(data, mode[0] == 'a');
+  return true;
+}
+
+bool MemoryFactory::Create(AppendOnlyFile **file, absl::string_view filename,
+                           absl::string_view mode) const {
+  int64_t size;
+  if (spill_ != nullptr && spill_->Size(filename, &size))
+    return false;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (files_.count(std::string(filename)))
+      return false;
+    files_[std::string(filename)] = std::make_shared<Data>();
+  }
+  return Open(file, filename, mode);
+}
+
+bool MemoryFactory::Open(AppendOnlyFile **file, absl::string_view filename,
+                         absl::string_view mode) const {
+  if (InSpill(filename))
+    return spill_->Open(file, filename, mode);
+  File *f;
+  if (!OpenFile(&f, filename, mode))
+    return false;
+  *file = f;
+  return true;
+}
+
+bool MemoryFactory::Open(InputFile **file, absl::string_view filename,
+                         absl::string_view mode) const {
+  if (InSpill(filename))
+    return spill_->Open(file, filename, mode);
+  File *f;
+  if (!OpenFile(&f, filename, mode))
+    return false;
+  *file = f;
+  return true;
+}
+
+bool MemoryFactory::Delete(absl::string_view filename) const {
+  {
+    absl::MutexLock lock(&mutex_);
+    // Open files keep their content, like an unlinked file.
+    if (files_.erase(std::string(filename)))
+      return true;
+  }
+  return spill_ != nullptr && spill_->Delete(filename);
+}
+
+bool MemoryFactory::Rename(absl::string_view filename,
+                           absl::string_view newname) const {
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = files_.find(std::string(filename));
+    if (it != files_.end()) {
+      files_[std::string(newname)] = it->second;
+      files_.erase(it);
+      if (spill_ != nullptr) {
+        // The renamed file replaces any file by that name.
+        spill_->Delete(newname);
+      }
+      return true;
+    }
+  }
+  return spill_ != nullptr && spill_->Rename(filename, newname);
+}
+
+bool MemoryFactory::Finalize(absl::string_view filename) const {
+  if (InSpill(filename))
+    return spill_->Finalize(filename);
+  // Finalize does nothing for files in memory.
+  return true;
+}
+
+bool MemoryFactory::Archive(absl::string_view filename) const {
+  if (spill_ == nullptr) {
+    // Without a spill factory files stay in memory.
+    return true;
+  }
+  std::shared_ptr<Data> data = Find(filename);
+  if (data == nullptr)
+    return spill_->Archive(filename);
+
+  AppendOnlyFile *file;
+  if (!spill_->Open(&file, filename, "w"))
+    return false;
+  Buffer buf;
+  for (int64_t offset = 0;; offset += kPageSize) {
+    buf.resize(kPageSize);
+    buf.resize(data->Read(offset, kPageSize, buf.data()));
+    if (buf.empty())
+      break;
+    if (!file->Write(buf)) {
+      file->Close();
+      spill_->Delete(filename);
+      return false;
+    }
+  }
+  if (!file->Sync()) {
+    file->Close();
+    spill_->Delete(filename);
+    return false;
+  }
+  if (!file->Close())
+    return false;
+
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = files_.find(std::string(filename));
+    if (it != files_.end() && it->second == data) {
+      files_.erase(it);
+    }
+  }
+  return spill_->Archive(filename);
+}
+
+bool MemoryFactory::Size(absl::string_view filename, int64_t *size) const {
+  std::shared_ptr<Data> data = Find(filename);
+  if (data == nullptr)
+    return spill_ != nullptr && spill_->Size(filename, size);
+  *size = data->Size();
+  return true;
+}
+
+bool MemoryFactory::Mtime(absl::string_view filename, absl::Time *time) const {
+  std::shared_ptr<Data> data = Find(filename);
+  if (data == nullptr)
+    return spill_ != nullptr && spill_->Mtime(filename, time);
+  *time = data->Mtime();
+  return true;
+}
+
+bool MemoryFactory::SetMtime(absl::string_view filename,
+                             absl::Time time) const {
+  std::shared_ptr<Data> data = Find(filename);
+  if (data == nullptr)
+    return spill_ != nullptr && spill_->SetMtime(filename, time);
+  data->SetMtime(time);
+  return true;
+}
+
+bool MemoryFactory::CreateDirectory(absl::string_view dirname) const {
+  // Directories are implicit in memory.
+  return spill_ == nullptr || spill_->CreateDirectory(dirname);
+}
+
+bool MemoryFactory::List(absl::string_view dirname,
+                         std::vector<std::string> *names) const {
+  std::string prefix(absl::StripSuffix(dirname, "/"));
+  prefix += '/';
+  std::set<std::string> found;
+  if (spill_ != nullptr) {
+    std::vector<std::string> spilled;
+    if (spill_->List(dirname, &spilled))
+      found.insert(spilled.begin(), spilled.end());
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    for (auto it = files_.lower_bound(prefix);
+         it != files_.end() && absl::StartsWith(it->first, prefix); ++it) {
+      absl::string_view name(it->first);
+      name.remove_prefix(prefix.size());
+      if (name.find('/') == absl::string_view::npos)
+        found.emplace(name);
+    }
+  }
+  names->insert(names->end(), found.begin(), found.end());
+  return true;
+}
+
+int64_t MemoryFactory::GetMemoryUsage() const {
+  absl::MutexLock lock(&mutex_);
+  int64_t usage = 0;
+  for (const auto &entry : files_) {
+    usage += entry.second->MemoryUsage();
+  }
+  return usage;
+}
+
+const Factory &Memory_Factory() {
+  static const MemoryFactory *factory = new MemoryFactory();
+  return *factory;
+}
+
+}  // namespace file
+
+}  // namespace mysql_ripple
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_FILE_MEMORY_H
+#define MYSQL_RIPPLE_FILE_MEMORY_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "file_base.h"
+
+namespace mysql_ripple {
+
+namespace file {
+
+// A Factory keeping files in memory, in pages of kPageSize bytes so that
+// appending never copies already written data. Files can be written and
+// read concurrently from different threads, and semantics follow stdio
+// (modes "r", "r+", "w" and "a", Truncate() zero fills when growing).
+//
+// If a spill factory is given, the memory factory acts as a RAM tier in
+// front of it: Archive() moves the file to the spill factory and frees the
+// memory, and files not found in memory are looked up in the spill factory.
+// Files that have not been archived are lost when the process exits, and
+// only finalized files shall be archived as later writes are not spilled.
+class MemoryFactory : public Factory {
+ public:
+  static const int64_t kPageSize = 64 * 1024;
+
+  explicit MemoryFactory(const Factory *spill = nullptr);
+  ~MemoryFactory() override;
+
+  bool Create(AppendOnlyFile **file, absl::string_view filename,
+              absl::string_view mode) const override;
+
+  bool Open(AppendOnlyFile **file, absl::string_view filename,
+            absl::string_view mode) const override;
+
+  bool Open(InputFile **file, absl::string_view filename,
+            absl::string_view mode) const override;
+
+  bool Delete(absl::string_view filename) const override;
+
+  bool Rename(absl::string_view filename,
+              absl::string_view newname) const override;
+
+  bool Finalize(absl::string_view filename) const override;
+
+  bool Archive(absl::string_view filename) const override;
+
+  bool Size(absl::string_view filename, int64_t *size) const override;
+
+  bool Mtime(absl::string_view filename, absl::Time *time) const override;
+
+  bool SetMtime(absl::string_view filename, absl::Time time) const override;
+
+  // Directories are implicit, files are listed by name prefix.
+  bool CreateDirectory(absl::string_view dirname) const override;
+
+  bool List(absl::string_view dirname,
+            std::vector<std::string> *names) const override;
+
+  // Number of bytes held in memory, including partially used pages.
+  int64_t GetMemoryUsage() const;
+
+ private:
+  class Data;
+  class File;
+
+  const Factory *spill_;
+  mutable absl::Mutex mutex_;
+  mutable std::map<std::string, std::shared_ptr<Data>> files_
+      ABSL_GUARDED_BY(mutex_);
+
+  std::shared_ptr<Data> Find(absl::string_view filename) const;
+  // Is the file only found in the spill factory.
+  bool InSpill(absl::string_view filename) const;
+  bool OpenFile(File **file, absl::string_view filename,
+                absl::string_view mode) const;
+
+  MemoryFactory(const MemoryFactory&) = delete;
+  MemoryFactory& operator=(const MemoryFactory&) = delete;
+};
+
+// A process wide memory factory without spill factory.
+const Factory& Memory_Factory();
+
+}  // namespace file
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_FILE_MEMORY_H
@@ -0,0 +1,359 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "file_tiered.h"
+
+#include <algorithm>
+#include <set>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "logging.h"
+
+namespace mysql_ripple {
+
+namespace file {
+
+// Files are copied in chunks of at most this size.
+static const int64_t kChunkSize = 1024 * 1024;
+
+TieredFactory::TieredFactory(const Factory &hot, absl::string_view hot_dir,
+                             const Factory &cold, absl::string_view cold_dir)
+    : hot_(hot),
+      hot_dir_(absl::StrCat(absl::StripSuffix(hot_dir, "/"), "/")),
+      cold_(cold),
+      cold_dir_(absl::StrCat(absl::StripSuffix(cold_dir, "/"), "/")),
+      pending_bytes_(0), input_(nullptr), output_(nullptr), remaining_(0),
+      copying_(false) {
+}
+
+TieredFactory::~TieredFactory() {
+  absl::MutexLock lock(&mutex_);
+  if (input_ != nullptr) {
+    AbortMigration();
+  }
+}
+
+std::string TieredFactory::GetColdPath(absl::string_view filename) const {
+  if (!absl::ConsumePrefix(&filename, hot_dir_))
+    return "";
+  return absl::StrCat(cold_dir_, filename);
+}
+
+bool TieredFactory::IsCold(absl::string_view filename) const {
+  std::string cold_path = GetColdPath(filename);
+  int64_t size;
+  return !cold_path.empty() && !hot_.Size(filename, &size) &&
+      cold_.Size(cold_path, &size);
+}
+
+bool TieredFactory::Create(AppendOnlyFile **file, absl::string_view filename,
+                           absl::string_view mode) const {
+  std::string cold_path = GetColdPath(filename);
+  int64_t size;
+  if (!cold_path.empty() && cold_.Size(cold_path, &size))
+    return false;
+  return hot_.Create(file, filename, mode);
+}
+
+bool TieredFactory::Open(AppendOnlyFile **file, absl::string_view filename,
+                         absl::string_view mode) const {
+  // Opening the hot file for writing may create it, so it must not be
+  // deleted by FinishMigration() between the lookup and the open.
+  absl::MutexLock lock(&mutex_);
+  if (IsCold(filename))
+    return cold_.Open(file, GetColdPath(filename), mode);
+  return hot_.Open(file, filename, mode);
+}
+
+bool TieredFactory::Open(InputFile **file, absl::string_view filename,
+                         absl::string_view mode) const {
+  // A migrated file is in the cold directory before it is deleted from the
+  // hot one, so a file not found in the hot directory is found in the cold
+  // one, also if it was migrated just now.
+  if (hot_.Open(file, filename, mode))
+    return true;
+  std::string cold_path = GetColdPath(filename);
+  return !cold_path.empty() && cold_.Open(file, cold_path, mode);
+}
+
+bool TieredFactory::Delete(absl::string_view filename) const {
+  absl::MutexLock lock(&mutex_);
+  Unqueue(filename);
+  bool ok = hot_.Delete(filename);
+  std::string cold_path = GetColdPath(filename);
+  if (!cold_path.empty() && cold_.Delete(cold_path))
+    ok = true;
+  return ok;
+}
+
+bool TieredFactory::Rename(absl::string_view filename,
+                           absl::string_view newname) const {
+  absl::MutexLock lock(&mutex_);
+  Unqueue(filename);
+  if (!IsCold(filename))
+    return hot_.Rename(filename, newname);
+
+  // Keep cold files in the cold directory, e.g when moved to trash.
+  std::string cold_newname = GetColdPath(newname);
+  if (cold_newname.empty())
+    return false;
+  if (!cold_.CreateDirectory(absl::string_view(cold_newname).substr(
+          0, cold_newname.rfind('/'))))
+    return false;
+  return cold_.Rename(GetColdPath(filename), cold_newname);
+}
+
+bool TieredFactory::Finalize(absl::string_view filename) const {
+  absl::MutexLock lock(&mutex_);
+  if (IsCold(filename))
+    return cold_.Finalize(GetColdPath(filename));
+  return hot_.Finalize(filename);
+}
+
+bool TieredFactory::Archive(absl::string_view filename) const {
+  if (GetColdPath(filename).empty() || IsCold(filename))
+    return true;
+  int64_t size;
+  if (!hot_.Size(filename, &size) || !hot_.Archive(filename))
+    return false;
+
+  absl::MutexLock lock(&mutex_);
+  for (const auto &entry : pending_) {
+    if (entry.first == filename)
+      return true;
+  }
+  pending_.emplace_back(std::string(filename), size);
+  pending_bytes_ += size;
+  return true;
+}
+
+bool TieredFactory::Size(absl::string_view filename, int64_t *size) const {
+  if (hot_.Size(filename, size))
+    return true;
+  std::string cold_path = GetColdPath(filename);
+  return !cold_path.empty() && cold_.Size(cold_path, size);
+}
+
+bool TieredFactory::DiskSize(absl::string_view filename,
+                             int64_t *size) const {
+  if (hot_.DiskSize(filename, size))
+    return true;
+  std::string cold_path = GetColdPath(filename);
+  return !cold_path.empty() && cold_.DiskSize(cold_path, size);
+}
+
+bool TieredFactory::Mtime(absl::string_view filename, absl::Time *time) const {
+  if (hot_.Mtime(filename, time))
+    return true;
+  std::string cold_path = GetColdPath(filename);
+  return !cold_path.empty() && cold_.Mtime(cold_path, time);
+}
+
+bool TieredFactory::SetMtime(absl::string_view filename,
+                             absl::Time time) const {
+  absl::MutexLock lock(&mutex_);
+  if (IsCold(filename))
+    return cold_.SetMtime(GetColdPath(filename), time);
+  return hot_.SetMtime(filename, time);
+}
+
+bool TieredFactory::CreateDirectory(absl::string_view dirname) const {
+  if (!hot_.CreateDirectory(dirname))
+    return false;
+  std::string cold_path = GetColdPath(dirname);
+  return cold_path.empty() || cold_.CreateDirectory(cold_path);
+}
+
+bool TieredFactory::List(absl::string_view dirname,
+                         std::vector<std::string> *names) const {
+  std::vector<std::string> hot_names, cold_names;
+  bool ok = hot_.List(dirname, &hot_names);
+  std::string cold_path = GetColdPath(dirname);
+  if (!cold_path.empty() && cold_.List(cold_path, &cold_names))
+    ok = true;
+  if (!ok)
+    return false;
+
+  // A file being migrated can be in both tiers, the .tmp copy written
+  // by the migration is not listed.
+  std::set<std::string> found(hot_names.begin(), hot_names.end());
+  for (const std::string &name : cold_names) {
+    if (!absl::EndsWith(name, ".tmp"))
+      found.insert(name);
+  }
+  names->insert(names->end(), found.begin(), found.end());
+  return true;
+}
+
+bool TieredFactory::RemoveStaleCopies() {
+  std::vector<std::string> names;
+  if (!cold_.List(cold_dir_, &names)) {
+    LOG(ERROR) << "Failed to list " << cold_dir_;
+    return false;
+  }
+  bool ok = true;
+  for (const std::string &name : names) {
+    if (!absl::EndsWith(name, ".tmp"))
+      continue;
+    std::string path = absl::StrCat(cold_dir_, name);
+    LOG(INFO) << "Deleting partial copy " << path;
+    if (!cold_.Delete(path)) {
+      LOG(ERROR) << "Failed to delete " << path;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+uint64_t TieredFactory::GetPendingBytes() const {
+  absl::MutexLock lock(&mutex_);
+  return pending_bytes_;
+}
+
+void TieredFactory::Unqueue(absl::string_view filename) const {
+  // Let Migrate() finish copying its chunk before the migration can be
+  // aborted.
+  mutex_.Await(absl::Condition(
+      +[](bool *copying) { return !*copying; }, &copying_));
+  if (input_ != nullptr && pending_.front().first == filename) {
+    AbortMigration();
+    return;
+  }
+  for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+    if (it->first == filename) {
+      pending_bytes_ -= it->second;
+      pending_.erase(it);
+      return;
+    }
+  }
+}
+
+void TieredFactory::AbortMigration() const {
+  const std::string &filename = pending_.front().first;
+  input_->Close();
+  output_->Close();
+  input_ = nullptr;
+  output_ = nullptr;
+  cold_.Delete(absl::StrCat(GetColdPath(filename), ".tmp"));
+  pending_bytes_ -= remaining_;
+  pending_.pop_front();
+}
+
+bool TieredFactory::StartMigration() {
+  while (!pending_.empty()) {
+    const std::string &filename = pending_.front().first;
+    std::string tmp_path = absl::StrCat(GetColdPath(filename), ".tmp");
+    if (hot_.Open(&input_, filename, "r")) {
+      if (cold_.Open(&output_, tmp_path, "w")) {
+        remaining_ = pending_.front().second;
+        return true;
+      }
+      input_->Close();
+      input_ = nullptr;
+    }
+    LOG(ERROR) << "Failed to start archiving " << filename << " to "
+               << tmp_path << ", leaving it in " << hot_dir_;
+    pending_bytes_ -= pending_.front().second;
+    pending_.pop_front();
+  }
+  return false;
+}
+
+bool TieredFactory::FinishMigration() {
+  const std::string filename = pending_.front().first;
+  std::string cold_path = GetColdPath(filename);
+  std::string tmp_path = absl::StrCat(cold_path, ".tmp");
+  bool ok = output_->Close();
+  input_->Close();
+  input_ = nullptr;
+  output_ = nullptr;
+  pending_.pop_front();
+
+  // Rename into place before deleting the hot file, so that readers find
+  // the file in one of the directories at all times.
+  if (!ok || !cold_.Rename(tmp_path, cold_path)) {
+    LOG(ERROR) << "Failed to archive " << filename << " to " << cold_path
+               << ", leaving it in " << hot_dir_;
+    cold_.Delete(tmp_path);
+    return false;
+  }
+
+  // Keep mtime, it decides when the file is purged.
+  absl::Time mtime;
+  if (hot_.Mtime(filename, &mtime)) {
+    cold_.SetMtime(cold_path, mtime);
+  }
+
+  if (!hot_.Delete(filename)) {
+    LOG(ERROR) << "Failed to delete archived " << filename;
+    return false;
+  }
+  return cold_.Archive(cold_path);
+}
+
+bool TieredFactory::Migrate(size_t max_bytes, size_t *copied) {
+  *copied = 0;
+  while (*copied < max_bytes) {
+    InputFile *input;
+    AppendOnlyFile *output;
+    int64_t size;
+    bool last;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (input_ == nullptr && !StartMigration())
+        return false;
+      size = std::min<int64_t>(
+          {remaining_, kChunkSize, static_cast<int64_t>(max_bytes - *copied)});
+      last = size == remaining_;
+      input = input_;
+      output = output_;
+      copying_ = true;
+    }
+
+    // Copy without the lock, so that Archive(), called when the binlog
+    // rotates, and readers never wait for io. Delete() and Rename() of the
+    // file being migrated wait for at most one chunk.
+    bool ok = true;
+    if (size > 0) {
+      Buffer buffer;
+      ok = input->Read(buffer, size) && output->Write(buffer);
+    }
+    if (ok && last) {
+      ok = output->Sync();
+    }
+
+    absl::MutexLock lock(&mutex_);
+    copying_ = false;
+    if (!ok) {
+      LOG(ERROR) << "Failed to copy " << pending_.front().first
+                 << " to " << cold_dir_ << ", leaving it in " << hot_dir_;
+      AbortMigration();
+      continue;
+    }
+    remaining_ -= size;
+    pending_bytes_ -= size;
+    *copied += size;
+    if (remaining_ == 0) {
+      FinishMigration();
+    }
+  }
+  absl::MutexLock lock(&mutex_);
+  return input_ != nullptr || !pending_.empty();
+}
+
+}  // namespace file
+
+}  // namespace mysql_ripple
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_FILE_TIERED_H
+#define MYSQL_RIPPLE_FILE_TIERED_H
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "file_base.h"
+
+namespace mysql_ripple {
+
+namespace file {
+
+// A Factory with two tiers: a hot directory where files are written and a
+// cold directory (typically on cheaper disks) to which archived files are
+// moved.
+//
+// Archive() only queues the file, the copy is done by repeated calls to
+// Migrate() from a single thread, which copies sequentially and at most
+// max_bytes per call so that the caller can throttle it. When a file has
+// been copied it is renamed into place in the cold directory before it is
+// deleted from the hot directory, so it can always be found in at least one
+// of them. The queue is not persisted, files that were still queued when
+// the process stopped must be archived again, and the partial copies left
+// behind are deleted by RemoveStaleCopies().
+//
+// Files are looked up in the hot directory first and then in the cold
+// directory, so readers are routed transparently. Readers that opened a
+// file before it was migrated keep reading the (unlinked) hot copy.
+class TieredFactory : public Factory {
+ public:
+  TieredFactory(const Factory &hot, absl::string_view hot_dir,
+                const Factory &cold, absl::string_view cold_dir);
+  ~TieredFactory() override;
+
+  bool Create(AppendOnlyFile **file, absl::string_view filename,
+              absl::string_view mode) const override;
+
+  bool Open(AppendOnlyFile **file, absl::string_view filename,
+            absl::string_view mode) const override;
+
+  bool Open(InputFile **file, absl::string_view filename,
+            absl::string_view mode) const override;
+
+  bool Delete(absl::string_view filename) const override;
+
+  bool Rename(absl::string_view filename,
+              absl::string_view newname) const override;
+
+  bool Finalize(absl::string_view filename) const override;
+
+  // Queue file to be moved to the cold directory.
+  bool Archive(absl::string_view filename) const override;
+
+  bool Size(absl::string_view filename, int64_t *size) const override;
+
+  bool DiskSize(absl::string_view filename, int64_t *size) const override;
+
+  bool Mtime(absl::string_view filename, absl::Time *time) const override;
+
+  bool SetMtime(absl::string_view filename, absl::Time time) const override;
+
+  // Create directory in both tiers.
+  bool CreateDirectory(absl::string_view dirname) const override;
+
+  // List files of directory in both tiers.
+  bool List(absl::string_view dirname,
+            std::vector<std::string> *names) const override;
+
+  // Copy at most max_bytes of queued files to the cold directory, storing
+  // the bytes copied in *copied.
+  // Return true if there are more files to migrate.
+  bool Migrate(size_t max_bytes, size_t *copied);
+
+  // Delete the .tmp copies of an interrupted migration from the cold
+  // directory. Call once at startup, before the first Migrate().
+  bool RemoveStaleCopies();
+
+  // Bytes of queued files not yet migrated.
+  uint64_t GetPendingBytes() const;
+
+ private:
+  const Factory &hot_;
+  const std::string hot_dir_;
+  const Factory &cold_;
+  const std::string cold_dir_;
+
+  // Files queued for migration with their size. The first one is being
+  // migrated if input_ is not null. State is mutable as files are
+  // unqueued by Delete() and Rename().
+  mutable absl::Mutex mutex_;
+  mutable std::deque<std::pair<std::string, int64_t>> pending_
+      ABSL_GUARDED_BY(mutex_);
+  mutable uint64_t pending_bytes_ ABSL_GUARDED_BY(mutex_);
+  mutable InputFile *input_ ABSL_GUARDED_BY(mutex_);
+  mutable AppendOnlyFile *output_ ABSL_GUARDED_BY(mutex_);
+  mutable int64_t remaining_ ABSL_GUARDED_BY(mutex_);
+
+  // Migrate() is copying a chunk of the first file without the mutex.
+  mutable bool copying_ ABSL_GUARDED_BY(mutex_);
+
+  // Path of file in cold directory, empty if not below hot directory.
+  std::string GetColdPath(absl::string_view filename) const;
+
+  // Is file only found in the cold directory.
+  bool IsCold(absl::string_view filename) const;
+
+  // Remove file from queue, aborting the migration if it is in progress.
+  void Unqueue(absl::string_view filename) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void AbortMigration() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool StartMigration() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool FinishMigration() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  TieredFactory(const TieredFactory&) = delete;
+  TieredFactory& operator=(const TieredFactory&) = delete;
+};
+
+}  // namespace file
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_FILE_TIERED_H
@@ -14,6 +14,14 @@
 
 #include "file.h"
 
+#include <sys/stat.h>
+
+#include <atomic>
+#include <thread>
+
+#include "file_compressed.h"
+#include "file_tiered.h"
+#include "absl/strings/str_cat.h"
 #include "gtest/gtest.h"
 
 namespace mysql_ripple {
@@ -73,6 +81,454 @@ TEST(FILE, Basic) {
   TestBasic(file::FILE_Factory(), GetTestDir() + "/file.test");
 }
 
+TEST(Memory, Basic) {
+  MemoryFactory factory;
+  TestBasic(factory, "file.test");
+  EXPECT_EQ(factory.GetMemoryUsage(), 0);
+}
+
+TEST(Memory, Pages) {
+  MemoryFactory factory;
+  AppendOnlyFile *ofile = nullptr;
+  InputFile *ifile = nullptr;
+  int64_t size;
+
+  // Write across page boundaries.
+  std::string data;
+  for (int i = 0; i < 3 * MemoryFactory::kPageSize / 2; i++) {
+    data.push_back(static_cast<char>(i % 251));
+  }
+  ASSERT_TRUE(factory.Create(&ofile, "file.test", "a"));
+  EXPECT_TRUE(ofile->Write(data));
+  EXPECT_TRUE(ofile->Write(data));
+  EXPECT_TRUE(factory.Size("file.test", &size));
+  EXPECT_EQ(size, 2 * data.size());
+  EXPECT_EQ(factory.GetMemoryUsage(), 3 * MemoryFactory::kPageSize);
+
+  ASSERT_TRUE(factory.Open(&ifile, "file.test", "r"));
+  Buffer buf;
+  EXPECT_TRUE(ifile->Seek(data.size()));
+  EXPECT_TRUE(ifile->Read(buf, data.size()));
+  EXPECT_EQ(absl::string_view(buf), data);
+  EXPECT_FALSE(ifile->eof());
+
+  // Short read at end of file.
+  buf.clear();
+  EXPECT_FALSE(ifile->Read(buf, 1));
+  EXPECT_EQ(buf.size(), 0);
+  EXPECT_TRUE(ifile->eof());
+
+  // Truncate releases pages and zero fills when growing again.
+  EXPECT_TRUE(ofile->Truncate(10));
+  EXPECT_EQ(factory.GetMemoryUsage(), MemoryFactory::kPageSize);
+  EXPECT_TRUE(ofile->Truncate(20));
+  buf.clear();
+  EXPECT_TRUE(ifile->Seek(0));
+  EXPECT_TRUE(ifile->Read(buf, 20));
+  EXPECT_EQ(absl::string_view(buf).substr(0, 10), data.substr(0, 10));
+  EXPECT_EQ(absl::string_view(buf).substr(10), std::string(10, '\0'));
+
+  // Writes in append mode go to the end of file.
+  int64_t offs;
+  EXPECT_TRUE(ofile->Write("x"));
+  EXPECT_TRUE(ofile->Tell(&offs));
+  EXPECT_EQ(offs, 21);
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_TRUE(ifile->Close());
+
+  // "r+" writes at start of file, "w" truncates.
+  ASSERT_TRUE(factory.Open(&ofile, "file.test", "r+"));
+  EXPECT_TRUE(ofile->Write("y"));
+  EXPECT_TRUE(factory.Size("file.test", &size));
+  EXPECT_EQ(size, 21);
+  EXPECT_TRUE(ofile->Close());
+  ASSERT_TRUE(factory.Open(&ofile, "file.test", "w"));
+  EXPECT_TRUE(factory.Size("file.test", &size));
+  EXPECT_EQ(size, 0);
+  EXPECT_TRUE(ofile->Close());
+
+  EXPECT_FALSE(factory.Create(&ofile, "file.test", "a"));
+  EXPECT_FALSE(factory.Open(&ifile, "missing.test", "r"));
+  EXPECT_TRUE(factory.Delete("file.test"));
+  EXPECT_FALSE(factory.Size("file.test", &size));
+}
+
+TEST(Memory, Directories) {
+  MemoryFactory factory;
+  AppendOnlyFile *ofile = nullptr;
+  EXPECT_TRUE(factory.CreateDirectory("dir"));
+  for (const char *filename : {"dir/b", "dir/a", "dir/sub/c", "dirx"}) {
+    ASSERT_TRUE(factory.Create(&ofile, filename, "a"));
+    EXPECT_TRUE(ofile->Close());
+  }
+  std::vector<std::string> names;
+  EXPECT_TRUE(factory.List("dir/", &names));
+  EXPECT_EQ(names, std::vector<std::string>({"a", "b"}));
+
+  absl::Time time = absl::FromUnixSeconds(1000);
+  absl::Time mtime;
+  EXPECT_TRUE(factory.SetMtime("dir/a", time));
+  EXPECT_TRUE(factory.Mtime("dir/a", &mtime));
+  EXPECT_EQ(mtime, time);
+  EXPECT_FALSE(factory.SetMtime("dir/x", time));
+}
+
+TEST(Memory, Spill) {
+  MemoryFactory factory(&file::FILE_Factory());
+  std::string filename = GetTestDir() + "/file_spill.test";
+  std::string data("a string");
+  AppendOnlyFile *ofile = nullptr;
+  InputFile *ifile = nullptr;
+  int64_t size;
+
+  file::FILE_Factory().Delete(filename);
+  ASSERT_TRUE(factory.Create(&ofile, filename, "a"));
+  EXPECT_TRUE(ofile->Write(data));
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_FALSE(file::FILE_Factory().Size(filename, &size));
+
+  // Archive moves the file to the spill factory.
+  EXPECT_TRUE(factory.Finalize(filename));
+  EXPECT_TRUE(factory.Archive(filename));
+  EXPECT_EQ(factory.GetMemoryUsage(), 0);
+  EXPECT_TRUE(file::FILE_Factory().Size(filename, &size));
+  EXPECT_EQ(size, data.size());
+
+  // and it is still accessible through the memory factory.
+  EXPECT_TRUE(factory.Size(filename, &size));
+  EXPECT_EQ(size, data.size());
+  ASSERT_TRUE(factory.Open(&ifile, filename, "r"));
+  Buffer buf;
+  EXPECT_TRUE(ifile->Read(buf, data.size()));
+  EXPECT_EQ(absl::string_view(buf), data);
+  EXPECT_TRUE(ifile->Close());
+  EXPECT_FALSE(factory.Create(&ofile, filename, "a"));
+
+  EXPECT_TRUE(factory.Delete(filename));
+  EXPECT_FALSE(file::FILE_Factory().Size(filename, &size));
+}
+
+TEST(Tiered, Basic) {
+  std::string hot = GetTestDir() + "/hot";
+  std::string cold = GetTestDir() + "/cold";
+  mkdir(hot.c_str(), 0755);
+  mkdir(cold.c_str(), 0755);
+  TieredFactory factory(FILE_Factory(), hot, FILE_Factory(), cold);
+  TestBasic(factory, hot + "/file.test");
+}
+
+TEST(Tiered, Migrate) {
+  std::string hot = GetTestDir() + "/hot";
+  std::string cold = GetTestDir() + "/cold";
+  mkdir(hot.c_str(), 0755);
+  mkdir(cold.c_str(), 0755);
+  TieredFactory factory(FILE_Factory(), hot, FILE_Factory(), cold);
+  std::string filename = hot + "/file.test";
+  std::string data(100, 'x');
+  AppendOnlyFile *ofile = nullptr;
+  InputFile *ifile = nullptr;
+  int64_t size;
+
+  FILE_Factory().Delete(filename);
+  FILE_Factory().Delete(cold + "/file.test");
+  ASSERT_TRUE(factory.Create(&ofile, filename, "a"));
+  EXPECT_TRUE(ofile->Write(data));
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_TRUE(factory.Finalize(filename));
+  EXPECT_TRUE(factory.Archive(filename));
+  EXPECT_EQ(factory.GetPendingBytes(), data.size());
+
+  // A reader opened before the migration keeps reading the hot file.
+  ASSERT_TRUE(factory.Open(&ifile, filename, "r"));
+
+  // Copy in two steps.
+  size_t copied;
+  EXPECT_TRUE(factory.Migrate(60, &copied));
+  EXPECT_EQ(copied, 60);
+  EXPECT_EQ(factory.GetPendingBytes(), 40);
+  EXPECT_TRUE(FILE_Factory().Size(filename, &size));
+  EXPECT_FALSE(factory.Migrate(60, &copied));
+  EXPECT_EQ(copied, 40);
+  EXPECT_EQ(factory.GetPendingBytes(), 0);
+  EXPECT_FALSE(FILE_Factory().Size(filename, &size));
+  EXPECT_TRUE(FILE_Factory().Size(cold + "/file.test", &size));
+  EXPECT_EQ(size, data.size());
+
+  Buffer buf;
+  EXPECT_TRUE(ifile->Read(buf, data.size()));
+  EXPECT_TRUE(ifile->Close());
+
+  // New readers are routed to the cold file.
+  EXPECT_TRUE(factory.Size(filename, &size));
+  EXPECT_EQ(size, data.size());
+  ASSERT_TRUE(factory.Open(&ifile, filename, "r"));
+  buf.clear();
+  EXPECT_TRUE(ifile->Read(buf, data.size()));
+  EXPECT_EQ(absl::string_view(buf), data);
+  EXPECT_TRUE(ifile->Close());
+  EXPECT_FALSE(factory.Create(&ofile, filename, "a"));
+
+  // Cold files stay cold when moved to trash, and are listed with the
+  // files of the hot trash directory.
+  std::string trash = hot + "/trash/file.test";
+  EXPECT_TRUE(factory.Rename(filename, trash));
+  EXPECT_TRUE(FILE_Factory().Size(cold + "/trash/file.test", &size));
+  std::vector<std::string> names;
+  EXPECT_TRUE(factory.List(hot + "/trash/", &names));
+  EXPECT_EQ(names, std::vector<std::string>({"file.test"}));
+  EXPECT_TRUE(factory.Delete(trash));
+  EXPECT_FALSE(factory.Size(trash, &size));
+}
+
+TEST(Tiered, MemoryTiers) {
+  MemoryFactory hot, cold;
+  TieredFactory factory(hot, "hot", cold, "cold");
+  AppendOnlyFile *ofile = nullptr;
+  absl::Time time = absl::FromUnixSeconds(1000);
+  absl::Time mtime;
+
+  ASSERT_TRUE(factory.Create(&ofile, "hot/file.test", "a"));
+  EXPECT_TRUE(ofile->Write(std::string(100, 'x')));
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_TRUE(factory.SetMtime("hot/file.test", time));
+  EXPECT_TRUE(factory.Archive("hot/file.test"));
+  size_t copied;
+  EXPECT_FALSE(factory.Migrate(100, &copied));
+
+  // The migrated file keeps its mtime.
+  EXPECT_TRUE(cold.Mtime("cold/file.test", &mtime));
+  EXPECT_EQ(mtime, time);
+
+  EXPECT_TRUE(factory.CreateDirectory("hot/trash"));
+  EXPECT_TRUE(factory.Rename("hot/file.test", "hot/trash/file.test"));
+  std::vector<std::string> names;
+  EXPECT_TRUE(factory.List("hot/trash", &names));
+  EXPECT_EQ(names, std::vector<std::string>({"file.test"}));
+  EXPECT_TRUE(factory.Delete("hot/trash/file.test"));
+}
+
+TEST(Tiered, RemoveStaleCopies) {
+  MemoryFactory hot, cold;
+  AppendOnlyFile *ofile = nullptr;
+  int64_t size;
+
+  // A migration that was interrupted by a restart.
+  ASSERT_TRUE(hot.Create(&ofile, "hot/file.test", "a"));
+  EXPECT_TRUE(ofile->Write(std::string(100, 'x')));
+  EXPECT_TRUE(ofile->Close());
+  ASSERT_TRUE(cold.Create(&ofile, "cold/file.test.tmp", "a"));
+  EXPECT_TRUE(ofile->Write(std::string(10, 'x')));
+  EXPECT_TRUE(ofile->Close());
+  ASSERT_TRUE(cold.Create(&ofile, "cold/other.test", "a"));
+  EXPECT_TRUE(ofile->Close());
+
+  TieredFactory factory(hot, "hot", cold, "cold");
+  EXPECT_TRUE(factory.RemoveStaleCopies());
+  EXPECT_FALSE(cold.Size("cold/file.test.tmp", &size));
+  EXPECT_TRUE(cold.Size("cold/other.test", &size));
+
+  // The file is queued again and migrated.
+  EXPECT_TRUE(factory.Archive("hot/file.test"));
+  size_t copied;
+  EXPECT_FALSE(factory.Migrate(1000, &copied));
+  EXPECT_EQ(copied, 100);
+  EXPECT_FALSE(hot.Size("hot/file.test", &size));
+  EXPECT_TRUE(cold.Size("cold/file.test", &size));
+  EXPECT_EQ(size, 100);
+}
+
+TEST(Tiered, OpenWhileMigrating) {
+  MemoryFactory hot, cold;
+  TieredFactory factory(hot, "hot", cold, "cold");
+  const int kFiles = 100;
+  for (int i = 0; i < kFiles; i++) {
+    AppendOnlyFile *ofile = nullptr;
+    std::string filename = absl::StrCat("hot/file", i);
+    ASSERT_TRUE(factory.Create(&ofile, filename, "a"));
+    EXPECT_TRUE(ofile->Write("data"));
+    EXPECT_TRUE(ofile->Close());
+    EXPECT_TRUE(factory.Archive(filename));
+  }
+
+  // Files are always found while they move between the tiers.
+  std::atomic<bool> done(false);
+  std::thread reader([&factory, &done]() {
+    while (!done) {
+      for (int i = 0; i < kFiles; i++) {
+        InputFile *ifile = nullptr;
+        ASSERT_TRUE(factory.Open(&ifile, absl::StrCat("hot/file", i), "r"));
+        EXPECT_TRUE(ifile->Close());
+      }
+    }
+  });
+  size_t copied;
+  while (factory.Migrate(2, &copied)) {}
+  done = true;
+  reader.join();
+  int64_t size;
+  EXPECT_FALSE(hot.Size("hot/file0", &size));
+  EXPECT_TRUE(cold.Size("cold/file0", &size));
+}
+
+TEST(Tiered, DeleteWhileMigrating) {
+  std::string hot = GetTestDir() + "/hot";
+  std::string cold = GetTestDir() + "/cold";
+  mkdir(hot.c_str(), 0755);
+  mkdir(cold.c_str(), 0755);
+  TieredFactory factory(FILE_Factory(), hot, FILE_Factory(), cold);
+  std::string filename = hot + "/file.test";
+  AppendOnlyFile *ofile = nullptr;
+  int64_t size;
+
+  FILE_Factory().Delete(filename);
+  ASSERT_TRUE(factory.Create(&ofile, filename, "a"));
+  EXPECT_TRUE(ofile->Write(std::string(100, 'x')));
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_TRUE(factory.Archive(filename));
+  size_t copied;
+  EXPECT_TRUE(factory.Migrate(10, &copied));
+
+  EXPECT_TRUE(factory.Delete(filename));
+  EXPECT_EQ(factory.GetPendingBytes(), 0);
+  EXPECT_FALSE(factory.Migrate(100, &copied));
+  EXPECT_EQ(copied, 0);
+  EXPECT_FALSE(factory.Size(filename, &size));
+  EXPECT_FALSE(FILE_Factory().Size(cold + "/file.test.tmp", &size));
+}
+
+std::string Pattern(int64_t size) {
+  std::string data;
+  for (int64_t i = 0; static_cast<int64_t>(data.size()) < size; i++) {
+    absl::StrAppend(&data, "event ", i, " ");
+  }
+  data.resize(size);
+  return data;
+}
+
+TEST(Compressed, Basic) {
+  CompressedFactory factory(FILE_Factory(), 1 << 20);
+  TestBasic(factory, GetTestDir() + "/file.test");
+}
+
+TEST(Compressed, Seek) {
+  CompressedFactory factory(FILE_Factory(), 1 << 20);
+  std::string filename = GetTestDir() + "/file_compressed.test";
+  const int64_t frame = CompressedFactory::kFrameSize;
+  std::string data = Pattern(3 * frame + frame / 2);
+  AppendOnlyFile *ofile = nullptr;
+  InputFile *ifile = nullptr;
+  int64_t size;
+
+  FILE_Factory().Delete(filename);
+  ASSERT_TRUE(factory.Create(&ofile, filename, "w"));
+  EXPECT_TRUE(ofile->Write(absl::string_view(data).substr(0, 1000)));
+  EXPECT_TRUE(ofile->Write(absl::string_view(data).substr(1000)));
+  EXPECT_TRUE(ofile->Close());
+
+  EXPECT_TRUE(factory.Size(filename, &size));
+  EXPECT_EQ(size, data.size());
+  int64_t file_size;
+  EXPECT_TRUE(FILE_Factory().Size(filename, &file_size));
+  EXPECT_LT(file_size, size / 4);
+
+  // Read across frame boundaries from a few positions.
+  ASSERT_TRUE(factory.Open(&ifile, filename, "r"));
+  for (int64_t offset : {int64_t{0}, frame - 10, 3 * frame + 5, frame / 2}) {
+    Buffer buf;
+    EXPECT_TRUE(ifile->Seek(offset));
+    EXPECT_TRUE(ifile->Read(buf, 100));
+    EXPECT_EQ(absl::string_view(buf), data.substr(offset, 100));
+  }
+  // Frames 0, 1 and 3 were decompressed.
+  EXPECT_EQ(factory.GetCache().GetSize(), 2 * frame + frame / 2);
+
+  // Short read at end of file.
+  Buffer buf;
+  EXPECT_TRUE(ifile->Seek(data.size() - 10));
+  EXPECT_FALSE(ifile->Read(buf, 20));
+  EXPECT_EQ(buf.size(), 10);
+  EXPECT_TRUE(ifile->eof());
+  EXPECT_TRUE(ifile->Close());
+
+  // Truncating to a size on disk frees compressed data and leaves an
+  // uncompressed file.
+  int64_t disk_size;
+  EXPECT_TRUE(factory.DiskSize(filename, &disk_size));
+  EXPECT_EQ(disk_size, file_size);
+  ASSERT_TRUE(factory.Open(&ofile, filename, "r+"));
+  EXPECT_TRUE(ofile->Truncate(file_size / 2));
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_EQ(factory.GetCache().GetSize(), 0);
+  int64_t new_file_size;
+  EXPECT_TRUE(FILE_Factory().Size(filename, &new_file_size));
+  EXPECT_GT(new_file_size, 0);
+  EXPECT_LE(new_file_size, file_size / 2);
+  EXPECT_TRUE(factory.Size(filename, &size));
+  EXPECT_EQ(size, new_file_size);
+  EXPECT_TRUE(factory.DiskSize(filename, &disk_size));
+  EXPECT_EQ(disk_size, new_file_size);
+
+  EXPECT_TRUE(factory.Delete(filename));
+}
+
+TEST(Compressed, Uncompressed) {
+  CompressedFactory factory(FILE_Factory(), 1 << 20);
+  std::string filename = GetTestDir() + "/file_uncompressed.test";
+  std::string data = Pattern(1000);
+  AppendOnlyFile *ofile = nullptr;
+  InputFile *ifile = nullptr;
+  int64_t size;
+
+  FILE_Factory().Delete(filename);
+  ASSERT_TRUE(FILE_Factory().Create(&ofile, filename, "w"));
+  EXPECT_TRUE(ofile->Write(data));
+  EXPECT_TRUE(ofile->Close());
+
+  EXPECT_TRUE(factory.Size(filename, &size));
+  EXPECT_EQ(size, data.size());
+  ASSERT_TRUE(factory.Open(&ifile, filename, "r"));
+  Buffer buf;
+  EXPECT_TRUE(ifile->Read(buf, data.size()));
+  EXPECT_EQ(absl::string_view(buf), data);
+  EXPECT_TRUE(ifile->Close());
+  EXPECT_TRUE(factory.Delete(filename));
+}
+
+TEST(Tiered, MigrateCompressed) {
+  std::string hot = GetTestDir() + "/hot";
+  std::string cold = GetTestDir() + "/cold";
+  mkdir(hot.c_str(), 0755);
+  mkdir(cold.c_str(), 0755);
+  CompressedFactory compressed(FILE_Factory(), 1 << 20);
+  TieredFactory factory(FILE_Factory(), hot, compressed, cold);
+  std::string filename = hot + "/file.test";
+  std::string data = Pattern(CompressedFactory::kFrameSize * 2);
+  AppendOnlyFile *ofile = nullptr;
+  InputFile *ifile = nullptr;
+  int64_t size;
+
+  FILE_Factory().Delete(filename);
+  FILE_Factory().Delete(cold + "/file.test");
+  ASSERT_TRUE(factory.Create(&ofile, filename, "a"));
+  EXPECT_TRUE(ofile->Write(data));
+  EXPECT_TRUE(ofile->Close());
+  EXPECT_TRUE(factory.Archive(filename));
+  size_t copied;
+  while (factory.Migrate(100000, &copied)) {}
+
+  EXPECT_TRUE(factory.Size(filename, &size));
+  EXPECT_EQ(size, data.size());
+  EXPECT_TRUE(FILE_Factory().Size(cold + "/file.test", &size));
+  EXPECT_LT(size, data.size() / 4);
+  ASSERT_TRUE(factory.Open(&ifile, filename, "r"));
+  Buffer buf;
+  EXPECT_TRUE(ifile->Seek(100));
+  EXPECT_TRUE(ifile->Read(buf, data.size() - 100));
+  EXPECT_EQ(absl::string_view(buf), data.substr(100));
+  EXPECT_TRUE(ifile->Close());
+  EXPECT_TRUE(factory.Delete(filename));
+}
+
 }  // namespace file
 
 }  // namespace mysql_ripple
@@ -37,6 +37,17 @@ DEFINE_string(ripple_server_address, "localhost",
 DEFINE_string(ripple_server_type, "tcp",
               "Server type that ripple will expose for incoming connections");
 
+DEFINE_string(ripple_server_socket, "",
+              "If set, ripple also accepts incoming connections on a unix"
+              " domain socket at this path");
+
+DEFINE_int32(ripple_server_accept_threads, 1,
+             "Threads accepting incoming connections. With more than 1,"
+             " each port is bound once per thread using SO_REUSEPORT.");
+
+DEFINE_int32(ripple_server_backlog, 1024,
+             "Listen backlog of each socket accepting incoming connections");
+
 DEFINE_string(ripple_server_name, "",
               "Server name that ripple sets when connecting to master "
               "and exposes in the server_name variable");
@@ -67,15 +78,58 @@ DEFINE_bool(ripple_master_compressed_protocol, true,
 DEFINE_double(ripple_master_heartbeat_period, 0.1,  // 100ms
               "Heartbeat period used for master connection");
 
+DEFINE_string(ripple_hedge_master_address, "",
+              "Address of a second upstream streaming the same GTIDs as the"
+              " master, e.g a replica of it. If set, transactions are taken"
+              " from whichever upstream delivers them first");
+
+DEFINE_int32(ripple_hedge_master_port, 51001,
+             "Port that ripple will use to connect to the second upstream");
+
+DEFINE_uint64(ripple_hedge_max_transaction_size, 64 * 1024 * 1024,
+              "Bytes of a transaction held back per upstream. The first"
+              " upstream to go past this writes the transaction directly,"
+              " the others drop their copies of it");
+
 DEFINE_int32(ripple_encryption_scheme, 255,  // encryption with fake key server
-             "Encryption scheme used by ripple for local binlogs");
+             "Encryption scheme used by ripple for local binlogs"
+             " (0=none, 1=AES-GCM per event, 2=AES-GCM per block of events,"
+             " 255 and 254 are 1 and 2 with example keys)");
+
+DEFINE_int32(ripple_encryption_threads, 4,
+             "Max threads, including the calling thread, used to encrypt and"
+             " decrypt events spanning several blocks with encryption"
+             " scheme 2");
+
+DEFINE_uint64(ripple_large_event_size, 16 * 1024 * 1024,
+              "Events larger than this are read and sent to slaves in parts"
+              " of this size, and buffers grown past it by an event are"
+              " freed after it.");
+
+DEFINE_uint64(ripple_large_event_memory, 256 * 1024 * 1024,
+              "Max bytes of event parts held at once by all slave sessions"
+              " sending large events. Sessions over the limit wait.");
+
+DEFINE_int32(ripple_large_event_memory_timeout, 60,
+             "Seconds a slave session waits for ripple_large_event_memory"
+             " before it fails");
 
 DEFINE_string(ripple_datadir, ".",
-              "Directory in which ripple will save local binlogs");
+              "Directory in which ripple will save local binlogs."
+              " The binlog index in it is written as a checksummed journal"
+              " that older versions can't read, so downgrading ripple over"
+              " an existing datadir is not supported.");
 
 DEFINE_int32(ripple_max_binlog_size, 1073741824,
              "Size after which binlog is rotated");
 
+DEFINE_bool(ripple_binlog_index_validate_files, true,
+            "Validate all binlog files in the binlog index on startup."
+            " If false, closed files are instead validated when first read.");
+
+DEFINE_int32(ripple_binlog_index_recover_threads, 8,
+             "Max no of threads used to validate binlog files on startup");
+
 DEFINE_bool(danger_danger_use_dbug_keys, false,
             "Use dbug keys (compatible with mysqld)");
 
@@ -94,6 +148,29 @@ DEFINE_int32(ripple_master_reconnect_attempts, 3,
              " ripple_master_reconnect_attempts per"
              " ripple_master_reconnect_period");
 
+DEFINE_int32(ripple_master_read_timeout, 0,
+             "Reconnect if nothing is read from the master for this many"
+             " seconds, including heartbeats (0 waits forever)");
+
+DEFINE_int32(ripple_master_write_timeout, 30,
+             "Fail writes to the master, e.g semi-sync acks, that block for"
+             " this many seconds (0 waits forever)");
+
+DEFINE_string(ripple_master_standby_addresses, "",
+              "Comma separated host[:port] of upstreams that ripple keeps"
+              " connected, authenticated and checked, and replicates from"
+              " at once when the connection to the master fails. The"
+              " master is tried again when replicating from the standby"
+              " ends. The port defaults to ripple_master_port");
+
+DEFINE_int32(ripple_master_standby_check_period, 1000,
+             "Check or reconnect standby connections every this many ms");
+
+DEFINE_int32(ripple_master_standby_timeout, 5,
+             "Connect, read and write timeout of standby connections in"
+             " seconds, also while replicating from a standby. Shall be"
+             " longer than ripple_master_heartbeat_period");
+
 DEFINE_bool(ripple_semi_sync_slave_enabled, false,
             "Shall ripple send semi-sync acks to the master");
 
@@ -111,6 +188,31 @@ DEFINE_uint64(ripple_purge_logs_keep_size, 0,
               " This is evaluated independently of"
               " ripple_purge_expire_logs_days.");
 
+DEFINE_uint64(ripple_purge_trash_rate, 0,
+              "If set, purged binlog files are moved to a trash directory"
+              " and freed in the background by truncating them at most"
+              " this many bytes per second (0=unlink directly).");
+
+DEFINE_string(ripple_archive_dir, "",
+              "If set, archived (closed) binlog files are moved from"
+              " ripple_datadir to this directory in the background.");
+
+DEFINE_uint64(ripple_archive_rate, 0,
+              "Copy at most this many bytes per second when moving binlog"
+              " files to ripple_archive_dir (0=unlimited).");
+
+DEFINE_bool(ripple_archive_compress, false,
+            "Compress binlog files when moving them to ripple_archive_dir."
+            " They are compressed in frames so that readers can still seek.");
+
+DEFINE_uint64(ripple_archive_cache_size, 64 * 1024 * 1024,
+              "Bytes of decompressed frames of compressed binlog files to"
+              " cache, shared by all readers.");
+
+DEFINE_int32(ripple_monitoring_port, 0,
+             "If set, serve metrics in Prometheus text format over http"
+             " on this port of localhost (0=disabled).");
+
 DEFINE_int32(ripple_master_alloc_server_id_timeout, 1000,
              "Wait for maximum this ms when making sure that server id is"
              " unique when connecting to a master.");
@@ -119,4 +221,19 @@ DEFINE_int32(ripple_slave_alloc_server_id_timeout, 5000,
              "Wait for maximum this ms when making sure that server id is"
              " unique when a slave connects.");
 
+DEFINE_int32(ripple_slave_threads, 8,
+             "Worker threads started up front to run slave sessions.");
+
+DEFINE_int32(ripple_slave_max_threads, 1024,
+             "Max worker threads running slave sessions. Sessions beyond"
+             " this wait for a session to end.");
+
+DEFINE_uint64(ripple_slave_thread_stack_size, 512 * 1024,
+              "Stack size of the worker threads running slave sessions"
+              " (0=system default).");
+
+DEFINE_string(ripple_slave_thread_cpus, "",
+              "If set, pin the worker threads running slave sessions to"
+              " these cpus, e.g 0-3,8.");
+
 }  // namespace mysql_ripple
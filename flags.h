@@ -26,6 +26,9 @@ DECLARE_string(ripple_rw_rpc_users);
 DECLARE_string(ripple_server_ports);
 DECLARE_string(ripple_server_address);
 DECLARE_string(ripple_server_type);
+DECLARE_string(ripple_server_socket);
+DECLARE_int32(ripple_server_accept_threads);
+DECLARE_int32(ripple_server_backlog);
 DECLARE_string(ripple_server_password_hash);
 
 DECLARE_int32(ripple_master_port);
@@ -35,15 +38,24 @@ DECLARE_string(ripple_master_protocol);
 DECLARE_string(ripple_master_address);
 DECLARE_bool(ripple_master_compressed_protocol);
 DECLARE_double(ripple_master_heartbeat_period);
+DECLARE_string(ripple_hedge_master_address);
+DECLARE_int32(ripple_hedge_master_port);
+DECLARE_uint64(ripple_hedge_max_transaction_size);
 
 DECLARE_int32(ripple_server_id);
 DECLARE_string(ripple_server_uuid);
 DECLARE_string(ripple_server_name);
 
 DECLARE_int32(ripple_encryption_scheme);
+DECLARE_int32(ripple_encryption_threads);
+DECLARE_uint64(ripple_large_event_size);
+DECLARE_uint64(ripple_large_event_memory);
+DECLARE_int32(ripple_large_event_memory_timeout);
 
 DECLARE_string(ripple_datadir);
 DECLARE_int32(ripple_max_binlog_size);
+DECLARE_bool(ripple_binlog_index_validate_files);
+DECLARE_int32(ripple_binlog_index_recover_threads);
 
 DECLARE_bool(danger_danger_use_dbug_keys);
 
@@ -52,6 +64,11 @@ DECLARE_string(ripple_version_binlog);
 
 DECLARE_int32(ripple_master_reconnect_period);
 DECLARE_int32(ripple_master_reconnect_attempts);
+DECLARE_int32(ripple_master_read_timeout);
+DECLARE_int32(ripple_master_write_timeout);
+DECLARE_string(ripple_master_standby_addresses);
+DECLARE_int32(ripple_master_standby_check_period);
+DECLARE_int32(ripple_master_standby_timeout);
 
 DECLARE_bool(ripple_semi_sync_slave_enabled);
 
@@ -59,10 +76,23 @@ DECLARE_string(ripple_requested_start_gtid_position);
 
 DECLARE_int32(ripple_purge_expire_logs_days);
 DECLARE_uint64(ripple_purge_logs_keep_size);
+DECLARE_uint64(ripple_purge_trash_rate);
+
+DECLARE_string(ripple_archive_dir);
+DECLARE_uint64(ripple_archive_rate);
+DECLARE_bool(ripple_archive_compress);
+DECLARE_uint64(ripple_archive_cache_size);
+
+DECLARE_int32(ripple_monitoring_port);
 
 DECLARE_int32(ripple_master_alloc_server_id_timeout);
 DECLARE_int32(ripple_slave_alloc_server_id_timeout);
 
+DECLARE_int32(ripple_slave_threads);
+DECLARE_int32(ripple_slave_max_threads);
+DECLARE_uint64(ripple_slave_thread_stack_size);
+DECLARE_string(ripple_slave_thread_cpus);
+
 }  // namespace mysql_ripple
 
 #endif  // MYSQL_RIPPLE_FLAGS_H
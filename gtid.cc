@@ -809,10 +809,10 @@ bool GTIDList::Subset(const GTIDList& A, const GTIDList& B) {
     if (stream_B == nullptr) {
       return false;
     }
-    auto a = stream_A.intervals;
-    auto b = stream_B->intervals;
-    bool ok = std::all_of(a.begin(), a.end(), [b](I& a) {
-      return std::any_of(b.begin(), b.end(), [a](I& b) {
+    const auto& a = stream_A.intervals;
+    const auto& b = stream_B->intervals;
+    bool ok = std::all_of(a.begin(), a.end(), [&b](I& a) {
+      return std::any_of(b.begin(), b.end(), [&a](I& b) {
         return a.start >= b.start && a.end <= b.end;
       });
     });
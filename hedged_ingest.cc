@@ -0,0 +1,255 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hedged_ingest.h"
+
+#include "flags.h"
+#include "logging.h"
+#include "monitoring.h"
+#include "mysql_constants.h"
+
+namespace mysql_ripple {
+
+HedgedIngest::HedgedIngest(Binlog *binlog,
+                           const std::vector<std::string>& names)
+    : binlog_(binlog),
+      upstreams_(names.size()),
+      writer_(nullptr),
+      formats_(names.size()),
+      connected_(0),
+      connection_(nullptr) {
+  for (size_t i = 0; i < names.size(); i++) {
+    upstreams_[i].name = names[i];
+    upstreams_[i].mode = Upstream::HOLD;
+  }
+}
+
+bool HedgedIngest::ConnectionEstablished(
+    int upstream, const mysql::ClientConnection *connection,
+    const GTIDList& start_position) {
+  Upstream *up = &upstreams_[upstream];
+  ClearTransaction(up);
+
+  absl::MutexLock lock(&mutex_);
+  // Transactions are tracked from where the upstream was asked to start,
+  // the binlog may have moved on since then.
+  up->position = binlog_->GetBinlogPosition();
+  up->position.gtid_start_position = start_position;
+  if (connected_ == 0) {
+    if (!binlog_->ConnectionEstablished(connection))
+      return false;
+    connection_ = connection;
+  }
+  connected_++;
+  return true;
+}
+
+bool HedgedIngest::AddEvent(int upstream, RawLogEventData event, bool wait) {
+  Upstream *up = &upstreams_[upstream];
+  if (event.header.type == constants::ET_HEARTBEAT)
+    return true;
+
+  if (event.header.type == constants::ET_FORMAT_DESCRIPTION)
+    return AddFormatDescriptor(upstream, event, wait);
+
+  bool in_transaction = up->position.InTransaction() ||
+                        constants::IsGtidEvent(event.header.type);
+  int res = up->position.Update(event, 0);
+  if (res == -1) {
+    LOG(ERROR) << "Failed to update position of upstream " << up->name;
+    return false;
+  }
+
+  if (!in_transaction) {
+    if (upstream != 0)
+      return true;
+    absl::MutexLock lock(&mutex_);
+    AwaitWriter();
+    return binlog_->AddEvent(event, wait);
+  }
+
+  if (up->mode == Upstream::WRITE)
+    return WriteEvent(up, event, res != 0, wait);
+
+  if (up->mode == Upstream::HOLD) {
+    up->offsets.push_back(up->buffer.size());
+    up->events.push_back(event.DeepCopy(&up->buffer));
+  }
+  if (res == 0) {
+    if (up->mode == Upstream::HOLD &&
+        up->buffer.size() > FLAGS_ripple_hedge_max_transaction_size)
+      return StopHolding(up);
+    return true;
+  }
+
+  bool success;
+  {
+    absl::MutexLock lock(&mutex_);
+    success = AddTransaction(up, wait);
+  }
+  ClearTransaction(up);
+  return success;
+}
+
+bool HedgedIngest::AddFormatDescriptor(int upstream, RawLogEventData event,
+                                       bool wait) {
+  Upstream *up = &upstreams_[upstream];
+  FormatDescriptorEvent format;
+  if (!format.ParseFromRawLogEventData(event)) {
+    LOG(ERROR) << "Failed to parse format descriptor from upstream "
+               << up->name;
+    return false;
+  }
+  format.checksum = 0;
+
+  absl::MutexLock lock(&mutex_);
+  formats_[upstream] = format;
+  const FormatDescriptorEvent& first = formats_[0];
+  if (upstream != 0) {
+    // A differing format would switch binlog file, possibly in the middle
+    // of a transaction written directly by another upstream.
+    if (!first.IsEmpty() && !format.EqualExceptTimestamp(first)) {
+      LOG(WARNING) << "Upstream " << up->name << " runs "
+                   << format.server_version << ", transactions from it are"
+                   << " written with the format of " << upstreams_[0].name
+                   << " that runs " << first.server_version;
+    }
+    return true;
+  }
+  AwaitWriter();
+  return binlog_->AddEvent(event, wait);
+}
+
+void HedgedIngest::ClearTransaction(Upstream *up) {
+  up->events.clear();
+  up->offsets.clear();
+  up->buffer.Reset(FLAGS_ripple_large_event_size);
+  up->mode = Upstream::HOLD;
+}
+
+bool HedgedIngest::AddTransaction(Upstream *up, bool wait) {
+  AwaitWriter();
+  const GTID& gtid = up->position.latest_completed_gtid;
+  GTIDList written = binlog_->GetBinlogPosition().gtid_start_position;
+  if (written.Contained(gtid)) {
+    monitoring::upstream_transactions_duplicate->Increment(up->name);
+    // The copy written by another upstream may not have been waited for.
+    return !wait || binlog_->Flush();
+  }
+
+  if (up->mode == Upstream::DROP) {
+    LOG(ERROR) << "Upstream " << up->name << " dropped transaction "
+               << gtid.ToString() << " that was not written by another one";
+    return false;
+  }
+
+  if (!written.ValidSuccessor(gtid)) {
+    LOG(ERROR) << "Upstream " << up->name << " sent gtid: "
+               << gtid.ToString() << " that is not valid successor to "
+               << written.ToString();
+    return false;
+  }
+
+  if (!WriteHeld(up, wait))
+    return false;
+  monitoring::upstream_transactions_won->Increment(up->name);
+  return true;
+}
+
+bool HedgedIngest::WriteHeld(Upstream *up, bool wait) {
+  for (size_t i = 0; i < up->events.size(); i++) {
+    // The buffer may have moved since the event was copied.
+    RawLogEventData event = up->events[i];
+    event.event_buffer = up->buffer.data() + up->offsets[i];
+    event.event_data = event.event_buffer + constants::LOG_EVENT_HEADER_LENGTH;
+    bool last = i + 1 == up->events.size();
+    if (!binlog_->AddEvent(event, wait && last)) {
+      LOG(ERROR) << "Failed to add event from upstream " << up->name
+                 << " to binlog";
+      Rollback();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HedgedIngest::StopHolding(Upstream *up) {
+  absl::MutexLock lock(&mutex_);
+  AwaitWriter();
+  const GTID& gtid = up->position.latest_start_gtid;
+  GTIDList written = binlog_->GetBinlogPosition().gtid_start_position;
+  if (written.Contained(gtid)) {
+    ClearTransaction(up);
+    up->mode = Upstream::DROP;
+    return true;
+  }
+
+  if (!written.ValidSuccessor(gtid)) {
+    LOG(ERROR) << "Upstream " << up->name << " sent gtid: "
+               << gtid.ToString() << " that is not valid successor to "
+               << written.ToString();
+    return false;
+  }
+
+  if (!WriteHeld(up, false))
+    return false;
+  ClearTransaction(up);
+  up->mode = Upstream::WRITE;
+  writer_ = up;
+  monitoring::upstream_transactions_unhedged->Increment(up->name);
+  return true;
+}
+
+bool HedgedIngest::WriteEvent(Upstream *up, RawLogEventData event, bool last,
+                              bool wait) {
+  absl::MutexLock lock(&mutex_);
+  if (!binlog_->AddEvent(event, wait && last)) {
+    LOG(ERROR) << "Failed to add event from upstream " << up->name
+               << " to binlog";
+    Rollback();
+    return false;
+  }
+  if (last) {
+    up->mode = Upstream::HOLD;
+    writer_ = nullptr;
+    monitoring::upstream_transactions_won->Increment(up->name);
+  }
+  return true;
+}
+
+void HedgedIngest::AwaitWriter() {
+  auto check = [this]() { return writer_ == nullptr; };
+  mutex_.Await(absl::Condition(&check));
+}
+
+void HedgedIngest::Rollback() {
+  binlog_->ConnectionClosed(connection_);
+  binlog_->ConnectionEstablished(connection_);
+  writer_ = nullptr;
+}
+
+void HedgedIngest::ConnectionClosed(int upstream) {
+  Upstream *up = &upstreams_[upstream];
+  ClearTransaction(up);
+
+  absl::MutexLock lock(&mutex_);
+  if (writer_ == up)
+    Rollback();
+  if (--connected_ == 0) {
+    binlog_->ConnectionClosed(connection_);
+    connection_ = nullptr;
+  }
+}
+
+}  // namespace mysql_ripple
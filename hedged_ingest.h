@@ -0,0 +1,156 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_HEDGED_INGEST_H
+#define MYSQL_RIPPLE_HEDGED_INGEST_H
+
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "binlog.h"
+#include "binlog_position.h"
+#include "buffer.h"
+#include "file_position.h"
+#include "gtid.h"
+#include "log_event.h"
+#include "mysql_client_connection.h"
+
+namespace mysql_ripple {
+
+// Writes events from several upstreams streaming the same GTIDs, e.g a
+// master and its semi-sync replica, into the binlog. The events of a
+// transaction are held back until the transaction is complete. The first
+// upstream to complete it writes it, copies from the others are dropped.
+//
+// Each upstream shall be fed by one thread, that calls
+// ConnectionEstablished(), AddEvent() and ConnectionClosed() in place of
+// the Binlog methods.
+//
+// A transaction larger than --ripple_hedge_max_transaction_size is not
+// held back whole: the first upstream to buffer that much of it writes it
+// directly, and the others wait for it and drop their copies.
+//
+// The upstreams should run the same server version, as only the format
+// descriptors of the first upstream are written, a differing one from
+// another upstream is logged. Events outside transactions (e.g Rotate)
+// are only written from the first upstream, so master positions in the
+// binlog are those of the first upstream except for transactions written
+// from another one.
+class HedgedIngest {
+ public:
+  // names label the upstreams in monitoring.
+  HedgedIngest(Binlog *binlog, const std::vector<std::string>& names);
+
+  int GetUpstreams() const { return upstreams_.size(); }
+
+  // Upstream connected, streaming transactions after start_position.
+  bool ConnectionEstablished(int upstream,
+                             const mysql::ClientConnection *connection,
+                             const GTIDList& start_position)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Add an event read from upstream.
+  // If wait is true and event completes a transaction, this method blocks
+  // until the transaction has been written to disk, by this upstream or
+  // an earlier one.
+  // Returns false on error, or if upstream completed a transaction that
+  // does not follow the binlog.
+  bool AddEvent(int upstream, RawLogEventData event, bool wait)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  void ConnectionClosed(int upstream) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Master position of upstream after the last event added from it,
+  // e.g for semi-sync replies.
+  FilePosition GetMasterPosition(int upstream) const {
+    return upstreams_[upstream].position.next_master_position;
+  }
+
+ private:
+  // Only accessed by the thread feeding the upstream.
+  struct Upstream {
+    std::string name;
+
+    // Tracks transaction boundaries and master position of the upstream.
+    BinlogPosition position;
+
+    // Events of the ongoing transaction, copied into buffer.
+    std::vector<RawLogEventData> events;
+    std::vector<size_t> offsets;
+    Buffer buffer;
+
+    // How the rest of the ongoing transaction is handled.
+    enum { HOLD, WRITE, DROP } mode;
+  };
+
+  Binlog *binlog_;
+  std::vector<Upstream> upstreams_;
+
+  // Serializes writes to the binlog.
+  absl::Mutex mutex_;
+
+  // Upstream writing a transaction directly, others wait for it to finish.
+  const Upstream *writer_ ABSL_GUARDED_BY(mutex_);
+
+  // Latest format descriptor of each upstream, without checksum.
+  std::vector<FormatDescriptorEvent> formats_ ABSL_GUARDED_BY(mutex_);
+
+  // Upstreams connected, and the connection that the binlog was told
+  // about when the first of them connected.
+  int connected_ ABSL_GUARDED_BY(mutex_);
+  const mysql::ClientConnection *connection_ ABSL_GUARDED_BY(mutex_);
+
+  void ClearTransaction(Upstream *upstream);
+
+  // Remember the format descriptor of upstream, writing it if upstream is
+  // the first one.
+  bool AddFormatDescriptor(int upstream, RawLogEventData event, bool wait)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Write the transaction held back for upstream, unless it already is in
+  // the binlog.
+  bool AddTransaction(Upstream *upstream, bool wait)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Stop holding back the transaction of upstream, which has grown too
+  // large. Write what is held back and go on writing directly, unless the
+  // transaction already is in the binlog.
+  bool StopHolding(Upstream *upstream) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Write the events held back for upstream, waiting for the last one if
+  // wait is true.
+  bool WriteHeld(Upstream *upstream, bool wait)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Add an event of the transaction upstream is writing directly.
+  bool WriteEvent(Upstream *upstream, RawLogEventData event, bool last,
+                  bool wait) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Wait for the upstream writing a transaction directly to finish.
+  void AwaitWriter() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Roll back the partial transaction in the binlog, so that other
+  // upstreams can go on writing.
+  void Rollback() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  HedgedIngest(const HedgedIngest&) = delete;
+  HedgedIngest& operator=(const HedgedIngest&) = delete;
+};
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_HEDGED_INGEST_H
@@ -0,0 +1,251 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hedged_ingest.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "binlog.h"
+#include "buffer.h"
+#include "file.h"
+#include "flags.h"
+#include "gtid.h"
+#include "log_event.h"
+#include "monitoring.h"
+
+namespace mysql_ripple {
+
+namespace {
+
+struct TestEvent {
+  Buffer buffer;
+  RawLogEventData raw;
+
+  TestEvent(const EventBase &event, uint32_t nextpos) {
+    LogEventHeader header;
+    header.timestamp = 0;
+    header.type = event.GetEventType();
+    header.server_id = 1;
+    header.event_length = header.PackLength() + event.PackLength();
+    header.nextpos = nextpos;
+    header.flags = 0;
+    uint8_t *ptr = buffer.Append(header.event_length);
+    header.SerializeToBuffer(ptr, header.PackLength());
+    event.SerializeToBuffer(ptr + header.PackLength(), event.PackLength());
+    EXPECT_TRUE(raw.ParseFromBuffer(buffer.data(), buffer.size()));
+  }
+};
+
+TestEvent MakeFormatDescriptor(const char *version = "10.3.0-MariaDB") {
+  FormatDescriptorEvent format;
+  format.SetToRipple(version);
+  format.checksum = 0;
+  return TestEvent(format, 0);
+}
+
+TestEvent MakeRotateEvent(const std::string& filename) {
+  RotateEvent ev;
+  ev.offset = 4;
+  ev.filename = filename;
+  return TestEvent(ev, 0);
+}
+
+GTID MakeGTID(uint64_t seq_no) {
+  GTID gtid;
+  gtid.set_server_id(1);
+  gtid.seq_no = seq_no;
+  return gtid;
+}
+
+// Add transaction seq_no, ending at master offset nextpos, from upstream.
+bool AddTransaction(HedgedIngest *ingest, int upstream, uint64_t seq_no,
+                    uint32_t nextpos) {
+  GTIDEvent gtid;
+  gtid.gtid = MakeGTID(seq_no);
+  gtid.flags = 0;
+  gtid.is_standalone = false;
+  gtid.has_group_commit_id = false;
+  QueryEvent query;
+  query.query = "INSERT";
+  XIDEvent xid;
+  xid.xid = seq_no;
+  return
+      ingest->AddEvent(upstream, TestEvent(gtid, nextpos - 2).raw, false) &&
+      ingest->AddEvent(upstream, TestEvent(query, nextpos - 1).raw, false) &&
+      ingest->AddEvent(upstream, TestEvent(xid, nextpos).raw, true);
+}
+
+class HedgedIngestTest : public ::testing::Test {
+ protected:
+  HedgedIngestTest()
+      : binlog_("binlog", int64_t{1} << 30, factory_),
+        ingest_(&binlog_, {"master", "hedge"}) {}
+
+  void SetUp() override {
+    monitoring::Initialize();
+    FLAGS_ripple_encryption_scheme = 0;
+    ASSERT_TRUE(binlog_.Create());
+    GTIDList start = binlog_.GetBinlogPosition().gtid_start_position;
+    for (int upstream = 0; upstream < 2; upstream++) {
+      ASSERT_TRUE(ingest_.ConnectionEstablished(upstream, nullptr, start));
+      ASSERT_TRUE(ingest_.AddEvent(upstream, MakeFormatDescriptor().raw,
+                                   true));
+      std::string filename = upstream == 0 ? "master-bin.1" : "hedge-bin.1";
+      ASSERT_TRUE(ingest_.AddEvent(upstream, MakeRotateEvent(filename).raw,
+                                   true));
+    }
+  }
+
+  void TearDown() override {
+    ingest_.ConnectionClosed(0);
+    ingest_.ConnectionClosed(1);
+    binlog_.Close();
+  }
+
+  BinlogPosition GetBinlogPosition() { return binlog_.GetBinlogPosition(); }
+
+  file::MemoryFactory factory_;
+  Binlog binlog_;
+  HedgedIngest ingest_;
+};
+
+}  // namespace
+
+TEST_F(HedgedIngestTest, FirstCopyWins) {
+  // Events outside transactions are only written from the first upstream.
+  EXPECT_EQ(GetBinlogPosition().next_master_position.filename,
+            "master-bin.1");
+
+  ASSERT_TRUE(AddTransaction(&ingest_, 1, 1, 1000));
+  BinlogPosition pos = GetBinlogPosition();
+  EXPECT_EQ(pos.latest_completed_gtid.seq_no, 1);
+  EXPECT_EQ(pos.next_master_position.offset, 1000);
+
+  // The copy from the master is dropped.
+  ASSERT_TRUE(AddTransaction(&ingest_, 0, 1, 2000));
+  EXPECT_TRUE(GetBinlogPosition().latest_event_end_position.equal(
+      pos.latest_event_end_position));
+
+  ASSERT_TRUE(AddTransaction(&ingest_, 0, 2, 3000));
+  pos = GetBinlogPosition();
+  EXPECT_EQ(pos.latest_completed_gtid.seq_no, 2);
+  EXPECT_EQ(pos.next_master_position.offset, 3000);
+  ASSERT_TRUE(AddTransaction(&ingest_, 1, 2, 4000));
+  EXPECT_TRUE(GetBinlogPosition().latest_event_end_position.equal(
+      pos.latest_event_end_position));
+
+  // Each upstream has its own master position.
+  EXPECT_EQ(ingest_.GetMasterPosition(0).filename, "master-bin.1");
+  EXPECT_EQ(ingest_.GetMasterPosition(0).offset, 3000);
+  EXPECT_EQ(ingest_.GetMasterPosition(1).filename, "hedge-bin.1");
+  EXPECT_EQ(ingest_.GetMasterPosition(1).offset, 4000);
+}
+
+TEST_F(HedgedIngestTest, TransactionsAreHeldBack) {
+  GTIDEvent gtid;
+  gtid.gtid = MakeGTID(1);
+  gtid.flags = 0;
+  gtid.is_standalone = false;
+  gtid.has_group_commit_id = false;
+  BinlogPosition pos = GetBinlogPosition();
+  ASSERT_TRUE(ingest_.AddEvent(1, TestEvent(gtid, 100).raw, false));
+  EXPECT_TRUE(GetBinlogPosition().latest_event_end_position.equal(
+      pos.latest_event_end_position));
+
+  // The other upstream completes the transaction first.
+  ASSERT_TRUE(AddTransaction(&ingest_, 0, 1, 1000));
+  EXPECT_EQ(GetBinlogPosition().latest_completed_gtid.seq_no, 1);
+
+  // A partial transaction is dropped when its upstream disconnects.
+  ingest_.ConnectionClosed(1);
+  GTIDList start = GetBinlogPosition().gtid_start_position;
+  ASSERT_TRUE(ingest_.ConnectionEstablished(1, nullptr, start));
+  ASSERT_TRUE(AddTransaction(&ingest_, 1, 2, 2000));
+  EXPECT_EQ(GetBinlogPosition().latest_completed_gtid.seq_no, 2);
+}
+
+TEST_F(HedgedIngestTest, LargeTransactionsAreNotHeld) {
+  uint64_t max_size = FLAGS_ripple_hedge_max_transaction_size;
+  FLAGS_ripple_hedge_max_transaction_size = 1;
+
+  GTIDEvent gtid;
+  gtid.gtid = MakeGTID(1);
+  gtid.flags = 0;
+  gtid.is_standalone = false;
+  gtid.has_group_commit_id = false;
+  QueryEvent query;
+  query.query = "INSERT";
+  XIDEvent xid;
+  xid.xid = 1;
+
+  // The first upstream past the limit writes right away.
+  BinlogPosition pos = GetBinlogPosition();
+  ASSERT_TRUE(ingest_.AddEvent(1, TestEvent(gtid, 100).raw, false));
+  EXPECT_FALSE(GetBinlogPosition().latest_event_end_position.equal(
+      pos.latest_event_end_position));
+
+  // The copy from the other upstream waits for it and is dropped.
+  std::thread master([this] {
+    EXPECT_TRUE(AddTransaction(&ingest_, 0, 1, 1000));
+  });
+  ASSERT_TRUE(ingest_.AddEvent(1, TestEvent(query, 101).raw, false));
+  ASSERT_TRUE(ingest_.AddEvent(1, TestEvent(xid, 102).raw, true));
+  master.join();
+  pos = GetBinlogPosition();
+  EXPECT_EQ(pos.latest_completed_gtid.seq_no, 1);
+  EXPECT_EQ(pos.next_master_position.offset, 102);
+  EXPECT_EQ(ingest_.GetMasterPosition(0).offset, 1000);
+
+  // Later transactions are hedged again.
+  FLAGS_ripple_hedge_max_transaction_size = max_size;
+  ASSERT_TRUE(AddTransaction(&ingest_, 0, 2, 2000));
+  ASSERT_TRUE(AddTransaction(&ingest_, 1, 2, 3000));
+  EXPECT_EQ(GetBinlogPosition().next_master_position.offset, 2000);
+}
+
+TEST_F(HedgedIngestTest, HedgeFormatDoesNotSwitchFile) {
+  uint64_t max_size = FLAGS_ripple_hedge_max_transaction_size;
+  FLAGS_ripple_hedge_max_transaction_size = 1;
+
+  GTIDEvent gtid;
+  gtid.gtid = MakeGTID(1);
+  gtid.flags = 0;
+  gtid.is_standalone = false;
+  gtid.has_group_commit_id = false;
+  QueryEvent query;
+  query.query = "INSERT";
+  XIDEvent xid;
+  xid.xid = 1;
+
+  // The master writes a large transaction directly, while the hedge,
+  // running another version, sends its format descriptor.
+  std::string filename =
+      GetBinlogPosition().latest_event_end_position.filename;
+  ASSERT_TRUE(ingest_.AddEvent(0, TestEvent(gtid, 100).raw, false));
+  ASSERT_TRUE(ingest_.AddEvent(1, MakeFormatDescriptor("10.4.0-MariaDB").raw,
+                               true));
+  ASSERT_TRUE(ingest_.AddEvent(0, TestEvent(query, 101).raw, false));
+  ASSERT_TRUE(ingest_.AddEvent(0, TestEvent(xid, 102).raw, true));
+  BinlogPosition pos = GetBinlogPosition();
+  EXPECT_EQ(pos.latest_completed_gtid.seq_no, 1);
+  EXPECT_EQ(pos.latest_event_end_position.filename, filename);
+  EXPECT_EQ(pos.master_format.server_version, "10.3.0-MariaDB");
+
+  FLAGS_ripple_hedge_max_transaction_size = max_size;
+  ASSERT_TRUE(AddTransaction(&ingest_, 0, 2, 2000));
+  EXPECT_EQ(GetBinlogPosition().latest_event_end_position.filename, filename);
+}
+
+}  // namespace mysql_ripple
@@ -19,9 +19,10 @@
 namespace mysql_ripple {
 
 Listener::Listener(SessionFactory *factory,
-                   mysql::ServerPort *port)
+                   mysql::ServerPort *port,
+                   int thread)
     : ThreadedSession(Session::Listener),
-      factory_(factory), port_(port) {
+      factory_(factory), port_(port), thread_(thread) {
 }
 
 Listener::~Listener() {
@@ -38,7 +39,7 @@ bool Listener::Stop() {
 void* Listener::Run() {
   mysql::ThreadInit();
   while (!ShouldStop()) {
-    Connection *con = port_->Accept();
+    Connection *con = port_->Accept(thread_);
     if (con != nullptr) {
       if (!factory_->NewSession(con)) {
         delete con;
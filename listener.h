@@ -24,10 +24,12 @@
 namespace mysql_ripple {
 
 // A threads listening to a port
+// Accepts connections on one of the accept threads of a port.
 class Listener : public ThreadedSession {
  public:
-  explicit Listener(SessionFactory *factory,
-                    mysql::ServerPort *port);
+  Listener(SessionFactory *factory,
+           mysql::ServerPort *port,
+           int thread);
   virtual ~Listener();
 
   // Override Stop() to wakeup listener hanging in Accept()
@@ -36,6 +38,7 @@ class Listener : public ThreadedSession {
  private:
   SessionFactory *factory_;
   mysql::ServerPort *port_;
+  int thread_;
 
  protected:
   void* Run();
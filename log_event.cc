@@ -62,6 +62,16 @@ bool RawLogEventData::ParseFromBuffer(const uint8_t *buffer,
   return header.event_length <= buffer_length;
 }
 
+bool RawLogEventData::ParsePartFromBuffer(const uint8_t *buffer,
+                                          int buffer_length) {
+  if (!header.ParseFromBuffer(buffer, buffer_length))
+    return false;
+  event_buffer = buffer;
+  event_data = event_buffer + constants::LOG_EVENT_HEADER_LENGTH;
+  event_data_length = buffer_length - constants::LOG_EVENT_HEADER_LENGTH;
+  return header.event_length >= buffer_length;
+}
+
 bool RawLogEventData::SerializeToBuffer(Buffer *buffer) {
   uint8_t *ptr = buffer->Append(header.event_length);
   event_buffer = ptr;
@@ -76,7 +86,7 @@ RawLogEventData RawLogEventData::DeepCopy(Buffer *dst) {
   RawLogEventData copy = *this;
 
   // then copy data
-  uint8_t *ptr = dst->Append(header.event_length);
+  uint8_t *ptr = dst->AppendUninitialized(header.event_length);
   memcpy(ptr, event_buffer, header.event_length);
 
   // and finally setup buffer pointers
@@ -58,6 +58,12 @@ struct RawLogEventData {
   const uint8_t *event_data;
 
   bool ParseFromBuffer(const uint8_t *buffer, int buffer_length);
+
+  // Parse the first part of an event longer than buffer_length, e.g as
+  // read by BinlogReader::ReadEvent(). event_data_length is then the length
+  // of the data in buffer.
+  bool ParsePartFromBuffer(const uint8_t *buffer, int buffer_length);
+
   bool SerializeToBuffer(Buffer *buffer);
 
   // Copy RawLogEventData header+data into dst and return a RawLogEventData
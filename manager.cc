@@ -14,6 +14,7 @@
 
 #include "manager.h"
 
+#include "monitoring.h"
 #include "mysql_client_connection.h"
 #include "mysql_master_session.h"
 #include "mysql_slave_session.h"
@@ -202,6 +203,49 @@ void Manager::FillBinlogPosition(ripple_proto::BinlogPosition *position) {
   CopyBinlogPosition(position, binlog_position);
 }
 
+static void CopyLatencyHistogram(ripple_proto::LatencyHistograms *histograms,
+                                 const std::string &stage,
+                                 const monitoring::HistogramBase *histogram) {
+  histogram->ForEach([histograms, &stage](
+      const std::vector<std::string> &labels,
+      const monitoring::internal::HistogramCell &cell) {
+    ripple_proto::LatencyHistogram *dest = histograms->add_histogram();
+    dest->set_stage(stage);
+    if (!labels.empty())
+      dest->set_slave(labels[0]);
+    dest->set_count(cell.Count());
+    dest->set_sum_us(cell.Sum());
+    dest->set_max_us(cell.Max());
+    dest->set_p50_us(cell.Percentile(50));
+    dest->set_p90_us(cell.Percentile(90));
+    dest->set_p99_us(cell.Percentile(99));
+    dest->set_p999_us(cell.Percentile(99.9));
+    for (int i = 0; i < monitoring::internal::HistogramCell::kBuckets; i++) {
+      uint64_t count = cell.BucketCount(i);
+      if (count == 0)
+        continue;
+      ripple_proto::LatencyHistogram::Bucket *bucket = dest->add_bucket();
+      bucket->set_upper_bound_us(
+          monitoring::internal::HistogramCell::BucketUpperBound(i));
+      bucket->set_count(count);
+    }
+  });
+}
+
+void Manager::FillLatencyHistograms(
+    ripple_proto::LatencyHistograms *histograms) {
+  CopyLatencyHistogram(histograms, "commit_to_received",
+                       monitoring::latency_commit_to_received);
+  CopyLatencyHistogram(histograms, "received_to_written",
+                       monitoring::latency_received_to_written);
+  CopyLatencyHistogram(histograms, "written_to_published",
+                       monitoring::latency_written_to_published);
+  CopyLatencyHistogram(histograms, "published_to_sent",
+                       monitoring::latency_published_to_sent);
+  CopyLatencyHistogram(histograms, "semi_sync_ack",
+                       monitoring::latency_semi_sync_ack);
+}
+
 void Manager::ToggleSemiSyncReply(const ripple_proto::OnOff *onoff,
                                   ripple_proto::Status *status) {
   rippled_->GetMasterSession().SetSemiSyncSlaveReplyEnabled(onoff->on());
@@ -46,6 +46,7 @@ class Manager {
   void FillSlaveBinlogPosition(const ripple_proto::SlaveAddress& address,
                                ripple_proto::BinlogPosition *position);
   void FillBinlogPosition(ripple_proto::BinlogPosition *position);
+  void FillLatencyHistograms(ripple_proto::LatencyHistograms *histograms);
 
   void ToggleSemiSyncReply(const ripple_proto::OnOff *onoff,
                            ripple_proto::Status *status);
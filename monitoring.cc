@@ -13,15 +13,340 @@
 // limitations under the License.
 
 #include "monitoring.h"
+
+#include <time.h>
+
+#include <algorithm>
+
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 
 namespace monitoring {
+
+namespace {
+
+struct Registry {
+  absl::Mutex mutex;
+  std::vector<internal::MetricBase*> metrics ABSL_GUARDED_BY(mutex);
+  std::vector<CallbackTrigger*> triggers ABSL_GUARDED_BY(mutex);
+};
+
+Registry* GetRegistry() {
+  static Registry* registry = new Registry();
+  return registry;
+}
+
+std::atomic<uint64_t> next_metric_id(0);
+
+// Escape label value or help text as required by the exposition format.
+std::string Escape(absl::string_view str, bool quote) {
+  std::string result;
+  for (char c : str) {
+    if (c == '\\') {
+      result.append("\\\\");
+    } else if (c == '\n') {
+      result.append("\\n");
+    } else if (c == '"' && quote) {
+      result.append("\\\"");
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+std::vector<std::string> SplitKey(const std::string& key, size_t labels) {
+  std::vector<std::string> values;
+  if (labels > 0)
+    values = absl::StrSplit(key, absl::string_view("\0", 1));
+  values.resize(labels);
+  return values;
+}
+
+}  // namespace
+
+namespace internal {
+
+int ShardIndex() {
+  static std::atomic<int> next_shard(0);
+  thread_local int shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) %
+      CounterCell::kShards;
+  return shard;
+}
+
+constexpr int CounterCell::kShards;
+
+void FormatSample(absl::string_view name, absl::string_view labels,
+                  absl::string_view value, std::string* out) {
+  if (labels.empty()) {
+    absl::StrAppend(out, name, " ", value, "\n");
+  } else {
+    absl::StrAppend(out, name, "{", labels, "} ", value, "\n");
+  }
+}
+
+void CounterCell::Format(absl::string_view name, absl::string_view labels,
+                         std::string* out) const {
+  FormatSample(name, labels, absl::StrCat(Value()), out);
+}
+
+void GaugeCell<std::string>::Format(absl::string_view name,
+                                    absl::string_view labels,
+                                    std::string* out) const {
+  std::string value_label =
+      absl::StrCat("value=\"", Escape(Value(), true), "\"");
+  if (labels.empty()) {
+    FormatSample(name, value_label, "1", out);
+  } else {
+    FormatSample(name, absl::StrCat(labels, ",", value_label), "1", out);
+  }
+}
+
+constexpr int HistogramCell::kSubBucketBits;
+constexpr int HistogramCell::kSubBuckets;
+constexpr int HistogramCell::kBuckets;
+
+HistogramCell::HistogramCell() : count_(0), sum_(0), max_(0) {
+  for (std::atomic<uint64_t>& bucket : buckets_) bucket.store(0);
+}
+
+uint64_t HistogramCell::BucketUpperBound(int index) {
+  if (index < kSubBuckets)
+    return index;
+  int shift = index / kSubBuckets - 1;
+  uint64_t sub_bucket = index % kSubBuckets + kSubBuckets;
+  // Wraps around to the max value for the last bucket.
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+uint64_t HistogramCell::Percentile(double percentile) const {
+  uint64_t count = Count();
+  if (count == 0)
+    return 0;
+  uint64_t target = std::max<uint64_t>(1, percentile / 100 * count + 0.5);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += BucketCount(i);
+    if (seen >= target)
+      return std::min(BucketUpperBound(i), Max());
+  }
+  return Max();
+}
+
+void HistogramCell::Format(absl::string_view name, absl::string_view labels,
+                           std::string* out) const {
+  int last = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    if (BucketCount(i) > 0)
+      last = i;
+  }
+
+  std::string bucket_name = absl::StrCat(name, "_bucket");
+  std::string prefix = labels.empty() ? "" : absl::StrCat(labels, ",");
+  uint64_t cumulative = 0;
+  for (int i = 0; i <= last; i++) {
+    cumulative += BucketCount(i);
+    // Only export the last bucket of each power of two.
+    if ((i + 1) % kSubBuckets == 0 || i == last) {
+      FormatSample(bucket_name,
+                   absl::StrCat(prefix, "le=\"", BucketUpperBound(i), "\""),
+                   absl::StrCat(cumulative), out);
+    }
+  }
+  uint64_t count = Count();
+  FormatSample(bucket_name, absl::StrCat(prefix, "le=\"+Inf\""),
+               absl::StrCat(count), out);
+  FormatSample(absl::StrCat(name, "_sum"), labels, absl::StrCat(Sum()), out);
+  FormatSample(absl::StrCat(name, "_count"), labels, absl::StrCat(count),
+               out);
+}
+
+MetricBase::MetricBase(absl::string_view name, absl::string_view help,
+                       absl::string_view type,
+                       std::vector<std::string> labels)
+    : id_(next_metric_id.fetch_add(1)),
+      name_(name),
+      help_(help),
+      type_(type),
+      labels_(std::move(labels)),
+      default_cell_(nullptr),
+      generation_(0),
+      locked_lookups_(0) {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  registry->metrics.push_back(this);
+}
+
+MetricBase::~MetricBase() {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  auto& metrics = registry->metrics;
+  metrics.erase(std::remove(metrics.begin(), metrics.end(), this),
+                metrics.end());
+}
+
+namespace {
+
+// Cells of labelled metrics used by this thread, by metric id and label
+// values, so that the common case doesn't need to take the mutex of the
+// metric. Metric ids are never reused, so entries of deleted metrics are
+// never found. The cache shares ownership of its cells, so a cell that is
+// removed concurrently stays valid until the thread sees the new
+// generation of the metric and drops its entries.
+struct ThreadCells {
+  uint64_t generation = 0;
+  absl::flat_hash_map<std::string, std::shared_ptr<Cell>> cells;
+};
+thread_local absl::flat_hash_map<uint64_t, ThreadCells> thread_cells;
+
+}  // namespace
+
+Cell* MetricBase::GetCell(const std::string& key) {
+  if (labels_.empty()) {
+    Cell* cell = default_cell_.load(std::memory_order_acquire);
+    if (cell != nullptr)
+      return cell;
+  } else {
+    auto metric = thread_cells.find(id_);
+    if (metric != thread_cells.end() &&
+        metric->second.generation ==
+        generation_.load(std::memory_order_acquire)) {
+      auto it = metric->second.cells.find(key);
+      if (it != metric->second.cells.end())
+        return it->second.get();
+    }
+  }
+
+  std::shared_ptr<Cell> cell;
+  uint64_t generation;
+  {
+    absl::MutexLock lock(&mutex_);
+    locked_lookups_++;
+    std::shared_ptr<Cell>& slot = cells_[key];
+    if (slot == nullptr)
+      slot.reset(NewCell());
+    cell = slot;
+    generation = generation_.load(std::memory_order_relaxed);
+  }
+  if (labels_.empty()) {
+    // Never removed, so cells_ keeps it alive.
+    default_cell_.store(cell.get(), std::memory_order_release);
+  } else {
+    ThreadCells& cached = thread_cells[id_];
+    if (cached.generation != generation) {
+      cached.cells.clear();
+      cached.generation = generation;
+    }
+    cached.cells[key] = cell;
+  }
+  return cell.get();
+}
+
+void MetricBase::RemoveCell(const std::string& key) {
+  if (labels_.empty())
+    return;
+  absl::MutexLock lock(&mutex_);
+  if (cells_.erase(key) > 0)
+    generation_.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t MetricBase::GetLockedLookups() const {
+  absl::MutexLock lock(&mutex_);
+  return locked_lookups_;
+}
+
+void MetricBase::Export(std::string* out) const {
+  absl::StrAppend(out, "# HELP ", name_, " ", Escape(help_, false), "\n");
+  absl::StrAppend(out, "# TYPE ", name_, " ", type_, "\n");
+
+  absl::MutexLock lock(&mutex_);
+  std::vector<const std::string*> keys;
+  for (const auto& it : cells_)
+    keys.push_back(&it.first);
+  std::sort(keys.begin(), keys.end(),
+            [](const std::string* a, const std::string* b) {
+              return *a < *b;
+            });
+  for (const std::string* key : keys) {
+    std::string labels;
+    std::vector<std::string> values = SplitKey(*key, labels_.size());
+    for (size_t i = 0; i < labels_.size(); i++) {
+      absl::StrAppend(&labels, i > 0 ? "," : "", labels_[i], "=\"",
+                      Escape(values[i], true), "\"");
+    }
+    cells_.at(*key)->Format(name_, labels, out);
+  }
+}
+
+void MetricBase::ForEachCell(const std::function<void(
+    const std::vector<std::string>& values, const Cell& cell)>& fn) const {
+  absl::MutexLock lock(&mutex_);
+  for (const auto& it : cells_)
+    fn(SplitKey(it.first, labels_.size()), *it.second);
+}
+
+}  // namespace internal
+
+CallbackTrigger::CallbackTrigger(std::function<void()> functor)
+    : functor_(std::move(functor)) {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  registry->triggers.push_back(this);
+}
+
+CallbackTrigger::~CallbackTrigger() {
+  // Taking the registry mutex also waits for a running export,
+  // so the functor is never called after this returns.
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  auto& triggers = registry->triggers;
+  triggers.erase(std::remove(triggers.begin(), triggers.end(), this),
+                 triggers.end());
+}
+
+std::string ExportText() {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  for (const CallbackTrigger* trigger : registry->triggers)
+    trigger->Run();
+
+  std::string out;
+  for (const internal::MetricBase* metric : registry->metrics)
+    metric->Export(&out);
+  return out;
+}
+
+int64_t CoarseUnixSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return ts.tv_sec;
+}
+
+int64_t MonotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t UnixMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 CallbackMetric<std::string>* master_connection_status;
 CallbackMetric<std::string>* last_master_connect_error;
 CallbackMetric<uint64_t>* time_since_master_last_connected;
 Metric<bool>* rippled_active;
 Metric<uint64_t>* bytes_sent_to_master;
 Metric<uint64_t>* bytes_received_from_master;
+Counter<>* semi_sync_acks_coalesced;
+Metric<uint64_t>* master_standbys_ready;
+Counter<std::string>* master_standby_failovers;
+Counter<std::string>* upstream_transactions_won;
+Counter<std::string>* upstream_transactions_duplicate;
+Counter<std::string>* upstream_transactions_unhedged;
 
 Metric<uint32_t, std::string>* slave_current_event_timestamp;
 CallbackMetric<std::string, std::string>* slave_connection_status;
@@ -30,6 +355,13 @@ Metric<uint>* num_slaves;
 Metric<uint64_t, std::string>* bytes_sent_to_slave;
 Metric<uint64_t, std::string>* bytes_received_from_slave;
 
+// Saturation of the worker pool: workers, workers running a session,
+// sessions waiting for a worker and how long the oldest has waited.
+CallbackMetric<uint64_t>* executor_threads;
+CallbackMetric<uint64_t>* executor_busy_threads;
+CallbackMetric<uint64_t>* executor_queued;
+CallbackMetric<uint64_t>* executor_queue_wait;
+
 Counter<std::string>* rippled_binlog_error;
 // Note about how this metric is used in binlog.cc: Most events are written
 // to the Binlog via WriteEvent, and we set this metric's value there.
@@ -39,23 +371,130 @@ Counter<std::string>* rippled_binlog_error;
 // while their timestamps are still valid.
 Metric<uint32_t>* binlog_last_event_timestamp;
 Metric<uint64_t>* binlog_last_event_received;
+// Purged binlog files waiting to be freed, total bytes freed and
+// bytes freed per second, see Binlog::ShrinkTrash().
+Metric<uint64_t>* binlog_trash_bytes;
+Metric<uint64_t>* binlog_trash_bytes_freed;
+Metric<uint64_t>* binlog_trash_free_rate;
+Metric<uint64_t>* binlog_archive_bytes;
+Metric<uint64_t>* binlog_archive_rate;
+
+// Latency of each stage that a transaction passes through in ripple,
+// recorded once per transaction at its GTID event. The master commit
+// timestamp only has second resolution.
+Histogram<>* latency_commit_to_received;
+Histogram<>* latency_received_to_written;
+// From the transaction being written until it is flushed and visible to
+// binlog readers.
+Histogram<>* latency_written_to_published;
+// From a slave's binlog reader seeing the transaction until it is sent.
+Histogram<std::string>* latency_published_to_sent;
+// From receiving an event that requests a semi-sync reply until the reply
+// has been sent.
+Histogram<>* latency_semi_sync_ack;
 
 void Initialize() {
-  bytes_sent_to_master = new Metric<uint64_t>();
-  bytes_received_from_master = new Metric<uint64_t>();
-  bytes_sent_to_slave = new Metric<uint64_t, std::string>();
-  bytes_received_from_slave = new Metric<uint64_t, std::string>();
-  master_connection_status = new CallbackMetric<std::string>();
-  last_master_connect_error = new CallbackMetric<std::string>();
-  time_since_master_last_connected = new CallbackMetric<uint64_t>();
-  rippled_active = new Metric<bool>();
-  slave_current_event_timestamp = new Metric<uint32_t, std::string>();
-  slave_connection_status = new CallbackMetric<std::string, std::string>();
-  last_slave_connect_error = new CallbackMetric<std::string, std::string>();
-  num_slaves = new Metric<uint>();
-  rippled_binlog_error = new Counter<std::string>();
-  binlog_last_event_timestamp = new Metric<uint32_t>();
-  binlog_last_event_received = new Metric<uint64_t>();
+  // Metrics are registered for the lifetime of the process,
+  // so only create them once.
+  static bool initialized = false;
+  if (initialized)
+    return;
+  initialized = true;
+
+  bytes_sent_to_master = new Metric<uint64_t>(
+      "bytes_sent_to_master", "Bytes sent to the master.");
+  bytes_received_from_master = new Metric<uint64_t>(
+      "bytes_received_from_master", "Bytes received from the master.");
+  semi_sync_acks_coalesced = new Counter<>(
+      "semi_sync_acks_coalesced",
+      "Semi-sync acks replaced by a newer one before being sent.");
+  master_standbys_ready = new Metric<uint64_t>(
+      "master_standbys_ready",
+      "Standby connections ready to replicate from.");
+  master_standby_failovers = new Counter<std::string>(
+      "master_standby_failovers",
+      "Replication streams started on a standby connection.", {"host"});
+  upstream_transactions_won = new Counter<std::string>(
+      "upstream_transactions_won",
+      "Transactions written to the binlog from an upstream.", {"upstream"});
+  upstream_transactions_duplicate = new Counter<std::string>(
+      "upstream_transactions_duplicate",
+      "Transactions from an upstream already written from another one.",
+      {"upstream"});
+  upstream_transactions_unhedged = new Counter<std::string>(
+      "upstream_transactions_unhedged",
+      "Transactions written directly from an upstream as they were larger"
+      " than ripple_hedge_max_transaction_size.", {"upstream"});
+  bytes_sent_to_slave = new Metric<uint64_t, std::string>(
+      "bytes_sent_to_slave", "Bytes sent to a slave.", {"slave"});
+  bytes_received_from_slave = new Metric<uint64_t, std::string>(
+      "bytes_received_from_slave", "Bytes received from a slave.", {"slave"});
+  master_connection_status = new CallbackMetric<std::string>(
+      "master_connection_status", "State of the connection to the master.");
+  last_master_connect_error = new CallbackMetric<std::string>(
+      "last_master_connect_error",
+      "Last error when connecting to the master.");
+  time_since_master_last_connected = new CallbackMetric<uint64_t>(
+      "time_since_master_last_connected",
+      "Seconds since the master was last connected, 0 if connected.");
+  rippled_active = new Metric<bool>(
+      "rippled_active", "Whether the master session is running.");
+  slave_current_event_timestamp = new Metric<uint32_t, std::string>(
+      "slave_current_event_timestamp",
+      "Timestamp of the last event sent to a slave.", {"slave"});
+  slave_connection_status = new CallbackMetric<std::string, std::string>(
+      "slave_connection_status", "State of the connection to a slave.",
+      {"slave"});
+  last_slave_connect_error = new CallbackMetric<std::string, std::string>(
+      "last_slave_connect_error", "Last error of the connection to a slave.",
+      {"slave"});
+  num_slaves = new Metric<uint>("num_slaves", "Number of connected slaves.");
+  executor_threads = new CallbackMetric<uint64_t>(
+      "executor_threads", "Worker threads of the session pool.");
+  executor_busy_threads = new CallbackMetric<uint64_t>(
+      "executor_busy_threads", "Worker threads running a session.");
+  executor_queued = new CallbackMetric<uint64_t>(
+      "executor_queued", "Sessions waiting for a worker thread.");
+  executor_queue_wait = new CallbackMetric<uint64_t>(
+      "executor_queue_wait_microseconds",
+      "Time the oldest session waiting for a worker has waited.");
+  rippled_binlog_error = new Counter<std::string>(
+      "rippled_binlog_error", "Number of binlog errors.", {"error"});
+  binlog_last_event_timestamp = new Metric<uint32_t>(
+      "binlog_last_event_timestamp",
+      "Timestamp of the last event written to the binlog.");
+  binlog_last_event_received = new Metric<uint64_t>(
+      "binlog_last_event_received",
+      "Unix time when the last event was written to the binlog.");
+  binlog_trash_bytes = new Metric<uint64_t>(
+      "binlog_trash_bytes", "Bytes of purged binlog files not yet freed.");
+  binlog_trash_bytes_freed = new Metric<uint64_t>(
+      "binlog_trash_bytes_freed", "Bytes of purged binlog files freed.");
+  binlog_trash_free_rate = new Metric<uint64_t>(
+      "binlog_trash_free_rate",
+      "Bytes of purged binlog files freed per second.");
+  binlog_archive_bytes = new Metric<uint64_t>(
+      "binlog_archive_bytes",
+      "Bytes of archived binlog files not yet moved to archive dir.");
+  binlog_archive_rate = new Metric<uint64_t>(
+      "binlog_archive_rate",
+      "Bytes of archived binlog files moved to archive dir per second.");
+  latency_commit_to_received = new Histogram<>(
+      "latency_commit_to_received_microseconds",
+      "Time from commit on the master until received.");
+  latency_received_to_written = new Histogram<>(
+      "latency_received_to_written_microseconds",
+      "Time from receiving an event until written to the binlog.");
+  latency_written_to_published = new Histogram<>(
+      "latency_written_to_published_microseconds",
+      "Time from writing a transaction until visible to slaves.");
+  latency_published_to_sent = new Histogram<std::string>(
+      "latency_published_to_sent_microseconds",
+      "Time from a transaction being visible until sent to a slave.",
+      {"slave"});
+  latency_semi_sync_ack = new Histogram<>(
+      "latency_semi_sync_ack_microseconds",
+      "Time from receiving an event until the semi-sync reply is sent.");
 }
 
 }   // namespace monitoring
@@ -17,49 +17,374 @@
 #ifndef MYSQL_RIPPLE_MONITORING_H
 #define MYSQL_RIPPLE_MONITORING_H
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
 namespace monitoring {
   void Initialize();
 
-  // TODO(pivanof): Add some meaningful implementations for these classes.
+  // Get all metrics in Prometheus text exposition format.
+  // All CallbackTriggers are run first.
+  std::string ExportText();
+
+  // Current unix time in seconds, from the clock that the kernel caches
+  // on every tick. Cheap enough to be called for each event.
+  int64_t CoarseUnixSeconds();
+
+  // Microseconds from CLOCK_MONOTONIC, for measuring latencies.
+  int64_t MonotonicMicros();
+
+  // Microseconds since the unix epoch.
+  int64_t UnixMicros();
+
+  namespace internal {
+    // The value(s) of a metric for one combination of label values.
+    class Cell {
+     public:
+      virtual ~Cell() {}
+
+      // Append exposition line(s) to out.
+      // labels is the formatted label pairs, without braces.
+      virtual void Format(absl::string_view name, absl::string_view labels,
+                          std::string* out) const = 0;
+    };
+
+    // Index of the calling thread's shard in CounterCell.
+    int ShardIndex();
+
+    // A counter that is sharded over threads, so that threads incrementing
+    // it concurrently don't contend on the same cache line.
+    class CounterCell : public Cell {
+     public:
+      static constexpr int kShards = 16;
+
+      CounterCell() {
+        for (Shard& shard : shards_) shard.value.store(0);
+      }
+
+      void Add(uint64_t n) {
+        shards_[ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+      }
+
+      uint64_t Value() const {
+        uint64_t sum = 0;
+        for (const Shard& shard : shards_)
+          sum += shard.value.load(std::memory_order_relaxed);
+        return sum;
+      }
+
+      void Format(absl::string_view name, absl::string_view labels,
+                  std::string* out) const override;
+
+     private:
+      struct alignas(64) Shard {
+        std::atomic<uint64_t> value;
+      };
+      Shard shards_[kShards];
+    };
+
+    // Append a formatted sample line to out.
+    void FormatSample(absl::string_view name, absl::string_view labels,
+                      absl::string_view value, std::string* out);
+
+    // A gauge, last value set wins.
+    template <typename T>
+    class GaugeCell : public Cell {
+     public:
+      GaugeCell() : value_(T()) {}
+
+      void Set(const T& value) {
+        value_.store(value, std::memory_order_relaxed);
+      }
+
+      T Value() const { return value_.load(std::memory_order_relaxed); }
+
+      void Format(absl::string_view name, absl::string_view labels,
+                  std::string* out) const override {
+        // unary + to format bool and char types as numbers.
+        FormatSample(name, labels, absl::StrCat(+Value()), out);
+      }
+
+     private:
+      std::atomic<T> value_;
+    };
+
+    // Prometheus has no string values, so string gauges are exported as
+    // an "info" sample with the string as value label.
+    template <>
+    class GaugeCell<std::string> : public Cell {
+     public:
+      void Set(const std::string& value) {
+        absl::MutexLock lock(&mutex_);
+        value_ = value;
+      }
+
+      std::string Value() const {
+        absl::MutexLock lock(&mutex_);
+        return value_;
+      }
+
+      void Format(absl::string_view name, absl::string_view labels,
+                  std::string* out) const override;
+
+     private:
+      mutable absl::Mutex mutex_;
+      std::string value_;
+    };
+
+    // A latency histogram with log-linear buckets as in HdrHistogram:
+    // values below kSubBuckets get one bucket each, and every power of two
+    // range above is split in kSubBuckets linear buckets. This bounds the
+    // relative error of a recorded value to 1/kSubBuckets, using a fixed
+    // set of buckets for all of uint64_t.
+    class HistogramCell : public Cell {
+     public:
+      static constexpr int kSubBucketBits = 3;
+      static constexpr int kSubBuckets = 1 << kSubBucketBits;
+      static constexpr int kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+      HistogramCell();
+
+      void Record(uint64_t value) {
+        buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max &&
+               !max_.compare_exchange_weak(max, value,
+                                           std::memory_order_relaxed)) {
+        }
+      }
+
+      static int BucketIndex(uint64_t value) {
+        if (value < kSubBuckets)
+          return value;
+        int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+        return (shift + 1) * kSubBuckets +
+            static_cast<int>(value >> shift) - kSubBuckets;
+      }
+
+      // Largest value that is recorded in bucket.
+      static uint64_t BucketUpperBound(int index);
+
+      uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+      uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+      uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+      uint64_t BucketCount(int index) const {
+        return buckets_[index].load(std::memory_order_relaxed);
+      }
+
+      // Get value at percentile (0-100), as upper bound of its bucket.
+      uint64_t Percentile(double percentile) const;
+
+      // Exported as cumulative buckets at powers of two.
+      void Format(absl::string_view name, absl::string_view labels,
+                  std::string* out) const override;
+
+     private:
+      std::atomic<uint64_t> buckets_[kBuckets];
+      std::atomic<uint64_t> count_;
+      std::atomic<uint64_t> sum_;
+      std::atomic<uint64_t> max_;
+    };
+
+    // Key for a combination of label values.
+    inline std::string LabelKey() { return std::string(); }
+
+    template <typename F>
+    std::string LabelKey(const F& field) {
+      return absl::StrCat(field);
+    }
+
+    template <typename F, typename... Rest>
+    std::string LabelKey(const F& field, const Rest&... rest) {
+      return absl::StrCat(field, absl::string_view("\0", 1),
+                          LabelKey(rest...));
+    }
+
+    // Base class of metrics, registers the metric so that it
+    // is included in ExportText().
+    class MetricBase {
+     public:
+      MetricBase(absl::string_view name, absl::string_view help,
+                 absl::string_view type, std::vector<std::string> labels);
+      virtual ~MetricBase();
+
+      // Append exposition of metric to out.
+      void Export(std::string* out) const;
+
+      // Call fn with label values and cell, for all cells.
+      void ForEachCell(const std::function<void(
+          const std::vector<std::string>& values, const Cell& cell)>& fn)
+          const;
+
+      // Times a cell was looked up under the mutex, e.g for tests.
+      uint64_t GetLockedLookups() const;
+
+     protected:
+      // Get cell for label values key, creating it if needed.
+      // This is lock free once the calling thread has used the cell.
+      Cell* GetCell(const std::string& key);
+
+      // Drop the cell for label values key, e.g when the object it
+      // describes is gone. A later GetCell() starts from a new cell.
+      void RemoveCell(const std::string& key);
+
+      virtual Cell* NewCell() const = 0;
 
+     private:
+      const uint64_t id_;  // unique, never reused.
+      const std::string name_;
+      const std::string help_;
+      const std::string type_;
+      const std::vector<std::string> labels_;
+
+      // Cell of metrics without labels.
+      std::atomic<Cell*> default_cell_;
+
+      // Incremented when a cell is removed, so that threads drop the
+      // cells they have cached.
+      std::atomic<uint64_t> generation_;
+
+      mutable absl::Mutex mutex_;
+      absl::flat_hash_map<std::string, std::shared_ptr<Cell>> cells_
+          ABSL_GUARDED_BY(mutex_);
+      uint64_t locked_lookups_ ABSL_GUARDED_BY(mutex_);
+
+      MetricBase(const MetricBase&) = delete;
+      MetricBase& operator=(const MetricBase&) = delete;
+    };
+  }  // namespace internal
+
+  // A monotonically increasing counter, with one label per field.
   template <typename... Fields>
-  class Counter {
+  class Counter : public internal::MetricBase {
    public:
+    Counter(absl::string_view name, absl::string_view help,
+            std::vector<std::string> labels = {})
+        : MetricBase(name, help, "counter", std::move(labels)) {}
+
     void Increment(Fields... fields) {
-      // Not implemented yet
+      IncrementBy(1, fields...);
+    }
+
+    void IncrementBy(uint64_t n, Fields... fields) {
+      static_cast<internal::CounterCell*>(
+          GetCell(internal::LabelKey(fields...)))->Add(n);
+    }
+
+    void Remove(Fields... fields) {
+      RemoveCell(internal::LabelKey(fields...));
+    }
+
+   protected:
+    internal::Cell* NewCell() const override {
+      return new internal::CounterCell();
     }
   };
 
+  // A value that is set, with one label per field.
   template <typename T, typename... Fields>
-  class CallbackMetric {
+  class Metric : public internal::MetricBase {
    public:
+    Metric(absl::string_view name, absl::string_view help,
+           std::vector<std::string> labels = {})
+        : MetricBase(name, help, "gauge", std::move(labels)) {}
+
     void Set(const T& value, Fields... fields) {
-      // Not implemented yet
+      static_cast<internal::GaugeCell<T>*>(
+          GetCell(internal::LabelKey(fields...)))->Set(value);
+    }
+
+    void Remove(Fields... fields) {
+      RemoveCell(internal::LabelKey(fields...));
+    }
+
+   protected:
+    internal::Cell* NewCell() const override {
+      return new internal::GaugeCell<T>();
     }
   };
 
-  class CallbackTrigger {
+  // A metric that is set by a CallbackTrigger when metrics are exported.
+  template <typename T, typename... Fields>
+  class CallbackMetric : public Metric<T, Fields...> {
    public:
-    class Options {};
+    using Metric<T, Fields...>::Metric;
+  };
+
+  // A histogram of latencies in microseconds, with one label per field.
+  class HistogramBase : public internal::MetricBase {
+   public:
+    HistogramBase(absl::string_view name, absl::string_view help,
+                  std::vector<std::string> labels)
+        : MetricBase(name, help, "histogram", std::move(labels)) {}
+
+    void ForEach(const std::function<void(
+        const std::vector<std::string>& values,
+        const internal::HistogramCell& cell)>& fn) const {
+      ForEachCell([&fn](const std::vector<std::string>& values,
+                        const internal::Cell& cell) {
+        fn(values, static_cast<const internal::HistogramCell&>(cell));
+      });
+    }
 
-    CallbackTrigger(std::function<void()> functor) {
-      // Not implemented yet
+   protected:
+    internal::Cell* NewCell() const override {
+      return new internal::HistogramCell();
     }
   };
 
-  template <typename T, typename... Fields>
-  class Metric {
+  template <typename... Fields>
+  class Histogram : public HistogramBase {
    public:
-    void Set(const T& value, Fields... fields) {
-      // Not implemented yet
+    Histogram(absl::string_view name, absl::string_view help,
+              std::vector<std::string> labels = {})
+        : HistogramBase(name, help, std::move(labels)) {}
+
+    void Record(uint64_t value, Fields... fields) {
+      static_cast<internal::HistogramCell*>(
+          GetCell(internal::LabelKey(fields...)))->Record(value);
+    }
+
+    // Record time since start, as returned by MonotonicMicros().
+    void RecordSince(int64_t start, Fields... fields) {
+      int64_t now = MonotonicMicros();
+      Record(now > start ? now - start : 0, fields...);
+    }
+
+    void Remove(Fields... fields) {
+      RemoveCell(internal::LabelKey(fields...));
     }
   };
 
+  // A functor that is called before metrics are exported,
+  // as long as the trigger exists.
+  class CallbackTrigger {
+   public:
+    class Options {};
+
+    CallbackTrigger(std::function<void()> functor);
+    ~CallbackTrigger();
+
+    void Run() const { functor_(); }
+
+   private:
+    std::function<void()> functor_;
+
+    CallbackTrigger(const CallbackTrigger&) = delete;
+    CallbackTrigger& operator=(const CallbackTrigger&) = delete;
+  };
+
   // The following metrics refer to the connection to the master:
   extern CallbackMetric<std::string>* master_connection_status;
   extern CallbackMetric<std::string>* last_master_connect_error;
@@ -67,6 +392,15 @@ namespace monitoring {
   extern Metric<bool>* rippled_active;
   extern Metric<uint64_t>* bytes_sent_to_master;
   extern Metric<uint64_t>* bytes_received_from_master;
+  extern Counter<>* semi_sync_acks_coalesced;
+  extern Metric<uint64_t>* master_standbys_ready;
+  extern Counter<std::string>* master_standby_failovers;
+  // Transactions written to the binlog from an upstream, and transactions
+  // dropped as another upstream had written them first.
+  extern Counter<std::string>* upstream_transactions_won;
+  extern Counter<std::string>* upstream_transactions_duplicate;
+  // Transactions too large to hold back, written directly from an upstream.
+  extern Counter<std::string>* upstream_transactions_unhedged;
 
   // The following metrics refer to the connection to the slave(s):
   extern Metric<uint32_t, std::string>* slave_current_event_timestamp;
@@ -76,10 +410,28 @@ namespace monitoring {
   extern Metric<uint64_t, std::string>* bytes_sent_to_slave;
   extern Metric<uint64_t, std::string>* bytes_received_from_slave;
 
+  // Worker pool running the slave sessions, see ThreadPoolExecutor:
+  extern CallbackMetric<uint64_t>* executor_threads;
+  extern CallbackMetric<uint64_t>* executor_busy_threads;
+  extern CallbackMetric<uint64_t>* executor_queued;
+  extern CallbackMetric<uint64_t>* executor_queue_wait;
+
   // Binlog metrics:
   extern Counter<std::string>* rippled_binlog_error;
   extern Metric<uint32_t>* binlog_last_event_timestamp;
   extern Metric<uint64_t>* binlog_last_event_received;
+  extern Metric<uint64_t>* binlog_trash_bytes;
+  extern Metric<uint64_t>* binlog_trash_bytes_freed;
+  extern Metric<uint64_t>* binlog_trash_free_rate;
+  extern Metric<uint64_t>* binlog_archive_bytes;
+  extern Metric<uint64_t>* binlog_archive_rate;
+
+  // Replication latency per stage of a transaction, see Initialize():
+  extern Histogram<>* latency_commit_to_received;
+  extern Histogram<>* latency_received_to_written;
+  extern Histogram<>* latency_written_to_published;
+  extern Histogram<std::string>* latency_published_to_sent;
+  extern Histogram<>* latency_semi_sync_ack;
 
   // Error messages used with the binlog error counter:
   // File errors:
@@ -0,0 +1,155 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "monitoring_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "logging.h"
+#include "monitoring.h"
+
+namespace mysql_ripple {
+
+// How often to check if we should stop.
+static const int kPollTimeoutMs = 200;
+// Max size of request, and max time to wait for it.
+static const size_t kMaxRequestSize = 8192;
+static const int kRequestTimeoutSeconds = 2;
+
+MonitoringServer::MonitoringServer(int port)
+    : ThreadedSession(Session::MonitoringServer),
+      port_(port),
+      fd_(-1) {
+}
+
+MonitoringServer::~MonitoringServer() {
+  if (fd_ != -1)
+    close(fd_);
+}
+
+bool MonitoringServer::Listen() {
+  fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ == -1) {
+    LOG(ERROR) << "Failed to create monitoring socket: " << strerror(errno);
+    return false;
+  }
+
+  int on = 1;
+  setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port_);
+  if (bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+    LOG(ERROR) << "Failed to bind monitoring port " << port_ << ": "
+               << strerror(errno);
+    return false;
+  }
+  if (listen(fd_, 16)) {
+    LOG(ERROR) << "Failed to listen on monitoring port " << port_ << ": "
+               << strerror(errno);
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  if (getsockname(fd_, reinterpret_cast<struct sockaddr *>(&addr), &len) == 0)
+    port_ = ntohs(addr.sin_port);
+
+  LOG(INFO) << "Serving metrics on localhost:" << port_;
+  return true;
+}
+
+void *MonitoringServer::Run() {
+  while (!ShouldStop()) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int res = poll(&pfd, 1, kPollTimeoutMs);
+    if (res <= 0)
+      continue;
+
+    int fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1)
+      continue;
+    ServeConnection(fd);
+    close(fd);
+  }
+  return nullptr;
+}
+
+void MonitoringServer::ServeConnection(int fd) {
+  struct timeval tv;
+  tv.tv_sec = kRequestTimeoutSeconds;
+  tv.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < kMaxRequestSize) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+      return;
+    request.append(buf, len);
+  }
+
+  std::string response = HandleRequest(request);
+  const char *ptr = response.data();
+  size_t left = response.size();
+  while (left > 0) {
+    ssize_t len = send(fd, ptr, left, MSG_NOSIGNAL);
+    if (len <= 0)
+      return;
+    ptr += len;
+    left -= len;
+  }
+}
+
+std::string MonitoringServer::HandleRequest(const std::string &request) {
+  std::string status;
+  std::string content_type = "text/plain";
+  std::string body;
+  if (absl::StartsWith(request, "GET /metrics ") ||
+      absl::StartsWith(request, "GET / ")) {
+    status = "200 OK";
+    content_type = "text/plain; version=0.0.4";
+    body = monitoring::ExportText();
+  } else if (absl::StartsWith(request, "GET ")) {
+    status = "404 Not Found";
+    body = "Not found\n";
+  } else {
+    status = "405 Method Not Allowed";
+    body = "Method not allowed\n";
+  }
+  return absl::StrCat("HTTP/1.0 ", status, "\r\n",
+                      "Content-Type: ", content_type, "\r\n",
+                      "Content-Length: ", body.size(), "\r\n",
+                      "Connection: close\r\n\r\n", body);
+}
+
+}  // namespace mysql_ripple
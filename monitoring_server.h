@@ -0,0 +1,55 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MYSQL_RIPPLE_MONITORING_SERVER_H
+#define MYSQL_RIPPLE_MONITORING_SERVER_H
+
+#include <string>
+
+#include "session.h"
+
+namespace mysql_ripple {
+
+// A minimal http server that serves monitoring::ExportText() on /metrics,
+// so that metrics can be scraped by Prometheus.
+// Requests are served one at a time on the session thread.
+class MonitoringServer : public ThreadedSession {
+ public:
+  explicit MonitoringServer(int port);
+  virtual ~MonitoringServer();
+
+  // Bind and listen on localhost:port.
+  bool Listen();
+
+  // Port listened on, useful when constructed with port 0.
+  int GetPort() const { return port_; }
+
+  // Get http response for request.
+  static std::string HandleRequest(const std::string &request);
+
+ protected:
+  void *Run() override;
+
+ private:
+  int port_;
+  int fd_;
+
+  void ServeConnection(int fd);
+};
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_MONITORING_SERVER_H
@@ -0,0 +1,228 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "monitoring.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "monitoring_server.h"
+
+namespace monitoring {
+
+static bool Contains(const std::string& text, const std::string& str) {
+  return text.find(str) != std::string::npos;
+}
+
+TEST(Monitoring, Counter) {
+  Counter<> counter("test_counter", "A counter.");
+  Counter<std::string, int> labelled("test_labelled_counter", "Labelled.",
+                                     {"name", "id"});
+
+  const int kThreads = 8;
+  const int kIncrements = 10000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.emplace_back([&counter, &labelled, i]() {
+      for (int j = 0; j < kIncrements; j++) {
+        counter.Increment();
+        labelled.Increment("a", i % 2);
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  labelled.IncrementBy(5, "b\"\n", 3);
+
+  std::string text = ExportText();
+  EXPECT_TRUE(Contains(text, "# HELP test_counter A counter.\n"
+                             "# TYPE test_counter counter\n"
+                             "test_counter 80000\n"));
+  EXPECT_TRUE(Contains(text, "test_labelled_counter{name=\"a\",id=\"0\"} "
+                             "40000\n"));
+  EXPECT_TRUE(Contains(text, "test_labelled_counter{name=\"a\",id=\"1\"} "
+                             "40000\n"));
+  EXPECT_TRUE(Contains(text, "test_labelled_counter{name=\"b\\\"\\n\","
+                             "id=\"3\"} 5\n"));
+}
+
+TEST(Monitoring, Metric) {
+  Metric<uint64_t> metric("test_gauge", "A gauge.");
+  Metric<bool, std::string> labelled("test_labelled_gauge", "Labelled.",
+                                     {"slave"});
+  Metric<std::string> status("test_status", "A string.");
+
+  metric.Set(17);
+  metric.Set(42);
+  labelled.Set(true, "s1");
+  labelled.Set(false, "s2");
+  status.Set("connected");
+
+  std::string text = ExportText();
+  EXPECT_TRUE(Contains(text, "# TYPE test_gauge gauge\ntest_gauge 42\n"));
+  EXPECT_TRUE(Contains(text, "test_labelled_gauge{slave=\"s1\"} 1\n"
+                             "test_labelled_gauge{slave=\"s2\"} 0\n"));
+  EXPECT_TRUE(Contains(text, "test_status{value=\"connected\"} 1\n"));
+}
+
+TEST(Monitoring, CellsAreCachedPerThread) {
+  Counter<std::string> counter("test_cached_counter", "Cached.", {"name"});
+  counter.Increment("a");
+  counter.Increment("b");
+  EXPECT_EQ(counter.GetLockedLookups(), 2);
+
+  // Cells already used by this thread are found without the mutex.
+  counter.Increment("a");
+  counter.IncrementBy(2, "b");
+  EXPECT_EQ(counter.GetLockedLookups(), 2);
+
+  // Other threads look up each cell once.
+  std::thread([&counter]() {
+    counter.Increment("a");
+    counter.Increment("a");
+  }).join();
+  EXPECT_EQ(counter.GetLockedLookups(), 3);
+  EXPECT_TRUE(Contains(ExportText(), "test_cached_counter{name=\"a\"} 4\n"));
+}
+
+TEST(Monitoring, RemoveCell) {
+  Metric<uint64_t, std::string> gauge("test_removed_gauge", "Removed.",
+                                      {"slave"});
+  gauge.Set(1, "s1");
+  gauge.Set(2, "s2");
+  std::thread([&gauge]() { gauge.Set(3, "s1"); }).join();
+  EXPECT_EQ(gauge.GetLockedLookups(), 3);
+
+  gauge.Remove("s1");
+  std::string text = ExportText();
+  EXPECT_FALSE(Contains(text, "test_removed_gauge{slave=\"s1\"}"));
+  EXPECT_TRUE(Contains(text, "test_removed_gauge{slave=\"s2\"} 2\n"));
+
+  // The cells cached by this thread are dropped, and a removed label
+  // starts from a new cell.
+  gauge.Set(4, "s1");
+  gauge.Set(5, "s2");
+  EXPECT_EQ(gauge.GetLockedLookups(), 5);
+  EXPECT_TRUE(Contains(ExportText(),
+                       "test_removed_gauge{slave=\"s1\"} 4\n"
+                       "test_removed_gauge{slave=\"s2\"} 5\n"));
+}
+
+TEST(Monitoring, CallbackTrigger) {
+  CallbackMetric<std::string, std::string> metric(
+      "test_callback", "Set by trigger.", {"slave"});
+  int calls = 0;
+  {
+    CallbackTrigger trigger([&metric, &calls]() {
+      metric.Set(std::to_string(++calls), "s1");
+    });
+    std::string text = ExportText();
+    EXPECT_TRUE(Contains(text, "test_callback{slave=\"s1\",value=\"1\"} 1\n"));
+  }
+  // Trigger is unregistered when destroyed.
+  ExportText();
+  EXPECT_EQ(calls, 1);
+
+  // Metric is unregistered when destroyed.
+  {
+    Metric<int> metric2("test_destroyed", "Destroyed.");
+  }
+  EXPECT_FALSE(Contains(ExportText(), "test_destroyed"));
+}
+
+TEST(Monitoring, Initialize) {
+  Initialize();
+  Initialize();
+  rippled_binlog_error->Increment(ERROR_READ_FILE);
+  std::string text = ExportText();
+  EXPECT_TRUE(Contains(text, "rippled_binlog_error{error=\"" +
+                             std::string(ERROR_READ_FILE) + "\"} 1\n"));
+  EXPECT_GT(CoarseUnixSeconds(), 1500000000);
+}
+
+TEST(Monitoring, HistogramBuckets) {
+  typedef internal::HistogramCell Cell;
+  // Buckets are contiguous and cover all values.
+  EXPECT_EQ(Cell::BucketIndex(0), 0);
+  for (int i = 0; i < Cell::kBuckets - 1; i++) {
+    uint64_t upper = Cell::BucketUpperBound(i);
+    EXPECT_EQ(Cell::BucketIndex(upper), i);
+    EXPECT_EQ(Cell::BucketIndex(upper + 1), i + 1);
+  }
+  EXPECT_EQ(Cell::BucketIndex(~uint64_t{0}), Cell::kBuckets - 1);
+  EXPECT_EQ(Cell::BucketUpperBound(Cell::kBuckets - 1), ~uint64_t{0});
+
+  // Relative error is bounded by bucket size.
+  for (uint64_t value : {9, 100, 1234, 99999, 123456789}) {
+    uint64_t upper = Cell::BucketUpperBound(Cell::BucketIndex(value));
+    EXPECT_GE(upper, value);
+    EXPECT_LE(upper - value, value / Cell::kSubBuckets);
+  }
+}
+
+TEST(Monitoring, Histogram) {
+  Histogram<std::string> histogram("test_histogram", "Latency.", {"slave"});
+  for (uint64_t i = 1; i <= 1000; i++)
+    histogram.Record(i, "s1");
+  histogram.Record(5, "s2");
+
+  int cells = 0;
+  histogram.ForEach([&cells](const std::vector<std::string>& labels,
+                             const internal::HistogramCell& cell) {
+    cells++;
+    ASSERT_EQ(labels.size(), 1);
+    if (labels[0] == "s1") {
+      EXPECT_EQ(cell.Count(), 1000);
+      EXPECT_EQ(cell.Sum(), 500500);
+      EXPECT_EQ(cell.Max(), 1000);
+      EXPECT_NEAR(cell.Percentile(50), 500, 500 / 8);
+      EXPECT_NEAR(cell.Percentile(99), 990, 990 / 8);
+      EXPECT_EQ(cell.Percentile(100), 1000);
+    } else {
+      EXPECT_EQ(labels[0], "s2");
+      EXPECT_EQ(cell.Count(), 1);
+      EXPECT_EQ(cell.Percentile(50), 5);
+    }
+  });
+  EXPECT_EQ(cells, 2);
+
+  std::string text = ExportText();
+  EXPECT_TRUE(Contains(text, "# TYPE test_histogram histogram\n"));
+  EXPECT_TRUE(Contains(text, "test_histogram_bucket{slave=\"s1\",le=\"7\"} "
+                             "7\n"));
+  EXPECT_TRUE(Contains(text, "test_histogram_bucket{slave=\"s1\",le=\"1023\"} "
+                             "1000\n"));
+  EXPECT_TRUE(Contains(text, "test_histogram_bucket{slave=\"s1\",le=\"+Inf\"} "
+                             "1000\n"));
+  EXPECT_TRUE(Contains(text, "test_histogram_sum{slave=\"s1\"} 500500\n"));
+  EXPECT_TRUE(Contains(text, "test_histogram_count{slave=\"s2\"} 1\n"));
+}
+
+TEST(Monitoring, HandleRequest) {
+  Metric<int> metric("test_http", "Http.");
+  metric.Set(3);
+  std::string response = mysql_ripple::MonitoringServer::HandleRequest(
+      "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(response.find("HTTP/1.0 200 OK\r\n"), 0);
+  EXPECT_TRUE(Contains(response, "text/plain; version=0.0.4"));
+  EXPECT_TRUE(Contains(response, "\r\n\r\n# HELP"));
+  EXPECT_TRUE(Contains(response, "test_http 3\n"));
+
+  response = mysql_ripple::MonitoringServer::HandleRequest(
+      "GET /other HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(response.find("HTTP/1.0 404"), 0);
+}
+
+}  // namespace monitoring
@@ -111,6 +111,17 @@ CryptResult Aes128GcmCrypto::Init(const unsigned char* key,
   return CRYPT_OK;
 }
 
+CryptResult Aes128GcmCrypto::SetIv(const unsigned char* iv) {
+  if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, mode())) {
+    char error_buf[1024];
+    unsigned long error= ERR_get_error();
+    ERR_error_string_n(error, error_buf, sizeof(error_buf));
+    fprintf(stderr, "EVP_CipherInit_ex with iv failed: %s (%lu)\n", error_buf, error);
+    return CRYPT_OPENSSL_ERROR;
+  }
+  return CRYPT_OK;
+}
+
 CryptResult Aes128GcmCrypto::AddAAD(const unsigned char* aad, int aad_size) {
   int outlen;
   return Crypt(aad, aad_size, NULL, &outlen);
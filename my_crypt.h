@@ -134,6 +134,10 @@ class Aes128GcmCrypto : public Crypto {
   CryptResult Init(const unsigned char* key, const unsigned char* iv,
                    int iv_size);
 
+  // Restart with a new iv, keeping the key schedule and iv size set up by
+  // Init(). Much cheaper than Init() when only the iv changes.
+  CryptResult SetIv(const unsigned char* iv);
+
   virtual CryptResult AddAAD(const unsigned char* aad, int aad_size);
 
  protected:
@@ -15,6 +15,7 @@
 #include "mysql_client_connection.h"
 
 #include <cstdio>
+#include <cstring>
 
 #include "absl/strings/numbers.h"
 #include "byte_order.h"
@@ -29,6 +30,7 @@
 // MySQL client library includes
 #include "mysql.h"
 #include "mysqld_error.h"
+#include "private/violite.h"
 
 
 // This are functions inside mysql client library that are not exported.
@@ -58,7 +60,11 @@ ClientConnection::ClientConnection() :
     Connection(MYSQL_CLIENT_CONNECTION),
     mysql_variant_(MYSQL_VARIANT_UNKNOWN),
     compress_(false),
-    heartbeat_period_(0.1) {
+    heartbeat_period_(0.1),
+    read_timeout_(0),
+    connect_timeout_(0),
+    write_timeout_(0),
+    own_server_id_(FLAGS_ripple_server_id) {
   mysql_.reset(mysql_init(0));
   Disconnect();
 }
@@ -120,6 +126,12 @@ ClientConnection::Connect(const char *name,
 
   unsigned int opt_protocol = ParseProtocolString(protocol);
   mysql_options(mysql_.get(), MYSQL_OPT_PROTOCOL, (char*) &opt_protocol);
+  if (read_timeout_ > 0)
+    mysql_options(mysql_.get(), MYSQL_OPT_READ_TIMEOUT, &read_timeout_);
+  if (connect_timeout_ > 0)
+    mysql_options(mysql_.get(), MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout_);
+  if (write_timeout_ > 0)
+    mysql_options(mysql_.get(), MYSQL_OPT_WRITE_TIMEOUT, &write_timeout_);
 
   MYSQL *res = mysql_real_connect(
       mysql_.get(), host, user, password, db, port, socket, flags);
@@ -351,7 +363,7 @@ bool ClientConnection::StartReplicationStreamMysql(
 
   COM_Binlog_Dump_GTID args;
   args.flags = 0;
-  args.server_id = FLAGS_ripple_server_id;
+  args.server_id = own_server_id_;
   args.position = kStartPos;
   compat::Convert(pos, &args.gtid_executed);
 
@@ -466,7 +478,7 @@ bool ClientConnection::StartReplicationStreamMariaDB(
   uint8_t buf[128];
   uint16_t binlog_flags = 0;
   int start_position = kStartPos;
-  int server_id = FLAGS_ripple_server_id;
+  int server_id = own_server_id_;
 
   byte_order::store4(buf + 0, start_position);
   byte_order::store2(buf + 4, binlog_flags);
@@ -501,6 +513,39 @@ bool ClientConnection::WritePacket(Packet packet) {
   return true;
 }
 
+uint8_t ClientConnection::ReservePacketNumber() {
+  return static_cast<uint8_t>(mysql_->net.pkt_nr++);
+}
+
+bool ClientConnection::WritePacketUnbuffered(const Buffer& buffer,
+                                             uint8_t packet_number) {
+  if (compress_ || buffer.size() >= MAX_PACKET_LENGTH) {
+    return false;
+  }
+
+  // Header and payload are written at once, as the ack is small.
+  Buffer frame;
+  uint8_t *ptr = frame.AppendUninitialized(NET_HEADER_SIZE + buffer.size());
+  byte_order::store3(ptr, buffer.size());
+  ptr[3] = packet_number;
+  memcpy(ptr + NET_HEADER_SIZE, buffer.data(), buffer.size());
+
+  ptr = frame.data();
+  size_t length = frame.size();
+  while (length > 0) {
+    size_t written = vio_write(mysql_->net.vio, ptr, length);
+    if (written == static_cast<size_t>(-1) || written == 0) {
+      // No SetError(), the reading thread owns the error state.
+      return false;
+    }
+    ptr += written;
+    length -= written;
+  }
+
+  bytes_sent += buffer.size();
+  return true;
+}
+
 void ClientConnection::Reset() {
   mysql_->net.pkt_nr = 0;
 }
@@ -43,6 +43,7 @@ class ClientConnection : public Connection {
   virtual void SetCompressed(bool val) {
     compress_ = val;
   }
+  bool GetCompressed() const { return compress_; }
 
   // Set heartbeat period used for replication stream.
   // Shall be used *before* Connect().
@@ -50,6 +51,34 @@ class ClientConnection : public Connection {
     heartbeat_period_ = heartbeat_period_seconds;
   }
 
+  // Fail reads that wait longer than read_timeout_seconds for data,
+  // 0 waits forever.
+  // Shall be used *before* Connect().
+  void SetReadTimeout(unsigned read_timeout_seconds) {
+    read_timeout_ = read_timeout_seconds;
+  }
+
+  // Fail Connect() if the server does not answer within
+  // connect_timeout_seconds, 0 uses the client library default.
+  // Shall be used *before* Connect().
+  void SetConnectTimeout(unsigned connect_timeout_seconds) {
+    connect_timeout_ = connect_timeout_seconds;
+  }
+
+  // Fail writes that block longer than write_timeout_seconds, 0 waits
+  // forever.
+  // Shall be used *before* Connect().
+  void SetWriteTimeout(unsigned write_timeout_seconds) {
+    write_timeout_ = write_timeout_seconds;
+  }
+
+  // Set server id sent when starting replication stream,
+  // default is --ripple_server_id.
+  // Shall be used *before* StartReplicationStream().
+  virtual void SetOwnServerId(uint32_t server_id) {
+    own_server_id_ = server_id;
+  }
+
   // Connect to server.
   // This method shall be called if connection status is DISCONNECTED or
   // CONNECT_FAILED otherwise it will return false directly.
@@ -132,6 +161,17 @@ class ClientConnection : public Connection {
     return WritePacket(p);
   }
 
+  // Reserve the packet number of a packet written with
+  // WritePacketUnbuffered(), as if the packet was written now.
+  virtual uint8_t ReservePacketNumber();
+
+  // Write a packet with a reserved packet number directly to the socket.
+  // Unlike WritePacket(), this may be called by one thread while another
+  // one is in ReadPacket(). Not supported on compressed connections.
+  // This method is blocking.
+  virtual bool WritePacketUnbuffered(const Buffer& buffer,
+                                     uint8_t packet_number);
+
   // Reset packet number
   virtual void Reset();
 
@@ -151,6 +191,10 @@ class ClientConnection : public Connection {
   ServerId server_id_;
   bool compress_;
   double heartbeat_period_;
+  unsigned read_timeout_;
+  unsigned connect_timeout_;
+  unsigned write_timeout_;
+  uint32_t own_server_id_;
 
   // saved for monitoring and error messages
   std::string connection_name_;
@@ -60,6 +60,11 @@ enum EventType {
 
 std::string ToString(EventType);
 
+// Is this the GTID event that starts a transaction.
+inline bool IsGtidEvent(int type) {
+  return type == ET_GTID_MARIADB || type == ET_GTID_MYSQL;
+}
+
 // Binlog v4 event lengths for ripple to construct a FormatDescriptorEvent.
 // These lengths were taken from mysql documentation and/or MariaDB source
 // code.
@@ -16,6 +16,10 @@
 
 #include <algorithm>
 
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
 #include "absl/time/clock.h"
 #include "byte_order.h"
 #include "flags.h"
@@ -30,11 +34,207 @@ namespace mysql_ripple {
 
 namespace mysql {
 
+// Build a semi-sync reply packet acking master_pos.
+static void BuildSemiSyncReply(const FilePosition& master_pos, Buffer *buf) {
+  uint8_t *ptr = buf->Append(1 + 8 + master_pos.filename.size());
+  byte_order::store1(ptr + 0, constants::SEMI_SYNC_HEADER);
+  byte_order::store8(ptr + 1, master_pos.offset);
+  master_pos.filename.copy(reinterpret_cast<char*>(ptr + 9),
+                           master_pos.filename.size());
+}
+
+SemiSyncAckSender::SemiSyncAckSender(ClientConnection *connection)
+    : connection_(connection),
+      stopping_(false),
+      failed_(false),
+      pending_(false),
+      packet_number_(0),
+      received_(0),
+      thread_(&SemiSyncAckSender::Run, this) {
+}
+
+SemiSyncAckSender::~SemiSyncAckSender() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  thread_.join();
+}
+
+bool SemiSyncAckSender::Send(const FilePosition& master_pos,
+                             int64_t received) {
+  // Reserved in the order acks are requested, as WritePacket() would.
+  uint8_t packet_number = connection_->ReservePacketNumber();
+
+  absl::MutexLock lock(&mutex_);
+  if (failed_)
+    return false;
+  if (pending_)
+    monitoring::semi_sync_acks_coalesced->Increment();
+  position_ = master_pos;
+  packet_number_ = packet_number;
+  received_ = received;
+  pending_ = true;
+  return true;
+}
+
+void SemiSyncAckSender::Run() {
+  auto has_work = [this]() { return pending_ || stopping_; };
+  mutex_.Lock();
+  while (true) {
+    mutex_.Await(absl::Condition(&has_work));
+    if (stopping_)
+      break;
+
+    Buffer buf;
+    BuildSemiSyncReply(position_, &buf);
+    uint8_t packet_number = packet_number_;
+    int64_t received = received_;
+    pending_ = false;
+    mutex_.Unlock();
+
+    bool success = connection_->WritePacketUnbuffered(buf, packet_number);
+    if (success)
+      monitoring::latency_semi_sync_ack->RecordSince(received);
+
+    mutex_.Lock();
+    if (!success) {
+      failed_ = true;
+      break;
+    }
+  }
+  mutex_.Unlock();
+}
+
+StandbyConnections::StandbyConnections(
+    const std::vector<std::pair<std::string, int>>& addresses,
+    const PrepareFunction& prepare, absl::Duration check_period)
+    : prepare_(prepare),
+      check_period_(check_period),
+      stopping_(false),
+      states_(addresses.size(), DISCONNECTED) {
+  for (const auto& address : addresses) {
+    standbys_.emplace_back(new Standby());
+    standbys_.back()->host = address.first;
+    standbys_.back()->port = address.second;
+  }
+  for (size_t i = 0; i < standbys_.size(); i++)
+    threads_.emplace_back(&StandbyConnections::Run, this, i);
+}
+
+StandbyConnections::~StandbyConnections() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  for (std::thread &thread : threads_)
+    thread.join();
+  monitoring::master_standbys_ready->Set(0);
+}
+
+StandbyConnections::Standby *StandbyConnections::Take() {
+  absl::MutexLock lock(&mutex_);
+  for (size_t i = 0; i < standbys_.size(); i++) {
+    if (states_[i] == READY) {
+      states_[i] = TAKEN;
+      UpdateReady();
+      return standbys_[i].get();
+    }
+  }
+  return nullptr;
+}
+
+void StandbyConnections::Release(Standby *standby) {
+  absl::MutexLock lock(&mutex_);
+  for (size_t i = 0; i < standbys_.size(); i++) {
+    if (standbys_[i].get() == standby)
+      states_[i] = RELEASED;
+  }
+}
+
+void StandbyConnections::Run(size_t i) {
+  ThreadInit();
+  mutex_.Lock();
+  while (!stopping_) {
+    if (states_[i] != TAKEN) {
+      states_[i] = PREPARING;
+      mutex_.Unlock();
+      bool ready = prepare_(standbys_[i].get());
+      mutex_.Lock();
+      states_[i] = ready ? READY : DISCONNECTED;
+      UpdateReady();
+    }
+
+    auto wake = [this, i]() { return stopping_ || states_[i] == RELEASED; };
+    mutex_.AwaitWithTimeout(absl::Condition(&wake), check_period_);
+  }
+  mutex_.Unlock();
+  ThreadDeinit();
+}
+
+void StandbyConnections::UpdateReady() {
+  int ready = 0;
+  for (State state : states_) {
+    if (state == READY)
+      ready++;
+  }
+  monitoring::master_standbys_ready->Set(ready);
+}
+
+bool StandbyConnections::ParseAddresses(
+    const std::string& addresses, int default_port,
+    std::vector<std::pair<std::string, int>> *result) {
+  result->clear();
+  for (absl::string_view address :
+       absl::StrSplit(addresses, ',', absl::SkipWhitespace())) {
+    address = absl::StripAsciiWhitespace(address);
+    absl::string_view host = address;
+    absl::string_view port_str;
+    bool has_port = false;
+    if (absl::ConsumePrefix(&address, "[")) {
+      size_t end = address.find(']');
+      if (end == absl::string_view::npos)
+        return false;
+      host = address.substr(0, end);
+      port_str = address.substr(end + 1);
+      if (!port_str.empty()) {
+        if (!absl::ConsumePrefix(&port_str, ":"))
+          return false;
+        has_port = true;
+      }
+    } else {
+      size_t colon = address.find(':');
+      if (colon != absl::string_view::npos) {
+        host = address.substr(0, colon);
+        port_str = address.substr(colon + 1);
+        has_port = true;
+        // An IPv6 host must be in brackets, or its last group would be
+        // taken as port.
+        if (port_str.find(':') != absl::string_view::npos)
+          return false;
+      }
+    }
+    if (host.empty())
+      return false;
+    int port = default_port;
+    if (has_port &&
+        (!absl::SimpleAtoi(port_str, &port) || port <= 0 || port > 65535))
+      return false;
+    result->emplace_back(std::string(host), port);
+  }
+  return true;
+}
+
 MasterSession::MasterSession(Binlog *binlog,
                              MasterSession::RippledInterface *rippled)
     : ThreadedSession(Session::MysqlMasterSession),
       binlog_(binlog),
       rippled_(rippled),
+      ingest_(nullptr),
+      upstream_(0),
+      connection_(&master_connection_),
+      standby_(nullptr),
+      standby_ended_(false),
       host_(FLAGS_ripple_master_address),
       port_(FLAGS_ripple_master_port),
       protocol_(FLAGS_ripple_master_protocol),
@@ -55,7 +255,10 @@ MasterSession::~MasterSession() {
 }
 
 void MasterSession::SetConnectionStatusMetrics() {
-  if (connection_.connection_status() == Connection::CONNECTED)
+  if (upstream_ != 0)
+    return;
+  ClientConnection *connection = connection_;
+  if (connection->connection_status() == Connection::CONNECTED)
     monitoring::time_since_master_last_connected->Set(0);
   else
     // Set this value in seconds
@@ -63,16 +266,16 @@ void MasterSession::SetConnectionStatusMetrics() {
       (absl::Now() - last_connected_time_) / absl::Seconds(1));
 
   monitoring::master_connection_status->Set(
-    Connection::to_string(connection_.connection_status()));
+    Connection::to_string(connection->connection_status()));
 
-  if (connection_.HasError())
+  if (connection->HasError())
     monitoring::last_master_connect_error->Set(
-      connection_.GetLastErrorMessage());
+      connection->GetLastErrorMessage());
   else
     monitoring::last_master_connect_error->Set("");
 
-  monitoring::bytes_sent_to_master->Set(connection_.GetBytesSent());
-  monitoring::bytes_received_from_master->Set(connection_.GetBytesReceived());
+  monitoring::bytes_sent_to_master->Set(connection->GetBytesSent());
+  monitoring::bytes_received_from_master->Set(connection->GetBytesReceived());
 }
 
 void MasterSession::ThrottleConnectionAttempts() {
@@ -100,63 +303,46 @@ void MasterSession::ResetThrottleConnectionAttempts() {
   last_connection_attempt_time_ = absl::InfinitePast();
 }
 
-bool MasterSession::Connect() {
-  ThrottleConnectionAttempts();
-
-  // Recheck state since ThrottleConnectionAttempts might have slept
-  if (ShouldStop()) {
-    return false;
-  }
-
-  last_connected_time_ = absl::Now();
-
-  connection_.SetCompressed(compressed_protocol_);
-  connection_.SetHeartbeatPeriod(heartbeat_period_);
-  if (connection_.Connect("master",
-                          host_.c_str(),
-                          port_,
+bool MasterSession::ConnectTo(ClientConnection *connection,
+                              const std::string& host, int port,
+                              std::string *server_name) {
+  connection->SetCompressed(compressed_protocol_);
+  connection->SetHeartbeatPeriod(heartbeat_period_);
+  if (connection->Connect("master",
+                          host.c_str(),
+                          port,
                           protocol_.c_str(),
                           user_.c_str(),
                           password_.c_str()) &&
-      connection_.FetchServerVersion() &&
-      connection_.FetchServerId()) {
-    connection_.FetchVariable("server_name", &server_name_);
+      connection->FetchServerVersion() &&
+      connection->FetchServerId()) {
+    connection->FetchVariable("server_name", server_name);
     {
       // Set own server name at master
       std::string q =
           "SET @server_name='" + FLAGS_ripple_server_name + "'";
-      if (!connection_.ExecuteStatement(q)) {
+      if (!connection->ExecuteStatement(q)) {
         LOG(ERROR) << "Failed to set @server_name"
                    << ", value: '" << FLAGS_ripple_server_name << "'";
 
-        connection_.Disconnect();
+        connection->Disconnect();
         return false;
       }
     }
 
     LOG(INFO) << "Connected to host: "
-              << host_
-              << ", port: " << port_
-              << ", server_id: " << connection_.GetServerId().server_id
-              << ", server_name: " << server_name_;
+              << host
+              << ", port: " << port
+              << ", server_id: " << connection->GetServerId().server_id
+              << ", server_name: " << *server_name;
 
-    uint32_t server_id_tmp = connection_.GetServerId().server_id;
+    uint32_t server_id_tmp = connection->GetServerId().server_id;
     if (server_id_tmp == FLAGS_ripple_server_id) {
       LOG(WARNING)
           << "Disconnecting as master has server id("
-          <<  connection_.GetServerId().server_id
+          <<  connection->GetServerId().server_id
           << ") that is same as rippled!";
-      connection_.Disconnect();
-      return false;
-    }
-
-    absl::Duration timeout =
-        absl::Milliseconds(FLAGS_ripple_master_alloc_server_id_timeout);
-    if (!rippled_->AllocServerId(server_id_tmp, timeout)) {
-      LOG(WARNING) << "Disconnecting as master has server id("
-                   << connection_.GetServerId().server_id
-                   << " that is already connected to rippled!";
-      connection_.Disconnect();
+      connection->Disconnect();
       return false;
     }
     return true;
@@ -164,15 +350,100 @@ bool MasterSession::Connect() {
 
   LOG(WARNING)
       << "Failed to connected to"
-      << " host: " << host_
-      << ", port: " << port_
-      << ", err: " << connection_.GetLastErrorMessage();
-  connection_.Disconnect();
+      << " host: " << host
+      << ", port: " << port
+      << ", err: " << connection->GetLastErrorMessage();
+  connection->Disconnect();
   return false;
 }
 
+bool MasterSession::Connect() {
+  ThrottleConnectionAttempts();
+
+  // Recheck state since ThrottleConnectionAttempts might have slept
+  if (ShouldStop()) {
+    return false;
+  }
+
+  last_connected_time_ = absl::Now();
+
+  master_connection_.SetReadTimeout(FLAGS_ripple_master_read_timeout);
+  master_connection_.SetWriteTimeout(FLAGS_ripple_master_write_timeout);
+  if (!ConnectTo(&master_connection_, host_, port_, &server_name_))
+    return false;
+
+  absl::Duration timeout =
+      absl::Milliseconds(FLAGS_ripple_master_alloc_server_id_timeout);
+  if (!rippled_->AllocServerId(master_connection_.GetServerId().server_id,
+                               timeout)) {
+    LOG(WARNING) << "Disconnecting as master has server id("
+                 << master_connection_.GetServerId().server_id
+                 << " that is already connected to rippled!";
+    master_connection_.Disconnect();
+    return false;
+  }
+  connection_ = &master_connection_;
+  return true;
+}
+
+bool MasterSession::PrepareStandby(StandbyConnections::Standby *standby) {
+  ClientConnection *connection = &standby->connection;
+  if (connection->connection_status() != Connection::CONNECTED) {
+    // So that an unreachable standby fails instead of hanging its thread.
+    connection->SetConnectTimeout(FLAGS_ripple_master_standby_timeout);
+    connection->SetReadTimeout(FLAGS_ripple_master_standby_timeout);
+    connection->SetWriteTimeout(FLAGS_ripple_master_standby_timeout);
+    if (!ConnectTo(connection, standby->host, standby->port,
+                   &standby->server_name))
+      return false;
+  }
+  // Also keeps the connection from idling out.
+  if (!connection->CheckSupportsSemiSync(
+          &standby->semi_sync_master_supported,
+          &standby->semi_sync_master_enabled)) {
+    LOG(WARNING) << "Disconnecting standby host: " << standby->host
+                 << ", port: " << standby->port
+                 << ", err: " << connection->GetLastErrorMessage();
+    connection->Disconnect();
+    return false;
+  }
+  return true;
+}
+
+bool MasterSession::TakeStandby() {
+  if (standbys_ == nullptr)
+    return false;
+  StandbyConnections::Standby *standby = standbys_->Take();
+  if (standby == nullptr)
+    return false;
+
+  // If the server id is taken, another session replicates from the same
+  // server. Don't wait for it to stop.
+  ClientConnection *connection = &standby->connection;
+  if (!rippled_->AllocServerId(connection->GetServerId().server_id,
+                               absl::ZeroDuration())) {
+    LOG(WARNING) << "Not using standby as it has server id("
+                 << connection->GetServerId().server_id
+                 << " that is already connected to rippled!";
+    connection->Disconnect();
+    standbys_->Release(standby);
+    return false;
+  }
+
+  LOG(INFO) << "Replicating from standby host: " << standby->host
+            << ", port: " << standby->port;
+  monitoring::master_standby_failovers->Increment(standby->host);
+  server_name_ = standby->server_name;
+  semi_sync_master_supported_ = standby->semi_sync_master_supported;
+  semi_sync_master_enabled_.store(standby->semi_sync_master_enabled,
+                                  std::memory_order_relaxed);
+  standby_ = standby;
+  connection_ = connection;
+  return true;
+}
+
 bool MasterSession::Stop() {
-  connection_.Abort();
+  connection_.load()->Abort();
   return ThreadedSession::Stop();
 }
 
@@ -181,22 +452,40 @@ void* MasterSession::Run() {
 
   DLOG(INFO) << "Master session starting";
 
+  if (!standby_addresses_.empty()) {
+    standbys_.reset(new StandbyConnections(
+        standby_addresses_,
+        [this](StandbyConnections::Standby *standby) {
+          return PrepareStandby(standby);
+        },
+        absl::Milliseconds(FLAGS_ripple_master_standby_check_period)));
+  }
+
   while (!ShouldStop()) {
-    if (!Connect()) {
-      continue;
-    }
+    // A standby is already connected and checked, so it is used first,
+    // without throttling. Unless replicating from a standby just ended,
+    // then the master is tried first, so that replication returns to it
+    // when it is back.
+    bool try_master = standby_ended_;
+    standby_ended_ = false;
+    if (try_master || !TakeStandby()) {
+      if (!Connect()) {
+        continue;
+      }
 
-    bool semi_sync_master_enabled_tmp;
-    if (!connection_.CheckSupportsSemiSync(&semi_sync_master_supported_,
-                                           &semi_sync_master_enabled_tmp)) {
-      Disconnect();
-      continue;
+      bool semi_sync_master_enabled_tmp;
+      if (!master_connection_.CheckSupportsSemiSync(
+              &semi_sync_master_supported_, &semi_sync_master_enabled_tmp)) {
+        Disconnect();
+        continue;
+      }
+      semi_sync_master_enabled_.store(semi_sync_master_enabled_tmp,
+                                      std::memory_order_relaxed);
     }
-    semi_sync_master_enabled_.store(semi_sync_master_enabled_tmp,
-                                    std::memory_order_relaxed);
+    ClientConnection *connection = connection_;
     if (!semi_sync_master_supported_) {
       LOG(WARNING) << "master does not support semi sync";
-    } else if (!semi_sync_master_enabled_tmp) {
+    } else if (!GetSemiSyncMasterEnabled()) {
       LOG(WARNING) << "master does not have semi sync enabled";
     } else {
       LOG(INFO) << "master has semi sync enabled";
@@ -212,15 +501,19 @@ void* MasterSession::Run() {
     bool semi_sync_active = semi_sync_master_supported_ &&
                             GetSemiSyncSlaveReplyEnabled();
     semi_sync_slave_reply_active_.store(semi_sync_active);
-    if (!connection_.StartReplicationStream(start_position, semi_sync_active)) {
+    if (!connection->StartReplicationStream(start_position,
+                                            semi_sync_active)) {
       LOG(ERROR) << "Failed to start replication stream: "
-                 << connection_.GetLastErrorMessage().c_str();
+                 << connection->GetLastErrorMessage().c_str();
       Disconnect();
       continue;
     }
 
+    if (semi_sync_active && !connection->GetCompressed()) {
+      ack_sender_.reset(new SemiSyncAckSender(connection));
+    }
 
-    if (!binlog_->ConnectionEstablished(&connection_)) {
+    if (!ConnectionEstablished(start_position)) {
       LOG(ERROR) << "Failure when establishing connection";
       last_connected_time_ = absl::Now();
       Disconnect();
@@ -234,14 +527,15 @@ void* MasterSession::Run() {
     format_.checksum = true;
 
     if (!HandleHandshakeEvents()) {
-      binlog_->ConnectionClosed(&connection_);
+      ConnectionClosed();
       last_connected_time_ = absl::Now();
       Disconnect();
       continue;
     }
 
     // We are now downloading binlogs; ripple client is in "START SLAVE;" mode
-    monitoring::rippled_active->Set(true);
+    if (upstream_ == 0)
+      monitoring::rippled_active->Set(true);
 
     // Then enter main loop
     while (!ShouldStop()) {
@@ -249,33 +543,53 @@ void* MasterSession::Run() {
       uint8_t semi_sync_reply = 0;
       if (!ReadEvent(&event, &semi_sync_reply))
         break;
+      int64_t received = monitoring::MonotonicMicros();
+      bool gtid_event = constants::IsGtidEvent(event.header.type);
+      if (gtid_event && event.header.timestamp != 0) {
+        int64_t lag = monitoring::UnixMicros() -
+            int64_t{event.header.timestamp} * 1000000;
+        monitoring::latency_commit_to_received->Record(lag > 0 ? lag : 0);
+      }
 
       bool reply = semi_sync_reply && GetSemiSyncSlaveReplyActive();
-      if (!binlog_->AddEvent(event, reply)) {
+      if (!AddEvent(event, reply)) {
         LOG(ERROR) << "Failed to add event to binlog";
         break;
       }
+      if (gtid_event)
+        monitoring::latency_received_to_written->RecordSince(received);
       if (reply) {
-        FilePosition file_pos =
-            binlog_->GetBinlogPosition().latest_master_position;
-        if (!SendSemiSyncReply(file_pos)) {
-          LOG(WARNING) << "Failed to send semi sync reply";
-          break;
+        // The event has been written to disk by AddEvent().
+        FilePosition file_pos = GetLatestMasterPosition();
+        if (ack_sender_ != nullptr) {
+          if (!ack_sender_->Send(file_pos, received)) {
+            LOG(WARNING) << "Failed to send semi sync reply";
+            break;
+          }
+        } else {
+          if (!SendSemiSyncReply(file_pos)) {
+            LOG(WARNING) << "Failed to send semi sync reply";
+            break;
+          }
+          monitoring::latency_semi_sync_ack->RecordSince(received);
         }
       }
       // Reset throttle counters now that we have processed
       // an event successfully.
       ResetThrottleConnectionAttempts();
     }
-    binlog_->ConnectionClosed(&connection_);
+    ConnectionClosed();
 
     LOG(INFO) << "Disconnecting from master";
     Disconnect();
 
     // We are no longer downloading binlogs.
-    monitoring::rippled_active->Set(false);
+    if (upstream_ == 0)
+      monitoring::rippled_active->Set(false);
   }
 
+  standbys_.reset(nullptr);
+
   DLOG(INFO) << "Master session stopping";
 
   ThreadDeinit();
@@ -284,18 +598,30 @@ void* MasterSession::Run() {
 }
 
 void MasterSession::Disconnect() {
-  rippled_->FreeServerId(connection_.GetServerId().server_id);
+  ClientConnection *connection = connection_;
+  // Acks not yet written are dropped. An ack being written is waited for,
+  // for at most the write timeout of the connection.
+  ack_sender_.reset(nullptr);
+  rippled_->FreeServerId(connection->GetServerId().server_id);
   last_connected_time_ = absl::Now();
   semi_sync_slave_reply_active_.store(false);
-  connection_.Disconnect();
+  connection->Disconnect();
+  if (standby_ != nullptr) {
+    // The standby is connected again by standbys_.
+    connection_ = &master_connection_;
+    standbys_->Release(standby_);
+    standby_ = nullptr;
+    standby_ended_ = true;
+  }
 }
 
 bool MasterSession::ReadEvent(RawLogEventData *event,
                               uint8_t *semi_sync_reply) {
-  Connection::Packet packet = connection_.ReadPacket();
+  ClientConnection *connection = connection_;
+  Connection::Packet packet = connection->ReadPacket();
   if (packet.length == -1) {
     LOG(ERROR) << "Failed to read packet: "
-               << connection_.GetLastErrorMessage().c_str();
+               << connection->GetLastErrorMessage().c_str();
     return false;
   }
 
@@ -366,13 +692,8 @@ bool MasterSession::ReadEvent(RawLogEventData *event,
 
 bool MasterSession::SendSemiSyncReply(const FilePosition& master_pos) {
   Buffer buf;
-  uint8_t *ptr = buf.Append(1 + 8 + master_pos.filename.size());
-  byte_order::store1(ptr + 0, constants::SEMI_SYNC_HEADER);
-  byte_order::store8(ptr + 1, master_pos.offset);
-  master_pos.filename.copy(reinterpret_cast<char*>(ptr + 9),
-                           master_pos.filename.size());
-
-  return connection_.WritePacket(buf);
+  BuildSemiSyncReply(master_pos, &buf);
+  return connection_.load()->WritePacket(buf);
 }
 
 bool MasterSession::HandleHandshakeEvents() {
@@ -421,9 +742,36 @@ bool MasterSession::HandleHandshakeEvents() {
   // format_ member variable.
 
   // Now add them to binlog with FD first and Rotate then
-  if (!binlog_->AddEvent(event, true)) return false;
+  if (!AddEvent(event, true)) return false;
+
+  return AddEvent(raw_rotate_event, true);
+}
+
+bool MasterSession::ConnectionEstablished(const GTIDList& start_position) {
+  if (ingest_ != nullptr)
+    return ingest_->ConnectionEstablished(upstream_, connection_,
+                                          start_position);
+  return binlog_->ConnectionEstablished(connection_);
+}
+
+bool MasterSession::AddEvent(RawLogEventData event, bool wait) {
+  if (ingest_ != nullptr)
+    return ingest_->AddEvent(upstream_, event, wait);
+  return binlog_->AddEvent(event, wait);
+}
+
+void MasterSession::ConnectionClosed() {
+  if (ingest_ != nullptr)
+    ingest_->ConnectionClosed(upstream_);
+  else
+    binlog_->ConnectionClosed(connection_);
+}
 
-  return binlog_->AddEvent(raw_rotate_event, true);
+FilePosition MasterSession::GetLatestMasterPosition() {
+  // With several upstreams, the binlog may have the position of another.
+  if (ingest_ != nullptr)
+    return ingest_->GetMasterPosition(upstream_);
+  return binlog_->GetLatestMasterPosition();
 }
 
 void MasterSession::SetSemiSyncSlaveReplyEnabled(bool onoff) {
@@ -18,8 +18,16 @@
 #define MYSQL_RIPPLE_MYSQL_MASTER_SESSION_H
 
 #include <atomic>
-
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
 #include "binlog.h"
+#include "hedged_ingest.h"
 #include "monitoring.h"
 #include "mysql_client_connection.h"
 #include "session.h"
@@ -28,6 +36,112 @@ namespace mysql_ripple {
 
 namespace mysql {
 
+// Sends semi-sync acks to the master from a thread of its own, so that
+// reading events never blocks on writing acks. Only the newest position
+// is sent, acks queued while a previous one is being written are collapsed.
+class SemiSyncAckSender {
+ public:
+  explicit SemiSyncAckSender(ClientConnection *connection);
+  ~SemiSyncAckSender();
+
+  // Queue an ack for master_pos, which must already be durable locally.
+  // received is MonotonicMicros() when the acked event was received.
+  // Called by the thread reading events.
+  // Returns false if writing an earlier ack failed.
+  bool Send(const FilePosition& master_pos, int64_t received);
+
+ private:
+  ClientConnection *connection_;
+
+  absl::Mutex mutex_;
+  bool stopping_ ABSL_GUARDED_BY(mutex_);
+  bool failed_ ABSL_GUARDED_BY(mutex_);
+  bool pending_ ABSL_GUARDED_BY(mutex_);
+  FilePosition position_ ABSL_GUARDED_BY(mutex_);
+  uint8_t packet_number_ ABSL_GUARDED_BY(mutex_);
+  int64_t received_ ABSL_GUARDED_BY(mutex_);
+
+  std::thread thread_;
+
+  void Run();
+
+  SemiSyncAckSender(const SemiSyncAckSender&) = delete;
+  SemiSyncAckSender& operator=(const SemiSyncAckSender&) = delete;
+};
+
+// Keeps connections to standby upstreams connected, authenticated and
+// checked from a thread per standby, so that MasterSession can start
+// replicating from one as soon as its connection fails, and a standby
+// that does not answer does not hold up the others.
+class StandbyConnections {
+ public:
+  struct Standby {
+    std::string host;
+    int port;
+    ClientConnection connection;
+    // Read from the upstream when connecting.
+    std::string server_name;
+    // Read from the upstream by each check.
+    bool semi_sync_master_supported = false;
+    bool semi_sync_master_enabled = false;
+  };
+
+  // Connects a standby that is not connected, or checks one that is.
+  // Returns false, with the connection disconnected, on failure.
+  // Called from the thread of the standby, should time out so that the
+  // destructor does not wait long for it.
+  typedef std::function<bool(Standby *standby)> PrepareFunction;
+
+  StandbyConnections(
+      const std::vector<std::pair<std::string, int>>& addresses,
+      const PrepareFunction& prepare, absl::Duration check_period);
+  // Waits for the ongoing prepare calls.
+  ~StandbyConnections();
+
+  // Take a standby ready to start replicating, nullptr if there is none.
+  // Standbys are taken in the order of their addresses.
+  Standby *Take();
+
+  // Give back a taken standby after disconnecting it. It is reconnected
+  // right away.
+  void Release(Standby *standby);
+
+  // Parse comma separated host[:port] into addresses. IPv6 hosts are
+  // written in brackets, [host]:port or [host].
+  // Returns false if a port or a host is invalid.
+  static bool ParseAddresses(
+      const std::string& addresses, int default_port,
+      std::vector<std::pair<std::string, int>> *result);
+
+ private:
+  enum State {
+    DISCONNECTED,
+    PREPARING,   // Being connected or checked by the thread.
+    READY,
+    TAKEN,
+    RELEASED     // Given back, to be prepared without waiting.
+  };
+
+  std::vector<std::unique_ptr<Standby>> standbys_;
+  PrepareFunction prepare_;
+  absl::Duration check_period_;
+
+  absl::Mutex mutex_;
+  bool stopping_ ABSL_GUARDED_BY(mutex_);
+  std::vector<State> states_ ABSL_GUARDED_BY(mutex_);
+
+  std::vector<std::thread> threads_;
+
+  // Prepare standby i every check period.
+  void Run(size_t i);
+
+  // Publish the number of READY standbys.
+  void UpdateReady() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  StandbyConnections(const StandbyConnections&) = delete;
+  StandbyConnections& operator=(const StandbyConnections&) = delete;
+};
+
 // A class representing a mysql active connection to a mysql master
 class MasterSession : public ThreadedSession {
  public:
@@ -44,7 +158,7 @@ class MasterSession : public ThreadedSession {
   // Return a const connection that can be inspected
   // but not modified.
   virtual const mysql::ClientConnection& GetConnection() const {
-    return connection_;
+    return *connection_;
   }
 
   bool Stop() override;
@@ -84,6 +198,20 @@ class MasterSession : public ThreadedSession {
   void SetCompressedProtocol(bool onoff) { compressed_protocol_ = onoff; }
   void SetHeartbeatPeriod(double period) { heartbeat_period_ = period; }
 
+  // Keep standby connections to addresses while the session is started.
+  void SetStandbyAddresses(
+      const std::vector<std::pair<std::string, int>>& addresses) {
+    standby_addresses_ = addresses;
+  }
+
+  // Write events through ingest, as upstream number upstream, rather than
+  // directly to the binlog. Only upstream 0 reports its connection in
+  // monitoring. Set before starting the session.
+  void SetHedgedIngest(HedgedIngest *ingest, int upstream) {
+    ingest_ = ingest;
+    upstream_ = upstream;
+  }
+
   std::string GetHost() const { return host_; }
   int GetPort() const { return port_; }
   std::string GetProtocol() const { return protocol_; }
@@ -95,7 +223,22 @@ class MasterSession : public ThreadedSession {
  private:
   Binlog *binlog_;
   RippledInterface* rippled_;
-  mysql::ClientConnection connection_;
+  HedgedIngest *ingest_;
+  int upstream_;
+
+  // Connection to host_, and the connection replicating, which is either
+  // master_connection_ or that of standby_.
+  mysql::ClientConnection master_connection_;
+  std::atomic<mysql::ClientConnection*> connection_;
+
+  std::vector<std::pair<std::string, int>> standby_addresses_;
+  // Set while Run() if there are standby addresses.
+  std::unique_ptr<StandbyConnections> standbys_;
+  // Standby taken for replicating, nullptr if master_connection_ is used.
+  StandbyConnections::Standby *standby_;
+  // Set when replicating from a standby ends, so that host_ is tried
+  // before the next standby.
+  bool standby_ended_;
 
   // Connection properties.
   // Set in constructor from FLAGS_.
@@ -117,17 +260,36 @@ class MasterSession : public ThreadedSession {
   // Wait for connection settings and then connect.
   bool Connect();
 
+  // Connect to host and check that it can be replicated from.
+  bool ConnectTo(mysql::ClientConnection *connection, const std::string& host,
+                 int port, std::string *server_name);
+
+  // Replicate from a standby connection, if one is ready.
+  bool TakeStandby();
+
+  bool PrepareStandby(StandbyConnections::Standby *standby);
+
   void Disconnect();
 
   // Handle handshake events, i.e Rotate+FormatDescriptor that
   // is sent by master when we connect.
   bool HandleHandshakeEvents();
 
+  // Binlog methods, called through ingest_ if set.
+  bool ConnectionEstablished(const GTIDList& start_position);
+  bool AddEvent(RawLogEventData event, bool wait);
+  void ConnectionClosed();
+  FilePosition GetLatestMasterPosition();
+
   // Read one event.
   bool ReadEvent(RawLogEventData *event, uint8_t *semi_sync_reply);
 
   bool SendSemiSyncReply(const FilePosition& master_pos);
 
+  // Sends acks while connected with semi-sync active, unless the
+  // connection is compressed. Then acks are sent by SendSemiSyncReply().
+  std::unique_ptr<SemiSyncAckSender> ack_sender_;
+
   // Throttle connection attempts so that we don't spin and try to connect.
   void ThrottleConnectionAttempts();
   // Reset counters after successfully having added things to binlog.
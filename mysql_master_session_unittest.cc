@@ -0,0 +1,247 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mysql_master_session.h"
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "buffer.h"
+#include "byte_order.h"
+#include "file_position.h"
+#include "gtest/gtest.h"
+#include "monitoring.h"
+#include "mysql_client_connection.h"
+
+namespace mysql_ripple {
+
+namespace mysql {
+
+namespace {
+
+typedef std::vector<std::pair<std::string, int>> Addresses;
+
+// Standbys are ready if their host is set ready. Counts the calls.
+class TestPrepare {
+ public:
+  bool Prepare(StandbyConnections::Standby *standby) {
+    absl::MutexLock lock(&mutex_);
+    calls_[standby->host]++;
+    return ready_.count(standby->host) > 0;
+  }
+
+  void SetReady(const std::string& host, bool ready) {
+    absl::MutexLock lock(&mutex_);
+    if (ready)
+      ready_.insert(host);
+    else
+      ready_.erase(host);
+  }
+
+  int GetCalls(const std::string& host) {
+    absl::MutexLock lock(&mutex_);
+    return calls_[host];
+  }
+
+ private:
+  absl::Mutex mutex_;
+  std::set<std::string> ready_;
+  std::map<std::string, int> calls_;
+};
+
+// Records the acks written instead of writing them. Writes block while
+// the connection is blocked.
+class TestConnection : public ClientConnection {
+ public:
+  TestConnection() : blocked_(true), writing_(false), latest_(0),
+                     packet_number_(0) {}
+
+  // Stands in for GetLatestMasterPosition(), acks shall not go past it.
+  void SetLatest(uint64_t offset) {
+    absl::MutexLock lock(&mutex_);
+    latest_ = offset;
+  }
+
+  void SetBlocked(bool blocked) {
+    absl::MutexLock lock(&mutex_);
+    blocked_ = blocked;
+  }
+
+  void AwaitWriting() {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(&writing_));
+  }
+
+  std::vector<std::pair<uint64_t, uint8_t>> GetWritten() {
+    absl::MutexLock lock(&mutex_);
+    return written_;
+  }
+
+  uint8_t ReservePacketNumber() override { return packet_number_++; }
+
+  bool WritePacketUnbuffered(const Buffer& buffer,
+                             uint8_t packet_number) override {
+    absl::MutexLock lock(&mutex_);
+    writing_ = true;
+    auto unblocked = [this]() { return !blocked_; };
+    mutex_.Await(absl::Condition(&unblocked));
+    writing_ = false;
+    uint64_t offset = byte_order::load8(buffer.data() + 1);
+    EXPECT_LE(offset, latest_);
+    written_.emplace_back(offset, packet_number);
+    return true;
+  }
+
+ private:
+  absl::Mutex mutex_;
+  bool blocked_;
+  bool writing_;
+  uint64_t latest_;
+  std::vector<std::pair<uint64_t, uint8_t>> written_;
+  uint8_t packet_number_;
+};
+
+void WaitFor(const std::function<bool()> &check) {
+  while (!check())
+    absl::SleepFor(absl::Milliseconds(1));
+}
+
+bool ReadyGauge(int ready) {
+  std::string sample = "master_standbys_ready " + std::to_string(ready) + "\n";
+  return monitoring::ExportText().find(sample) != std::string::npos;
+}
+
+}  // namespace
+
+TEST(StandbyConnections, ParseAddresses) {
+  Addresses addresses;
+  EXPECT_TRUE(StandbyConnections::ParseAddresses(
+      " a:1, b ,[::1]:3,[fe80::1], 10.0.0.1:5", 10, &addresses));
+  Addresses expected = {
+    {"a", 1}, {"b", 10}, {"::1", 3}, {"fe80::1", 10}, {"10.0.0.1", 5}};
+  EXPECT_EQ(addresses, expected);
+
+  EXPECT_TRUE(StandbyConnections::ParseAddresses("", 10, &addresses));
+  EXPECT_TRUE(addresses.empty());
+
+  for (const char *invalid : {"a:0", "a:65536", "a:x", "a:", ":1", "::1",
+                              "fe80::1:3306", "[::1", "[::1]3", "[::1]:",
+                              "[]:1"}) {
+    EXPECT_FALSE(StandbyConnections::ParseAddresses(invalid, 10, &addresses))
+        << invalid;
+  }
+}
+
+TEST(StandbyConnections, TakeAndRelease) {
+  monitoring::Initialize();
+  TestPrepare prepare;
+  prepare.SetReady("a", true);
+  prepare.SetReady("b", true);
+  {
+    // Standbys are only prepared when started and when released.
+    StandbyConnections standbys(
+        {{"a", 1}, {"b", 2}, {"c", 3}},
+        [&prepare](StandbyConnections::Standby *standby) {
+          return prepare.Prepare(standby);
+        },
+        absl::InfiniteDuration());
+    WaitFor([&] { return prepare.GetCalls("c") == 1 && ReadyGauge(2); });
+
+    // Taken in the order of the addresses.
+    StandbyConnections::Standby *a = standbys.Take();
+    ASSERT_NE(a, nullptr);
+    EXPECT_EQ(a->host, "a");
+    EXPECT_EQ(a->port, 1);
+    EXPECT_TRUE(ReadyGauge(1));
+    StandbyConnections::Standby *b = standbys.Take();
+    ASSERT_NE(b, nullptr);
+    EXPECT_EQ(b->host, "b");
+    EXPECT_EQ(standbys.Take(), nullptr);
+    EXPECT_TRUE(ReadyGauge(0));
+
+    // A released standby is prepared again and can be taken again.
+    standbys.Release(a);
+    WaitFor([] { return ReadyGauge(1); });
+    EXPECT_EQ(prepare.GetCalls("a"), 2);
+    EXPECT_EQ(standbys.Take(), a);
+
+    // Unless it fails to prepare.
+    prepare.SetReady("a", false);
+    standbys.Release(a);
+    standbys.Release(b);
+    WaitFor([&] { return prepare.GetCalls("a") == 3 && ReadyGauge(1); });
+    EXPECT_EQ(standbys.Take(), b);
+    EXPECT_EQ(standbys.Take(), nullptr);
+    EXPECT_EQ(prepare.GetCalls("c"), 1);
+  }
+  EXPECT_TRUE(ReadyGauge(0));
+}
+
+TEST(StandbyConnections, SlowStandby) {
+  monitoring::Initialize();
+  TestPrepare prepare;
+  prepare.SetReady("b", true);
+  absl::Notification unblock;
+  StandbyConnections standbys(
+      {{"a", 1}, {"b", 2}},
+      [&](StandbyConnections::Standby *standby) {
+        // a does not answer until unblocked.
+        if (standby->host == "a")
+          unblock.WaitForNotification();
+        return prepare.Prepare(standby);
+      },
+      absl::Milliseconds(1));
+
+  // b is ready while a is still being prepared.
+  StandbyConnections::Standby *b = nullptr;
+  WaitFor([&] { return (b = standbys.Take()) != nullptr; });
+  EXPECT_EQ(b->host, "b");
+  unblock.Notify();
+}
+
+TEST(SemiSyncAckSender, SendsNewestPosition) {
+  monitoring::Initialize();
+  TestConnection connection;
+  SemiSyncAckSender sender(&connection);
+  FilePosition pos("master-bin.000001", 0);
+
+  // The first ack is being written when a burst of acks is queued.
+  pos.offset = 100;
+  connection.SetLatest(pos.offset);
+  ASSERT_TRUE(sender.Send(pos, 0));
+  connection.AwaitWriting();
+  for (int i = 1; i <= 10; i++) {
+    pos.offset = 100 + i * 10;
+    connection.SetLatest(pos.offset);
+    ASSERT_TRUE(sender.Send(pos, 0));
+  }
+  connection.SetBlocked(false);
+
+  // Only the newest position of the burst is written, with the packet
+  // number reserved for it.
+  typedef std::vector<std::pair<uint64_t, uint8_t>> Written;
+  WaitFor([&] { return connection.GetWritten().size() == 2; });
+  EXPECT_EQ(connection.GetWritten(), Written({{100, 0}, {200, 10}}));
+}
+
+}  // namespace mysql
+
+}  // namespace mysql_ripple
@@ -454,8 +454,8 @@ bool Protocol::SendMetaData(
     byte_order::store4(ptr + 3, col->max_length);
     byte_order::store1(ptr + 7, col->datatype);
     byte_order::store2(ptr + 8, 0);   // flags
-    byte_order::store1(ptr + 9, 0);   // decimals
-    byte_order::store2(ptr + 10, 0);  // filler
+    byte_order::store1(ptr + 10, 0);  // decimals
+    byte_order::store2(ptr + 11, 0);  // filler
     if (!connection_->WritePacket(buffer)) {
       return false;
     }
@@ -510,14 +510,14 @@ bool Protocol::SendResultset(const resultset::Resultset& result) {
   return true;
 }
 
-bool Protocol::SendEvent(RawLogEventData log_event) {
+void Protocol::PackEvent(RawLogEventData log_event, bool event_checksums,
+                         Buffer *dst) {
   // These are sent "as is"
-  Buffer b;
-  uint8_t *ptr = b.Append(log_event.header.event_length + 1 +
-                          (event_checksums_ ? 4 : 0));
+  uint8_t *ptr = dst->AppendUninitialized(log_event.header.event_length +
+                                          1 + (event_checksums ? 4 : 0));
   ptr[0] = 0;
   memcpy(ptr + 1, log_event.event_buffer, log_event.header.event_length);
-  if (event_checksums_) {
+  if (event_checksums) {
     // reserialize the header since length includes checksum
     log_event.header.event_length += 4;
     log_event.header.SerializeToBuffer(ptr + 1,
@@ -527,7 +527,11 @@ bool Protocol::SendEvent(RawLogEventData log_event) {
                                         log_event.header.event_length - 4);
     byte_order::store4(ptr + 1 + log_event.header.event_length - 4, val);
   }
+}
 
+bool Protocol::SendEvent(RawLogEventData log_event) {
+  Buffer b;
+  PackEvent(log_event, event_checksums_, &b);
   if (!connection_->WritePacket(b)) {
     LOG(ERROR) << "Failed to send event: "
                << connection_->GetLastErrorMessage()
@@ -558,6 +562,77 @@ bool Protocol::SendEvent(RawLogEventData log_event) {
   return true;
 }
 
+bool Protocol::SendEventStart(RawLogEventData first_part) {
+  int part_length =
+      constants::LOG_EVENT_HEADER_LENGTH + first_part.event_data_length;
+  event_remaining_ = first_part.header.event_length - part_length;
+
+  // Framed like PackEvent(), the checksum is sent after the last part.
+  Buffer b;
+  uint8_t *ptr = b.AppendUninitialized(1 + part_length);
+  ptr[0] = 0;
+  memcpy(ptr + 1, first_part.event_buffer, part_length);
+  if (event_checksums_) {
+    // reserialize the header since length includes checksum
+    first_part.header.event_length += 4;
+    first_part.header.SerializeToBuffer(ptr + 1,
+                                        constants::LOG_EVENT_HEADER_LENGTH);
+    event_checksum_ = ComputeEventChecksum(ptr + 1, part_length);
+  }
+
+  if (!connection_->BeginPacket(1 + first_part.header.event_length) ||
+      !connection_->WritePacketPart(b)) {
+    LOG(ERROR) << "Failed to send event: "
+               << connection_->GetLastErrorMessage()
+               << ", type: " << constants::ToString(
+                   static_cast<constants::EventType>(first_part.header.type))
+               << ", length: " << first_part.header.event_length;
+    event_remaining_ = 0;
+    return false;
+  }
+
+  DLOG(INFO) << "Send event in parts"
+             << ", type: " << constants::ToString(
+                 static_cast<constants::EventType>(first_part.header.type))
+             << ", timestamp: " << first_part.header.timestamp
+             << ", length: " << first_part.header.event_length
+             << ", nextpos: " << first_part.header.nextpos;
+  return true;
+}
+
+bool Protocol::SendEventPart(absl::string_view part) {
+  const uint8_t *ptr = reinterpret_cast<const uint8_t *>(part.data());
+  if (part.size() > event_remaining_) {
+    LOG(ERROR) << "Failed to send event part"
+               << ", size: " << part.size()
+               << ", remaining: " << event_remaining_;
+    return false;
+  }
+  Connection::Packet p = { static_cast<int>(part.size()), ptr };
+  if (!connection_->WritePacketPart(p)) {
+    LOG(ERROR) << "Failed to send event part: "
+               << connection_->GetLastErrorMessage()
+               << ", remaining: " << event_remaining_;
+    event_remaining_ = 0;
+    return false;
+  }
+  event_remaining_ -= part.size();
+  if (event_checksums_) {
+    event_checksum_ = crc32(event_checksum_, ptr, part.size());
+    if (event_remaining_ == 0) {
+      uint8_t checksum[4];
+      byte_order::store4(checksum, event_checksum_);
+      Connection::Packet c = { sizeof(checksum), checksum };
+      if (!connection_->WritePacketPart(c)) {
+        LOG(ERROR) << "Failed to send event checksum: "
+                   << connection_->GetLastErrorMessage();
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 uint32_t Protocol::ComputeEventChecksum(const uint8_t *ptr, int length) {
   return crc32(0, ptr, length);
 }
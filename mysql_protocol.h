@@ -41,7 +41,8 @@ struct COM_Binlog_Dump_GTID
 class Protocol {
  public:
   explicit Protocol(ServerConnection *con) :
-      event_checksums_(false), connection_(con) {}
+      event_checksums_(false), event_checksum_(0), event_remaining_(0),
+      connection_(con) {}
   virtual ~Protocol() {}
 
   virtual void SetEventChecksums(bool val) { event_checksums_ = val; }
@@ -63,6 +64,12 @@ class Protocol {
                              int count);
   virtual bool SendEvent(RawLogEventData event);
 
+  // Send an event that is read in parts (see BinlogReader::ReadEvent()).
+  // SendEventStart() sends the first part and SendEventPart() the next
+  // ones, the packet is complete once header.event_length bytes are sent.
+  virtual bool SendEventStart(RawLogEventData first_part);
+  virtual bool SendEventPart(absl::string_view part);
+
   // Compute bytes needed to store number.
   int PackLength(uint64_t number);
   // Compute bytes needed to store null terminated string.
@@ -78,6 +85,10 @@ class Protocol {
     return Unpack(reinterpret_cast<const uint8_t**>(ptr));
   }
 
+  // Append event packet (as sent by SendEvent) to dst.
+  static void PackEvent(RawLogEventData event, bool event_checksums,
+                        Buffer *dst);
+
   static uint32_t ComputeEventChecksum(const uint8_t *ptr, int length);
   static bool VerifyAndStripEventChecksum(RawLogEventData *event);
   static void StripEventChecksum(RawLogEventData *event);
@@ -87,6 +98,9 @@ class Protocol {
 
  private:
   bool event_checksums_;
+  // Of the event being sent in parts.
+  uint32_t event_checksum_;
+  size_t event_remaining_;
   ServerConnection *connection_;  // not owned
 };
 
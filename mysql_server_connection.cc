@@ -15,9 +15,11 @@
 #include "mysql_server_connection.h"
 
 #include <netinet/in.h>
+#include <algorithm>
 #include <cstdio>
 #include <utility>
 
+#include "byte_order.h"
 #include "monitoring.h"
 
 // MySQL client library includes
@@ -36,7 +38,10 @@ ServerConnection::ServerConnection(MYSQL *mysql, std::string address,
     : Connection(MYSQL_SERVER_CONNECTION),
       mysql_(mysql),
       host_(std::move(address)),
-      port_(port) {}
+      port_(port),
+      packet_remaining_(0),
+      frame_remaining_(0),
+      frame_full_(false) {}
 
 ServerConnection::~ServerConnection() {
   Disconnect();
@@ -97,6 +102,80 @@ bool ServerConnection::WritePacket(Packet packet) {
   return true;
 }
 
+bool ServerConnection::BeginPacket(size_t length) {
+  if (mysql_->net.compress) {
+    SetError("Packets can not be written in parts when compressed");
+    return false;
+  }
+  if (packet_remaining_ > 0) {
+    SetError("Previous packet not completely written");
+    return false;
+  }
+  // Write what my_net_write() has buffered first.
+  if (net_flush(&mysql_->net)) {
+    SetError("Failed net_flush before writing packet in parts");
+    return false;
+  }
+  packet_remaining_ = length;
+  frame_remaining_ = 0;
+  frame_full_ = false;
+  return true;
+}
+
+bool ServerConnection::WritePacketPart(Packet part) {
+  const uint8_t *ptr = part.ptr;
+  size_t length = part.length;
+  if (length > packet_remaining_) {
+    SetError("Packet part larger than packet");
+    return false;
+  }
+  while (length > 0) {
+    if (frame_remaining_ == 0) {
+      size_t frame = std::min<size_t>(packet_remaining_, MAX_PACKET_LENGTH);
+      if (!WriteFrameHeader(frame))
+        return false;
+      frame_remaining_ = frame;
+      frame_full_ = frame == MAX_PACKET_LENGTH;
+    }
+    size_t len = std::min(length, frame_remaining_);
+    if (!WriteFully(ptr, len))
+      return false;
+    bytes_sent += len;
+    ptr += len;
+    length -= len;
+    frame_remaining_ -= len;
+    packet_remaining_ -= len;
+  }
+  // A packet whose last physical packet has max length ends with an
+  // empty one.
+  if (packet_remaining_ == 0 && frame_remaining_ == 0 && frame_full_) {
+    frame_full_ = false;
+    return WriteFrameHeader(0);
+  }
+  return true;
+}
+
+bool ServerConnection::WriteFrameHeader(size_t length) {
+  uint8_t header[NET_HEADER_SIZE];
+  byte_order::store3(header, length);
+  header[3] = static_cast<uint8_t>(mysql_->net.pkt_nr++);
+  return WriteFully(header, sizeof(header));
+}
+
+bool ServerConnection::WriteFully(const uint8_t *ptr, size_t length) {
+  while (length > 0) {
+    size_t written = vio_write(mysql_->net.vio, ptr, length);
+    if (written == static_cast<size_t>(-1) || written == 0) {
+      SetError("Failed to write packet part");
+      packet_remaining_ = 0;
+      return false;
+    }
+    ptr += written;
+    length -= written;
+  }
+  return true;
+}
+
 void ServerConnection::Reset() {
   mysql_->net.pkt_nr = 0;
 }
@@ -134,6 +213,10 @@ void ServerConnection::SetCompressed(bool val) {
     mysql_->net.compress = 0;
 }
 
+bool ServerConnection::GetCompressed() const {
+  return mysql_->net.compress != 0;
+}
+
 
 }  // namespace mysql
 
@@ -66,6 +66,20 @@ class ServerConnection : public Connection {
     return WritePacket(p);
   }
 
+  // Write a packet of length bytes in parts, so that it need not be held
+  // in memory at once. BeginPacket() starts it and WritePacketPart()
+  // writes its next bytes, until length bytes have been written. Parts are
+  // framed into physical packets as my_net_write() frames a large packet.
+  // Not supported with the compressed protocol.
+  // These methods are blocking.
+  virtual bool BeginPacket(size_t length);
+  virtual bool WritePacketPart(Packet part);
+
+  virtual bool WritePacketPart(const Buffer& part) {
+    Packet p = { static_cast<int>(part.size()), part.data() };
+    return WritePacketPart(p);
+  }
+
   // Reset packet number
   virtual void Reset();
 
@@ -75,6 +89,7 @@ class ServerConnection : public Connection {
   // Enabled/disable compressed protocol
   // (default is disabled).
   virtual void SetCompressed(bool val);
+  virtual bool GetCompressed() const;
 
   std::string GetHost() const override { return host_; }
   uint16_t GetPort() const override { return port_; }
@@ -87,6 +102,15 @@ class ServerConnection : public Connection {
   ServerConnection(MYSQL *mysql, std::string address, uint16_t port);
   const std::string host_;
   const uint16_t port_;
+
+  // Of the packet being written in parts.
+  size_t packet_remaining_;  // bytes not yet written
+  size_t frame_remaining_;   // bytes left of the current physical packet
+  bool frame_full_;          // current physical packet has max length
+
+  // Write a physical packet header for length bytes.
+  bool WriteFrameHeader(size_t length);
+  bool WriteFully(const uint8_t *ptr, size_t length);
 };
 
 }  // namespace mysql
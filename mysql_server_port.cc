@@ -83,7 +83,8 @@ ServerPort* ServerPortFactory::GetInstance(const std::string& type,
     }
   }
 
-  if (port_list.empty()) {
+  // Ports are optional for types that do not use them.
+  if (port_list.empty() && !ports.empty()) {
     LOG(FATAL) << "Found 0 ports! arg: \"" << ports << "\"";
   }
 
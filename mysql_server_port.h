@@ -34,7 +34,12 @@ class ServerPort {
   virtual bool Bind() = 0;
   virtual bool Listen() = 0;
   // return unauthenticated ServerConnection
-  virtual ServerConnection* Accept() = 0;
+  ServerConnection* Accept() { return Accept(0); }
+
+  // Number of threads that should call Accept(thread), each with its own
+  // thread in [0, GetAcceptThreads()).
+  virtual int GetAcceptThreads() const { return 1; }
+  virtual ServerConnection* Accept(int thread) = 0;
 
   // Shutdown (wakes up thread calling Accept())
   virtual bool Shutdown() = 0;
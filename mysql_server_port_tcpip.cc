@@ -15,10 +15,14 @@
 #include "mysql_server_port_tcpip.h"
 
 #include <netdb.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+
 #include "logging.h"
 #include "mysql_constants.h"
 #include "plugin.h"
@@ -38,16 +42,10 @@ DECLARE_PLUGIN(mysql_server_port_tcpip) {
 namespace mysql {
 
 TcpIpServerPort::TcpIpServerPort(const std::string& address,
-                                 const std::vector<int>& ports)
-    : address_(address), socket_(-1) {
-
-  port_ = ports[0];
-  if (ports.size() > 1) {
-    //TODO (jonaso) :
-    LOG(WARNING) << "TcpIpServerPort only supports 1 port."
-                 << " Using " << port_ << " and ignoring rest ("
-                 << (ports.size() - 1) << " ports)";
-  }
+                                 const std::vector<int>& ports,
+                                 int accept_threads, int backlog)
+    : address_(address), ports_(ports),
+      accept_threads_(std::max(accept_threads, 1)), backlog_(backlog) {
 }
 
 TcpIpServerPort::~TcpIpServerPort() {
@@ -77,7 +75,7 @@ static bool Resolve(const std::string& address, struct sockaddr_in *dst) {
   return true;
 }
 
-bool TcpIpServerPort::Bind() {
+int TcpIpServerPort::BindSocket(int port, bool reuse_port) {
   int fd = -1;
 
   struct addrinfo hints;
@@ -98,13 +96,15 @@ bool TcpIpServerPort::Bind() {
   if (res != 0) {
     PLOG(ERROR) << "Failed to lookup '" << address_ << "'"
                << ", res: " << res;
-    return false;
+    return -1;
   }
 
   struct addrinfo* ai= NULL;
   // Loop through all possible addresses.
   for (ai = ai_list; ai != NULL; ai = ai->ai_next) {
-    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    // Non blocking, so that Accept() can poll all ports of a thread.
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                ai->ai_protocol);
     if (fd == -1) {
       PLOG(INFO)
           << "Failed to create socket with "
@@ -118,12 +118,20 @@ bool TcpIpServerPort::Bind() {
       close(fd);
       continue;
     }
+    // Only with several accept threads, as SO_REUSEPORT would also let a
+    // second ripple bind the same port without error.
+    if (reuse_port &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+      PLOG(INFO) << "Failed to set SO_REUSEPORT";
+      close(fd);
+      continue;
+    }
     if (ai->ai_family == AF_INET) {
       reinterpret_cast<struct sockaddr_in*>(ai->ai_addr)->sin_port
-          = htons(port_);
+          = htons(port);
     } else if (ai->ai_family == AF_INET6) {
       reinterpret_cast<struct sockaddr_in6*>(ai->ai_addr)->sin6_port
-          = htons(port_);
+          = htons(port);
     } else {
       LOG(INFO) << "Unknown family!" << ai->ai_family;
       close(fd);
@@ -139,50 +147,119 @@ bool TcpIpServerPort::Bind() {
   freeaddrinfo(ai_list);
   if (ai == NULL) {
     LOG(ERROR) << "Unable to create server port for '"
-               << address_ << "' port: " << port_;
+               << address_ << "' port: " << port;
+    return -1;
+  }
+  return fd;
+}
+
+// Return the port that fd is bound to, or -1.
+static int GetBoundPort(int fd) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) != 0)
+    return -1;
+  if (addr.ss_family == AF_INET)
+    return ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+  if (addr.ss_family == AF_INET6)
+    return ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+  return -1;
+}
+
+bool TcpIpServerPort::Bind() {
+  if (ports_.empty()) {
+    LOG(ERROR) << "No ports to bind for '" << address_ << "'";
     return false;
   }
+  bool reuse_port = accept_threads_ > 1;
+  sockets_.assign(accept_threads_, std::vector<int>());
+  for (int port : ports_) {
+    int bound_port = port;
+    for (int thread = 0; thread < accept_threads_; thread++) {
+      int fd = BindSocket(bound_port, reuse_port);
+      if (fd == -1) {
+        Close();
+        return false;
+      }
+      sockets_[thread].push_back(fd);
+      // The other threads join the port picked for port 0.
+      if (bound_port == 0)
+        bound_port = GetBoundPort(fd);
+    }
 
-  if (address_.length() == 0) {
-    LOG(INFO) << "Listen on host: * "
-              << ", port: " << port_;
-  } else {
-    LOG(INFO) << "Listen on host: " << address_
-              << ", port: " << port_;
+    if (address_.length() == 0) {
+      LOG(INFO) << "Listen on host: * "
+                << ", port: " << bound_port
+                << ", accept threads: " << accept_threads_;
+    } else {
+      LOG(INFO) << "Listen on host: " << address_
+                << ", port: " << bound_port
+                << ", accept threads: " << accept_threads_;
+    }
   }
-  socket_ = fd;
   return true;
 }
 
 bool TcpIpServerPort::Listen() {
-  if (socket_ == -1)
+  if (sockets_.empty())
     return false;
 
-  if (listen(socket_, 32) != 0) {
-    PLOG(ERROR) << "listen() failed";
-    return false;
+  for (const std::vector<int>& sockets : sockets_) {
+    for (int fd : sockets) {
+      if (listen(fd, backlog_) != 0) {
+        PLOG(ERROR) << "listen() failed";
+        return false;
+      }
+    }
   }
 
   return true;
 }
 
 bool TcpIpServerPort::Shutdown() {
-  if (socket_ == -1)
+  if (sockets_.empty())
     return false;
-  shutdown(socket_, SHUT_RDWR);
+  for (const std::vector<int>& sockets : sockets_) {
+    for (int fd : sockets) {
+      shutdown(fd, SHUT_RDWR);
+    }
+  }
   return true;
 }
 
-ServerConnection* TcpIpServerPort::Accept() {
-  if (socket_ == -1) {
+ServerConnection* TcpIpServerPort::Accept(int thread) {
+  if (thread < 0 || thread >= static_cast<int>(sockets_.size())) {
     return nullptr;
   }
 
-  int new_sock = accept(socket_, 0, 0);
+  const std::vector<int>& sockets = sockets_[thread];
+  std::vector<struct pollfd> fds(sockets.size());
+  for (size_t i = 0; i < sockets.size(); i++) {
+    fds[i].fd = sockets[i];
+    fds[i].events = POLLIN;
+  }
 
-  if (new_sock == -1) {
-    PLOG(ERROR) << "accept() failed";
-    return nullptr;
+  int new_sock = -1;
+  while (new_sock == -1) {
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      PLOG(ERROR) << "poll() failed";
+      return nullptr;
+    }
+    for (const struct pollfd& fd : fds) {
+      if (fd.revents == 0)
+        continue;
+      new_sock = accept4(fd.fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (new_sock != -1)
+        break;
+      // The connection may have been reset since poll().
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED ||
+          errno == EINTR)
+        continue;
+      PLOG(ERROR) << "accept4() failed";
+      return nullptr;
+    }
   }
 
   Vio *new_vio = nullptr;
@@ -214,10 +291,12 @@ ServerConnection* TcpIpServerPort::Accept() {
 }
 
 bool TcpIpServerPort::Close() {
-  if (socket_ != -1) {
-    close(socket_);
-    socket_ = -1;
+  for (const std::vector<int>& sockets : sockets_) {
+    for (int fd : sockets) {
+      close(fd);
+    }
   }
+  sockets_.clear();
   return true;
 }
 
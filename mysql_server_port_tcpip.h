@@ -18,23 +18,31 @@
 #define MYSQL_RIPPLE_MYSQL_SERVER_PORT_TCPIP_H
 
 #include <string>
+#include <vector>
 
+#include "flags.h"
 #include "mysql_server_port.h"
 
 namespace mysql_ripple {
 
 namespace mysql {
 
+// Listens on all ports. With several accept threads, each thread gets its
+// own socket per port, bound with SO_REUSEPORT so that the kernel spreads
+// incoming connections over the threads.
 class TcpIpServerPort : public ServerPort {
  public:
   TcpIpServerPort(const std::string& address,
-                  const std::vector<int>& ports);
+                  const std::vector<int>& ports,
+                  int accept_threads, int backlog);
   virtual ~TcpIpServerPort();
 
   bool Bind() override;
   bool Listen() override;
+  int GetAcceptThreads() const override { return accept_threads_; }
   // return unauthenticated RawConnection
-  ServerConnection* Accept() override;
+  using ServerPort::Accept;
+  ServerConnection* Accept(int thread) override;
 
   // Shutdown (wakes up thread calling Accept())
   bool Shutdown() override;
@@ -44,8 +52,13 @@ class TcpIpServerPort : public ServerPort {
 
  private:
   std::string address_;
-  int port_;
-  int socket_;
+  std::vector<int> ports_;
+  int accept_threads_;
+  int backlog_;
+  std::vector<std::vector<int>> sockets_;  // [thread][port]
+
+  // Bind a new socket to port on address_, returns -1 on failure.
+  int BindSocket(int port, bool reuse_port);
 };
 
 class TcpIpServerPortFactory : public ServerPortFactory {
@@ -54,7 +67,9 @@ class TcpIpServerPortFactory : public ServerPortFactory {
 
   ServerPort *NewInstance(const std::string& address,
                           const std::vector<int>& ports) override {
-    return new TcpIpServerPort(address, ports);
+    return new TcpIpServerPort(address, ports,
+                               FLAGS_ripple_server_accept_threads,
+                               FLAGS_ripple_server_backlog);
   }
 
   bool Match(const std::string& type) override {
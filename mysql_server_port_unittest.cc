@@ -14,8 +14,15 @@
 
 #include "mysql_server_port.h"
 
+#include <unistd.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
 #include "gtest/gtest.h"
 #include "executor.h"
+#include "flags.h"
 #include "init.h"
 #include "plugin.h"
 
@@ -25,12 +32,13 @@ const char *kPortType = "tcp";
 
 class Acceptor : public RunnableInterface {
  public:
-  explicit Acceptor(mysql::ServerPort& port) : port_(port) {}
+  explicit Acceptor(mysql::ServerPort& port, int thread = 0)
+      : port_(port), thread_(thread) {}
   virtual ~Acceptor() {}
 
   void Run() {
     printf("before Accept()\n");
-    port_.Accept();
+    port_.Accept(thread_);
     printf("after Accept()\n");
   }
 
@@ -46,6 +54,7 @@ class Acceptor : public RunnableInterface {
 
  private:
   mysql::ServerPort& port_;
+  int thread_;
 };
 
 TEST(ServerPort, ShutdownAccept) {
@@ -79,6 +88,58 @@ TEST(ServerPort, AcceptShutdown) {
   EXPECT_TRUE(port->Close());
 }
 
+TEST(ServerPort, AcceptThreads) {
+  FLAGS_ripple_server_accept_threads = 2;
+  ThreadPoolExecutor pool;
+  std::unique_ptr<mysql::ServerPort> port(
+      mysql::ServerPortFactory::GetInstance(kPortType, "localhost", "0,0"));
+  FLAGS_ripple_server_accept_threads = 1;
+  EXPECT_EQ(port->GetAcceptThreads(), 2);
+  EXPECT_TRUE(port->Bind());
+  EXPECT_TRUE(port->Listen());
+  EXPECT_TRUE(pool.Execute(new Acceptor(*port, 0)));
+  EXPECT_TRUE(pool.Execute(new Acceptor(*port, 1)));
+  sleep(1);
+  // Wakes up both threads.
+  EXPECT_TRUE(port->Shutdown());
+  pool.WaitStopped();
+  EXPECT_TRUE(port->Close());
+}
+
+TEST(ServerPort, UnixSocket) {
+  std::string path = ::testing::TempDir() + "ripple.sock";
+  ThreadPoolExecutor pool;
+  std::unique_ptr<mysql::ServerPort> port(
+      mysql::ServerPortFactory::GetInstance("unix", path, ""));
+  ASSERT_NE(port, nullptr);
+  EXPECT_TRUE(port->Bind());
+  // A socket left behind is replaced.
+  std::unique_ptr<mysql::ServerPort> port2(
+      mysql::ServerPortFactory::GetInstance("unix", path, ""));
+  EXPECT_TRUE(port2->Bind());
+  EXPECT_TRUE(port2->Listen());
+  // Closing the replaced port keeps the new socket.
+  EXPECT_TRUE(port->Close());
+  EXPECT_EQ(access(path.c_str(), F_OK), 0);
+  // One in use is not.
+  std::unique_ptr<mysql::ServerPort> port3(
+      mysql::ServerPortFactory::GetInstance("unix", path, ""));
+  EXPECT_FALSE(port3->Bind());
+  EXPECT_TRUE(pool.Execute(new Acceptor(*port2)));
+  sleep(1);
+  EXPECT_TRUE(port2->Shutdown());
+  pool.WaitStopped();
+  EXPECT_TRUE(port2->Close());
+  EXPECT_NE(access(path.c_str(), F_OK), 0);
+
+  // Other files are not.
+  FILE *f = fopen(path.c_str(), "w");
+  ASSERT_NE(f, nullptr);
+  fclose(f);
+  EXPECT_FALSE(port->Bind());
+  unlink(path.c_str());
+}
+
 }  // namespace mysql_ripple
 
 namespace mysql_ripple {
@@ -86,6 +147,7 @@ namespace mysql_ripple {
 namespace plugin {
 
 extern Plugin plugin_mysql_server_port_tcpip;
+extern Plugin plugin_mysql_server_port_unix;
 
 }  // namespace plugin
 
@@ -97,6 +159,7 @@ int main(int argc, char **argv) {
 
   mysql_ripple::Init(argc, argv);
   mysql_ripple::plugin::plugin_mysql_server_port_tcpip.Init();
+  mysql_ripple::plugin::plugin_mysql_server_port_unix.Init();
 
   return RUN_ALL_TESTS();
 }
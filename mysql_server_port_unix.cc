@@ -0,0 +1,194 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mysql_server_port_unix.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "flags.h"
+#include "logging.h"
+#include "plugin.h"
+
+#include "private/violite.h"
+
+namespace mysql_ripple {
+
+namespace plugin {
+
+DECLARE_PLUGIN(mysql_server_port_unix) {
+  return mysql::UnixServerPortFactory::Register();
+}
+
+}  // namespace plugin
+
+namespace mysql {
+
+UnixServerPort::UnixServerPort(const std::string& path)
+    : path_(path), socket_(-1), dev_(0), ino_(0) {
+}
+
+UnixServerPort::~UnixServerPort() {
+  Close();
+}
+
+bool UnixServerPort::Bind() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path_.empty() || path_.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR) << "Invalid unix socket path '" << path_ << "'";
+    return false;
+  }
+  memcpy(addr.sun_path, path_.c_str(), path_.size());
+
+  // Remove a socket left behind by a previous run, but nothing else. A
+  // socket that accepts connections is in use by a running server.
+  struct stat st;
+  if (lstat(path_.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      LOG(ERROR) << "Unable to create server port, '" << path_ << "'"
+                 << " exists and is not a socket";
+      return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+      PLOG(ERROR) << "Failed to create unix socket";
+      return false;
+    }
+    int res = connect(probe, reinterpret_cast<struct sockaddr*>(&addr),
+                      sizeof(addr));
+    int err = errno;
+    close(probe);
+    if (res == 0) {
+      LOG(ERROR) << "Unable to create server port, '" << path_ << "'"
+                 << " is in use by another server";
+      return false;
+    }
+    if (err != ECONNREFUSED) {
+      errno = err;
+      PLOG(ERROR) << "Unable to create server port, failed to check if '"
+                  << path_ << "' is in use";
+      return false;
+    }
+    unlink(path_.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    PLOG(ERROR) << "Failed to create unix socket";
+    return false;
+  }
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    PLOG(ERROR) << "Unable to create server port for '" << path_ << "'";
+    close(fd);
+    return false;
+  }
+
+  if (lstat(path_.c_str(), &st) != 0) {
+    PLOG(ERROR) << "Failed to stat '" << path_ << "'";
+    close(fd);
+    unlink(path_.c_str());
+    return false;
+  }
+  dev_ = st.st_dev;
+  ino_ = st.st_ino;
+
+  LOG(INFO) << "Listen on unix socket: " << path_;
+  socket_ = fd;
+  return true;
+}
+
+bool UnixServerPort::Listen() {
+  if (socket_ == -1)
+    return false;
+
+  if (listen(socket_, FLAGS_ripple_server_backlog) != 0) {
+    PLOG(ERROR) << "listen() failed";
+    return false;
+  }
+
+  return true;
+}
+
+bool UnixServerPort::Shutdown() {
+  if (socket_ == -1)
+    return false;
+  shutdown(socket_, SHUT_RDWR);
+  return true;
+}
+
+ServerConnection* UnixServerPort::Accept(int thread) {
+  if (socket_ == -1 || thread != 0) {
+    return nullptr;
+  }
+
+  int new_sock = accept4(socket_, nullptr, nullptr, SOCK_CLOEXEC);
+
+  if (new_sock == -1) {
+    PLOG(ERROR) << "accept4() failed";
+    return nullptr;
+  }
+
+  Vio *new_vio = nullptr;
+  ServerConnection *new_connection = nullptr;
+  do {
+    int flags = 0;
+    MYSQL_SOCKET mysql_socket = { new_sock };
+    new_vio = mysql_socket_vio_new(mysql_socket, VIO_TYPE_SOCKET, flags);
+    if (new_vio == nullptr)
+      break;
+
+    new_connection = ServerConnection::Accept(new_vio);
+    if (new_connection == nullptr)
+      break;
+
+    return new_connection;
+  } while (0);
+
+  if (new_connection != nullptr)
+    delete new_connection;
+
+  if (new_vio != nullptr)
+    vio_delete(new_vio);
+
+  if (new_sock != -1)
+    close(new_sock);
+
+  return nullptr;
+}
+
+bool UnixServerPort::Close() {
+  if (socket_ != -1) {
+    close(socket_);
+    // The socket may have been replaced by another server, see Bind().
+    struct stat st;
+    if (lstat(path_.c_str(), &st) == 0 && st.st_dev == dev_ &&
+        st.st_ino == ino_) {
+      unlink(path_.c_str());
+    }
+    socket_ = -1;
+  }
+  return true;
+}
+
+}  // namespace mysql
+
+}  // namespace mysql_ripple
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2018 The Ripple Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MYSQL_RIPPLE_MYSQL_SERVER_PORT_UNIX_H
+#define MYSQL_RIPPLE_MYSQL_SERVER_PORT_UNIX_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "mysql_server_port.h"
+
+namespace mysql_ripple {
+
+namespace mysql {
+
+// Listens on a unix domain socket at path, for clients on the same host.
+class UnixServerPort : public ServerPort {
+ public:
+  explicit UnixServerPort(const std::string& path);
+  virtual ~UnixServerPort();
+
+  bool Bind() override;
+  bool Listen() override;
+  // return unauthenticated RawConnection
+  using ServerPort::Accept;
+  ServerConnection* Accept(int thread) override;
+
+  // Shutdown (wakes up thread calling Accept())
+  bool Shutdown() override;
+
+  // Close server port, and remove the socket file unless it has been
+  // replaced by another server.
+  bool Close() override;
+
+ private:
+  std::string path_;
+  int socket_;
+
+  // Identity of the socket file created by Bind().
+  dev_t dev_;
+  ino_t ino_;
+};
+
+class UnixServerPortFactory : public ServerPortFactory {
+ public:
+  virtual ~UnixServerPortFactory() {}
+
+  // address is the path of the socket, ports are not used.
+  ServerPort *NewInstance(const std::string& address,
+                          const std::vector<int>& ports) override {
+    return new UnixServerPort(address);
+  }
+
+  bool Match(const std::string& type) override {
+    return type.compare("unix") == 0;
+  }
+
+  static bool Register() {
+    return ServerPortFactory::Register(new UnixServerPortFactory());
+  }
+
+ private:
+  UnixServerPortFactory() {}
+};
+
+}  // namespace mysql
+
+}  // namespace mysql_ripple
+
+#endif  // MYSQL_RIPPLE_MYSQL_SERVER_PORT_UNIX_H
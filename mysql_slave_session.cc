@@ -726,6 +726,13 @@ bool SlaveSession::HandleBinlogDumpGtid(Connection::Packet p) {
 }
 
 bool SlaveSession::SendEvents() {
+  // Large events are read and sent in parts, which the compressed protocol
+  // can not frame.
+  if (!connection_->GetCompressed()) {
+    binlog_reader_.SetMaxEventPartSize(FLAGS_ripple_large_event_size,
+                                       [this]() { return ShouldStop(); });
+  }
+
   BinlogPosition binlog_position = binlog_reader_.GetBinlogPosition();
   FilePosition pos = binlog_position.latest_event_end_position;
 
@@ -802,12 +809,30 @@ bool SlaveSession::SendEvents() {
           protocol_->GetEventChecksums();
     }
 
-    if (!protocol_->SendEvent(event)) {
+    if (binlog_reader_.GetRemainingEventBytes() > 0) {
+      if (!protocol_->SendEventStart(event)) {
+        return false;
+      }
+      while (binlog_reader_.GetRemainingEventBytes() > 0) {
+        absl::string_view part;
+        if (binlog_reader_.ReadEventPart(&part) != file_util::READ_OK) {
+          LOG(ERROR) << "Failed to read event part";
+          return false;
+        }
+        if (!protocol_->SendEventPart(part)) {
+          return false;
+        }
+      }
+    } else if (!protocol_->SendEvent(event)) {
       return false;
     }
 
     monitoring::slave_current_event_timestamp->Set(event.header.timestamp,
         GetServerName());
+    if (constants::IsGtidEvent(event.header.type)) {
+      monitoring::latency_published_to_sent->RecordSince(
+          binlog_reader_.GetEndPositionTime(), GetServerName());
+    }
   } while (true);
 
   return true;
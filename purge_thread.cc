@@ -14,8 +14,15 @@
 
 #include "purge_thread.h"
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <limits>
+
 #include "flags.h"
 #include "logging.h"
+#include "monitoring.h"
 
 namespace mysql_ripple {
 
@@ -46,6 +53,10 @@ void* PurgeThread::Run() {
                                  &oldest_file);
     }
 
+    // Purging appends records to the binlog index, compact it
+    // once in a while.
+    binlog_->CompactIndex();
+
     // Wait 3 minutes before checking again
     WaitState(Session::STOPPING, kCheckTime);
   }
@@ -53,4 +64,98 @@ void* PurgeThread::Run() {
   return nullptr;
 }
 
+// Lowest cpu priority and idle io class (see ioprio_set(2)) for the
+// calling thread.
+static void LowerPriority() {
+  pid_t tid = syscall(SYS_gettid);
+  if (setpriority(PRIO_PROCESS, tid, 19) != 0 ||
+      syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid,
+              3 << 13 /* IOPRIO_CLASS_IDLE */) != 0) {
+    LOG(WARNING) << "Failed to lower priority of thread";
+  }
+}
+
+// Truncate files in trash every 100ms.
+static const absl::Duration kTrashTick = absl::Milliseconds(100);
+
+// And check for new files in trash every second.
+static const absl::Duration kTrashIdleTime = absl::Seconds(1);
+
+TrashThread::TrashThread(Binlog *binlog)
+    : ThreadedSession(Session::TrashThread),
+      binlog_(binlog) {
+}
+
+TrashThread::~TrashThread() {
+}
+
+void* TrashThread::Run() {
+  LowerPriority();
+
+  while (!ShouldStop()) {
+    uint64_t rate = FLAGS_ripple_purge_trash_rate;
+    size_t max_bytes = std::numeric_limits<size_t>::max();
+    if (rate > 0) {
+      max_bytes = std::max<size_t>(
+          1, rate * absl::FDivDuration(kTrashTick, absl::Seconds(1)));
+    }
+
+    absl::Time start = absl::Now();
+    size_t freed;
+    bool more = binlog_->ShrinkTrash(max_bytes, &freed);
+    absl::Duration elapsed = absl::Now() - start;
+    // Bytes freed per tick, or per time taken if freeing was slower.
+    monitoring::binlog_trash_free_rate->Set(
+        freed / absl::ToDoubleSeconds(std::max(elapsed, kTrashTick)));
+
+    WaitState(Session::STOPPING,
+              more ? std::max(kTrashTick - elapsed, absl::ZeroDuration())
+                   : kTrashIdleTime);
+  }
+
+  return nullptr;
+}
+
+// Copy at most this much per tick when archiving without rate limit.
+static const size_t kMaxArchiveBytesPerTick = 64 * 1024 * 1024;
+
+ArchiveThread::ArchiveThread(file::TieredFactory *factory)
+    : ThreadedSession(Session::ArchiveThread),
+      factory_(factory) {
+}
+
+ArchiveThread::~ArchiveThread() {
+}
+
+void* ArchiveThread::Run() {
+  LowerPriority();
+
+  // Same pacing as the trash thread, copy once per tick and check for
+  // new files every idle period.
+  while (!ShouldStop()) {
+    // Without rate limit, still return once per tick to check for stop.
+    uint64_t rate = FLAGS_ripple_archive_rate;
+    size_t max_bytes = kMaxArchiveBytesPerTick;
+    if (rate > 0) {
+      max_bytes = std::max<size_t>(
+          1, rate * absl::FDivDuration(kTrashTick, absl::Seconds(1)));
+    }
+
+    absl::Time start = absl::Now();
+    size_t copied;
+    bool more = factory_->Migrate(max_bytes, &copied);
+    absl::Duration elapsed = absl::Now() - start;
+    monitoring::binlog_archive_bytes->Set(factory_->GetPendingBytes());
+    // Bytes copied per tick, or per time taken if copying was slower.
+    monitoring::binlog_archive_rate->Set(
+        copied / absl::ToDoubleSeconds(std::max(elapsed, kTrashTick)));
+
+    WaitState(Session::STOPPING,
+              more ? std::max(kTrashTick - elapsed, absl::ZeroDuration())
+                   : kTrashIdleTime);
+  }
+
+  return nullptr;
+}
+
 }  // namespace mysql_ripple
@@ -18,6 +18,7 @@
 #define MYSQL_RIPPLE_PURGE_THREAD_H
 
 #include "binlog.h"
+#include "file_tiered.h"
 #include "session.h"
 
 namespace mysql_ripple {
@@ -34,6 +35,36 @@ class PurgeThread : public ThreadedSession {
   Binlog *binlog_;
 };
 
+// This thread frees purged binlog files that has been moved to trash,
+// at the rate set by --ripple_purge_trash_rate.
+// It runs with low cpu and io priority.
+class TrashThread : public ThreadedSession {
+ public:
+  explicit TrashThread(Binlog *binlog);
+  virtual ~TrashThread();
+
+ protected:
+  void *Run() override;
+
+ private:
+  Binlog *binlog_;
+};
+
+// This thread moves archived binlog files to --ripple_archive_dir,
+// at the rate set by --ripple_archive_rate.
+// It runs with low cpu and io priority.
+class ArchiveThread : public ThreadedSession {
+ public:
+  explicit ArchiveThread(file::TieredFactory *factory);
+  virtual ~ArchiveThread();
+
+ protected:
+  void *Run() override;
+
+ private:
+  file::TieredFactory *factory_;
+};
+
 }  // namespace mysql_ripple
 
 #endif  // MYSQL_RIPPLE_MYSQL_PURGE_THREAD_H
@@ -12,9 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <atomic>
+#include <cerrno>
 #include <csignal>
 
 #include "absl/time/time.h"
@@ -91,6 +93,27 @@ bool Rippled::Setup() {
     }
   }
 
+  if (!FLAGS_ripple_archive_dir.empty()) {
+    if (mkdir(FLAGS_ripple_archive_dir.c_str(), 0755) != 0 &&
+        errno != EEXIST) {
+      LOG(ERROR) << "Failed to create archive dir "
+                 << FLAGS_ripple_archive_dir;
+      return false;
+    }
+    const file::Factory *cold = &DEFAULT_FILE_FACTORY();
+    if (FLAGS_ripple_archive_compress) {
+      compressed_factory_.reset(new file::CompressedFactory(
+          DEFAULT_FILE_FACTORY(), FLAGS_ripple_archive_cache_size));
+      cold = compressed_factory_.get();
+    }
+    tiered_factory_.reset(new file::TieredFactory(
+        DEFAULT_FILE_FACTORY(), FLAGS_ripple_datadir,
+        *cold, FLAGS_ripple_archive_dir));
+    if (!tiered_factory_->RemoveStaleCopies()) {
+      return false;
+    }
+  }
+
   binlog_.reset(new Binlog(FLAGS_ripple_datadir.c_str(),
                            FLAGS_ripple_max_binlog_size, GetFileFactory()));
   GTIDList start_pos;
@@ -148,13 +171,69 @@ bool Rippled::Setup() {
     return false;
   }
 
-  pool_.reset(new ThreadPoolExecutor());
+  if (!FLAGS_ripple_server_socket.empty()) {
+    socket_port_.reset(mysql::ServerPortFactory::GetInstance(
+        "unix", FLAGS_ripple_server_socket, ""));
+    if (socket_port_ == nullptr || !socket_port_->Bind() ||
+        !socket_port_->Listen()) {
+      return false;
+    }
+  }
+
+  ThreadPoolExecutor::Options pool_options;
+  pool_options.min_threads = FLAGS_ripple_slave_threads;
+  pool_options.max_threads = FLAGS_ripple_slave_max_threads;
+  pool_options.stack_size = FLAGS_ripple_slave_thread_stack_size;
+  if (!ThreadPoolExecutor::ParseCpuList(FLAGS_ripple_slave_thread_cpus,
+                                        &pool_options.cpus)) {
+    LOG(ERROR) << "Invalid cpu list in ripple_slave_thread_cpus: "
+               << FLAGS_ripple_slave_thread_cpus;
+    return false;
+  }
+  pool_.reset(new ThreadPoolExecutor(pool_options));
   slave_factory_.reset(new mysql::SlaveSessionFactory(this,
                                                       binlog_.get(),
                                                       pool_.get()));
-  listener_.reset(new Listener(slave_factory_.get(), port_));
+  for (int thread = 0; thread < port_->GetAcceptThreads(); thread++) {
+    listeners_.emplace_back(
+        new Listener(slave_factory_.get(), port_, thread));
+  }
+  if (socket_port_ != nullptr) {
+    for (int thread = 0; thread < socket_port_->GetAcceptThreads();
+         thread++) {
+      listeners_.emplace_back(
+          new Listener(slave_factory_.get(), socket_port_.get(), thread));
+    }
+  }
   master_session_.reset(new mysql::MasterSession(binlog_.get(), this));
+  std::vector<std::pair<std::string, int>> standby_addresses;
+  if (!mysql::StandbyConnections::ParseAddresses(
+          FLAGS_ripple_master_standby_addresses, FLAGS_ripple_master_port,
+          &standby_addresses)) {
+    LOG(ERROR) << "Invalid port in ripple_master_standby_addresses: "
+               << FLAGS_ripple_master_standby_addresses;
+    return false;
+  }
+  master_session_->SetStandbyAddresses(standby_addresses);
+  if (!FLAGS_ripple_hedge_master_address.empty()) {
+    hedged_ingest_.reset(new HedgedIngest(binlog_.get(), {"master", "hedge"}));
+    master_session_->SetHedgedIngest(hedged_ingest_.get(), 0);
+    hedge_session_.reset(new mysql::MasterSession(binlog_.get(), this));
+    hedge_session_->SetHost(FLAGS_ripple_hedge_master_address);
+    hedge_session_->SetPort(FLAGS_ripple_hedge_master_port);
+    hedge_session_->SetHedgedIngest(hedged_ingest_.get(), 1);
+  }
   purge_thread_.reset(new PurgeThread(binlog_.get()));
+  trash_thread_.reset(new TrashThread(binlog_.get()));
+  if (tiered_factory_ != nullptr)
+    archive_thread_.reset(new ArchiveThread(tiered_factory_.get()));
+  if (FLAGS_ripple_monitoring_port > 0) {
+    monitoring_server_.reset(
+        new MonitoringServer(FLAGS_ripple_monitoring_port));
+    if (!monitoring_server_->Listen()) {
+      return false;
+    }
+  }
 
   return true;
 }
@@ -167,23 +246,39 @@ void Rippled::Teardown() {
     binlog_->Stop();
   if (master_session_ != nullptr)
     master_session_->Stop();
-  if (listener_ != nullptr)
-    listener_->Stop();
+  if (hedge_session_ != nullptr)
+    hedge_session_->Stop();
+  for (auto &listener : listeners_)
+    listener->Stop();
   if (purge_thread_ != nullptr)
     purge_thread_->Stop();
+  if (trash_thread_ != nullptr)
+    trash_thread_->Stop();
+  if (archive_thread_ != nullptr)
+    archive_thread_->Stop();
+  if (monitoring_server_ != nullptr)
+    monitoring_server_->Stop();
   // Manager session does not need to be stopped because its run method will
   // return when the RPC server it borrows from the listener dies.
 
   // Then wait for them to stop.
   if (master_session_ != nullptr)
     master_session_->WaitState(Session::STOPPED, absl::Seconds(3));
+  if (hedge_session_ != nullptr)
+    hedge_session_->WaitState(Session::STOPPED, absl::Seconds(3));
   LOG(INFO) << "Stopped master session!";
-  if (listener_ != nullptr)
-    listener_->WaitState(Session::STOPPED, absl::Seconds(3));
-  LOG(INFO) << "Stopped listener!";
+  for (auto &listener : listeners_)
+    listener->WaitState(Session::STOPPED, absl::Seconds(3));
+  LOG(INFO) << "Stopped listeners!";
 
   if (purge_thread_ != nullptr)
     purge_thread_->WaitState(Session::STOPPED, absl::Seconds(3));
+  if (trash_thread_ != nullptr)
+    trash_thread_->WaitState(Session::STOPPED, absl::Seconds(3));
+  if (archive_thread_ != nullptr)
+    archive_thread_->WaitState(Session::STOPPED, absl::Seconds(3));
+  if (monitoring_server_ != nullptr)
+    monitoring_server_->WaitState(Session::STOPPED, absl::Seconds(3));
 
   if (manager_session_ != nullptr) {
     LOG(INFO) << "Manager session still exists...";
@@ -198,14 +293,24 @@ void Rippled::Teardown() {
 
   if (port_ != nullptr)
     port_->Close();
+  if (socket_port_ != nullptr)
+    socket_port_->Close();
 
   purge_thread_.reset(nullptr);
+  trash_thread_.reset(nullptr);
+  archive_thread_.reset(nullptr);
+  monitoring_server_.reset(nullptr);
   manager_session_.reset(nullptr);
+  hedge_session_.reset(nullptr);
   master_session_.reset(nullptr);
-  listener_.reset(nullptr);
+  hedged_ingest_.reset(nullptr);
+  listeners_.clear();
+  socket_port_.reset(nullptr);
   slave_factory_.reset(nullptr);
   pool_.reset(nullptr);
   binlog_.reset(nullptr);
+  tiered_factory_.reset(nullptr);
+  compressed_factory_.reset(nullptr);
   mysql::DeinitClientLibrary();
 }
 
@@ -215,15 +320,23 @@ bool Rippled::Start() {
     manager_session_->WaitStarted();
   }
 
-  listener_->Start();
-  listener_->WaitStarted();
+  for (auto &listener : listeners_) {
+    listener->Start();
+    listener->WaitStarted();
+  }
 
   if (!FLAGS_ripple_master_address.empty()) {
     // Only start master session if we have address to connect to.
     master_session_->Start();
     master_session_->WaitStarted();
+    StartHedgeSession();
   }
   purge_thread_->Start();
+  trash_thread_->Start();
+  if (archive_thread_ != nullptr)
+    archive_thread_->Start();
+  if (monitoring_server_ != nullptr)
+    monitoring_server_->Start();
 
   return true;
 }
@@ -250,10 +363,13 @@ BinlogPosition Rippled::GetBinlogPosition() const {
 
 bool Rippled::StartMasterSession(std::string *msg, bool idempotent) {
   if (idempotent) {
-    if (master_session_->session_state() == Session::STARTED)
+    if (master_session_->session_state() == Session::STARTED) {
+      StartHedgeSession();
       return true;
+    }
     if (master_session_->session_state() == Session::STARTING) {
       master_session_->WaitStarted();
+      StartHedgeSession();
       return true;
     }
   }
@@ -264,19 +380,25 @@ bool Rippled::StartMasterSession(std::string *msg, bool idempotent) {
   }
 
   master_session_->WaitStarted();
+  StartHedgeSession();
   return true;
 }
 
 bool Rippled::StopMasterSession(std::string *msg, bool idempotent) {
   if (idempotent) {
-    if (master_session_->session_state() == Session::INITIAL)
+    if (master_session_->session_state() == Session::INITIAL) {
+      StopHedgeSession();
       return true;
+    }
     if (master_session_->session_state() == Session::STOPPING ||
-        master_session_->session_state() == Session::STOPPED)
+        master_session_->session_state() == Session::STOPPED) {
+      StopHedgeSession();
       return master_session_->WaitState(
           Session::INITIAL, absl::InfiniteDuration()) == Session::INITIAL;
+    }
   }
 
+  StopHedgeSession();
   if (!master_session_->Stop()) {
     msg->assign("Incorrect state!");
     return false;
@@ -290,6 +412,23 @@ bool Rippled::StopMasterSession(std::string *msg, bool idempotent) {
   return false;
 }
 
+void Rippled::StartHedgeSession() {
+  if (hedge_session_ == nullptr)
+    return;
+  // Join a hedge session left stopping by an earlier stop.
+  Session::SessionState state = hedge_session_->session_state();
+  if (state == Session::STOPPING || state == Session::STOPPED)
+    hedge_session_->Join();
+  hedge_session_->Start();
+  hedge_session_->WaitStarted();
+}
+
+void Rippled::StopHedgeSession() {
+  // Join() of a session that is not running does nothing.
+  if (hedge_session_ != nullptr)
+    hedge_session_->Join();
+}
+
 bool Rippled::FlushLogs(std::string *new_file) {
   return binlog_->SwitchFile(new_file);
 }
@@ -319,6 +458,8 @@ std::string Rippled::GetServerName() const {
 }
 
 const file::Factory &Rippled::GetFileFactory() const {
+  if (tiered_factory_ != nullptr)
+    return *tiered_factory_;
   return DEFAULT_FILE_FACTORY();
 }
 
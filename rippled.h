@@ -18,17 +18,22 @@
 #define MYSQL_RIPPLE_RIPPLED_H
 
 #include <unordered_set>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
 #include "absl/synchronization/mutex.h"
 #include "binlog.h"
 #include "file.h"
+#include "file_compressed.h"
+#include "file_tiered.h"
+#include "hedged_ingest.h"
 #include "listener.h"
 #include "management_session.h"
 #include "manager.h"
 #include "mysql_master_session.h"
 #include "mysql_server_port.h"
 #include "mysql_slave_session.h"
+#include "monitoring_server.h"
 #include "purge_thread.h"
 #include "session_factory.h"
 
@@ -84,14 +89,27 @@ class Rippled : mysql::SlaveSession::RippledInterface,
 
  private:
   friend class Manager;
+  // Set if binlog files are archived to --ripple_archive_dir, and
+  // compressed there if --ripple_archive_compress.
+  std::unique_ptr<file::CompressedFactory> compressed_factory_;
+  std::unique_ptr<file::TieredFactory> tiered_factory_;
   std::unique_ptr<Binlog> binlog_;
   mysql::ServerPort* port_;
+  // Set if --ripple_server_socket.
+  std::unique_ptr<mysql::ServerPort> socket_port_;
   std::unique_ptr<ThreadPoolExecutor> pool_;
   std::unique_ptr<mysql::SlaveSessionFactory> slave_factory_;
-  std::unique_ptr<Listener> listener_;
+  std::vector<std::unique_ptr<Listener>> listeners_;
   std::unique_ptr<ManagementSession> manager_session_;
   std::unique_ptr<mysql::MasterSession> master_session_;
+  // Set if --ripple_hedge_master_address. Then both master sessions write
+  // to the binlog through hedged_ingest_.
+  std::unique_ptr<HedgedIngest> hedged_ingest_;
+  std::unique_ptr<mysql::MasterSession> hedge_session_;
   std::unique_ptr<PurgeThread> purge_thread_;
+  std::unique_ptr<TrashThread> trash_thread_;
+  std::unique_ptr<ArchiveThread> archive_thread_;
+  std::unique_ptr<MonitoringServer> monitoring_server_;
 
   absl::Mutex server_id_mutex_;
   absl::flat_hash_set<uint32_t> allocated_server_ids_;
@@ -100,6 +118,11 @@ class Rippled : mysql::SlaveSession::RippledInterface,
   absl::Mutex shutdown_mutex_;
   bool shutdown_requested_ ABSL_GUARDED_BY(shutdown_mutex_) = false;
   Uuid uuid_;
+
+  // The hedge session is started and stopped with the master session,
+  // these bring it to the state of the master session.
+  void StartHedgeSession();
+  void StopHedgeSession();
 };
 
 }  // namespace mysql_ripple
@@ -0,0 +1,294 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// End-to-end benchmark of rippled.
+//
+// Starts a FakeMaster streaming a synthetic workload, a rippled
+// replicating from it and a number of FakeReplicas replicating from
+// rippled, and reports throughput and per stage latency.
+//
+// Example:
+//   rippled_benchmark --rippled=./rippled --replicas=4 --transactions=100000
+//
+// If --rippled is empty, an already running rippled is used, it shall be
+// configured to replicate from --master_port and serve on --rippled_port.
+//
+// With --replay_binlogs the master replays existing binlog files instead
+// of the synthetic workload, as fast as possible or with --replay_speed
+// times the pacing given by the original event timestamps:
+//   rippled_benchmark --rippled=./rippled
+//     --replay_binlogs=binlog.000001,binlog.000002 --replay_speed=10
+
+#include <ftw.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "binlog_file_source.h"
+#include "fake_master.h"
+#include "fake_replica.h"
+#include "file_FILE.h"
+#include "flags.h"
+#include "init.h"
+#include "logging.h"
+#include "monitoring.h"
+#include "mysql_init.h"
+#include "mysql_server_port.h"
+#include "plugin.h"
+
+DEFINE_string(rippled, "",
+              "Path of rippled binary to start, if empty an already running"
+              " rippled is used");
+DEFINE_int32(master_port, 51101, "Port of the fake master");
+DEFINE_int32(rippled_port, 51102, "Port rippled serves replicas on");
+DEFINE_int32(replicas, 1, "Number of fake replicas");
+DEFINE_uint64(transactions, 100000, "Number of transactions to replicate");
+DEFINE_int32(statements, 4,
+             "Statements per transaction, 0 for standalone transactions");
+DEFINE_int32(event_size, 256, "Size of each statement event");
+DEFINE_double(rate, 0,
+              "Transactions per second sent by the master,"
+              " 0 for as fast as possible");
+DEFINE_bool(mariadb, true, "Use MariaDB flavour, otherwise MySQL");
+DEFINE_int32(semi_sync_every, 0,
+             "Request a semi-sync reply every n:th transaction, 0 disables"
+             " semi-sync");
+DEFINE_int32(timeout, 600, "Seconds to wait for replicas to catch up");
+DEFINE_string(replay_binlogs, "",
+              "Comma separated list of binlog files to replay instead of the"
+              " synthetic workload");
+DEFINE_double(replay_speed, 0,
+              "Replay binlogs at this multiple of their original speed,"
+              " 0 for as fast as possible");
+
+namespace mysql_ripple {
+
+namespace bench {
+
+namespace {
+
+// Start rippled as a child process, return its pid or -1.
+pid_t StartRippled(const std::string &datadir, const std::string &version) {
+  std::vector<std::string> args = {
+    FLAGS_rippled,
+    "--ripple_datadir=" + datadir,
+    "--ripple_master_address=127.0.0.1",
+    absl::StrCat("--ripple_master_port=", FLAGS_master_port),
+    "--ripple_master_protocol=tcp",
+    "--ripple_master_compressed_protocol=false",
+    "--ripple_server_address=127.0.0.1",
+    absl::StrCat("--ripple_server_ports=", FLAGS_rippled_port),
+    "--ripple_server_type=tcp",
+    "--ripple_version_protocol=" + version,
+    absl::StrCat("--ripple_semi_sync_slave_enabled=",
+                 FLAGS_semi_sync_every > 0 ? "true" : "false"),
+  };
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<char*> argv;
+    for (auto &arg : args) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  if (pid < 0) {
+    LOG(ERROR) << "Failed to fork rippled: " << strerror(errno);
+  }
+  return pid;
+}
+
+void StopRippled(pid_t pid) {
+  kill(pid, SIGTERM);
+  int status;
+  waitpid(pid, &status, 0);
+}
+
+int RemoveEntry(const char *path, const struct stat *sb, int type,
+                struct FTW *ftw) {
+  return remove(path);
+}
+
+// Remove datadir of rippled started by StartRippled().
+void RemoveDatadir(const std::string &datadir) {
+  nftw(datadir.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void PrintLatency(const char *name,
+                  const monitoring::internal::HistogramCell &hist) {
+  printf("%-28s count: %8" PRIu64 " p50: %8" PRIu64 " us p99: %8" PRIu64
+         " us max: %8" PRIu64 " us\n",
+         name, hist.Count(), hist.Percentile(50), hist.Percentile(99),
+         hist.Max());
+}
+
+int Run() {
+  std::unique_ptr<EventSource> source;
+  BinlogFileSource *replay = nullptr;
+  if (!FLAGS_replay_binlogs.empty()) {
+    std::vector<std::string> files =
+        absl::StrSplit(FLAGS_replay_binlogs, ',', absl::SkipEmpty());
+    replay = new BinlogFileSource(files, file::FILE_Factory());
+    source.reset(replay);
+    if (!replay->Init()) {
+      return 1;
+    }
+  } else {
+    SyntheticWorkload::Options workload_options;
+    workload_options.mariadb = FLAGS_mariadb;
+    workload_options.transactions = FLAGS_transactions;
+    workload_options.statements = FLAGS_statements;
+    workload_options.event_size = FLAGS_event_size;
+    source.reset(new SyntheticWorkload(workload_options));
+  }
+  std::string version = source->GetServerVersion();
+
+  // The fake master announces itself using the protocol version.
+  FLAGS_ripple_version_protocol = version;
+
+  std::unique_ptr<mysql::ServerPort> port(
+      mysql::ServerPortFactory::GetInstance(
+          "tcp", "127.0.0.1", std::to_string(FLAGS_master_port)));
+  if (port == nullptr || !port->Bind() || !port->Listen()) {
+    LOG(ERROR) << "Failed to listen on port " << FLAGS_master_port;
+    return 1;
+  }
+
+  FakeMaster::Options master_options;
+  master_options.rate = FLAGS_rate;
+  master_options.speed = FLAGS_replay_speed;
+  master_options.semi_sync_every = FLAGS_semi_sync_every;
+  FakeMaster master(port.get(), source.get(), master_options);
+  master.Start();
+
+  std::string datadir;
+  pid_t pid = -1;
+  if (!FLAGS_rippled.empty()) {
+    char tmpl[] = "/tmp/rippled_benchmark.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+      LOG(ERROR) << "Failed to create datadir: " << strerror(errno);
+      return 1;
+    }
+    datadir = tmpl;
+    pid = StartRippled(datadir, version);
+    if (pid < 0) {
+      return 1;
+    }
+  }
+
+  std::vector<std::unique_ptr<FakeReplica>> replicas;
+  for (int i = 0; i < FLAGS_replicas; i++) {
+    FakeReplica::Options options;
+    options.port = FLAGS_rippled_port;
+    options.server_id = 1000 + i;
+    // When replaying the number of transactions is not known up front,
+    // wait for all that the master sends.
+    options.transactions = replay != nullptr ? 0 : FLAGS_transactions;
+    replicas.emplace_back(new FakeReplica(&master, options));
+    replicas.back()->Start();
+  }
+
+  int exit_code = 0;
+  for (auto &replica : replicas) {
+    if (!replica->WaitDone(absl::Seconds(FLAGS_timeout))) {
+      LOG(ERROR) << "Timeout waiting for replica, received "
+                 << replica->GetTransactionsReceived() << " of "
+                 << master.GetTransactionsSent() << " transactions";
+      exit_code = 1;
+      break;
+    }
+  }
+
+  for (auto &replica : replicas) {
+    replica->Stop();
+  }
+  master.Stop();
+  if (replay != nullptr && replay->Failed()) {
+    LOG(ERROR) << "Replay stopped at an error reading the binlog files";
+    exit_code = 1;
+  }
+  port->Close();
+  if (pid > 0) {
+    StopRippled(pid);
+    RemoveDatadir(datadir);
+  }
+
+  double master_seconds =
+      (master.GetEndTime() - master.GetStartTime()) / 1e6;
+  int64_t end_time = master.GetEndTime();
+  for (auto &replica : replicas) {
+    end_time = std::max(end_time, replica->GetEndTime());
+  }
+  double total_seconds = (end_time - master.GetStartTime()) / 1e6;
+  uint64_t trx = master.GetTransactionsSent();
+
+  printf("transactions: %" PRIu64 ", replicas: %d, server: %s\n", trx,
+         FLAGS_replicas, version.c_str());
+  if (replay != nullptr) {
+    printf("replayed:     %10" PRIu64 " events %8.2f MB\n",
+           replay->GetEventsRead(), replay->GetBytesRead() / 1e6);
+  }
+  if (master_seconds > 0) {
+    printf("master send:  %10.0f trx/s %8.2f MB/s\n", trx / master_seconds,
+           master.GetBytesSent() / master_seconds / 1e6);
+  }
+  if (total_seconds > 0) {
+    printf("end to end:   %10.0f trx/s\n", trx / total_seconds);
+  }
+  for (size_t i = 0; i < replicas.size(); i++) {
+    PrintLatency(absl::StrCat("replica ", i, " latency").c_str(),
+                 replicas[i]->GetLatency());
+  }
+  if (FLAGS_semi_sync_every > 0) {
+    PrintLatency("semi-sync ack latency", master.GetAckLatency());
+  }
+
+  return exit_code;
+}
+
+}  // namespace
+
+}  // namespace bench
+
+}  // namespace mysql_ripple
+
+int main(int argc, char **argv) {
+  mysql_ripple::Init(argc, argv);
+
+  if (!mysql_ripple::plugin::InitPlugins()) {
+    exit(1);
+  }
+  if (!mysql_ripple::mysql::InitClientLibrary()) {
+    exit(1);
+  }
+  monitoring::Initialize();
+
+  exit(mysql_ripple::bench::Run());
+}
@@ -0,0 +1,423 @@
+// Copyright 2018 The Ripple Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks of the code executed for each replicated event.
+//
+// Each benchmark reports allocs/op, the number of calls to operator new
+// per iteration. To check for regressions, compare against the checked in
+// baseline using compare.py from google benchmark:
+//
+//   bazel run -c opt :rippled_microbenchmark --
+//       --benchmark_out=/tmp/new.json --benchmark_out_format=json
+//   compare.py benchmarks rippled_microbenchmark_baseline.json /tmp/new.json
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "binlog.h"
+#include "binlog_position.h"
+#include "buffer.h"
+#include "byte_order.h"
+#include "encryption.h"
+#include "file_memory.h"
+#include "flags.h"
+#include "gtid.h"
+#include "log_event.h"
+#include "logging.h"
+#include "monitoring.h"
+#include "mysql_constants.h"
+#include "mysql_protocol.h"
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = malloc(size);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+  free(ptr);
+}
+
+namespace mysql_ripple {
+
+namespace {
+
+// Counts allocations done while benchmark is running.
+class AllocationCounter {
+ public:
+  explicit AllocationCounter(benchmark::State *state)
+      : state_(state), start_(allocations.load()) {}
+  ~AllocationCounter() {
+    state_->counters["allocs/op"] = benchmark::Counter(
+        allocations.load() - start_, benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  benchmark::State *state_;
+  uint64_t start_;
+};
+
+// A serialized event and a RawLogEventData pointing to it.
+struct TestEvent {
+  Buffer buffer;
+  RawLogEventData raw;
+
+  TestEvent(const EventBase &event, uint32_t server_id) {
+    LogEventHeader header;
+    header.timestamp = 0;
+    header.type = event.GetEventType();
+    header.server_id = server_id;
+    header.event_length = header.PackLength() + event.PackLength();
+    header.nextpos = 0;
+    header.flags = 0;
+    uint8_t *ptr = buffer.Append(header.event_length);
+    header.SerializeToBuffer(ptr, header.PackLength());
+    event.SerializeToBuffer(ptr + header.PackLength(), event.PackLength());
+    Parse();
+  }
+
+  TestEvent(const TestEvent &other) : buffer(other.buffer) {
+    Parse();
+  }
+
+  void Parse() {
+    CHECK(raw.ParseFromBuffer(buffer.data(), buffer.size()));
+  }
+
+  // Update seq_no of a MariaDB GTIDEvent in place.
+  void SetSeqNo(uint64_t seq_no) {
+    byte_order::store8(buffer.data() + constants::LOG_EVENT_HEADER_LENGTH,
+                       seq_no);
+  }
+};
+
+TestEvent MakeGTIDEvent(uint64_t seq_no) {
+  GTIDEvent ev;
+  ev.gtid.set_server_id(1);
+  ev.gtid.seq_no = seq_no;
+  ev.gtid.domain_id = 0;
+  ev.flags = 0;
+  ev.is_standalone = 0;
+  ev.has_group_commit_id = 0;
+  return TestEvent(ev, 1);
+}
+
+TestEvent MakeQueryEvent(int size) {
+  QueryEvent ev;
+  ev.query = std::string(size, 'x');
+  return TestEvent(ev, 1);
+}
+
+TestEvent MakeXIDEvent(uint64_t xid) {
+  XIDEvent ev;
+  ev.xid = xid;
+  return TestEvent(ev, 1);
+}
+
+// A gtid in stream no i, MariaDB streams are keyed by domain
+// and MySQL streams by uuid.
+GTID StreamGTID(int i, uint64_t seq_no, bool mysql) {
+  GTID gtid;
+  if (mysql) {
+    gtid.server_id.uuid.ConstructFromServerId(i + 1);
+  } else {
+    gtid.server_id.assign(1);
+    gtid.domain_id = i;
+  }
+  gtid.seq_no = seq_no;
+  return gtid;
+}
+
+GTIDList StreamGTIDList(int streams, bool mysql) {
+  GTIDList list = mysql ?
+      GTIDList(GTIDList::KEY_UUID, GTIDList::MODE_GAPS) :
+      GTIDList(GTIDList::KEY_DOMAIN_ID, GTIDList::MODE_MONOTONIC);
+  for (int i = 0; i < streams; i++) {
+    CHECK(list.Update(StreamGTID(i, 1, mysql)));
+  }
+  return list;
+}
+
+void BM_LogEventHeaderParse(benchmark::State &state) {
+  TestEvent event = MakeQueryEvent(100);
+  LogEventHeader header;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        header.ParseFromBuffer(event.buffer.data(), event.buffer.size()));
+  }
+}
+BENCHMARK(BM_LogEventHeaderParse);
+
+void BM_RawLogEventDataParse(benchmark::State &state) {
+  TestEvent event = MakeQueryEvent(state.range(0));
+  RawLogEventData raw;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        raw.ParseFromBuffer(event.buffer.data(), event.buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * event.buffer.size());
+}
+BENCHMARK(BM_RawLogEventDataParse)->Arg(64)->Arg(4096);
+
+// One MariaDB transaction (GTID, Query, XID) per iteration.
+void BM_BinlogPositionUpdate(benchmark::State &state) {
+  BinlogPosition pos;
+  TestEvent gtid = MakeGTIDEvent(1);
+  TestEvent query = MakeQueryEvent(100);
+  TestEvent xid = MakeXIDEvent(1);
+  off_t offset = 4;
+  uint64_t seq_no = 1;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    gtid.SetSeqNo(seq_no++);
+    CHECK_EQ(pos.Update(gtid.raw, offset += gtid.buffer.size()), 0);
+    CHECK_EQ(pos.Update(query.raw, offset += query.buffer.size()), 0);
+    CHECK_EQ(pos.Update(xid.raw, offset += xid.buffer.size()), 1);
+  }
+}
+BENCHMARK(BM_BinlogPositionUpdate);
+
+void BM_GTIDListUpdate(benchmark::State &state) {
+  int streams = state.range(0);
+  bool mysql = state.range(1);
+  GTIDList list = StreamGTIDList(streams, mysql);
+  uint64_t seq_no = 2;
+  int i = 0;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    CHECK(list.Update(StreamGTID(i, seq_no, mysql)));
+    if (++i == streams) {
+      i = 0;
+      seq_no++;
+    }
+  }
+}
+BENCHMARK(BM_GTIDListUpdate)->ArgsProduct({{1, 10, 100, 1000}, {0, 1}});
+
+void BM_GTIDListValidSuccessor(benchmark::State &state) {
+  int streams = state.range(0);
+  bool mysql = state.range(1);
+  GTIDList list = StreamGTIDList(streams, mysql);
+  int i = 0;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(list.ValidSuccessor(StreamGTID(i, 2, mysql)));
+    if (++i == streams)
+      i = 0;
+  }
+}
+BENCHMARK(BM_GTIDListValidSuccessor)
+    ->ArgsProduct({{1, 10, 100, 1000}, {0, 1}});
+
+void BM_GTIDListSubset(benchmark::State &state) {
+  int streams = state.range(0);
+  bool mysql = state.range(1);
+  GTIDList a = StreamGTIDList(streams, mysql);
+  GTIDList b = StreamGTIDList(streams, mysql);
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(GTIDList::Subset(a, b));
+  }
+}
+BENCHMARK(BM_GTIDListSubset)->ArgsProduct({{1, 10, 100, 1000}, {0, 1}});
+
+void BM_AesGcmEncrypt(benchmark::State &state) {
+  AesGcmBinlogEncryptor encryptor(255, KeyHandler::GetInstance(true));
+  CHECK(encryptor.Init());
+  Buffer event;
+  event.Append(state.range(0));
+  Buffer dst;
+  off_t offset = 4;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    dst.clear();
+    CHECK(encryptor.Encrypt(offset, event.data(), event.size(), &dst));
+    offset += dst.size();
+  }
+  state.SetBytesProcessed(state.iterations() * event.size());
+}
+BENCHMARK(BM_AesGcmEncrypt)->RangeMultiplier(16)->Range(64, 1 << 20);
+
+void BM_AesGcmDecrypt(benchmark::State &state) {
+  AesGcmBinlogEncryptor encryptor(255, KeyHandler::GetInstance(true));
+  CHECK(encryptor.Init());
+  Buffer event;
+  event.Append(state.range(0));
+  Buffer encrypted;
+  CHECK(encryptor.Encrypt(4, event.data(), event.size(), &encrypted));
+  Buffer dst;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    dst.clear();
+    CHECK(encryptor.Decrypt(4, encrypted.data(), encrypted.size(), &dst));
+  }
+  state.SetBytesProcessed(state.iterations() * event.size());
+}
+BENCHMARK(BM_AesGcmDecrypt)->RangeMultiplier(16)->Range(64, 1 << 20);
+
+// Discards written data, so that only encryption is measured.
+class NullFile : public file::AppendOnlyFile {
+ public:
+  NullFile() : size_(0) {}
+  bool Close() override { return true; }
+  bool Tell(int64_t *offset) override { *offset = size_; return true; }
+  bool Truncate(int64_t size) override { size_ = size; return true; }
+  bool Write(const absl::string_view data) override {
+    size_ += data.size();
+    return true;
+  }
+  bool Flush() override { return true; }
+  bool Sync() override { return true; }
+
+ private:
+  int64_t size_;
+};
+
+// One event of range(0) bytes written with the block encryption scheme,
+// large events are encrypted in parallel.
+void BM_BlockEncryptorWrite(benchmark::State &state) {
+  BlockBinlogEncryptor encryptor(254, KeyHandler::GetInstance(true));
+  CHECK(encryptor.Init());
+  Buffer event;
+  event.Append(state.range(0));
+  NullFile file;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    CHECK(encryptor.Write(&file, event));
+    CHECK(encryptor.Flush(&file));
+  }
+  state.SetBytesProcessed(state.iterations() * event.size());
+}
+BENCHMARK(BM_BlockEncryptorWrite)->RangeMultiplier(16)->Range(4096, 16 << 20)
+    ->UseRealTime();
+
+// Reading one event as BinlogReader does, range(0) is encryption scheme and
+// range(1) is 1 to use the reader from GetEventReader() and 0 for virtual
+// calls.
+void BM_EncryptorReadEvent(benchmark::State &state) {
+  const int kEvents = 1000;
+  file::MemoryFactory factory;
+  std::unique_ptr<BinlogEncryptor> writer(
+      BinlogEncryptorFactory::GetInstance(state.range(0)));
+  CHECK(writer->Init());
+  file::AppendOnlyFile *ofile;
+  CHECK(factory.Open(&ofile, "binlog", "w"));
+  TestEvent query = MakeQueryEvent(100);
+  for (int i = 0; i < kEvents; i++)
+    CHECK(writer->Write(ofile, query.buffer));
+  CHECK(writer->Flush(ofile));
+  int64_t end_of_file;
+  CHECK(ofile->Tell(&end_of_file));
+  ofile->Close();
+
+  std::unique_ptr<BinlogEncryptor> reader(writer->Copy());
+  BinlogEncryptor::EventReader read_event =
+      state.range(1) ? reader->GetEventReader() : BinlogEncryptor::ReadEvent;
+  file::InputFile *ifile;
+  CHECK(factory.Open(&ifile, "binlog", "r"));
+  Buffer event;
+  int64_t offset = 0;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    if (offset == end_of_file) {
+      CHECK(ifile->Seek(0));
+    }
+    size_t remaining;
+    CHECK_EQ(read_event(reader.get(), ifile, end_of_file, SIZE_MAX, &event,
+                        &remaining, &offset),
+             file_util::READ_OK);
+  }
+  ifile->Close();
+}
+BENCHMARK(BM_EncryptorReadEvent)->ArgsProduct({{0, 255, 254}, {0, 1}});
+
+// Framing done by Protocol::SendEvent, i.e excluding the network write.
+void BM_ProtocolPackEvent(benchmark::State &state) {
+  TestEvent event = MakeQueryEvent(state.range(0));
+  bool checksums = state.range(1);
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    Buffer packet;
+    mysql::Protocol::PackEvent(event.raw, checksums, &packet);
+    benchmark::DoNotOptimize(packet.data());
+  }
+  state.SetBytesProcessed(state.iterations() * event.buffer.size());
+}
+BENCHMARK(BM_ProtocolPackEvent)->ArgsProduct({{64, 4096}, {0, 1}});
+
+// One MariaDB transaction (GTID, Query, XID) per iteration,
+// range(0) is encryption scheme.
+void BM_BinlogAddEvent(benchmark::State &state) {
+  // Keep files in memory so that the benchmark measures cpu rather than
+  // disk.
+  file::MemoryFactory factory;
+  FLAGS_ripple_encryption_scheme = state.range(0);
+
+  Binlog binlog("binlog", int64_t{1} << 40, factory);
+  CHECK(binlog.Create());
+  FormatDescriptorEvent format;
+  format.SetToRipple("10.3.0-MariaDB");
+  format.checksum = 0;
+  TestEvent fd(format, 1);
+  CHECK(binlog.AddEvent(fd.raw, false));
+
+  TestEvent gtid = MakeGTIDEvent(1);
+  TestEvent query = MakeQueryEvent(100);
+  TestEvent xid = MakeXIDEvent(1);
+  uint64_t seq_no = 1;
+  AllocationCounter counter(&state);
+  for (auto _ : state) {
+    gtid.SetSeqNo(seq_no++);
+    CHECK(binlog.AddEvent(gtid.raw, false));
+    CHECK(binlog.AddEvent(query.raw, false));
+    CHECK(binlog.AddEvent(xid.raw, true));
+  }
+  binlog.Close();
+}
+BENCHMARK(BM_BinlogAddEvent)->Arg(0)->Arg(255)->Arg(254);
+
+}  // namespace
+
+}  // namespace mysql_ripple
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  monitoring::Initialize();
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -30,7 +30,10 @@ class Session {
     MysqlMasterSession,  // This is a connection to a mysql master.
     MysqlSlaveSession,   // This is a slave connected to rippled.
     MgmSession,          // This is a monitoring/management connection
-    PurgeThread
+    PurgeThread,
+    TrashThread,         // This frees purged binlog files.
+    ArchiveThread,       // This moves archived binlog files to cold storage.
+    MonitoringServer     // This serves metrics over http.
   };
 
   enum SessionState {
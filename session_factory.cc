@@ -69,12 +69,27 @@ void SlaveSessionFactory::EndSession(SlaveSession *session) {
   if (active_slaves_.find(session) != active_slaves_.end()) {
     active_slaves_.erase(session);
     monitoring::num_slaves->Set(active_slaves_.size());
+    RemoveSlaveMetrics(session->GetServerName());
   } else {
     LOG(ERROR) << "Could not find slave session in collection of "
                << "active slaves";
   }
 }
 
+void SlaveSessionFactory::RemoveSlaveMetrics(const std::string& name) {
+  // Slaves reconnecting under the same name share the series.
+  for (SlaveSession *slave : active_slaves_) {
+    if (slave->GetServerName() == name)
+      return;
+  }
+  monitoring::slave_current_event_timestamp->Remove(name);
+  monitoring::slave_connection_status->Remove(name);
+  monitoring::last_slave_connect_error->Remove(name);
+  monitoring::bytes_sent_to_slave->Remove(name);
+  monitoring::bytes_received_from_slave->Remove(name);
+  monitoring::latency_published_to_sent->Remove(name);
+}
+
 void SlaveSessionFactory::IterateSessions(SessionIteratorFn *iterator,
                                           void *cookie) {
   absl::MutexLock lock(&mutex_);
@@ -18,6 +18,7 @@
 #define MYSQL_RIPPLE_SESSION_FACTORY_H
 
 #include <set>
+#include <string>
 
 #include "binlog.h"
 #include "connection.h"
@@ -41,7 +42,7 @@ class SlaveSession;
 typedef void (SessionIteratorFn)(SlaveSession *session, void* cookie);
 
 // This is a session factory, that accepts mysql slaves and runs
-// them in one thread per session using the ThreadPoolExecutor.
+// them on the worker threads of the ThreadPoolExecutor.
 class SlaveSessionFactory : public SessionFactory,
                             public SlaveSession::FactoryInterface {
  public:
@@ -65,6 +66,10 @@ class SlaveSessionFactory : public SessionFactory,
   monitoring::CallbackTrigger connection_status_trigger_;
   void SetConnectionStatusMetrics();
 
+  // Drop the per-slave series of name unless another active slave
+  // still uses it. Must be called with mutex_ held.
+  void RemoveSlaveMetrics(const std::string& name);
+
   SlaveSessionFactory(SlaveSessionFactory&&) = delete;
   SlaveSessionFactory(const SlaveSessionFactory&) = delete;
   SlaveSessionFactory& operator=(SlaveSessionFactory&&) = delete;